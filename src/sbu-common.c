@@ -64,6 +64,32 @@ sbu_device_property_to_unit(SbuDeviceProperty key)
 	return NULL;
 }
 
+const gchar *
+sbu_history_mode_to_string(SbuHistoryMode mode)
+{
+	if (mode == SBU_HISTORY_MODE_UNKNOWN)
+		return "unknown";
+	if (mode == SBU_HISTORY_MODE_AVERAGE)
+		return "average";
+	if (mode == SBU_HISTORY_MODE_MINMAX)
+		return "minmax";
+	if (mode == SBU_HISTORY_MODE_LTTB)
+		return "lttb";
+	return NULL;
+}
+
+SbuHistoryMode
+sbu_history_mode_from_string(const gchar *mode)
+{
+	if (g_strcmp0(mode, "average") == 0)
+		return SBU_HISTORY_MODE_AVERAGE;
+	if (g_strcmp0(mode, "minmax") == 0)
+		return SBU_HISTORY_MODE_MINMAX;
+	if (g_strcmp0(mode, "lttb") == 0)
+		return SBU_HISTORY_MODE_LTTB;
+	return SBU_HISTORY_MODE_UNKNOWN;
+}
+
 gchar *
 sbu_format_for_display(gdouble val, const gchar *suffix)
 {
@@ -99,3 +125,28 @@ sbu_format_for_display(gdouble val, const gchar *suffix)
 	}
 	return g_string_free(str, FALSE);
 }
+
+/**
+ * sbu_openmetrics_append_label:
+ * @str: a #GString
+ * @key: a label name
+ * @value: (nullable): a label value
+ *
+ * Appends `key="value"`, escaping the value as required by OpenMetrics.
+ **/
+void
+sbu_openmetrics_append_label(GString *str, const gchar *key, const gchar *value)
+{
+	g_string_append_printf(str, "%s=\"", key);
+	for (guint i = 0; value != NULL && value[i] != '\0'; i++) {
+		if (value[i] == '\\')
+			g_string_append(str, "\\\\");
+		else if (value[i] == '"')
+			g_string_append(str, "\\\"");
+		else if (value[i] == '\n')
+			g_string_append(str, "\\n");
+		else
+			g_string_append_c(str, value[i]);
+	}
+	g_string_append_c(str, '"');
+}
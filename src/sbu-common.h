@@ -34,12 +34,26 @@ typedef enum {
 	SBU_DEVICE_PROPERTY_LAST
 } SbuDeviceProperty;
 
+typedef enum {
+	SBU_HISTORY_MODE_UNKNOWN,
+	SBU_HISTORY_MODE_AVERAGE,
+	SBU_HISTORY_MODE_MINMAX,
+	SBU_HISTORY_MODE_LTTB,
+	SBU_HISTORY_MODE_LAST
+} SbuHistoryMode;
+
 const gchar *
 sbu_node_kind_to_string(SbuNodeKind kind);
 const gchar *
 sbu_device_property_to_string(SbuDeviceProperty value);
 const gchar *
 sbu_device_property_to_unit(SbuDeviceProperty value);
+const gchar *
+sbu_history_mode_to_string(SbuHistoryMode mode);
+SbuHistoryMode
+sbu_history_mode_from_string(const gchar *mode);
 
 gchar *
 sbu_format_for_display(gdouble val, const gchar *suffix);
+void
+sbu_openmetrics_append_label(GString *str, const gchar *key, const gchar *value);
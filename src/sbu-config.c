@@ -20,13 +20,24 @@ G_DEFINE_TYPE(SbuConfig, sbu_config, G_TYPE_OBJECT)
 
 #define SBU_CONFIG_GROUP "sbud Settings"
 
+static gchar *
+sbu_config_get_filename(void)
+{
+	const gchar *config_fn = g_getenv("SBU_CONFIG");
+
+	/* allow testing with a different file */
+	if (config_fn != NULL)
+		return g_strdup(config_fn);
+	return g_build_filename(SYSCONFDIR, "sbud", "sbud.conf", NULL);
+}
+
 static gboolean
 sbu_config_open(SbuConfig *self, GError **error)
 {
 	g_autofree gchar *config_fn = NULL;
 	if (self->loaded)
 		return TRUE;
-	config_fn = g_build_filename(SYSCONFDIR, "sbud", "sbud.conf", NULL);
+	config_fn = sbu_config_get_filename();
 	if (!g_key_file_load_from_file(self->config, config_fn, G_KEY_FILE_NONE, error)) {
 		g_prefix_error(error, "coulf not open %s: ", config_fn);
 		return FALSE;
@@ -35,6 +46,24 @@ sbu_config_open(SbuConfig *self, GError **error)
 	return TRUE;
 }
 
+/* the old values are kept if the file is now invalid */
+gboolean
+sbu_config_reload(SbuConfig *self, GError **error)
+{
+	g_autofree gchar *config_fn = NULL;
+	g_autoptr(GKeyFile) config = g_key_file_new();
+
+	config_fn = sbu_config_get_filename();
+	if (!g_key_file_load_from_file(config, config_fn, G_KEY_FILE_NONE, error)) {
+		g_prefix_error(error, "could not reload %s: ", config_fn);
+		return FALSE;
+	}
+	g_key_file_unref(self->config);
+	self->config = g_steal_pointer(&config);
+	self->loaded = TRUE;
+	return TRUE;
+}
+
 gchar *
 sbu_config_get_string(SbuConfig *self, const gchar *key, GError **error)
 {
@@ -51,6 +80,14 @@ sbu_config_get_integer(SbuConfig *self, const gchar *key, GError **error)
 	return g_key_file_get_integer(self->config, SBU_CONFIG_GROUP, key, error);
 }
 
+gchar **
+sbu_config_get_string_list(SbuConfig *self, const gchar *key, GError **error)
+{
+	if (!sbu_config_open(self, error))
+		return NULL;
+	return g_key_file_get_string_list(self->config, SBU_CONFIG_GROUP, key, NULL, error);
+}
+
 gboolean
 sbu_config_get_boolean(SbuConfig *self, const gchar *key, GError **error)
 {
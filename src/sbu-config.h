@@ -13,8 +13,12 @@ G_DECLARE_FINAL_TYPE(SbuConfig, sbu_config, SBU, CONFIG, GObject)
 
 SbuConfig *
 sbu_config_new(void);
+gboolean
+sbu_config_reload(SbuConfig *self, GError **error);
 gchar *
 sbu_config_get_string(SbuConfig *self, const gchar *key, GError **error);
+gchar **
+sbu_config_get_string_list(SbuConfig *self, const gchar *key, GError **error);
 gint
 sbu_config_get_integer(SbuConfig *self, const gchar *key, GError **error);
 gboolean
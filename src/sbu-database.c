@@ -10,15 +10,25 @@
 #include <sqlite3.h>
 
 #include "sbu-database.h"
+#include "sbu-stats.h"
 
 struct _SbuDatabase {
 	GObject parent_instance;
 	gchar *location;
 	sqlite3 *db;
+	SbuStatsHistogram *stats_insert;
+	SbuStatsHistogram *stats_insert_batch;
+	SbuStatsHistogram *stats_query;
 };
 
 G_DEFINE_TYPE(SbuDatabase, sbu_database, G_TYPE_OBJECT)
 
+const gchar *
+sbu_database_get_location(SbuDatabase *self)
+{
+	return self->location;
+}
+
 void
 sbu_database_set_location(SbuDatabase *self, const gchar *location)
 {
@@ -152,7 +162,11 @@ sbu_database_open(SbuDatabase *self, GError **error)
 
 	/* open database */
 	g_debug("loading %s", self->location);
-	rc = sqlite3_open(self->location, &self->db);
+	/* history queries run in a worker thread */
+	rc = sqlite3_open_v2(self->location,
+			     &self->db,
+			     SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_FULLMUTEX,
+			     NULL);
 	if (rc != SQLITE_OK) {
 		g_set_error(error,
 			    G_IO_ERROR,
@@ -183,7 +197,7 @@ sbu_database_open(SbuDatabase *self, GError **error)
 	return TRUE;
 }
 
-static void
+void
 sbu_database_item_free(SbuDatabaseItem *item)
 {
 	g_free(item->key);
@@ -222,6 +236,7 @@ sbu_database_save_value(SbuDatabase *self,
 			gint val,
 			GError **error)
 {
+	gint64 ts_start = g_get_monotonic_time();
 	g_autofree gchar *statement = NULL;
 
 	/* sanity check */
@@ -237,7 +252,58 @@ sbu_database_save_value(SbuDatabase *self,
 				    device_id,
 				    key,
 				    val);
-	return sbu_database_execute(self, statement, error);
+	if (!sbu_database_execute(self, statement, error))
+		return FALSE;
+	sbu_stats_histogram_record(self->stats_insert, ts_start);
+	return TRUE;
+}
+
+/**
+ * sbu_database_save_values:
+ * @self: a #SbuDatabase
+ * @device_id: a device ID
+ * @items: (element-type SbuDatabaseItem): values to save
+ * @error: a #GError or %NULL
+ *
+ * Saves all the values using a single statement, which is much faster than
+ * calling sbu_database_save_value() for each one.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_database_save_values(SbuDatabase *self,
+			 const gchar *device_id,
+			 GPtrArray *items,
+			 GError **error)
+{
+	gint64 ts_start = g_get_monotonic_time();
+	g_autoptr(GString) statement = NULL;
+
+	/* sanity check */
+	if (self->db == NULL) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "database is not open");
+		return FALSE;
+	}
+	if (items->len == 0)
+		return TRUE;
+
+	/* save to database */
+	statement = g_string_new("INSERT INTO log (ts, device_id, key, val) VALUES ");
+	for (guint i = 0; i < items->len; i++) {
+		SbuDatabaseItem *item = g_ptr_array_index(items, i);
+		if (i > 0)
+			g_string_append(statement, ", ");
+		g_string_append_printf(statement,
+				       "('%" G_GINT64_FORMAT "', '%s', '%s', '%i')",
+				       item->ts,
+				       device_id,
+				       item->key,
+				       item->val);
+	}
+	if (!sbu_database_execute(self, statement->str, error))
+		return FALSE;
+	sbu_stats_histogram_record(self->stats_insert_batch, ts_start);
+	return TRUE;
 }
 
 GPtrArray *
@@ -251,6 +317,7 @@ sbu_database_query(SbuDatabase *self,
 	g_autoptr(GPtrArray) results =
 	    g_ptr_array_new_with_free_func((GDestroyNotify)sbu_database_item_free);
 	gchar *error_msg = NULL;
+	gint64 ts_query = g_get_monotonic_time();
 	gint rc;
 	g_autofree gchar *statement = NULL;
 
@@ -272,6 +339,7 @@ sbu_database_query(SbuDatabase *self,
 	}
 
 	/* success */
+	sbu_stats_histogram_record(self->stats_query, ts_query);
 	return g_steal_pointer(&results);
 }
 
@@ -290,6 +358,9 @@ sbu_database_finalize(GObject *object)
 static void
 sbu_database_init(SbuDatabase *self)
 {
+	self->stats_insert = sbu_stats_histogram_get("db:insert");
+	self->stats_insert_batch = sbu_stats_histogram_get("db:insert-batch");
+	self->stats_query = sbu_stats_histogram_get("db:query");
 }
 
 static void
@@ -18,12 +18,18 @@ typedef struct {
 	gint val;
 } SbuDatabaseItem;
 
+void
+sbu_database_item_free(SbuDatabaseItem *item);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuDatabaseItem, sbu_database_item_free)
+
 SbuDatabase *
 sbu_database_new(void);
 gboolean
 sbu_database_open(SbuDatabase *self, GError **error);
 gboolean
 sbu_database_repair(SbuDatabase *self, GError **error);
+const gchar *
+sbu_database_get_location(SbuDatabase *self);
 void
 sbu_database_set_location(SbuDatabase *self, const gchar *location);
 gboolean
@@ -32,6 +38,11 @@ sbu_database_save_value(SbuDatabase *self,
 			const gchar *key,
 			gint val,
 			GError **error);
+gboolean
+sbu_database_save_values(SbuDatabase *self,
+			 const gchar *device_id,
+			 GPtrArray *items,
+			 GError **error);
 GPtrArray *
 sbu_database_query(SbuDatabase *self,
 		   const gchar *device_id,
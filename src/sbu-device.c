@@ -19,11 +19,46 @@ typedef struct {
 	gchar *id;
 	gchar *firmware_version;
 	gchar *serial_number;
+	GHashTable *metadata; /* key : GINT_TO_POINTER(value) */
+	guint64 generation;
+	GVariant *cache; /* of generation cache_generation */
+	guint64 cache_generation;
+	guint update_depth;
+	GHashTable *update_changes; /* id:propname : GVariant (ssv) */
 } SbuDevicePrivate;
 
+enum { SIGNAL_VALUES_CHANGED, SIGNAL_LAST };
+
+static guint signals[SIGNAL_LAST] = {0};
+
 G_DEFINE_TYPE_WITH_PRIVATE(SbuDevice, sbu_device, G_TYPE_OBJECT)
 #define GET_PRIVATE(o) (sbu_device_get_instance_private(o))
 
+/* anything that changes the result of sbu_device_to_variant() or the metadata */
+static void
+sbu_device_invalidate(SbuDevice *self)
+{
+	SbuDevicePrivate *priv = GET_PRIVATE(self);
+	priv->generation++;
+}
+
+/**
+ * sbu_device_get_generation:
+ * @self: a #SbuDevice
+ *
+ * Gets a counter that increases every time the device, or any of its nodes
+ * or links, changes.
+ *
+ * Returns: integer
+ **/
+guint64
+sbu_device_get_generation(SbuDevice *self)
+{
+	SbuDevicePrivate *priv = GET_PRIVATE(self);
+	g_return_val_if_fail(SBU_IS_DEVICE(self), 0);
+	return priv->generation;
+}
+
 const gchar *
 sbu_device_get_id(SbuDevice *self)
 {
@@ -35,7 +70,9 @@ void
 sbu_device_set_id(SbuDevice *self, const gchar *id)
 {
 	SbuDevicePrivate *priv = GET_PRIVATE(self);
+	g_free(priv->id);
 	priv->id = g_strdup(id);
+	sbu_device_invalidate(self);
 }
 
 const gchar *
@@ -49,7 +86,9 @@ void
 sbu_device_set_firmware_version(SbuDevice *self, const gchar *firmware_version)
 {
 	SbuDevicePrivate *priv = GET_PRIVATE(self);
+	g_free(priv->firmware_version);
 	priv->firmware_version = g_strdup(firmware_version);
+	sbu_device_invalidate(self);
 }
 
 const gchar *
@@ -63,7 +102,41 @@ void
 sbu_device_set_serial_number(SbuDevice *self, const gchar *serial_number)
 {
 	SbuDevicePrivate *priv = GET_PRIVATE(self);
+	g_free(priv->serial_number);
 	priv->serial_number = g_strdup(serial_number);
+	sbu_device_invalidate(self);
+}
+
+/**
+ * sbu_device_get_metadata:
+ * @self: a #SbuDevice
+ *
+ * Gets the raw values the plugin read from the hardware, which are exported
+ * for debugging and monitoring but not shown in the UI.
+ *
+ * Returns: (transfer none): a #GHashTable of key : GINT_TO_POINTER(value)
+ **/
+GHashTable *
+sbu_device_get_metadata(SbuDevice *self)
+{
+	SbuDevicePrivate *priv = GET_PRIVATE(self);
+	return priv->metadata;
+}
+
+void
+sbu_device_set_metadata(SbuDevice *self, const gchar *key, gint value)
+{
+	SbuDevicePrivate *priv = GET_PRIVATE(self);
+	gpointer value_old = NULL;
+
+	g_return_if_fail(SBU_IS_DEVICE(self));
+	g_return_if_fail(key != NULL);
+
+	if (g_hash_table_lookup_extended(priv->metadata, key, NULL, &value_old) &&
+	    GPOINTER_TO_INT(value_old) == value)
+		return;
+	g_hash_table_insert(priv->metadata, g_strdup(key), GINT_TO_POINTER(value));
+	sbu_device_invalidate(self);
 }
 
 GPtrArray *
@@ -144,11 +217,129 @@ sbu_device_set_link_active(SbuDevice *self, SbuNodeKind src, SbuNodeKind dst, gb
 	sbu_link_set_active(l, value);
 }
 
+static void
+sbu_device_emit_values_changed(SbuDevice *self)
+{
+	SbuDevicePrivate *priv = GET_PRIVATE(self);
+	GHashTableIter iter;
+	GVariant *value;
+	GVariantBuilder builder;
+	g_autoptr(GVariant) changes = NULL;
+
+	if (g_hash_table_size(priv->update_changes) == 0)
+		return;
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(ssv)"));
+	g_hash_table_iter_init(&iter, priv->update_changes);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&value))
+		g_variant_builder_add_value(&builder, value);
+	g_hash_table_remove_all(priv->update_changes);
+	changes = g_variant_ref_sink(g_variant_builder_end(&builder));
+	g_signal_emit(self, signals[SIGNAL_VALUES_CHANGED], 0, changes);
+}
+
+/* only the latest value of each property is kept until the update is committed */
+static void
+sbu_device_object_notify_cb(GObject *obj, GParamSpec *pspec, SbuDevice *self)
+{
+	SbuDevicePrivate *priv = GET_PRIVATE(self);
+	const gchar *propname = g_param_spec_get_name(pspec);
+	const gchar *id;
+	GVariant *value;
+
+	sbu_device_invalidate(self);
+	if (SBU_IS_NODE(obj))
+		id = sbu_node_get_id(SBU_NODE(obj));
+	else
+		id = sbu_link_get_id(SBU_LINK(obj));
+	if (G_PARAM_SPEC_VALUE_TYPE(pspec) == G_TYPE_BOOLEAN) {
+		gboolean tmp = FALSE;
+		g_object_get(obj, propname, &tmp, NULL);
+		value = g_variant_new_boolean(tmp);
+	} else if (G_PARAM_SPEC_VALUE_TYPE(pspec) == G_TYPE_DOUBLE) {
+		gdouble tmp = 0.f;
+		g_object_get(obj, propname, &tmp, NULL);
+		value = g_variant_new_double(tmp);
+	} else {
+		return;
+	}
+	g_hash_table_replace(priv->update_changes,
+			     g_strdup_printf("%s:%s", id, propname),
+			     g_variant_ref_sink(g_variant_new("(ssv)", id, propname, value)));
+
+	/* not in a transaction, so each change is delivered by itself */
+	if (priv->update_depth == 0)
+		sbu_device_emit_values_changed(self);
+}
+
+static void
+sbu_device_freeze_notify(SbuDevice *self, gboolean freeze)
+{
+	SbuDevicePrivate *priv = GET_PRIVATE(self);
+	GPtrArray *arrays[] = {priv->nodes, priv->links};
+	for (guint j = 0; j < G_N_ELEMENTS(arrays); j++) {
+		for (guint i = 0; i < arrays[j]->len; i++) {
+			GObject *obj = g_ptr_array_index(arrays[j], i);
+			if (freeze)
+				g_object_freeze_notify(obj);
+			else
+				g_object_thaw_notify(obj);
+		}
+	}
+}
+
+/**
+ * sbu_device_begin_update:
+ * @self: a #SbuDevice
+ *
+ * Starts collecting node and link changes so that they are delivered as a
+ * single ::values-changed emission by sbu_device_commit_update().
+ * Nodes and links must not be added until the update is committed, and
+ * updates can be nested.
+ **/
+void
+sbu_device_begin_update(SbuDevice *self)
+{
+	SbuDevicePrivate *priv = GET_PRIVATE(self);
+	g_return_if_fail(SBU_IS_DEVICE(self));
+	if (priv->update_depth++ == 0)
+		sbu_device_freeze_notify(self, TRUE);
+}
+
+/**
+ * sbu_device_commit_update:
+ * @self: a #SbuDevice
+ *
+ * Ends an update started with sbu_device_begin_update(), emitting
+ * ::values-changed once with every property that changed.
+ **/
+void
+sbu_device_commit_update(SbuDevice *self)
+{
+	SbuDevicePrivate *priv = GET_PRIVATE(self);
+	g_return_if_fail(SBU_IS_DEVICE(self));
+	g_return_if_fail(priv->update_depth > 0);
+	if (priv->update_depth > 1) {
+		priv->update_depth--;
+		return;
+	}
+
+	/* the frozen notifications are collected before the depth drops */
+	sbu_device_freeze_notify(self, FALSE);
+	priv->update_depth = 0;
+	sbu_device_emit_values_changed(self);
+}
+
 void
 sbu_device_add_node(SbuDevice *self, SbuNode *node)
 {
 	SbuDevicePrivate *priv = GET_PRIVATE(self);
 	g_ptr_array_add(priv->nodes, g_object_ref(node));
+	g_signal_connect_object(node,
+				"notify",
+				G_CALLBACK(sbu_device_object_notify_cb),
+				self,
+				0);
+	sbu_device_invalidate(self);
 }
 
 void
@@ -156,8 +347,22 @@ sbu_device_add_link(SbuDevice *self, SbuLink *link)
 {
 	SbuDevicePrivate *priv = GET_PRIVATE(self);
 	g_ptr_array_add(priv->links, g_object_ref(link));
+	g_signal_connect_object(link,
+				"notify",
+				G_CALLBACK(sbu_device_object_notify_cb),
+				self,
+				0);
+	sbu_device_invalidate(self);
 }
 
+/**
+ * sbu_device_to_variant:
+ * @self: a #SbuDevice
+ *
+ * Serializes the device. The result is cached until the generation changes.
+ *
+ * Returns: (transfer full): a #GVariant of type `a{sv}`
+ **/
 GVariant *
 sbu_device_to_variant(SbuDevice *self)
 {
@@ -166,6 +371,10 @@ sbu_device_to_variant(SbuDevice *self)
 
 	g_return_val_if_fail(SBU_IS_DEVICE(self), NULL);
 
+	/* nothing changed */
+	if (priv->cache != NULL && priv->cache_generation == priv->generation)
+		return g_variant_ref(priv->cache);
+
 	/* create an array with all the metadata in */
 	g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
 	if (priv->id != NULL) {
@@ -207,7 +416,11 @@ sbu_device_to_variant(SbuDevice *self)
 		    "links",
 		    g_variant_new_array(G_VARIANT_TYPE("a{sv}"), children, priv->links->len));
 	}
-	return g_variant_new("a{sv}", &builder);
+	if (priv->cache != NULL)
+		g_variant_unref(priv->cache);
+	priv->cache = g_variant_ref_sink(g_variant_builder_end(&builder));
+	priv->cache_generation = priv->generation;
+	return g_variant_ref(priv->cache);
 }
 static void
 sbu_device_from_key_value(SbuDevice *self, const gchar *key, GVariant *value)
@@ -281,14 +494,161 @@ sbu_device_from_variant(GVariant *value)
 	return self;
 }
 
+/**
+ * sbu_device_apply_change:
+ * @self: a #SbuDevice
+ * @id: a node or link ID
+ * @key: a property name, e.g. `voltage` or `active`
+ * @value: a #GVariant of type `d` or `b`
+ * @error: a #GError or %NULL
+ *
+ * Updates a single node or link property in place, as sent by the daemon in
+ * the `ValuesChanged` signal.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_device_apply_change(SbuDevice *self,
+			const gchar *id,
+			const gchar *key,
+			GVariant *value,
+			GError **error)
+{
+	SbuDevicePrivate *priv = GET_PRIVATE(self);
+
+	g_return_val_if_fail(SBU_IS_DEVICE(self), FALSE);
+
+	if (g_variant_is_of_type(value, G_VARIANT_TYPE_DOUBLE)) {
+		for (guint i = 0; i < priv->nodes->len; i++) {
+			SbuNode *n = g_ptr_array_index(priv->nodes, i);
+			if (g_strcmp0(sbu_node_get_id(n), id) != 0)
+				continue;
+			for (guint j = 0; j < SBU_DEVICE_PROPERTY_LAST; j++) {
+				if (g_strcmp0(sbu_device_property_to_string(j), key) == 0) {
+					sbu_node_set_value(n, j, g_variant_get_double(value));
+					return TRUE;
+				}
+			}
+		}
+	} else if (g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)) {
+		for (guint i = 0; i < priv->links->len; i++) {
+			SbuLink *l = g_ptr_array_index(priv->links, i);
+			if (g_strcmp0(sbu_link_get_id(l), id) == 0 && g_strcmp0(key, "active") == 0) {
+				sbu_link_set_active(l, g_variant_get_boolean(value));
+				return TRUE;
+			}
+		}
+	}
+	g_set_error(error,
+		    G_IO_ERROR,
+		    G_IO_ERROR_NOT_FOUND,
+		    "no %s:%s of type %s",
+		    id,
+		    key,
+		    g_variant_get_type_string(value));
+	return FALSE;
+}
+
+/**
+ * sbu_device_apply_changes:
+ * @self: a #SbuDevice
+ * @changes: a #GVariant of type `a(sssv)`
+ * @error: a #GError or %NULL
+ *
+ * Applies all the changes that are for this device, ignoring the others.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_device_apply_changes(SbuDevice *self, GVariant *changes, GError **error)
+{
+	GVariantIter iter;
+	const gchar *device_id;
+	const gchar *id;
+	const gchar *key;
+	GVariant *value;
+
+	gboolean ret = TRUE;
+
+	g_return_val_if_fail(SBU_IS_DEVICE(self), FALSE);
+
+	sbu_device_begin_update(self);
+	g_variant_iter_init(&iter, changes);
+	while (ret && g_variant_iter_next(&iter, "(&s&s&sv)", &device_id, &id, &key, &value)) {
+		if (g_strcmp0(device_id, sbu_device_get_id(self)) == 0)
+			ret = sbu_device_apply_change(self, id, key, value, error);
+		g_variant_unref(value);
+	}
+	sbu_device_commit_update(self);
+	return ret;
+}
+
 gboolean
-sbu_device_refresh(SbuDevice *device, GError **error)
+sbu_device_refresh(SbuDevice *device, GCancellable *cancellable, GError **error)
 {
 	SbuDeviceClass *device_class = SBU_DEVICE_GET_CLASS(device);
 	g_return_val_if_fail(SBU_IS_DEVICE(device), FALSE);
+	g_return_val_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable), FALSE);
 	if (device_class->refresh == NULL)
 		return TRUE;
-	return device_class->refresh(device, error);
+	return device_class->refresh(device, cancellable, error);
+}
+
+/**
+ * sbu_device_refresh_async:
+ * @device: a #SbuDevice
+ * @cancellable: a #GCancellable, or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Refreshes the device without blocking the main loop. Devices that only
+ * implement the synchronous refresh are refreshed in place and complete in
+ * the next main loop iteration.
+ **/
+void
+sbu_device_refresh_async(SbuDevice *device,
+			 GCancellable *cancellable,
+			 GAsyncReadyCallback callback,
+			 gpointer user_data)
+{
+	SbuDeviceClass *device_class = SBU_DEVICE_GET_CLASS(device);
+	g_autoptr(GTask) task = NULL;
+	g_autoptr(GError) error = NULL;
+
+	g_return_if_fail(SBU_IS_DEVICE(device));
+	g_return_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable));
+
+	if (device_class->refresh_async != NULL) {
+		device_class->refresh_async(device, cancellable, callback, user_data);
+		return;
+	}
+	task = g_task_new(device, cancellable, callback, user_data);
+	g_task_set_source_tag(task, sbu_device_refresh_async);
+	if (!sbu_device_refresh(device, cancellable, &error)) {
+		g_task_return_error(task, g_steal_pointer(&error));
+		return;
+	}
+	g_task_return_boolean(task, TRUE);
+}
+
+/**
+ * sbu_device_refresh_finish:
+ * @device: a #SbuDevice
+ * @res: a #GAsyncResult
+ * @error: a #GError, or %NULL
+ *
+ * Gets the result of sbu_device_refresh_async().
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_device_refresh_finish(SbuDevice *device, GAsyncResult *res, GError **error)
+{
+	SbuDeviceClass *device_class = SBU_DEVICE_GET_CLASS(device);
+	g_return_val_if_fail(SBU_IS_DEVICE(device), FALSE);
+	if (device_class->refresh_async != NULL)
+		return device_class->refresh_finish(device, res, error);
+	return g_task_propagate_boolean(G_TASK(res), error);
 }
 
 static void
@@ -299,6 +659,10 @@ sbu_device_finalize(GObject *object)
 	g_free(priv->id);
 	g_free(priv->firmware_version);
 	g_free(priv->serial_number);
+	g_hash_table_unref(priv->metadata);
+	g_hash_table_unref(priv->update_changes);
+	if (priv->cache != NULL)
+		g_variant_unref(priv->cache);
 	g_ptr_array_unref(priv->nodes);
 	g_ptr_array_unref(priv->links);
 	G_OBJECT_CLASS(sbu_device_parent_class)->finalize(object);
@@ -310,6 +674,11 @@ sbu_device_init(SbuDevice *self)
 	SbuDevicePrivate *priv = GET_PRIVATE(self);
 	priv->nodes = g_ptr_array_new_with_free_func((GDestroyNotify)g_object_unref);
 	priv->links = g_ptr_array_new_with_free_func((GDestroyNotify)g_object_unref);
+	priv->metadata = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	priv->update_changes = g_hash_table_new_full(g_str_hash,
+						     g_str_equal,
+						     g_free,
+						     (GDestroyNotify)g_variant_unref);
 }
 
 static void
@@ -317,6 +686,25 @@ sbu_device_class_init(SbuDeviceClass *klass_device)
 {
 	GObjectClass *object_class = G_OBJECT_CLASS(klass_device);
 	object_class->finalize = sbu_device_finalize;
+
+	/**
+	 * SbuDevice::values-changed:
+	 * @device: a #SbuDevice
+	 * @changes: a #GVariant of type `a(ssv)` of node or link ID, property and value
+	 *
+	 * Emitted for each node or link property change, or once for all of the
+	 * changes made between sbu_device_begin_update() and sbu_device_commit_update().
+	 **/
+	signals[SIGNAL_VALUES_CHANGED] = g_signal_new("values-changed",
+						      G_TYPE_FROM_CLASS(object_class),
+						      G_SIGNAL_RUN_LAST,
+						      0,
+						      NULL,
+						      NULL,
+						      g_cclosure_marshal_VOID__VARIANT,
+						      G_TYPE_NONE,
+						      1,
+						      G_TYPE_VARIANT);
 }
 
 SbuDevice *
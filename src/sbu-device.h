@@ -7,6 +7,8 @@
 
 #pragma once
 
+#include <gio/gio.h>
+
 #include "sbu-common.h"
 #include "sbu-database.h"
 #include "sbu-link.h"
@@ -17,11 +19,18 @@ G_DECLARE_DERIVABLE_TYPE(SbuDevice, sbu_device, SBU, DEVICE, GObject)
 
 struct _SbuDeviceClass {
 	GObjectClass parent_class;
-	gboolean (*refresh)(SbuDevice *device, GError **error);
+	gboolean (*refresh)(SbuDevice *device, GCancellable *cancellable, GError **error);
+	void (*refresh_async)(SbuDevice *device,
+			      GCancellable *cancellable,
+			      GAsyncReadyCallback callback,
+			      gpointer user_data);
+	gboolean (*refresh_finish)(SbuDevice *device, GAsyncResult *res, GError **error);
 };
 
 SbuDevice *
 sbu_device_new(void);
+guint64
+sbu_device_get_generation(SbuDevice *self);
 const gchar *
 sbu_device_get_id(SbuDevice *self);
 void
@@ -34,8 +43,23 @@ const gchar *
 sbu_device_get_serial_number(SbuDevice *self);
 void
 sbu_device_set_serial_number(SbuDevice *self, const gchar *serial_number);
+GHashTable *
+sbu_device_get_metadata(SbuDevice *self);
+void
+sbu_device_set_metadata(SbuDevice *self, const gchar *key, gint value);
+void
+sbu_device_begin_update(SbuDevice *self);
+void
+sbu_device_commit_update(SbuDevice *self);
 gboolean
-sbu_device_refresh(SbuDevice *device, GError **error);
+sbu_device_refresh(SbuDevice *device, GCancellable *cancellable, GError **error);
+void
+sbu_device_refresh_async(SbuDevice *device,
+			 GCancellable *cancellable,
+			 GAsyncReadyCallback callback,
+			 gpointer user_data);
+gboolean
+sbu_device_refresh_finish(SbuDevice *device, GAsyncResult *res, GError **error);
 
 GPtrArray *
 sbu_device_get_nodes(SbuDevice *self);
@@ -60,6 +84,15 @@ sbu_device_get_link_active(SbuDevice *self, SbuNodeKind src, SbuNodeKind dst);
 void
 sbu_device_set_link_active(SbuDevice *self, SbuNodeKind src, SbuNodeKind dst, gboolean value);
 
+gboolean
+sbu_device_apply_change(SbuDevice *self,
+			const gchar *id,
+			const gchar *key,
+			GVariant *value,
+			GError **error);
+gboolean
+sbu_device_apply_changes(SbuDevice *self, GVariant *changes, GError **error);
+
 SbuDevice *
 sbu_device_from_variant(GVariant *value);
 GVariant *
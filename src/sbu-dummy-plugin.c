@@ -97,6 +97,7 @@ sbu_dummy_plugin_refresh(SbuPlugin *plugin, GCancellable *cancellable, GError **
 	gdouble tmp;
 
 	/* make the panel more volt-y */
+	sbu_device_begin_update(self->device);
 	tmp = sbu_device_get_node_value(self->device,
 					SBU_NODE_KIND_BATTERY,
 					SBU_DEVICE_PROPERTY_VOLTAGE);
@@ -113,6 +114,7 @@ sbu_dummy_plugin_refresh(SbuPlugin *plugin, GCancellable *cancellable, GError **
 				  SBU_NODE_KIND_UTILITY,
 				  SBU_DEVICE_PROPERTY_POWER,
 				  tmp + g_random_double_range(-10.f, 10.f));
+	sbu_device_commit_update(self->device);
 
 	/* save raw value */
 	sbu_plugin_update_metadata(plugin, self->device, "TestKey", 123456);
@@ -146,12 +148,6 @@ sbu_dummy_plugin_finalize(GObject *object)
 static void
 sbu_dummy_plugin_init(SbuDummyPlugin *self)
 {
-	SbuPlugin *plugin = SBU_PLUGIN(self);
-	if (g_getenv("SBU_DUMMY_ENABLE") == NULL) {
-		g_debug("disabling '%s' as not testing", sbu_plugin_get_name(plugin));
-		sbu_plugin_set_enabled(plugin, FALSE);
-		return;
-	}
 }
 
 static void
@@ -163,3 +159,9 @@ sbu_dummy_plugin_class_init(SbuDummyPluginClass *class)
 	plugin_class->refresh = sbu_dummy_plugin_refresh;
 	object_class->finalize = sbu_dummy_plugin_finalize;
 }
+
+GType
+sbu_plugin_query_type(void)
+{
+	return SBU_TYPE_DUMMY_PLUGIN;
+}
@@ -6,10 +6,12 @@
 
 #include "config.h"
 
+#include <gio/gunixfdlist.h>
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 #include <locale.h>
 #include <math.h>
+#include <unistd.h>
 
 #include "egg-graph-widget.h"
 #include "sbu-common.h"
@@ -17,6 +19,7 @@
 #include "sbu-database.h"
 #include "sbu-device.h"
 #include "sbu-gui-resources.h"
+#include "sbu-history.h"
 #include "sbu-link.h"
 #include "sbu-node.h"
 #include "sbu-xml-modifier.h"
@@ -28,6 +31,7 @@ typedef struct {
 	SbuDatabase *database;
 	GDBusProxy *proxy;
 	SbuDevice *device;
+	guint64 device_seq;
 	GtkSizeGroup *details_sizegroup_title;
 	GtkSizeGroup *details_sizegroup_value;
 	GtkWidget *graph_widget;
@@ -173,48 +177,164 @@ sbu_gui_refresh_details(SbuGui *self)
 	}
 }
 
+static void
+sbu_gui_add_graph_point(SbuGui *self,
+			GPtrArray *data,
+			guint64 now,
+			guint64 ts,
+			gdouble val,
+			guint32 color)
+{
+	EggGraphPoint *point = egg_graph_point_new();
+	point->x = ts + self->history_interval - now;
+	point->y = val;
+	point->color = color;
+	g_ptr_array_add(data, point);
+}
+
+/* the history is passed as a sealed memfd, which avoids copying it */
 static GPtrArray *
-sbu_gui_get_graph_data(SbuGui *self, const gchar *key, guint32 color, GError **error)
+sbu_gui_get_graph_data_fd(SbuGui *self,
+			  const gchar *key,
+			  guint64 now,
+			  guint limit,
+			  guint32 color,
+			  GError **error)
 {
-	GVariantIter iter;
-	gdouble val;
-	guint64 now = g_get_real_time() / G_USEC_PER_SEC;
-	guint64 ts;
-	guint limit = 0;
+	const SbuHistoryItem *items;
+	gint fd;
+	gint32 fd_idx = 0;
+	guint count = 0;
+	g_autoptr(GMappedFile) mapped = NULL;
 	g_autoptr(GPtrArray) data = NULL;
+	g_autoptr(GUnixFDList) fd_list = NULL;
 	g_autoptr(GVariant) reply = NULL;
 
-	/* query daemon */
-	if (self->history_filter > 0)
-		limit = 100 / self->history_filter;
+	reply = g_dbus_proxy_call_with_unix_fd_list_sync(self->proxy,
+							 "GetHistoryFd",
+							 g_variant_new("(ssttus)",
+								       sbu_device_get_id(self->device),
+								       key,
+								       now - self->history_interval,
+								       now,
+								       limit,
+								       "lttb"),
+							 G_DBUS_CALL_FLAGS_NONE,
+							 -1,
+							 NULL,
+							 &fd_list,
+							 self->cancellable,
+							 error);
+	if (reply == NULL)
+		return NULL;
+	g_variant_get(reply, "(hu)", &fd_idx, &count);
+	fd = g_unix_fd_list_get(fd_list, fd_idx, error);
+	if (fd < 0)
+		return NULL;
+	mapped = sbu_history_map_fd(fd, error);
+	close(fd);
+	if (mapped == NULL) {
+		g_prefix_error(error, "cannot map history: ");
+		return NULL;
+	}
+
+	/* create data for graph */
+	data = g_ptr_array_new_with_free_func((GDestroyNotify)egg_graph_point_free);
+	items = (const SbuHistoryItem *)g_mapped_file_get_contents(mapped);
+	count = MIN(count, g_mapped_file_get_length(mapped) / sizeof(SbuHistoryItem));
+	for (guint i = 0; i < count; i++)
+		sbu_gui_add_graph_point(self, data, now, items[i].ts, items[i].val, color);
+	return g_steal_pointer(&data);
+}
+
+/* older daemons only have GetHistory, which always averages */
+static GPtrArray *
+sbu_gui_get_graph_data_variant(SbuGui *self,
+			       const gchar *key,
+			       guint64 now,
+			       guint limit,
+			       guint32 color,
+			       GError **error)
+{
+	GVariantIter iter;
+	guint64 ts = 0;
+	gdouble val = 0.f;
+	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GPtrArray) data = NULL;
+	g_autoptr(GVariant) array = NULL;
+	g_autoptr(GVariant) reply = NULL;
 
 	reply = g_dbus_proxy_call_sync(self->proxy,
-				       "GetHistory",
-				       g_variant_new("(ssttu)",
+				       "GetHistoryWithMode",
+				       g_variant_new("(ssttus)",
 						     sbu_device_get_id(self->device),
 						     key,
 						     now - self->history_interval,
 						     now,
-						     limit),
+						     limit,
+						     "lttb"),
 				       G_DBUS_CALL_FLAGS_NONE,
 				       -1,
 				       self->cancellable,
-				       error);
-	if (reply == NULL) {
-		g_prefix_error(error, "cannot get history: ");
-		return FALSE;
+				       &error_local);
+	if (reply == NULL &&
+	    g_error_matches(error_local, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD)) {
+		reply = g_dbus_proxy_call_sync(self->proxy,
+					       "GetHistory",
+					       g_variant_new("(ssttu)",
+							     sbu_device_get_id(self->device),
+							     key,
+							     now - self->history_interval,
+							     now,
+							     limit),
+					       G_DBUS_CALL_FLAGS_NONE,
+					       -1,
+					       self->cancellable,
+					       error);
+	} else if (reply == NULL) {
+		g_propagate_error(error, g_steal_pointer(&error_local));
 	}
+	if (reply == NULL)
+		return NULL;
 
 	/* create data for graph */
 	data = g_ptr_array_new_with_free_func((GDestroyNotify)egg_graph_point_free);
-	reply = g_variant_get_child_value(reply, 0);
-	g_variant_iter_init(&iter, reply);
-	while (g_variant_iter_next(&iter, "(td)", &ts, &val)) {
-		EggGraphPoint *point = egg_graph_point_new();
-		point->x = ts + self->history_interval - now;
-		point->y = val;
-		point->color = color;
-		g_ptr_array_add(data, point);
+	array = g_variant_get_child_value(reply, 0);
+	g_variant_iter_init(&iter, array);
+	while (g_variant_iter_next(&iter, "(td)", &ts, &val))
+		sbu_gui_add_graph_point(self, data, now, ts, val, color);
+	return g_steal_pointer(&data);
+}
+
+static GPtrArray *
+sbu_gui_get_graph_data(SbuGui *self, const gchar *key, guint32 color, GError **error)
+{
+	guint64 now = g_get_real_time() / G_USEC_PER_SEC;
+	guint limit = 0;
+	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GPtrArray) data = NULL;
+
+	/* query daemon */
+	if (self->history_filter > 0)
+		limit = 100 / self->history_filter;
+	data = sbu_gui_get_graph_data_fd(self, key, now, limit, color, &error_local);
+	if (data != NULL)
+		return g_steal_pointer(&data);
+
+	/* the daemon is too old, or was built without memfd support */
+	if (!g_error_matches(error_local, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD) &&
+	    !g_error_matches(error_local, G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED) &&
+	    !g_error_matches(error_local, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED)) {
+		g_propagate_prefixed_error(error,
+					   g_steal_pointer(&error_local),
+					   "cannot get history: ");
+		return NULL;
+	}
+	g_debug("falling back to GetHistory: %s", error_local->message);
+	data = sbu_gui_get_graph_data_variant(self, key, now, limit, color, error);
+	if (data == NULL) {
+		g_prefix_error(error, "cannot get history: ");
+		return NULL;
 	}
 	return g_steal_pointer(&data);
 }
@@ -927,8 +1047,32 @@ sbu_gui_proxy_signal_cb(GDBusProxy *proxy,
 			gpointer user_data)
 {
 	SbuGui *self = (SbuGui *)user_data;
-	if (g_strcmp0(signal_name, "Changed") == 0)
+	if (g_strcmp0(signal_name, "Changed") == 0) {
 		sbu_gui_proxy_get_devices(self);
+		return;
+	}
+	if (g_strcmp0(signal_name, "ValuesChanged") == 0) {
+		guint64 seq = 0;
+		g_autoptr(GError) error = NULL;
+		g_autoptr(GVariant) changes = NULL;
+
+		/* a missed signal means the local copy is stale */
+		g_variant_get(parameters, "(t@a(sssv))", &seq, &changes);
+		if (self->device == NULL ||
+		    (self->device_seq != 0 && seq != self->device_seq + 1)) {
+			self->device_seq = seq;
+			sbu_gui_proxy_get_devices(self);
+			return;
+		}
+		self->device_seq = seq;
+		if (!sbu_device_apply_changes(self->device, changes, &error)) {
+			g_warning("failed to apply changes: %s", error->message);
+			sbu_gui_proxy_get_devices(self);
+			return;
+		}
+		sbu_gui_refresh_overview(self);
+		sbu_gui_refresh_details(self);
+	}
 }
 
 static void
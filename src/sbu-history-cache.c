@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "sbu-database.h"
+#include "sbu-history-cache.h"
+#include "sbu-history.h"
+
+#define SBU_HISTORY_CACHE_MAX_ENTRIES_DEFAULT 64
+#define SBU_HISTORY_CACHE_MAX_BYTES_DEFAULT   (8 * 1024 * 1024)
+
+typedef struct {
+	gchar *hash_key;
+	gchar *device_id;
+	gchar *key;
+	guint64 ts_start;
+	guint64 ts_end;
+	GVariant *value;	    /* nullable, rebuilt from buckets when required */
+	SbuHistoryBuckets *buckets; /* nullable, live windows only */
+	GList *link;		    /* in lru, not owned */
+} SbuHistoryCacheEntry;
+
+struct _SbuHistoryCache {
+	GObject parent_instance;
+	GHashTable *hash; /* hash_key : SbuHistoryCacheEntry */
+	GQueue lru;	  /* most recently used at the head */
+	guint max_entries;
+	gsize max_bytes;
+	gsize bytes;
+	guint64 hits;
+	guint64 misses;
+	guint64 evictions;
+	guint64 invalidations;
+	guint64 appends;
+};
+
+G_DEFINE_TYPE(SbuHistoryCache, sbu_history_cache, G_TYPE_OBJECT)
+
+static void
+sbu_history_cache_entry_free(SbuHistoryCacheEntry *entry)
+{
+	g_free(entry->hash_key);
+	g_free(entry->device_id);
+	g_free(entry->key);
+	if (entry->value != NULL)
+		g_variant_unref(entry->value);
+	if (entry->buckets != NULL)
+		sbu_history_buckets_free(entry->buckets);
+	g_free(entry);
+}
+
+static gsize
+sbu_history_cache_entry_get_size(SbuHistoryCacheEntry *entry)
+{
+	gsize size = sizeof(SbuHistoryCacheEntry) + strlen(entry->hash_key) +
+		     strlen(entry->device_id) + strlen(entry->key);
+	if (entry->value != NULL)
+		size += g_variant_get_size(entry->value);
+	if (entry->buckets != NULL)
+		size += sbu_history_buckets_get_size(entry->buckets);
+	return size;
+}
+
+static gchar *
+sbu_history_cache_build_hash_key(const gchar *device_id,
+				 const gchar *key,
+				 guint64 ts_start,
+				 guint64 ts_end,
+				 guint limit,
+				 SbuHistoryMode mode)
+{
+	return g_strdup_printf("%s|%s|%" G_GUINT64_FORMAT "|%" G_GUINT64_FORMAT "|%u|%s",
+			       device_id,
+			       key,
+			       ts_start,
+			       ts_end,
+			       limit,
+			       sbu_history_mode_to_string(mode));
+}
+
+static void
+sbu_history_cache_remove_entry(SbuHistoryCache *self, SbuHistoryCacheEntry *entry)
+{
+	self->bytes -= sbu_history_cache_entry_get_size(entry);
+	g_queue_delete_link(&self->lru, entry->link);
+	g_hash_table_remove(self->hash, entry->hash_key);
+}
+
+/* live windows grow as samples are added, so the size is limited as well as
+ * the number of entries */
+static void
+sbu_history_cache_trim(SbuHistoryCache *self)
+{
+	while (g_queue_get_length(&self->lru) > self->max_entries ||
+	       (self->bytes > self->max_bytes && self->lru.tail != NULL)) {
+		SbuHistoryCacheEntry *entry = g_queue_peek_tail(&self->lru);
+		g_debug("evicting %s", entry->hash_key);
+		sbu_history_cache_remove_entry(self, entry);
+		self->evictions++;
+	}
+}
+
+/**
+ * sbu_history_cache_align:
+ * @ts_start: (inout): start of the range
+ * @ts_end: (inout): end of the range
+ * @limit: number of buckets
+ *
+ * Widens the range so that it starts and ends on a bucket boundary. Clients
+ * typically ask for "the last N seconds", so without this the key would change
+ * every second and the cache would never be hit.
+ *
+ * The aligned end may be in the future; the caller should only query up to
+ * the current time and insert the raw samples so that the window can be kept
+ * up to date with sbu_history_cache_add_item().
+ **/
+void
+sbu_history_cache_align(guint64 *ts_start, guint64 *ts_end, guint limit)
+{
+	guint64 width;
+	if (limit == 0 || *ts_end <= *ts_start)
+		return;
+	width = MAX((*ts_end - *ts_start) / limit, 1);
+	*ts_start -= *ts_start % width;
+	*ts_end += width - 1 - (*ts_end % width);
+}
+
+void
+sbu_history_cache_set_max_entries(SbuHistoryCache *self, guint max_entries)
+{
+	g_return_if_fail(SBU_IS_HISTORY_CACHE(self));
+	self->max_entries = max_entries;
+	sbu_history_cache_trim(self);
+}
+
+void
+sbu_history_cache_set_max_bytes(SbuHistoryCache *self, gsize max_bytes)
+{
+	g_return_if_fail(SBU_IS_HISTORY_CACHE(self));
+	self->max_bytes = max_bytes;
+	sbu_history_cache_trim(self);
+}
+
+/**
+ * sbu_history_cache_lookup:
+ *
+ * Returns: (transfer full): a #GVariant, or %NULL if not in the cache
+ **/
+GVariant *
+sbu_history_cache_lookup(SbuHistoryCache *self,
+			 const gchar *device_id,
+			 const gchar *key,
+			 guint64 ts_start,
+			 guint64 ts_end,
+			 guint limit,
+			 SbuHistoryMode mode)
+{
+	SbuHistoryCacheEntry *entry;
+	g_autofree gchar *hash_key = NULL;
+
+	g_return_val_if_fail(SBU_IS_HISTORY_CACHE(self), NULL);
+
+	hash_key = sbu_history_cache_build_hash_key(device_id, key, ts_start, ts_end, limit, mode);
+	entry = g_hash_table_lookup(self->hash, hash_key);
+	if (entry == NULL) {
+		self->misses++;
+		return NULL;
+	}
+
+	/* move to the front */
+	g_queue_unlink(&self->lru, entry->link);
+	g_queue_push_head_link(&self->lru, entry->link);
+	self->hits++;
+
+	/* new samples were added since the last lookup */
+	if (entry->value == NULL) {
+		g_autoptr(GArray) items = NULL;
+		self->bytes -= sbu_history_cache_entry_get_size(entry);
+		items = sbu_history_buckets_to_array(entry->buckets);
+		entry->value = g_variant_ref_sink(sbu_history_to_variant(items));
+		self->bytes += sbu_history_cache_entry_get_size(entry);
+	}
+	return g_variant_ref(entry->value);
+}
+
+/**
+ * sbu_history_cache_insert:
+ * @value: the downsampled result
+ * @buckets: (transfer full) (nullable): the state @value was built from
+ *
+ * Adds the result to the cache. If the range ends in the future then @buckets
+ * should be set, so that new samples can be added to the window rather than
+ * dropping it on every poll. Only the per-bucket state is kept, not the raw
+ * samples, so a live window costs about the same as a historical one.
+ **/
+void
+sbu_history_cache_insert(SbuHistoryCache *self,
+			 const gchar *device_id,
+			 const gchar *key,
+			 guint64 ts_start,
+			 guint64 ts_end,
+			 guint limit,
+			 SbuHistoryMode mode,
+			 GVariant *value,
+			 SbuHistoryBuckets *buckets)
+{
+	SbuHistoryCacheEntry *entry;
+	g_autofree gchar *hash_key = NULL;
+	g_autoptr(SbuHistoryBuckets) buckets_tmp = buckets;
+
+	g_return_if_fail(SBU_IS_HISTORY_CACHE(self));
+
+	if (self->max_entries == 0)
+		return;
+
+	/* replace any existing entry */
+	hash_key = sbu_history_cache_build_hash_key(device_id, key, ts_start, ts_end, limit, mode);
+	entry = g_hash_table_lookup(self->hash, hash_key);
+	if (entry != NULL)
+		sbu_history_cache_remove_entry(self, entry);
+
+	entry = g_new0(SbuHistoryCacheEntry, 1);
+	entry->hash_key = g_steal_pointer(&hash_key);
+	entry->device_id = g_strdup(device_id);
+	entry->key = g_strdup(key);
+	entry->ts_start = ts_start;
+	entry->ts_end = ts_end;
+	entry->value = g_variant_ref_sink(value);
+	entry->buckets = g_steal_pointer(&buckets_tmp);
+	g_queue_push_head(&self->lru, entry);
+	entry->link = g_queue_peek_head_link(&self->lru);
+	g_hash_table_insert(self->hash, entry->hash_key, entry);
+	self->bytes += sbu_history_cache_entry_get_size(entry);
+	sbu_history_cache_trim(self);
+}
+
+/**
+ * sbu_history_cache_add_item:
+ * @device_id: a device ID
+ * @item: the new sample, as saved to the database
+ *
+ * Updates every entry for @device_id and @item->key that covers the sample
+ * timestamp. Live windows have the sample added to the running bucket state
+ * and the result is rebuilt on the next lookup; any other entry is dropped.
+ * Entries that end before the new sample are still correct and are left alone.
+ **/
+void
+sbu_history_cache_add_item(SbuHistoryCache *self,
+			   const gchar *device_id,
+			   const SbuDatabaseItem *item)
+{
+	GList *l;
+
+	g_return_if_fail(SBU_IS_HISTORY_CACHE(self));
+	g_return_if_fail(item != NULL);
+
+	l = self->lru.head;
+	while (l != NULL) {
+		SbuHistoryCacheEntry *entry = l->data;
+		l = l->next;
+		if (item->ts < 0 || (guint64)item->ts < entry->ts_start ||
+		    (guint64)item->ts > entry->ts_end)
+			continue;
+		if (g_strcmp0(entry->key, item->key) != 0 ||
+		    g_strcmp0(entry->device_id, device_id) != 0)
+			continue;
+
+		/* only in-order samples can be added */
+		if (entry->buckets != NULL) {
+			gsize size = sbu_history_cache_entry_get_size(entry);
+			if (sbu_history_buckets_add(entry->buckets, item->ts, item->val)) {
+				g_clear_pointer(&entry->value, g_variant_unref);
+				self->bytes -= size;
+				self->bytes += sbu_history_cache_entry_get_size(entry);
+				self->appends++;
+				continue;
+			}
+		}
+		sbu_history_cache_remove_entry(self, entry);
+		self->invalidations++;
+	}
+	sbu_history_cache_trim(self);
+}
+
+void
+sbu_history_cache_clear(SbuHistoryCache *self)
+{
+	g_return_if_fail(SBU_IS_HISTORY_CACHE(self));
+	while (self->lru.head != NULL)
+		sbu_history_cache_remove_entry(self, self->lru.head->data);
+}
+
+guint64
+sbu_history_cache_get_hits(SbuHistoryCache *self)
+{
+	g_return_val_if_fail(SBU_IS_HISTORY_CACHE(self), 0);
+	return self->hits;
+}
+
+guint64
+sbu_history_cache_get_misses(SbuHistoryCache *self)
+{
+	g_return_val_if_fail(SBU_IS_HISTORY_CACHE(self), 0);
+	return self->misses;
+}
+
+guint64
+sbu_history_cache_get_evictions(SbuHistoryCache *self)
+{
+	g_return_val_if_fail(SBU_IS_HISTORY_CACHE(self), 0);
+	return self->evictions;
+}
+
+guint
+sbu_history_cache_get_size(SbuHistoryCache *self)
+{
+	g_return_val_if_fail(SBU_IS_HISTORY_CACHE(self), 0);
+	return g_queue_get_length(&self->lru);
+}
+
+gsize
+sbu_history_cache_get_bytes(SbuHistoryCache *self)
+{
+	g_return_val_if_fail(SBU_IS_HISTORY_CACHE(self), 0);
+	return self->bytes;
+}
+
+GVariant *
+sbu_history_cache_to_variant(SbuHistoryCache *self)
+{
+	GVariantBuilder builder;
+	gdouble hit_rate = 0.f;
+
+	g_return_val_if_fail(SBU_IS_HISTORY_CACHE(self), NULL);
+
+	if (self->hits + self->misses > 0)
+		hit_rate = (gdouble)self->hits / (gdouble)(self->hits + self->misses);
+	g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&builder, "{sv}", "hits", g_variant_new_uint64(self->hits));
+	g_variant_builder_add(&builder, "{sv}", "misses", g_variant_new_uint64(self->misses));
+	g_variant_builder_add(&builder, "{sv}", "hit-rate", g_variant_new_double(hit_rate));
+	g_variant_builder_add(&builder, "{sv}", "evictions", g_variant_new_uint64(self->evictions));
+	g_variant_builder_add(&builder,
+			      "{sv}",
+			      "invalidations",
+			      g_variant_new_uint64(self->invalidations));
+	g_variant_builder_add(&builder, "{sv}", "appends", g_variant_new_uint64(self->appends));
+	g_variant_builder_add(&builder,
+			      "{sv}",
+			      "entries",
+			      g_variant_new_uint32(g_queue_get_length(&self->lru)));
+	g_variant_builder_add(&builder,
+			      "{sv}",
+			      "max-entries",
+			      g_variant_new_uint32(self->max_entries));
+	g_variant_builder_add(&builder, "{sv}", "bytes", g_variant_new_uint64(self->bytes));
+	g_variant_builder_add(&builder,
+			      "{sv}",
+			      "max-bytes",
+			      g_variant_new_uint64(self->max_bytes));
+	return g_variant_builder_end(&builder);
+}
+
+static void
+sbu_history_cache_finalize(GObject *object)
+{
+	SbuHistoryCache *self = SBU_HISTORY_CACHE(object);
+
+	g_queue_clear(&self->lru);
+	g_hash_table_unref(self->hash);
+
+	G_OBJECT_CLASS(sbu_history_cache_parent_class)->finalize(object);
+}
+
+static void
+sbu_history_cache_init(SbuHistoryCache *self)
+{
+	self->max_entries = SBU_HISTORY_CACHE_MAX_ENTRIES_DEFAULT;
+	self->max_bytes = SBU_HISTORY_CACHE_MAX_BYTES_DEFAULT;
+	self->hash = g_hash_table_new_full(g_str_hash,
+					   g_str_equal,
+					   NULL,
+					   (GDestroyNotify)sbu_history_cache_entry_free);
+	g_queue_init(&self->lru);
+}
+
+static void
+sbu_history_cache_class_init(SbuHistoryCacheClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = sbu_history_cache_finalize;
+}
+
+SbuHistoryCache *
+sbu_history_cache_new(void)
+{
+	SbuHistoryCache *self;
+	self = g_object_new(SBU_TYPE_HISTORY_CACHE, NULL);
+	return SBU_HISTORY_CACHE(self);
+}
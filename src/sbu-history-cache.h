@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+#include "sbu-common.h"
+#include "sbu-database.h"
+#include "sbu-history.h"
+
+#define SBU_TYPE_HISTORY_CACHE (sbu_history_cache_get_type())
+G_DECLARE_FINAL_TYPE(SbuHistoryCache, sbu_history_cache, SBU, HISTORY_CACHE, GObject)
+
+SbuHistoryCache *
+sbu_history_cache_new(void);
+void
+sbu_history_cache_set_max_entries(SbuHistoryCache *self, guint max_entries);
+void
+sbu_history_cache_set_max_bytes(SbuHistoryCache *self, gsize max_bytes);
+void
+sbu_history_cache_align(guint64 *ts_start, guint64 *ts_end, guint limit);
+GVariant *
+sbu_history_cache_lookup(SbuHistoryCache *self,
+			 const gchar *device_id,
+			 const gchar *key,
+			 guint64 ts_start,
+			 guint64 ts_end,
+			 guint limit,
+			 SbuHistoryMode mode);
+void
+sbu_history_cache_insert(SbuHistoryCache *self,
+			 const gchar *device_id,
+			 const gchar *key,
+			 guint64 ts_start,
+			 guint64 ts_end,
+			 guint limit,
+			 SbuHistoryMode mode,
+			 GVariant *value,
+			 SbuHistoryBuckets *buckets);
+void
+sbu_history_cache_add_item(SbuHistoryCache *self,
+			   const gchar *device_id,
+			   const SbuDatabaseItem *item);
+void
+sbu_history_cache_clear(SbuHistoryCache *self);
+GVariant *
+sbu_history_cache_to_variant(SbuHistoryCache *self);
+guint64
+sbu_history_cache_get_hits(SbuHistoryCache *self);
+guint64
+sbu_history_cache_get_misses(SbuHistoryCache *self);
+guint64
+sbu_history_cache_get_evictions(SbuHistoryCache *self);
+guint
+sbu_history_cache_get_size(SbuHistoryCache *self);
+gsize
+sbu_history_cache_get_bytes(SbuHistoryCache *self);
@@ -0,0 +1,503 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "sbu-database.h"
+#include "sbu-history.h"
+
+typedef struct {
+	guint idx;
+	guint cnt;
+	gdouble acc;
+	gint64 min_ts;
+	gdouble min_val;
+	gint64 max_ts;
+	gdouble max_val;
+} SbuHistoryBucket;
+
+struct _SbuHistoryBuckets {
+	gint64 ts_start;
+	gint64 ts_end;
+	gint64 ts_last;
+	gdouble val_last;
+	guint limit;	    /* number of buckets */
+	guint limit_points; /* as requested */
+	SbuHistoryMode mode;
+	GArray *buckets; /* of SbuHistoryBucket, only the ones with values */
+};
+
+static void
+sbu_history_add(GArray *array, gint64 ts, gdouble val)
+{
+	SbuHistoryItem item = {.ts = ts, .val = val};
+	g_array_append_val(array, item);
+}
+
+/* the bucket is chosen from the timestamp, not the array index, so that the
+ * same point always ends up in the same bucket for a given time range */
+static guint
+sbu_history_bucket_for_ts(gint64 ts, gint64 ts_start, gint64 ts_end, guint limit)
+{
+	gint64 span = ts_end - ts_start + 1;
+	if (ts <= ts_start || span <= 0)
+		return 0;
+	if (ts >= ts_end)
+		return limit - 1;
+	return (guint)(((ts - ts_start) * (gint64)limit) / span);
+}
+
+static gint64
+sbu_history_bucket_center(guint idx, gint64 ts_start, gint64 ts_end, guint limit)
+{
+	gint64 span = ts_end - ts_start + 1;
+	return ts_start + ((2 * (gint64)idx + 1) * span) / (2 * (gint64)limit);
+}
+
+/**
+ * sbu_history_can_append:
+ * @limit: number of buckets
+ * @mode: a #SbuHistoryMode
+ *
+ * Checks if the downsampled result only depends on the state of each bucket,
+ * and so can be kept up to date using a #SbuHistoryBuckets.
+ *
+ * Returns: %TRUE if sbu_history_buckets_new() can be used
+ **/
+gboolean
+sbu_history_can_append(guint limit, SbuHistoryMode mode)
+{
+	if (limit == 0)
+		return FALSE;
+	return mode != SBU_HISTORY_MODE_LTTB || limit < 3;
+}
+
+/**
+ * sbu_history_buckets_new:
+ * @ts_start: start of the requested range
+ * @ts_end: end of the requested range
+ * @limit: number of buckets
+ * @mode: a #SbuHistoryMode
+ *
+ * Creates the running state for a downsampled range. Only the buckets that
+ * have values are stored, so the size depends on the samples added rather
+ * than on @limit.
+ *
+ * Returns: (transfer full): a #SbuHistoryBuckets
+ **/
+SbuHistoryBuckets *
+sbu_history_buckets_new(gint64 ts_start, gint64 ts_end, guint limit, SbuHistoryMode mode)
+{
+	SbuHistoryBuckets *self;
+
+	g_return_val_if_fail(sbu_history_can_append(limit, mode), NULL);
+
+	self = g_new0(SbuHistoryBuckets, 1);
+	self->limit_points = limit;
+
+	/* two points per bucket, so use half as many */
+	if (mode == SBU_HISTORY_MODE_MINMAX && limit >= 2) {
+		limit /= 2;
+	} else {
+		mode = SBU_HISTORY_MODE_AVERAGE;
+	}
+	self->ts_start = ts_start;
+	self->ts_end = ts_end;
+	self->ts_last = G_MININT64;
+	self->limit = limit;
+	self->mode = mode;
+	self->buckets = g_array_new(FALSE, FALSE, sizeof(SbuHistoryBucket));
+	return self;
+}
+
+void
+sbu_history_buckets_free(SbuHistoryBuckets *self)
+{
+	g_array_unref(self->buckets);
+	g_free(self);
+}
+
+/**
+ * sbu_history_buckets_add:
+ * @self: a #SbuHistoryBuckets
+ * @ts: timestamp
+ * @val: value, as stored in the database
+ *
+ * Adds a value to the bucket that covers @ts.
+ *
+ * Returns: %FALSE if @ts is older than a value that has already been added
+ **/
+gboolean
+sbu_history_buckets_add(SbuHistoryBuckets *self, gint64 ts, gdouble val)
+{
+	SbuHistoryBucket *bucket = NULL;
+	guint idx = sbu_history_bucket_for_ts(ts, self->ts_start, self->ts_end, self->limit);
+
+	if (ts < self->ts_last)
+		return FALSE;
+	self->ts_last = ts;
+	self->val_last = val;
+	if (self->buckets->len > 0) {
+		bucket = &g_array_index(self->buckets, SbuHistoryBucket, self->buckets->len - 1);
+		if (bucket->idx != idx)
+			bucket = NULL;
+	}
+	if (bucket == NULL) {
+		SbuHistoryBucket bucket_new = {.idx = idx,
+					       .min_ts = ts,
+					       .min_val = val,
+					       .max_ts = ts,
+					       .max_val = val};
+		g_array_append_val(self->buckets, bucket_new);
+		bucket = &g_array_index(self->buckets, SbuHistoryBucket, self->buckets->len - 1);
+	}
+	bucket->acc += val;
+	bucket->cnt++;
+	if (val < bucket->min_val) {
+		bucket->min_ts = ts;
+		bucket->min_val = val;
+	}
+	if (val > bucket->max_val) {
+		bucket->max_ts = ts;
+		bucket->max_val = val;
+	}
+	return TRUE;
+}
+
+/* always two points, so a bucket with one value repeats it */
+static void
+sbu_history_buckets_add_minmax(SbuHistoryBucket *bucket, GArray *array)
+{
+	if (bucket->min_ts > bucket->max_ts) {
+		sbu_history_add(array, bucket->max_ts, bucket->max_val);
+		sbu_history_add(array, bucket->min_ts, bucket->min_val);
+		return;
+	}
+	sbu_history_add(array, bucket->min_ts, bucket->min_val);
+	sbu_history_add(array, bucket->max_ts, bucket->max_val);
+}
+
+/* empty buckets are interpolated from the average of the buckets either side,
+ * or use the nearest one at either end of the range */
+static gdouble
+sbu_history_buckets_fill_value(SbuHistoryBucket *prev, SbuHistoryBucket *next, guint idx)
+{
+	gdouble prev_val;
+	gdouble next_val;
+
+	if (prev == NULL)
+		return next->acc / (gdouble)next->cnt;
+	prev_val = prev->acc / (gdouble)prev->cnt;
+	if (next == NULL)
+		return prev_val;
+	next_val = next->acc / (gdouble)next->cnt;
+	return prev_val + (next_val - prev_val) * (gdouble)(idx - prev->idx) /
+			      (gdouble)(next->idx - prev->idx);
+}
+
+/**
+ * sbu_history_buckets_to_array:
+ * @self: a #SbuHistoryBuckets
+ *
+ * Gets the downsampled points, in the same format as sbu_history_downsample().
+ *
+ * Returns: (transfer full): a #GArray of #SbuHistoryItem
+ **/
+GArray *
+sbu_history_buckets_to_array(SbuHistoryBuckets *self)
+{
+	GArray *array;
+	guint j = 0;
+
+	array = g_array_sized_new(FALSE, FALSE, sizeof(SbuHistoryItem), self->limit_points);
+	if (self->buckets->len == 0)
+		return array;
+	for (guint idx = 0; idx < self->limit; idx++) {
+		SbuHistoryBucket *next = NULL;
+		SbuHistoryBucket *prev = NULL;
+		gint64 center;
+		gdouble val;
+
+		center = sbu_history_bucket_center(idx, self->ts_start, self->ts_end, self->limit);
+
+		if (j < self->buckets->len)
+			next = &g_array_index(self->buckets, SbuHistoryBucket, j);
+		if (next != NULL && next->idx == idx) {
+			if (self->mode == SBU_HISTORY_MODE_MINMAX)
+				sbu_history_buckets_add_minmax(next, array);
+			else
+				sbu_history_add(array, center, next->acc / (gdouble)next->cnt);
+			j++;
+			continue;
+		}
+		if (j > 0)
+			prev = &g_array_index(self->buckets, SbuHistoryBucket, j - 1);
+		val = sbu_history_buckets_fill_value(prev, next, idx);
+		sbu_history_add(array, center, val);
+		if (self->mode == SBU_HISTORY_MODE_MINMAX)
+			sbu_history_add(array, center, val);
+	}
+
+	/* an odd limit ends with the newest value */
+	if (array->len < self->limit_points)
+		sbu_history_add(array, self->ts_last, self->val_last);
+	return array;
+}
+
+gsize
+sbu_history_buckets_get_size(SbuHistoryBuckets *self)
+{
+	return sizeof(SbuHistoryBuckets) + self->buckets->len * sizeof(SbuHistoryBucket);
+}
+
+/* Largest-Triangle-Three-Buckets, see "Downsampling Time Series for Visual
+ * Representation" by Sveinn Steinarsson -- the first and last points are
+ * always kept and exactly one point is chosen from every bucket in between */
+static GArray *
+sbu_history_downsample_lttb(GPtrArray *items, guint limit)
+{
+	GArray *array = g_array_sized_new(FALSE, FALSE, sizeof(SbuHistoryItem), limit);
+	SbuDatabaseItem *item_a;
+	gdouble every = (gdouble)(items->len - 2) / (gdouble)(limit - 2);
+	guint a = 0;
+
+	item_a = g_ptr_array_index(items, 0);
+	sbu_history_add(array, item_a->ts, item_a->val);
+	for (guint i = 0; i < limit - 2; i++) {
+		gdouble avg_ts = 0.f;
+		gdouble avg_val = 0.f;
+		gdouble area_max = -1.f;
+		guint avg_start = (guint)floor((i + 1) * every) + 1;
+		guint avg_end = MIN((guint)floor((i + 2) * every) + 1, items->len);
+		guint range_start = (guint)floor(i * every) + 1;
+		guint range_end = (guint)floor((i + 1) * every) + 1;
+		guint next_a = range_start;
+
+		/* average of the next bucket is the third point of the triangle */
+		for (guint j = avg_start; j < avg_end; j++) {
+			SbuDatabaseItem *item = g_ptr_array_index(items, j);
+			avg_ts += item->ts;
+			avg_val += item->val;
+		}
+		if (avg_end > avg_start) {
+			avg_ts /= (gdouble)(avg_end - avg_start);
+			avg_val /= (gdouble)(avg_end - avg_start);
+		} else {
+			SbuDatabaseItem *item = g_ptr_array_index(items, items->len - 1);
+			avg_ts = item->ts;
+			avg_val = item->val;
+		}
+
+		/* pick the point in this bucket with the largest triangle */
+		item_a = g_ptr_array_index(items, a);
+		for (guint j = range_start; j < range_end; j++) {
+			SbuDatabaseItem *item = g_ptr_array_index(items, j);
+			gdouble area = fabs(((gdouble)item_a->ts - avg_ts) *
+						(item->val - (gdouble)item_a->val) -
+					    ((gdouble)item_a->ts - (gdouble)item->ts) *
+						(avg_val - (gdouble)item_a->val));
+			if (area > area_max) {
+				area_max = area;
+				next_a = j;
+			}
+		}
+		item_a = g_ptr_array_index(items, next_a);
+		sbu_history_add(array, item_a->ts, item_a->val);
+		a = next_a;
+	}
+	item_a = g_ptr_array_index(items, items->len - 1);
+	sbu_history_add(array, item_a->ts, item_a->val);
+	return array;
+}
+
+/**
+ * sbu_history_downsample:
+ * @items: sorted #SbuDatabaseItem's
+ * @ts_start: start of the requested range
+ * @ts_end: end of the requested range
+ * @limit: number of buckets, or 0 for no filtering
+ * @mode: a #SbuHistoryMode
+ *
+ * Reduces the raw values to exactly @limit points, or to none if there are no
+ * values. %SBU_HISTORY_MODE_AVERAGE returns the average of each of the @limit
+ * buckets, aligned to the bucket center. %SBU_HISTORY_MODE_MINMAX returns the
+ * lowest and highest point of each of @limit / 2 buckets, followed by the
+ * newest value if @limit is odd. In both modes an empty bucket is filled by
+ * interpolating between the buckets either side of it.
+ * %SBU_HISTORY_MODE_LTTB returns @limit points chosen to preserve the visual
+ * shape of the data, or all of the values if there are fewer than that.
+ *
+ * Returns: (transfer full): a #GArray of #SbuHistoryItem
+ **/
+GArray *
+sbu_history_downsample(GPtrArray *items,
+		       gint64 ts_start,
+		       gint64 ts_end,
+		       guint limit,
+		       SbuHistoryMode mode)
+{
+	g_autoptr(SbuHistoryBuckets) buckets = NULL;
+
+	/* no filter, or nothing to filter */
+	if (limit == 0 || (mode == SBU_HISTORY_MODE_LTTB && items->len <= limit)) {
+		GArray *array = g_array_sized_new(FALSE, FALSE, sizeof(SbuHistoryItem), items->len);
+		for (guint i = 0; i < items->len; i++) {
+			SbuDatabaseItem *item = g_ptr_array_index(items, i);
+			sbu_history_add(array, item->ts, item->val);
+		}
+		return array;
+	}
+
+	/* LTTB needs at least the first, last and one other point */
+	if (mode == SBU_HISTORY_MODE_LTTB && limit >= 3)
+		return sbu_history_downsample_lttb(items, limit);
+
+	/* everything else only needs the state of each bucket */
+	buckets = sbu_history_buckets_new(ts_start, ts_end, limit, mode);
+	for (guint i = 0; i < items->len; i++) {
+		SbuDatabaseItem *item = g_ptr_array_index(items, i);
+		sbu_history_buckets_add(buckets, item->ts, item->val);
+	}
+	return sbu_history_buckets_to_array(buckets);
+}
+
+/**
+ * sbu_history_to_variant:
+ * @items: a #GArray of #SbuHistoryItem
+ *
+ * Converts the downsampled items to the format used on the bus. Values are
+ * stored in the database as thousandths, apart from booleans.
+ *
+ * Returns: (transfer floating): a #GVariant of type `(a(td))`
+ **/
+GVariant *
+sbu_history_to_variant(GArray *items)
+{
+	GVariantBuilder builder;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("(a(td))"));
+	g_variant_builder_open(&builder, G_VARIANT_TYPE("a(td)"));
+	for (guint i = 0; i < items->len; i++) {
+		SbuHistoryItem *item = &g_array_index(items, SbuHistoryItem, i);
+		gdouble val = item->val;
+		if (fabs(val) > 1.1f)
+			val /= 1000.f;
+		g_variant_builder_add(&builder, "(td)", (guint64)item->ts, val);
+	}
+	g_variant_builder_close(&builder);
+	return g_variant_builder_end(&builder);
+}
+
+/* the fd contents are the same as the GVariant serialisation of a(td) */
+G_STATIC_ASSERT(sizeof(SbuHistoryItem) == 16);
+
+/**
+ * sbu_history_to_fd:
+ * @history: a #GVariant of type `(a(td))` or `a(td)`
+ * @error: a #GError or %NULL
+ *
+ * Writes the history as packed native-endian #SbuHistoryItem records to a
+ * sealed memfd, suitable for passing to a client that can mmap it.
+ *
+ * Returns: a file descriptor, or -1 on error
+ **/
+gint
+sbu_history_to_fd(GVariant *history, GError **error)
+{
+#ifdef HAVE_MEMFD_CREATE
+	const guint8 *data;
+	gsize size;
+	gint fd;
+	g_autoptr(GVariant) array = NULL;
+
+	if (g_variant_is_of_type(history, G_VARIANT_TYPE("(a(td))")))
+		array = g_variant_get_child_value(history, 0);
+	else
+		array = g_variant_ref(history);
+	data = g_variant_get_data(array);
+	size = g_variant_get_size(array);
+
+	fd = memfd_create("sbu-history", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    g_io_error_from_errno(errno),
+			    "failed to create memfd: %s",
+			    g_strerror(errno));
+		return -1;
+	}
+	while (size > 0) {
+		gssize wrote = write(fd, data, size);
+		if (wrote < 0) {
+			if (errno == EINTR)
+				continue;
+			g_set_error(error,
+				    G_IO_ERROR,
+				    g_io_error_from_errno(errno),
+				    "failed to write memfd: %s",
+				    g_strerror(errno));
+			close(fd);
+			return -1;
+		}
+		data += wrote;
+		size -= wrote;
+	}
+
+	/* the client can trust the size and contents will not change */
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) <
+	    0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    g_io_error_from_errno(errno),
+			    "failed to seal memfd: %s",
+			    g_strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+#else
+	g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "no memfd support");
+	return -1;
+#endif
+}
+
+/**
+ * sbu_history_map_fd:
+ * @fd: a file descriptor from sbu_history_to_fd()
+ * @error: a #GError or %NULL
+ *
+ * Maps the history read-only; the contents are an array of #SbuHistoryItem.
+ *
+ * Returns: (transfer full): a #GMappedFile, or %NULL on error
+ **/
+GMappedFile *
+sbu_history_map_fd(gint fd, GError **error)
+{
+	g_autoptr(GMappedFile) mapped = NULL;
+
+	mapped = g_mapped_file_new_from_fd(fd, FALSE, error);
+	if (mapped == NULL)
+		return NULL;
+	if (g_mapped_file_get_length(mapped) % sizeof(SbuHistoryItem) != 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "history size %" G_GSIZE_FORMAT " is not a multiple of %" G_GSIZE_FORMAT,
+			    g_mapped_file_get_length(mapped),
+			    sizeof(SbuHistoryItem));
+		return NULL;
+	}
+	return g_steal_pointer(&mapped);
+}
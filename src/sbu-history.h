@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#pragma once
+
+#include <glib.h>
+
+#include "sbu-common.h"
+
+typedef struct {
+	gint64 ts;
+	gdouble val;
+} SbuHistoryItem;
+
+typedef struct _SbuHistoryBuckets SbuHistoryBuckets;
+
+GArray *
+sbu_history_downsample(GPtrArray *items,
+		       gint64 ts_start,
+		       gint64 ts_end,
+		       guint limit,
+		       SbuHistoryMode mode);
+gboolean
+sbu_history_can_append(guint limit, SbuHistoryMode mode);
+SbuHistoryBuckets *
+sbu_history_buckets_new(gint64 ts_start, gint64 ts_end, guint limit, SbuHistoryMode mode);
+void
+sbu_history_buckets_free(SbuHistoryBuckets *self);
+gboolean
+sbu_history_buckets_add(SbuHistoryBuckets *self, gint64 ts, gdouble val);
+GArray *
+sbu_history_buckets_to_array(SbuHistoryBuckets *self);
+gsize
+sbu_history_buckets_get_size(SbuHistoryBuckets *self);
+GVariant *
+sbu_history_to_variant(GArray *items);
+gint
+sbu_history_to_fd(GVariant *history, GError **error);
+GMappedFile *
+sbu_history_map_fd(gint fd, GError **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuHistoryBuckets, sbu_history_buckets_free)
@@ -0,0 +1,527 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#include "config.h"
+
+#include <glib/gstdio.h>
+#include <math.h>
+#include <string.h>
+
+#include "sbu-line-exporter.h"
+#include "sbu-stats.h"
+
+/* keep datagrams under the usual MTU */
+#define SBU_LINE_EXPORTER_DATAGRAM_MAX 1400
+#define SBU_LINE_EXPORTER_TIMEOUT      5 /* s */
+
+typedef enum {
+	SBU_LINE_EXPORTER_KIND_TCP,
+	SBU_LINE_EXPORTER_KIND_UDP,
+} SbuLineExporterKind;
+
+struct _SbuLineExporter {
+	GObject parent_instance;
+	guint batch_size;     /* lines */
+	guint flush_interval; /* ms */
+	gchar *spool;	      /* nullable */
+	gsize spool_max;
+	GThread *thread;
+	GAsyncQueue *queue;	  /* of gchar* lines, or the quit marker */
+	GCancellable *cancellable; /* cancelled to stop blocking network calls */
+	SbuStatsHistogram *stats_send;
+	SbuStatsCounter *stats_dropped;
+	SbuStatsCounter *stats_errors;
+
+	/* only used from the thread */
+	SbuLineExporterKind kind;
+	GSocketConnectable *address;
+	GSocketClient *client;
+	GSocketConnection *connection; /* TCP */
+	GSocket *socket;	       /* UDP */
+	gsize spool_size;
+};
+
+G_DEFINE_TYPE(SbuLineExporter, sbu_line_exporter, G_TYPE_OBJECT)
+
+static gchar sbu_line_exporter_quit_marker;
+
+static void
+sbu_line_exporter_append_escaped(GString *str, const gchar *value)
+{
+	for (guint i = 0; value[i] != '\0'; i++) {
+		if (value[i] == ',' || value[i] == '=' || value[i] == ' ')
+			g_string_append_c(str, '\\');
+		g_string_append_c(str, value[i]);
+	}
+}
+
+static void
+sbu_line_exporter_string_free(GString *str)
+{
+	g_string_free(str, TRUE);
+}
+
+static void
+sbu_line_exporter_append_field(GString *str, const gchar *key, GVariant *value)
+{
+	gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+	if (g_variant_is_of_type(value, G_VARIANT_TYPE_DOUBLE)) {
+		gdouble tmp = g_variant_get_double(value);
+
+		/* not valid in line protocol, and would reject the whole batch */
+		if (!isfinite(tmp))
+			return;
+		g_ascii_dtostr(buf, sizeof(buf), tmp);
+	} else if (g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)) {
+		g_strlcpy(buf, g_variant_get_boolean(value) ? "true" : "false", sizeof(buf));
+	} else {
+		return;
+	}
+	if (str->len > 0)
+		g_string_append_c(str, ',');
+	sbu_line_exporter_append_escaped(str, key);
+	g_string_append_printf(str, "=%s", buf);
+}
+
+/**
+ * sbu_line_exporter_format:
+ * @changes: a #GVariant of type `a(sssv)`
+ * @timestamp: a UNIX timestamp in nanoseconds
+ *
+ * Formats the changes in InfluxDB line protocol, with one line for each node
+ * or link, e.g. `sbu,device=0,id=node_battery voltage=27.5,current=3 1700000000000000000`
+ * where the fields are the values that changed.
+ *
+ * Returns: (transfer full) (nullable): lines ending with `\n`, or %NULL if there
+ * were no values that could be exported
+ **/
+gchar *
+sbu_line_exporter_format(GVariant *changes, gint64 timestamp)
+{
+	GVariantIter iter;
+	GVariant *change;
+	g_autoptr(GHashTable) fields = NULL;
+	g_autoptr(GPtrArray) order = g_ptr_array_new_with_free_func(g_free);
+	g_autoptr(GString) str = g_string_new(NULL);
+
+	/* group by device and node, keeping the order they changed in */
+	fields = g_hash_table_new_full(g_str_hash,
+				       g_str_equal,
+				       g_free,
+				       (GDestroyNotify)sbu_line_exporter_string_free);
+	g_variant_iter_init(&iter, changes);
+	while ((change = g_variant_iter_next_value(&iter)) != NULL) {
+		const gchar *device_id;
+		const gchar *id;
+		const gchar *key;
+		GString *line;
+		g_autofree gchar *tags = NULL;
+		g_autoptr(GVariant) value = NULL;
+
+		g_variant_get(change, "(&s&s&sv)", &device_id, &id, &key, &value);
+		tags = g_strdup_printf("%s\n%s", device_id, id);
+		line = g_hash_table_lookup(fields, tags);
+		if (line == NULL) {
+			line = g_string_new(NULL);
+			g_ptr_array_add(order, g_strdup(tags));
+			g_hash_table_insert(fields, g_steal_pointer(&tags), line);
+		}
+		sbu_line_exporter_append_field(line, key, value);
+		g_variant_unref(change);
+	}
+	for (guint i = 0; i < order->len; i++) {
+		const gchar *tags = g_ptr_array_index(order, i);
+		GString *line = g_hash_table_lookup(fields, tags);
+		g_auto(GStrv) split = g_strsplit(tags, "\n", 2);
+
+		if (line->len == 0)
+			continue;
+		g_string_append(str, "sbu,device=");
+		sbu_line_exporter_append_escaped(str, split[0]);
+		g_string_append(str, ",id=");
+		sbu_line_exporter_append_escaped(str, split[1]);
+		g_string_append_printf(str, " %s %" G_GINT64_FORMAT "\n", line->str, timestamp);
+	}
+	if (str->len == 0)
+		return NULL;
+	return g_string_free(g_steal_pointer(&str), FALSE);
+}
+
+static gboolean
+sbu_line_exporter_ensure_connected(SbuLineExporter *self, GError **error)
+{
+	g_autoptr(GSocketAddress) address = NULL;
+	g_autoptr(GSocketAddressEnumerator) enumerator = NULL;
+
+	if (self->kind == SBU_LINE_EXPORTER_KIND_TCP) {
+		if (self->connection != NULL)
+			return TRUE;
+		self->connection =
+		    g_socket_client_connect(self->client, self->address, self->cancellable, error);
+		return self->connection != NULL;
+	}
+
+	/* connecting a datagram socket just sets the default destination */
+	if (self->socket != NULL)
+		return TRUE;
+	enumerator = g_socket_connectable_enumerate(self->address);
+	address = g_socket_address_enumerator_next(enumerator, NULL, error);
+	if (address == NULL) {
+		if (error != NULL && *error == NULL)
+			g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "no address");
+		return FALSE;
+	}
+	self->socket = g_socket_new(g_socket_address_get_family(address),
+				    G_SOCKET_TYPE_DATAGRAM,
+				    G_SOCKET_PROTOCOL_UDP,
+				    error);
+	if (self->socket == NULL)
+		return FALSE;
+	if (!g_socket_connect(self->socket, address, self->cancellable, error)) {
+		g_clear_object(&self->socket);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* including the newline, if there is one */
+static gsize
+sbu_line_exporter_line_len(const gchar *data, gsize len)
+{
+	const gchar *eol = memchr(data, '\n', len);
+	return eol != NULL ? (gsize)(eol - data) + 1 : len;
+}
+
+static gboolean
+sbu_line_exporter_write(SbuLineExporter *self, const gchar *data, gsize len, GError **error)
+{
+	GOutputStream *ostream;
+
+	if (!sbu_line_exporter_ensure_connected(self, error))
+		return FALSE;
+	if (self->kind == SBU_LINE_EXPORTER_KIND_TCP) {
+		ostream = g_io_stream_get_output_stream(G_IO_STREAM(self->connection));
+		if (!g_output_stream_write_all(ostream,
+					       data,
+					       len,
+					       NULL,
+					       self->cancellable,
+					       error)) {
+			g_clear_object(&self->connection);
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	/* as many whole lines as fit in each datagram, as a line cannot be split */
+	for (gsize off = 0; off < len;) {
+		gsize chunk = 0;
+		while (off + chunk < len) {
+			gsize line_len =
+			    sbu_line_exporter_line_len(data + off + chunk, len - off - chunk);
+			if (chunk + line_len > SBU_LINE_EXPORTER_DATAGRAM_MAX)
+				break;
+			chunk += line_len;
+		}
+
+		/* a single line that is too large can never be sent */
+		if (chunk == 0) {
+			gsize line_len = sbu_line_exporter_line_len(data + off, len - off);
+			g_debug("dropping %" G_GSIZE_FORMAT " byte line, too large for a datagram",
+				line_len);
+			sbu_stats_counter_inc(self->stats_dropped);
+			off += line_len;
+			continue;
+		}
+		if (g_socket_send(self->socket, data + off, chunk, self->cancellable, error) < 0) {
+			g_clear_object(&self->socket);
+			return FALSE;
+		}
+		off += chunk;
+	}
+	return TRUE;
+}
+
+static void
+sbu_line_exporter_spool_append(SbuLineExporter *self, const gchar *data, gsize len)
+{
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GFile) file = NULL;
+	g_autoptr(GFileOutputStream) ostream = NULL;
+
+	if (self->spool == NULL || self->kind != SBU_LINE_EXPORTER_KIND_TCP)
+		return;
+	if (self->spool_size + len > self->spool_max) {
+		g_debug("spool %s is full, dropping %" G_GSIZE_FORMAT " bytes", self->spool, len);
+		sbu_stats_counter_inc(self->stats_dropped);
+		return;
+	}
+	file = g_file_new_for_path(self->spool);
+	ostream = g_file_append_to(file, G_FILE_CREATE_PRIVATE, NULL, &error);
+	if (ostream == NULL ||
+	    !g_output_stream_write_all(G_OUTPUT_STREAM(ostream), data, len, NULL, NULL, &error)) {
+		g_warning("failed to write to %s: %s", self->spool, error->message);
+		return;
+	}
+	self->spool_size += len;
+}
+
+/* this may send some lines twice if the connection drops half way through,
+ * but the database deduplicates points with the same series and timestamp */
+static gboolean
+sbu_line_exporter_spool_replay(SbuLineExporter *self, GError **error)
+{
+	gsize len = 0;
+	g_autofree gchar *data = NULL;
+
+	if (self->spool == NULL || self->spool_size == 0)
+		return TRUE;
+	if (!g_file_get_contents(self->spool, &data, &len, error))
+		return FALSE;
+	if (!sbu_line_exporter_write(self, data, len, error))
+		return FALSE;
+	g_debug("replayed %" G_GSIZE_FORMAT " bytes from %s", len, self->spool);
+	g_unlink(self->spool);
+	self->spool_size = 0;
+	return TRUE;
+}
+
+static void
+sbu_line_exporter_flush(SbuLineExporter *self, GString *batch)
+{
+	gint64 ts_start = g_get_monotonic_time();
+	g_autoptr(GError) error = NULL;
+
+	if (batch->len == 0)
+		return;
+
+	/* anything spooled is older, so goes first */
+	if (!sbu_line_exporter_spool_replay(self, &error) ||
+	    !sbu_line_exporter_write(self, batch->str, batch->len, &error)) {
+		g_debug("failed to send %" G_GSIZE_FORMAT " bytes: %s", batch->len, error->message);
+		sbu_stats_counter_inc(self->stats_errors);
+		sbu_line_exporter_spool_append(self, batch->str, batch->len);
+	} else {
+		sbu_stats_histogram_record(self->stats_send, ts_start);
+	}
+	g_string_truncate(batch, 0);
+}
+
+static gpointer
+sbu_line_exporter_thread_cb(gpointer user_data)
+{
+	SbuLineExporter *self = SBU_LINE_EXPORTER(user_data);
+	gint64 deadline = 0;
+	gint64 interval = (gint64)self->flush_interval * 1000;
+	guint batch_lines = 0;
+	g_autoptr(GString) batch = g_string_new(NULL);
+
+	while (TRUE) {
+		gpointer item;
+		g_autofree gchar *lines = NULL;
+
+		/* sleep until there is something to do */
+		if (batch_lines == 0) {
+			item = g_async_queue_pop(self->queue);
+		} else {
+			gint64 timeout = deadline - g_get_monotonic_time();
+			item = g_async_queue_timeout_pop(self->queue, MAX(timeout, 0));
+		}
+		if (item == &sbu_line_exporter_quit_marker)
+			break;
+		lines = item;
+		if (lines != NULL) {
+			if (batch_lines == 0)
+				deadline = g_get_monotonic_time() + interval;
+			g_string_append(batch, lines);
+			for (guint i = 0; lines[i] != '\0'; i++) {
+				if (lines[i] == '\n')
+					batch_lines++;
+			}
+		}
+		if (batch_lines >= self->batch_size || g_get_monotonic_time() >= deadline) {
+			sbu_line_exporter_flush(self, batch);
+			batch_lines = 0;
+		}
+	}
+
+	/* best effort, or spool it for next time */
+	sbu_line_exporter_flush(self, batch);
+	return NULL;
+}
+
+/**
+ * sbu_line_exporter_push_changes:
+ * @self: a #SbuLineExporter
+ * @changes: a #GVariant of type `a(sssv)`
+ *
+ * Formats the changes with the current time and queues them for the next
+ * batch. This never blocks on the network.
+ **/
+void
+sbu_line_exporter_push_changes(SbuLineExporter *self, GVariant *changes)
+{
+	gchar *lines;
+
+	g_return_if_fail(SBU_IS_LINE_EXPORTER(self));
+
+	if (self->thread == NULL)
+		return;
+	lines = sbu_line_exporter_format(changes, g_get_real_time() * 1000);
+	if (lines != NULL)
+		g_async_queue_push(self->queue, lines);
+}
+
+void
+sbu_line_exporter_set_batch_size(SbuLineExporter *self, guint batch_size)
+{
+	g_return_if_fail(SBU_IS_LINE_EXPORTER(self));
+	g_return_if_fail(self->thread == NULL);
+	self->batch_size = MAX(batch_size, 1);
+}
+
+/**
+ * sbu_line_exporter_set_flush_interval:
+ * @self: a #SbuLineExporter
+ * @flush_interval: the longest time to hold lines, in ms
+ **/
+void
+sbu_line_exporter_set_flush_interval(SbuLineExporter *self, guint flush_interval)
+{
+	g_return_if_fail(SBU_IS_LINE_EXPORTER(self));
+	g_return_if_fail(self->thread == NULL);
+	self->flush_interval = flush_interval;
+}
+
+/**
+ * sbu_line_exporter_set_spool:
+ * @self: a #SbuLineExporter
+ * @filename: (nullable): where to save lines that could not be sent
+ * @max_size: the largest the spool can grow to, in bytes
+ *
+ * Batches that cannot be sent are appended to the spool, which is replayed
+ * before the next batch that can be sent. Without a spool they are dropped.
+ *
+ * The spool is only used for TCP endpoints. A UDP datagram that is lost on
+ * the way is never reported, so only local send errors could be detected.
+ **/
+void
+sbu_line_exporter_set_spool(SbuLineExporter *self, const gchar *filename, gsize max_size)
+{
+	g_return_if_fail(SBU_IS_LINE_EXPORTER(self));
+	g_return_if_fail(self->thread == NULL);
+	g_free(self->spool);
+	self->spool = g_strdup(filename);
+	self->spool_max = max_size;
+}
+
+/**
+ * sbu_line_exporter_start:
+ * @self: a #SbuLineExporter
+ * @uri: the endpoint, e.g. `tcp://localhost:8094` or `udp://localhost:8089`
+ * @error: a #GError or %NULL
+ *
+ * Starts the thread that sends batches to the endpoint.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_line_exporter_start(SbuLineExporter *self, const gchar *uri, GError **error)
+{
+	GStatBuf st;
+	g_autofree gchar *scheme = NULL;
+
+	g_return_val_if_fail(SBU_IS_LINE_EXPORTER(self), FALSE);
+	g_return_val_if_fail(uri != NULL, FALSE);
+	g_return_val_if_fail(self->thread == NULL, FALSE);
+
+	scheme = g_uri_parse_scheme(uri);
+	if (g_strcmp0(scheme, "tcp") == 0) {
+		self->kind = SBU_LINE_EXPORTER_KIND_TCP;
+	} else if (g_strcmp0(scheme, "udp") == 0) {
+		self->kind = SBU_LINE_EXPORTER_KIND_UDP;
+	} else {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_ARGUMENT,
+			    "%s is not a tcp:// or udp:// URI",
+			    uri);
+		return FALSE;
+	}
+	self->address = g_network_address_parse_uri(uri, 0, error);
+	if (self->address == NULL)
+		return FALSE;
+
+	/* left over from last time */
+	if (self->spool != NULL && self->kind == SBU_LINE_EXPORTER_KIND_TCP &&
+	    g_stat(self->spool, &st) == 0)
+		self->spool_size = st.st_size;
+	self->thread = g_thread_new("sbu-line-exporter", sbu_line_exporter_thread_cb, self);
+	return TRUE;
+}
+
+static void
+sbu_line_exporter_finalize(GObject *object)
+{
+	SbuLineExporter *self = SBU_LINE_EXPORTER(object);
+
+	/* do not wait for a connection timeout, the last batch gets spooled */
+	if (self->thread != NULL) {
+		g_cancellable_cancel(self->cancellable);
+		g_async_queue_push(self->queue, &sbu_line_exporter_quit_marker);
+		g_thread_join(self->thread);
+	}
+	g_async_queue_unref(self->queue);
+	if (self->address != NULL)
+		g_object_unref(self->address);
+	if (self->connection != NULL)
+		g_object_unref(self->connection);
+	if (self->socket != NULL)
+		g_object_unref(self->socket);
+	g_object_unref(self->client);
+	g_object_unref(self->cancellable);
+	g_free(self->spool);
+
+	G_OBJECT_CLASS(sbu_line_exporter_parent_class)->finalize(object);
+}
+
+static void
+sbu_line_exporter_init(SbuLineExporter *self)
+{
+	self->batch_size = 500;
+	self->flush_interval = 5000;
+	self->queue = g_async_queue_new_full(g_free);
+	self->cancellable = g_cancellable_new();
+	self->stats_send = sbu_stats_histogram_get("line:send");
+	self->stats_dropped = sbu_stats_counter_get("line:dropped");
+	self->stats_errors = sbu_stats_counter_get("line:errors");
+	self->client = g_socket_client_new();
+	g_socket_client_set_timeout(self->client, SBU_LINE_EXPORTER_TIMEOUT);
+}
+
+static void
+sbu_line_exporter_class_init(SbuLineExporterClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = sbu_line_exporter_finalize;
+}
+
+/**
+ * sbu_line_exporter_new:
+ *
+ * Creates an exporter that pushes values in InfluxDB line protocol, which is
+ * also understood by Telegraf, VictoriaMetrics and QuestDB.
+ *
+ * Returns: (transfer full): a #SbuLineExporter
+ **/
+SbuLineExporter *
+sbu_line_exporter_new(void)
+{
+	SbuLineExporter *self;
+	self = g_object_new(SBU_TYPE_LINE_EXPORTER, NULL);
+	return SBU_LINE_EXPORTER(self);
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+#define SBU_TYPE_LINE_EXPORTER (sbu_line_exporter_get_type())
+G_DECLARE_FINAL_TYPE(SbuLineExporter, sbu_line_exporter, SBU, LINE_EXPORTER, GObject)
+
+SbuLineExporter *
+sbu_line_exporter_new(void);
+void
+sbu_line_exporter_set_batch_size(SbuLineExporter *self, guint batch_size);
+void
+sbu_line_exporter_set_flush_interval(SbuLineExporter *self, guint flush_interval);
+void
+sbu_line_exporter_set_spool(SbuLineExporter *self, const gchar *filename, gsize max_size);
+gboolean
+sbu_line_exporter_start(SbuLineExporter *self, const gchar *uri, GError **error);
+void
+sbu_line_exporter_push_changes(SbuLineExporter *self, GVariant *changes);
+gchar *
+sbu_line_exporter_format(GVariant *changes, gint64 timestamp);
@@ -7,14 +7,23 @@
 #include "config.h"
 
 #include <gio/gio.h>
+#include <gio/gunixfdlist.h>
 #include <glib-unix.h>
 #include <glib/gi18n.h>
 #include <locale.h>
 #include <stdlib.h>
 
 #include "sbu-common.h"
+#include "sbu-config.h"
+#include "sbu-dbus-generated.h"
 #include "sbu-device.h"
+#include "sbu-history.h"
+#include "sbu-line-exporter.h"
 #include "sbu-manager.h"
+#include "sbu-metrics.h"
+#include "sbu-stats.h"
+#include "sbu-stream-server.h"
+#include "sbu-subscription.h"
 
 typedef struct {
 	GCancellable *cancellable;
@@ -22,8 +31,16 @@ typedef struct {
 	guint name_owner_id;
 	guint timed_exit_id;
 	SbuManager *manager;
+	SbuConfig *config;
+	SbuStreamServer *stream_server; /* nullable */
+	SbuMetrics *metrics;		/* nullable */
+	SbuLineExporter *line_exporter; /* nullable */
 	GDBusConnection *connection;
 	GDBusNodeInfo *introspection;
+	GDBusObjectManagerServer *object_manager;
+	GHashTable *subscriptions; /* id : SbuSubscription */
+	GHashTable *watches;	   /* sender : watch id */
+	guint subscription_id;
 } SbuMain;
 
 static gboolean
@@ -36,23 +53,23 @@ sbu_main_sigint_cb(gpointer user_data)
 	return FALSE;
 }
 
-static GVariant *
-sbu_main_device_array_to_variant(GPtrArray *devices)
+static gboolean
+sbu_main_sighup_cb(gpointer user_data)
 {
-	GVariantBuilder builder;
-
-	g_variant_builder_init(&builder, G_VARIANT_TYPE("aa{sv}"));
-	for (guint i = 0; i < devices->len; i++) {
-		SbuDevice *device = g_ptr_array_index(devices, i);
-		GVariant *tmp = sbu_device_to_variant(SBU_DEVICE(device));
-		g_variant_builder_add_value(&builder, tmp);
-	}
-	return g_variant_new("(aa{sv})", &builder);
+	SbuMain *self = (SbuMain *)user_data;
+	g_autoptr(GError) error = NULL;
+	g_debug("handling SIGHUP");
+	if (!sbu_manager_reload(self->manager, &error))
+		g_warning("failed to reload config: %s", error->message);
+	return TRUE;
 }
 
 static void
 sbu_main_manager_changed_cb(SbuManager *manager, SbuMain *self)
 {
+	if (self->stream_server != NULL)
+		sbu_stream_server_push_snapshot(self->stream_server);
+
 	/* not yet connected */
 	if (self->connection == NULL)
 		return;
@@ -65,6 +82,344 @@ sbu_main_manager_changed_cb(SbuManager *manager, SbuMain *self)
 				      NULL);
 }
 
+static void
+sbu_main_manager_values_changed_cb(SbuManager *manager,
+				   guint64 seq,
+				   GVariant *changes,
+				   SbuMain *self)
+{
+	GHashTableIter iter;
+	SbuSubscription *subscription;
+
+	if (self->stream_server != NULL)
+		sbu_stream_server_push_changes(self->stream_server, seq, changes);
+	if (self->line_exporter != NULL)
+		sbu_line_exporter_push_changes(self->line_exporter, changes);
+
+	/* not yet connected */
+	if (self->connection == NULL)
+		return;
+	g_hash_table_iter_init(&iter, self->subscriptions);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&subscription))
+		sbu_subscription_add_changes(subscription, changes);
+	g_dbus_connection_emit_signal(self->connection,
+				      NULL,
+				      SBU_DBUS_PATH,
+				      SBU_DBUS_INTERFACE,
+				      "ValuesChanged",
+				      g_variant_new("(t@a(sssv))", seq, changes),
+				      NULL);
+}
+
+static GVariant *
+sbu_main_stream_snapshot_cb(gpointer user_data)
+{
+	SbuMain *self = (SbuMain *)user_data;
+	return sbu_manager_get_devices_variant(self->manager, NULL);
+}
+
+static void
+sbu_main_stream_history_ready_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	g_autoptr(GTask) task = G_TASK(user_data);
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) history = NULL;
+
+	history = sbu_manager_get_history_finish(SBU_MANAGER(source), res, &error);
+	if (history == NULL) {
+		g_task_return_error(task, g_steal_pointer(&error));
+		return;
+	}
+	g_task_return_pointer(task,
+			      g_variant_get_child_value(history, 0),
+			      (GDestroyNotify)g_variant_unref);
+}
+
+static void
+sbu_main_stream_history_cb(const gchar *device_id,
+			   const gchar *key,
+			   guint64 start,
+			   guint64 end,
+			   guint limit,
+			   const gchar *mode_str,
+			   GTask *task,
+			   gpointer user_data)
+{
+	SbuMain *self = (SbuMain *)user_data;
+	SbuHistoryMode mode = sbu_history_mode_from_string(mode_str);
+	g_autoptr(GError) error = NULL;
+	g_autoptr(SbuDevice) device = NULL;
+
+	if (mode == SBU_HISTORY_MODE_UNKNOWN) {
+		g_task_return_new_error(task,
+					G_IO_ERROR,
+					G_IO_ERROR_INVALID_ARGUMENT,
+					"no history mode %s",
+					mode_str);
+		return;
+	}
+	device = sbu_manager_get_device_by_id(self->manager, device_id, &error);
+	if (device == NULL) {
+		g_task_return_error(task, g_steal_pointer(&error));
+		return;
+	}
+
+	/* the database is queried in a thread */
+	sbu_manager_get_history_async(self->manager,
+				      device,
+				      key,
+				      start,
+				      end,
+				      limit,
+				      mode,
+				      g_task_get_cancellable(task),
+				      sbu_main_stream_history_ready_cb,
+				      g_object_ref(task));
+}
+
+static gboolean
+sbu_main_stream_setup(SbuMain *self, GError **error)
+{
+	g_autofree gchar *path = NULL;
+
+	/* optional, and off by default */
+	path = sbu_config_get_string(self->config, "StreamSocket", NULL);
+	if (path == NULL || path[0] == '\0')
+		return TRUE;
+	self->stream_server = sbu_stream_server_new();
+	sbu_stream_server_set_funcs(self->stream_server,
+				    sbu_main_stream_snapshot_cb,
+				    sbu_main_stream_history_cb,
+				    self);
+	if (!sbu_stream_server_start(self->stream_server, path, error))
+		return FALSE;
+	g_debug("streaming values on %s", path);
+	return TRUE;
+}
+
+static gboolean
+sbu_main_metrics_setup(SbuMain *self, GError **error)
+{
+	g_autofree gchar *address = NULL;
+
+	/* optional, and off by default */
+	address = sbu_config_get_string(self->config, "MetricsListen", NULL);
+	if (address == NULL || address[0] == '\0')
+		return TRUE;
+	self->metrics = sbu_metrics_new();
+	sbu_metrics_set_devices(self->metrics, sbu_manager_get_devices(self->manager));
+	if (!sbu_metrics_start(self->metrics, address, error))
+		return FALSE;
+	g_debug("serving metrics on http://%s/metrics", address);
+	return TRUE;
+}
+
+static gboolean
+sbu_main_line_exporter_setup(SbuMain *self, GError **error)
+{
+	gint batch_size;
+	gint flush_interval;
+	gint spool_max;
+	g_autofree gchar *spool = NULL;
+	g_autofree gchar *uri = NULL;
+
+	/* optional, and off by default */
+	uri = sbu_config_get_string(self->config, "LineProtocolUri", NULL);
+	if (uri == NULL || uri[0] == '\0')
+		return TRUE;
+	self->line_exporter = sbu_line_exporter_new();
+	batch_size = sbu_config_get_integer(self->config, "LineProtocolBatchSize", NULL);
+	if (batch_size > 0)
+		sbu_line_exporter_set_batch_size(self->line_exporter, batch_size);
+	flush_interval = sbu_config_get_integer(self->config, "LineProtocolFlushInterval", NULL);
+	if (flush_interval > 0)
+		sbu_line_exporter_set_flush_interval(self->line_exporter, flush_interval * 1000);
+	spool = sbu_config_get_string(self->config, "LineProtocolSpool", NULL);
+	spool_max = sbu_config_get_integer(self->config, "LineProtocolSpoolMax", NULL);
+	if (spool != NULL && spool[0] != '\0' && spool_max > 0) {
+		sbu_line_exporter_set_spool(self->line_exporter,
+					    spool,
+					    (gsize)spool_max * 1024 * 1024);
+	}
+	if (!sbu_line_exporter_start(self->line_exporter, uri, error))
+		return FALSE;
+	g_debug("pushing values to %s", uri);
+	return TRUE;
+}
+
+/* device IDs can contain anything, object paths cannot */
+static gchar *
+sbu_main_device_object_path(SbuDevice *device)
+{
+	g_autofree gchar *id = g_strdup(sbu_device_get_id(device));
+	for (guint i = 0; id[i] != '\0'; i++) {
+		if (!g_ascii_isalnum(id[i]))
+			id[i] = '_';
+	}
+	return g_strdup_printf("%s/devices/%s", SBU_DBUS_PATH, id);
+}
+
+static void
+sbu_main_export_node(SbuMain *self, const gchar *device_path, SbuNode *node)
+{
+	const gchar *props[] =
+	    {"power", "power-max", "voltage", "voltage-max", "current", "current-max", "frequency"};
+	g_autofree gchar *path = g_strdup_printf("%s/%s", device_path, sbu_node_get_id(node));
+	g_autoptr(SbuDbusNode) skeleton = sbu_dbus_node_skeleton_new();
+	g_autoptr(SbuDbusObjectSkeleton) object = sbu_dbus_object_skeleton_new(path);
+
+	sbu_dbus_node_set_id(skeleton, sbu_node_get_id(node));
+	sbu_dbus_node_set_kind(skeleton, sbu_node_kind_to_string(sbu_node_get_kind(node)));
+
+	/* the skeleton caches the value and only emits PropertiesChanged on change */
+	for (guint i = 0; i < G_N_ELEMENTS(props); i++)
+		g_object_bind_property(node, props[i], skeleton, props[i], G_BINDING_SYNC_CREATE);
+	sbu_dbus_object_skeleton_set_node(object, skeleton);
+	g_dbus_object_manager_server_export(self->object_manager, G_DBUS_OBJECT_SKELETON(object));
+}
+
+static void
+sbu_main_export_link(SbuMain *self, const gchar *device_path, SbuLink *link)
+{
+	g_autofree gchar *path = g_strdup_printf("%s/%s", device_path, sbu_link_get_id(link));
+	g_autoptr(SbuDbusLink) skeleton = sbu_dbus_link_skeleton_new();
+	g_autoptr(SbuDbusObjectSkeleton) object = sbu_dbus_object_skeleton_new(path);
+
+	sbu_dbus_link_set_id(skeleton, sbu_link_get_id(link));
+	sbu_dbus_link_set_src(skeleton, sbu_node_kind_to_string(sbu_link_get_src(link)));
+	sbu_dbus_link_set_dst(skeleton, sbu_node_kind_to_string(sbu_link_get_dst(link)));
+	g_object_bind_property(link, "active", skeleton, "active", G_BINDING_SYNC_CREATE);
+	sbu_dbus_object_skeleton_set_link(object, skeleton);
+	g_dbus_object_manager_server_export(self->object_manager, G_DBUS_OBJECT_SKELETON(object));
+}
+
+static void
+sbu_main_manager_device_added_cb(SbuManager *manager, SbuDevice *device, SbuMain *self)
+{
+	GPtrArray *array;
+	g_autofree gchar *path = sbu_main_device_object_path(device);
+	g_autoptr(SbuDbusDevice) skeleton = sbu_dbus_device_skeleton_new();
+	g_autoptr(SbuDbusObjectSkeleton) object = sbu_dbus_object_skeleton_new(path);
+
+	sbu_dbus_device_set_id(skeleton, sbu_device_get_id(device));
+	sbu_dbus_device_set_firmware_version(skeleton, sbu_device_get_firmware_version(device));
+	sbu_dbus_device_set_serial_number(skeleton, sbu_device_get_serial_number(device));
+	sbu_dbus_object_skeleton_set_device(object, skeleton);
+	g_dbus_object_manager_server_export(self->object_manager, G_DBUS_OBJECT_SKELETON(object));
+
+	array = sbu_device_get_nodes(device);
+	for (guint i = 0; i < array->len; i++)
+		sbu_main_export_node(self, path, g_ptr_array_index(array, i));
+	array = sbu_device_get_links(device);
+	for (guint i = 0; i < array->len; i++)
+		sbu_main_export_link(self, path, g_ptr_array_index(array, i));
+}
+
+static void
+sbu_main_manager_device_removed_cb(SbuManager *manager, SbuDevice *device, SbuMain *self)
+{
+	GPtrArray *array;
+	g_autofree gchar *path = sbu_main_device_object_path(device);
+
+	array = sbu_device_get_nodes(device);
+	for (guint i = 0; i < array->len; i++) {
+		SbuNode *node = g_ptr_array_index(array, i);
+		g_autofree gchar *path_node = g_strdup_printf("%s/%s", path, sbu_node_get_id(node));
+		g_dbus_object_manager_server_unexport(self->object_manager, path_node);
+	}
+	array = sbu_device_get_links(device);
+	for (guint i = 0; i < array->len; i++) {
+		SbuLink *link = g_ptr_array_index(array, i);
+		g_autofree gchar *path_link = g_strdup_printf("%s/%s", path, sbu_link_get_id(link));
+		g_dbus_object_manager_server_unexport(self->object_manager, path_link);
+	}
+	g_dbus_object_manager_server_unexport(self->object_manager, path);
+}
+
+/* only sent to the subscriber, so it needs no match rule */
+static void
+sbu_main_subscription_changes_cb(SbuSubscription *subscription, GVariant *changes, SbuMain *self)
+{
+	g_autoptr(GError) error = NULL;
+	if (!g_dbus_connection_emit_signal(self->connection,
+					   sbu_subscription_get_sender(subscription),
+					   SBU_DBUS_PATH,
+					   SBU_DBUS_INTERFACE,
+					   "SubscriptionChanged",
+					   g_variant_new("(u@a(sssv))",
+							 sbu_subscription_get_id(subscription),
+							 changes),
+					   &error))
+		g_warning("failed to notify %s: %s",
+			  sbu_subscription_get_sender(subscription),
+			  error->message);
+}
+
+static void
+sbu_main_sender_vanished_cb(GDBusConnection *connection, const gchar *name, gpointer user_data)
+{
+	SbuMain *self = (SbuMain *)user_data;
+	GHashTableIter iter;
+	SbuSubscription *subscription;
+
+	g_debug("%s left the bus, dropping subscriptions", name);
+	g_hash_table_iter_init(&iter, self->subscriptions);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&subscription)) {
+		if (g_strcmp0(sbu_subscription_get_sender(subscription), name) == 0)
+			g_hash_table_iter_remove(&iter);
+	}
+	g_bus_unwatch_name(GPOINTER_TO_UINT(g_hash_table_lookup(self->watches, name)));
+	g_hash_table_remove(self->watches, name);
+}
+
+static guint
+sbu_main_subscribe(SbuMain *self, const gchar *sender, gchar **keys, gdouble max_rate_hz)
+{
+	g_autoptr(SbuSubscription) subscription = NULL;
+
+	subscription = sbu_subscription_new(++self->subscription_id, sender, keys, max_rate_hz);
+	g_signal_connect(subscription,
+			 "changes",
+			 G_CALLBACK(sbu_main_subscription_changes_cb),
+			 self);
+	g_hash_table_insert(self->subscriptions,
+			    GUINT_TO_POINTER(self->subscription_id),
+			    g_steal_pointer(&subscription));
+
+	/* one watch per client, however many subscriptions it has */
+	if (!g_hash_table_contains(self->watches, sender)) {
+		guint watch_id = g_bus_watch_name_on_connection(self->connection,
+								sender,
+								G_BUS_NAME_WATCHER_FLAGS_NONE,
+								NULL,
+								sbu_main_sender_vanished_cb,
+								self,
+								NULL);
+		g_hash_table_insert(self->watches, g_strdup(sender), GUINT_TO_POINTER(watch_id));
+	}
+	g_debug("%s subscribed as %u", sender, self->subscription_id);
+	return self->subscription_id;
+}
+
+static gboolean
+sbu_main_unsubscribe(SbuMain *self, const gchar *sender, guint id, GError **error)
+{
+	SbuSubscription *subscription;
+
+	subscription = g_hash_table_lookup(self->subscriptions, GUINT_TO_POINTER(id));
+	if (subscription == NULL ||
+	    g_strcmp0(sbu_subscription_get_sender(subscription), sender) != 0) {
+		g_set_error(error,
+			    G_DBUS_ERROR,
+			    G_DBUS_ERROR_INVALID_ARGS,
+			    "no subscription %u",
+			    id);
+		return FALSE;
+	}
+	g_hash_table_remove(self->subscriptions, GUINT_TO_POINTER(id));
+	return TRUE;
+}
+
 static GDBusNodeInfo *
 sbu_main_load_introspection(const gchar *filename, GError **error)
 {
@@ -75,6 +430,11 @@ sbu_main_load_introspection(const gchar *filename, GError **error)
 	    "    <method name='GetDevices'>\n"
 	    "      <arg name='devices' type='aa{sv}' direction='out' />\n"
 	    "    </method>\n"
+	    "    <method name='GetDevicesIfChanged'>\n"
+	    "      <arg name='since_generation' type='t' direction='in' />\n"
+	    "      <arg name='generation' type='t' direction='out' />\n"
+	    "      <arg name='devices' type='aa{sv}' direction='out' />\n"
+	    "    </method>\n"
 	    "    <method name='GetHistory'>\n"
 	    "      <arg name='device_id' direction='in' type='s'/>\n"
 	    "      <arg name='key' direction='in' type='s'/>\n"
@@ -83,7 +443,50 @@ sbu_main_load_introspection(const gchar *filename, GError **error)
 	    "      <arg name='limit' direction='in' type='u'/>\n"
 	    "      <arg name='data' direction='out' type='a(td)'/>\n"
 	    "    </method>\n"
+	    "    <!-- limit=0 returns every raw value, otherwise exactly limit points:\n"
+	    "         'average' has the average of each bucket, 'minmax' has the lowest\n"
+	    "         and highest point of limit/2 buckets and the newest value if limit\n"
+	    "         is odd, empty buckets are interpolated, and 'lttb' has fewer\n"
+	    "         points only if there are fewer raw values -->\n"
+	    "    <method name='GetHistoryWithMode'>\n"
+	    "      <arg name='device_id' direction='in' type='s'/>\n"
+	    "      <arg name='key' direction='in' type='s'/>\n"
+	    "      <arg name='start' direction='in' type='t'/>\n"
+	    "      <arg name='end' direction='in' type='t'/>\n"
+	    "      <arg name='limit' direction='in' type='u'/>\n"
+	    "      <arg name='mode' direction='in' type='s'/>\n"
+	    "      <arg name='data' direction='out' type='a(td)'/>\n"
+	    "    </method>\n"
+	    "    <method name='GetHistoryFd'>\n"
+	    "      <arg name='device_id' direction='in' type='s'/>\n"
+	    "      <arg name='key' direction='in' type='s'/>\n"
+	    "      <arg name='start' direction='in' type='t'/>\n"
+	    "      <arg name='end' direction='in' type='t'/>\n"
+	    "      <arg name='limit' direction='in' type='u'/>\n"
+	    "      <arg name='mode' direction='in' type='s'/>\n"
+	    "      <arg name='fd' direction='out' type='h'/>\n"
+	    "      <arg name='count' direction='out' type='u'/>\n"
+	    "    </method>\n"
+	    "    <method name='GetStatistics'>\n"
+	    "      <arg name='statistics' direction='out' type='a{sv}'/>\n"
+	    "    </method>\n"
+	    "    <method name='Subscribe'>\n"
+	    "      <arg name='keys' direction='in' type='as'/>\n"
+	    "      <arg name='max_rate_hz' direction='in' type='d'/>\n"
+	    "      <arg name='id' direction='out' type='u'/>\n"
+	    "    </method>\n"
+	    "    <method name='Unsubscribe'>\n"
+	    "      <arg name='id' direction='in' type='u'/>\n"
+	    "    </method>\n"
 	    "    <signal name='Changed' />\n"
+	    "    <signal name='ValuesChanged'>\n"
+	    "      <arg name='seq' type='t'/>\n"
+	    "      <arg name='changes' type='a(sssv)'/>\n"
+	    "    </signal>\n"
+	    "    <signal name='SubscriptionChanged'>\n"
+	    "      <arg name='id' type='u'/>\n"
+	    "      <arg name='changes' type='a(sssv)'/>\n"
+	    "    </signal>\n"
 	    "  </interface>\n"
 	    "</node>\n";
 	/* build introspection from XML */
@@ -106,30 +509,144 @@ sbu_main_daemon_method_call(GDBusConnection *connection,
 
 	g_debug("Called %s()", method_name);
 	if (g_strcmp0(method_name, "GetDevices") == 0) {
-		val = sbu_main_device_array_to_variant(sbu_manager_get_devices(self->manager));
+		g_autoptr(GVariant) devices = sbu_manager_get_devices_variant(self->manager, NULL);
+		val = g_variant_new("(@aa{sv})", devices);
+		g_dbus_method_invocation_return_value(invocation, val);
+		return;
+	}
+	if (g_strcmp0(method_name, "GetDevicesIfChanged") == 0) {
+		guint64 generation = sbu_manager_get_generation(self->manager);
+		guint64 since = 0;
+		g_autoptr(GVariant) devices = NULL;
+
+		/* idle clients cost nothing more than this */
+		g_variant_get(parameters, "(t)", &since);
+		if (since == generation) {
+			val = g_variant_new("(t@aa{sv})",
+					    generation,
+					    g_variant_new_array(G_VARIANT_TYPE("a{sv}"), NULL, 0));
+			g_dbus_method_invocation_return_value(invocation, val);
+			return;
+		}
+		devices = sbu_manager_get_devices_variant(self->manager, &generation);
+		val = g_variant_new("(t@aa{sv})", generation, devices);
 		g_dbus_method_invocation_return_value(invocation, val);
 		return;
 	}
-	if (g_strcmp0(method_name, "GetHistory") == 0) {
+	if (g_strcmp0(method_name, "GetHistory") == 0 ||
+	    g_strcmp0(method_name, "GetHistoryWithMode") == 0 ||
+	    g_strcmp0(method_name, "GetHistoryFd") == 0) {
 		const gchar *device_id = NULL;
 		const gchar *key = NULL;
+		const gchar *mode_str = "average";
 		guint64 start = 0;
 		guint64 end = 0;
 		guint limit = 0;
+		gint64 ts_start = g_get_monotonic_time();
+		SbuHistoryMode mode;
 		g_autoptr(SbuDevice) device = NULL;
-
-		g_variant_get(parameters, "(&s&sttu)", &device_id, &key, &start, &end, &limit);
+		g_autoptr(GVariant) history = NULL;
+
+		if (g_strcmp0(method_name, "GetHistory") != 0) {
+			g_variant_get(parameters,
+				      "(&s&sttu&s)",
+				      &device_id,
+				      &key,
+				      &start,
+				      &end,
+				      &limit,
+				      &mode_str);
+		} else {
+			g_variant_get(parameters,
+				      "(&s&sttu)",
+				      &device_id,
+				      &key,
+				      &start,
+				      &end,
+				      &limit);
+		}
+		mode = sbu_history_mode_from_string(mode_str);
+		if (mode == SBU_HISTORY_MODE_UNKNOWN) {
+			g_set_error(&error,
+				    G_DBUS_ERROR,
+				    G_DBUS_ERROR_INVALID_ARGS,
+				    "no history mode %s",
+				    mode_str);
+			g_dbus_method_invocation_return_gerror(invocation, error);
+			return;
+		}
 		device = sbu_manager_get_device_by_id(self->manager, device_id, &error);
 		if (device == NULL) {
 			g_dbus_method_invocation_return_gerror(invocation, error);
 			return;
 		}
-		val =
-		    sbu_manager_get_history(self->manager, device, key, start, end, limit, &error);
-		if (val == NULL) {
+		history = sbu_manager_get_history(self->manager,
+						  device,
+						  key,
+						  start,
+						  end,
+						  limit,
+						  mode,
+						  &error);
+		if (history == NULL) {
+			g_dbus_method_invocation_return_gerror(invocation, error);
+			return;
+		}
+
+		/* large results are sent out-of-band rather than through the bus */
+		if (g_strcmp0(method_name, "GetHistoryFd") == 0) {
+			gint fd;
+			g_autoptr(GUnixFDList) fd_list = NULL;
+			g_autoptr(GVariant) array = g_variant_get_child_value(history, 0);
+
+			fd = sbu_history_to_fd(history, &error);
+			if (fd < 0) {
+				g_dbus_method_invocation_return_gerror(invocation, error);
+				return;
+			}
+			fd_list = g_unix_fd_list_new_from_array(&fd, 1);
+			g_dbus_method_invocation_return_value_with_unix_fd_list(
+			    invocation,
+			    g_variant_new("(hu)", 0, (guint)g_variant_n_children(array)),
+			    fd_list);
+			sbu_stats_record("dbus:GetHistoryFd", ts_start);
+			return;
+		}
+		g_dbus_method_invocation_return_value(invocation, history);
+		sbu_stats_record("dbus:GetHistory", ts_start);
+		return;
+	}
+	if (g_strcmp0(method_name, "Subscribe") == 0) {
+		gdouble max_rate_hz = 0.f;
+		guint id;
+		g_autofree const gchar **keys = NULL;
+
+		g_variant_get(parameters, "(^a&sd)", &keys, &max_rate_hz);
+		if (max_rate_hz < 0.f) {
+			g_set_error(&error,
+				    G_DBUS_ERROR,
+				    G_DBUS_ERROR_INVALID_ARGS,
+				    "invalid rate %.2f",
+				    max_rate_hz);
 			g_dbus_method_invocation_return_gerror(invocation, error);
 			return;
 		}
+		id = sbu_main_subscribe(self, sender, (gchar **)keys, max_rate_hz);
+		g_dbus_method_invocation_return_value(invocation, g_variant_new("(u)", id));
+		return;
+	}
+	if (g_strcmp0(method_name, "Unsubscribe") == 0) {
+		guint id = 0;
+		g_variant_get(parameters, "(u)", &id);
+		if (!sbu_main_unsubscribe(self, sender, id, &error)) {
+			g_dbus_method_invocation_return_gerror(invocation, error);
+			return;
+		}
+		g_dbus_method_invocation_return_value(invocation, NULL);
+		return;
+	}
+	if (g_strcmp0(method_name, "GetStatistics") == 0) {
+		val = g_variant_new("(@a{sv})", sbu_manager_get_statistics(self->manager));
 		g_dbus_method_invocation_return_value(invocation, val);
 		return;
 	}
@@ -172,6 +689,7 @@ sbu_main_bus_acquired_cb(GDBusConnection *connection, const gchar *name, gpointe
 							      NULL};
 
 	self->connection = g_object_ref(connection);
+	g_dbus_object_manager_server_set_connection(self->object_manager, self->connection);
 	registration_id = g_dbus_connection_register_object(self->connection,
 							    SBU_DBUS_PATH,
 							    self->introspection->interfaces[0],
@@ -200,14 +718,30 @@ sbu_main_name_acquired_cb(GDBusConnection *connection, const gchar *name, gpoint
 static void
 sbu_main_self_free(SbuMain *self)
 {
+	GHashTableIter iter;
+	gpointer watch_id;
+
 	if (self->name_owner_id != 0)
 		g_bus_unown_name(self->name_owner_id);
+	g_hash_table_iter_init(&iter, self->watches);
+	while (g_hash_table_iter_next(&iter, NULL, &watch_id))
+		g_bus_unwatch_name(GPOINTER_TO_UINT(watch_id));
+	g_hash_table_unref(self->watches);
+	g_hash_table_unref(self->subscriptions);
+	g_object_unref(self->object_manager);
 	if (self->connection != NULL)
 		g_object_unref(self->connection);
 	if (self->introspection != NULL)
 		g_dbus_node_info_unref(self->introspection);
 	g_main_loop_unref(self->loop);
 	g_object_unref(self->cancellable);
+	if (self->stream_server != NULL)
+		g_object_unref(self->stream_server);
+	if (self->metrics != NULL)
+		g_object_unref(self->metrics);
+	if (self->line_exporter != NULL)
+		g_object_unref(self->line_exporter);
+	g_object_unref(self->config);
 	g_object_unref(self->manager);
 	g_free(self);
 }
@@ -221,6 +755,13 @@ sbu_main_self_new(void)
 	self->loop = g_main_loop_new(NULL, FALSE);
 	self->cancellable = g_cancellable_new();
 	self->manager = sbu_manager_new();
+	self->config = sbu_config_new();
+	self->object_manager = g_dbus_object_manager_server_new(SBU_DBUS_PATH);
+	self->subscriptions = g_hash_table_new_full(g_direct_hash,
+						    g_direct_equal,
+						    NULL,
+						    (GDestroyNotify)g_object_unref);
+	self->watches = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 	return self;
 }
 
@@ -274,6 +815,9 @@ main(int argc, char *argv[])
 	/* do stuff on ctrl+c */
 	g_unix_signal_add_full(G_PRIORITY_DEFAULT, SIGINT, sbu_main_sigint_cb, self, NULL);
 
+	/* re-read the config file on systemctl reload */
+	g_unix_signal_add_full(G_PRIORITY_DEFAULT, SIGHUP, sbu_main_sighup_cb, self, NULL);
+
 	/* TRANSLATORS: program name */
 	g_set_application_name(_("SBU Daemon"));
 	g_option_context_add_main_entries(context, options, NULL);
@@ -287,6 +831,16 @@ main(int argc, char *argv[])
 	if (verbose)
 		g_setenv("G_MESSAGES_DEBUG", "all", TRUE);
 
+	/* devices can be added during setup, and are exported once we have a connection */
+	g_signal_connect(self->manager,
+			 "device-added",
+			 G_CALLBACK(sbu_main_manager_device_added_cb),
+			 self);
+	g_signal_connect(self->manager,
+			 "device-removed",
+			 G_CALLBACK(sbu_main_manager_device_removed_cb),
+			 self);
+
 	/* perform failable manager setup */
 	if (!sbu_manager_setup(self->manager, &error)) {
 		g_printerr("%s: %s\n", _("Failed to start manager"), error->message);
@@ -296,6 +850,24 @@ main(int argc, char *argv[])
 			 "changed",
 			 G_CALLBACK(sbu_main_manager_changed_cb),
 			 self);
+	g_signal_connect(self->manager,
+			 "values-changed",
+			 G_CALLBACK(sbu_main_manager_values_changed_cb),
+			 self);
+
+	/* local clients that want every value without the bus overhead */
+	if (!sbu_main_stream_setup(self, &error)) {
+		g_printerr("%s: %s\n", _("Failed to start stream socket"), error->message);
+		return EXIT_FAILURE;
+	}
+	if (!sbu_main_metrics_setup(self, &error)) {
+		g_printerr("%s: %s\n", _("Failed to start metrics exporter"), error->message);
+		return EXIT_FAILURE;
+	}
+	if (!sbu_main_line_exporter_setup(self, &error)) {
+		g_printerr("%s: %s\n", _("Failed to start line protocol exporter"), error->message);
+		return EXIT_FAILURE;
+	}
 
 	/* valgrinding */
 	if (timed_exit)
@@ -13,25 +13,112 @@
 #include "sbu-config.h"
 #include "sbu-database.h"
 #include "sbu-device.h"
-#include "sbu-dummy-plugin.h"
+#include "sbu-history-cache.h"
+#include "sbu-history.h"
 #include "sbu-manager.h"
-#include "sbu-msx-plugin.h"
+#include "sbu-plugin.h"
+#include "sbu-stats.h"
+
+/* number of quiet polls before the interval is increased */
+#define SBU_MANAGER_POLL_STABLE_CYCLES 3
 
 struct _SbuManager {
 	GObject parent_instance;
 	guint poll_id;
 	guint poll_interval;
+	guint poll_interval_min;
+	guint poll_interval_max;
+	guint poll_stable_cnt;
+	guint poll_budget; /* ms, or 0 for the poll interval */
+	gboolean poll_adaptive;
+	gboolean poll_activity;
+	gdouble poll_threshold; /* relative */
+	gboolean poll_running;
+	GHashTable *last_values; /* id:propname : gdouble */
+	GHashTable *pending_values; /* device:id:propname : GVariant (sssv) */
+	guint pending_id;
+	guint64 pending_seq;
+	guint64 generation; /* of devices no longer in the array */
+	GVariant *devices_cache; /* aa{sv} */
+	guint64 devices_generation;
 	GPtrArray *plugins;
+	GHashTable *plugins_setup; /* SbuPlugin, still being set up */
 	GPtrArray *devices;
+	GPtrArray *devices_disabled; /* owned by disabled plugins */
+	SbuConfig *config;
 	SbuDatabase *database;
+	SbuHistoryCache *history_cache;
+	guint64 history_generation; /* of values saved to the database */
+	SbuStatsHistogram *stats_changed;
+	SbuStatsHistogram *stats_values_changed;
+	SbuStatsHistogram *stats_poll;
+	SbuStatsCounter *stats_poll_overruns;
 };
 
 G_DEFINE_TYPE(SbuManager, sbu_manager, G_TYPE_OBJECT)
 
-enum { SIGNAL_CHANGED, SIGNAL_LAST };
+enum {
+	SIGNAL_CHANGED,
+	SIGNAL_VALUES_CHANGED,
+	SIGNAL_DEVICE_ADDED,
+	SIGNAL_DEVICE_REMOVED,
+	SIGNAL_LAST
+};
 
 static guint signals[SIGNAL_LAST] = {0};
 
+/**
+ * sbu_manager_get_generation:
+ * @self: a #SbuManager
+ *
+ * Gets a counter that increases whenever any device is added, removed or
+ * changed. This is the sum of the device generations, so removing a device
+ * adds its generation to the base value to keep the counter increasing.
+ *
+ * Returns: integer
+ **/
+guint64
+sbu_manager_get_generation(SbuManager *self)
+{
+	guint64 generation = self->generation;
+	for (guint i = 0; i < self->devices->len; i++)
+		generation += sbu_device_get_generation(g_ptr_array_index(self->devices, i));
+	return generation;
+}
+
+/**
+ * sbu_manager_get_devices_variant:
+ * @self: a #SbuManager
+ * @generation: (out) (optional): the generation of the result
+ *
+ * Serializes all the devices, which is only done again when the generation
+ * changes.
+ *
+ * Returns: (transfer full): a #GVariant of type `aa{sv}`
+ **/
+GVariant *
+sbu_manager_get_devices_variant(SbuManager *self, guint64 *generation)
+{
+	GVariantBuilder builder;
+	guint64 generation_now = sbu_manager_get_generation(self);
+
+	if (generation != NULL)
+		*generation = generation_now;
+	if (self->devices_cache != NULL && self->devices_generation == generation_now)
+		return g_variant_ref(self->devices_cache);
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("aa{sv}"));
+	for (guint i = 0; i < self->devices->len; i++) {
+		SbuDevice *device = g_ptr_array_index(self->devices, i);
+		g_autoptr(GVariant) tmp = sbu_device_to_variant(device);
+		g_variant_builder_add_value(&builder, tmp);
+	}
+	if (self->devices_cache != NULL)
+		g_variant_unref(self->devices_cache);
+	self->devices_cache = g_variant_ref_sink(g_variant_builder_end(&builder));
+	self->devices_generation = generation_now;
+	return g_variant_ref(self->devices_cache);
+}
+
 GPtrArray *
 sbu_manager_get_devices(SbuManager *self)
 {
@@ -50,34 +137,240 @@ sbu_manager_get_device_by_id(SbuManager *self, const gchar *device_id, GError **
 	return NULL;
 }
 
+static void
+sbu_manager_poll_start(SbuManager *self);
+
+static void
+sbu_manager_emit_changed(SbuManager *self)
+{
+	gint64 ts_start = g_get_monotonic_time();
+	g_signal_emit(self, signals[SIGNAL_CHANGED], 0);
+	sbu_stats_histogram_record(self->stats_changed, ts_start);
+}
+
 static gboolean
-sbu_manager_poll_cb(gpointer user_data)
+sbu_manager_flush_values_cb(gpointer user_data)
 {
 	SbuManager *self = SBU_MANAGER(user_data);
+	GHashTableIter iter;
+	GVariant *value;
+	GVariantBuilder builder;
+	gint64 ts_start = g_get_monotonic_time();
+	g_autoptr(GVariant) changes = NULL;
 
-	/* rescan stuff that can change at runtime */
-	for (guint i = 0; i < self->devices->len; i++) {
-		SbuDevice *device = g_ptr_array_index(self->devices, i);
-		g_autoptr(GError) error = NULL;
-		if (!sbu_device_refresh(device, &error)) {
-			g_warning("failed to refresh %s: %s",
-				  sbu_device_get_id(device),
-				  error->message);
-		}
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(sssv)"));
+	g_hash_table_iter_init(&iter, self->pending_values);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&value))
+		g_variant_builder_add_value(&builder, value);
+	g_hash_table_remove_all(self->pending_values);
+	changes = g_variant_ref_sink(g_variant_builder_end(&builder));
+	g_signal_emit(self, signals[SIGNAL_VALUES_CHANGED], 0, ++self->pending_seq, changes);
+	sbu_stats_histogram_record(self->stats_values_changed, ts_start);
+	self->pending_id = 0;
+	return FALSE;
+}
+
+/* only the latest value of each property is sent, once the current poll
+ * cycle or plugin callback has returned to the main loop */
+static void
+sbu_manager_queue_value(SbuManager *self,
+			SbuDevice *device,
+			const gchar *id,
+			const gchar *propname,
+			GVariant *value)
+{
+	g_autofree gchar *key = NULL;
+
+	key = g_strdup_printf("%s:%s:%s", sbu_device_get_id(device), id, propname);
+	g_hash_table_replace(
+	    self->pending_values,
+	    g_steal_pointer(&key),
+	    g_variant_ref_sink(
+		g_variant_new("(sssv)", sbu_device_get_id(device), id, propname, value)));
+	if (self->pending_id == 0)
+		self->pending_id = g_idle_add(sbu_manager_flush_values_cb, self);
+}
+
+/* returns TRUE if the poll interval was changed */
+static gboolean
+sbu_manager_poll_adapt(SbuManager *self)
+{
+	guint poll_interval = self->poll_interval;
+
+	if (!self->poll_adaptive)
+		return FALSE;
+
+	/* something is happening, so sample faster */
+	if (self->poll_activity) {
+		self->poll_stable_cnt = 0;
+		poll_interval = MAX(poll_interval / 2, self->poll_interval_min);
+
+		/* back off slowly once things have settled down */
+	} else if (++self->poll_stable_cnt >= SBU_MANAGER_POLL_STABLE_CYCLES) {
+		self->poll_stable_cnt = 0;
+		poll_interval = MIN(poll_interval * 2, self->poll_interval_max);
+	}
+	self->poll_activity = FALSE;
+	if (poll_interval == self->poll_interval)
+		return FALSE;
+	g_message("changing poll interval from %us to %us", self->poll_interval, poll_interval);
+	self->poll_interval = poll_interval;
+	return TRUE;
+}
+
+/* a link toggling or a value moving by more than the threshold counts as activity */
+static void
+sbu_manager_poll_check_activity(SbuManager *self,
+				const gchar *id,
+				const gchar *propname,
+				GVariant *value_new)
+{
+	gdouble value;
+	gdouble *value_old;
+	g_autofree gchar *key = NULL;
+
+	if (!self->poll_adaptive)
+		return;
+	if (!g_variant_is_of_type(value_new, G_VARIANT_TYPE_DOUBLE)) {
+		self->poll_activity = TRUE;
+		return;
+	}
+	value = g_variant_get_double(value_new);
+	key = g_strdup_printf("%s:%s", id, propname);
+	value_old = g_hash_table_lookup(self->last_values, key);
+	if (value_old == NULL) {
+		value_old = g_new0(gdouble, 1);
+		*value_old = value;
+		g_hash_table_insert(self->last_values, g_steal_pointer(&key), value_old);
+		return;
+	}
+	if (fabs(value - *value_old) > fabs(*value_old) * self->poll_threshold) {
+		g_debug("activity on %s: %.2f -> %.2f", key, *value_old, value);
+		self->poll_activity = TRUE;
 	}
+	*value_old = value;
+}
+
+typedef struct {
+	SbuManager *self;
+	GCancellable *cancellable;
+	GSource *deadline_source;
+	gint64 ts_start;
+	guint budget; /* ms */
+	guint pending;
+} SbuManagerPollHelper;
+
+static void
+sbu_manager_poll_helper_free(SbuManagerPollHelper *helper)
+{
+	g_source_destroy(helper->deadline_source);
+	g_source_unref(helper->deadline_source);
+	g_object_unref(helper->cancellable);
+	g_object_unref(helper->self);
+	g_free(helper);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuManagerPollHelper, sbu_manager_poll_helper_free)
+
+static gboolean
+sbu_manager_poll_deadline_cb(gpointer user_data)
+{
+	SbuManagerPollHelper *helper = (SbuManagerPollHelper *)user_data;
+	g_cancellable_cancel(helper->cancellable);
+	return G_SOURCE_REMOVE;
+}
+
+/* called when the last device of the cycle has completed */
+static void
+sbu_manager_poll_done(SbuManagerPollHelper *helper_tmp)
+{
+	g_autoptr(SbuManagerPollHelper) helper = helper_tmp;
+	SbuManager *self = helper->self;
+
+	/* plugins are refreshed once the devices have all responded */
+	self->poll_running = FALSE;
 	for (guint i = 0; i < self->plugins->len; i++) {
 		SbuPlugin *plugin = g_ptr_array_index(self->plugins, i);
 		g_autoptr(GError) error = NULL;
+		if (g_cancellable_is_cancelled(helper->cancellable))
+			break;
 		if (!sbu_plugin_get_enabled(plugin))
 			continue;
-		if (!sbu_plugin_refresh(plugin, NULL, &error)) {
+		if (g_hash_table_contains(self->plugins_setup, plugin))
+			continue;
+		if (!sbu_plugin_refresh(plugin, helper->cancellable, &error)) {
 			g_warning("failed to refresh %s: %s",
 				  sbu_plugin_get_name(plugin),
 				  error->message);
 		}
 	}
+	sbu_stats_histogram_record(self->stats_poll, helper->ts_start);
+	if (g_cancellable_is_cancelled(helper->cancellable)) {
+		g_warning("poll cycle overran budget of %ums, keeping partial results",
+			  helper->budget);
+		sbu_stats_counter_inc(self->stats_poll_overruns);
+	}
 
-	g_signal_emit(self, signals[SIGNAL_CHANGED], 0);
+	/* anything refreshed before the deadline has already been queued */
+
+	/* poll faster or slower next time */
+	if (sbu_manager_poll_adapt(self))
+		sbu_manager_poll_start(self);
+}
+
+static void
+sbu_manager_poll_device_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuDevice *device = SBU_DEVICE(source);
+	SbuManagerPollHelper *helper = (SbuManagerPollHelper *)user_data;
+	g_autoptr(GError) error = NULL;
+
+	if (!sbu_device_refresh_finish(device, res, &error)) {
+		g_warning("failed to refresh %s: %s",
+			  sbu_device_get_id(device),
+			  error->message);
+	}
+	if (--helper->pending == 0)
+		sbu_manager_poll_done(helper);
+}
+
+/* every device is refreshed at the same time from the main loop, and the
+ * deadline cancels whatever is still in flight when the budget runs out */
+static gboolean
+sbu_manager_poll_cb(gpointer user_data)
+{
+	SbuManager *self = SBU_MANAGER(user_data);
+	SbuManagerPollHelper *helper;
+
+	/* the last cycle is still waiting for a device */
+	if (self->poll_running) {
+		g_debug("poll cycle still in progress, skipping");
+		return TRUE;
+	}
+
+	/* cut the cycle off at the deadline */
+	helper = g_new0(SbuManagerPollHelper, 1);
+	helper->self = g_object_ref(self);
+	helper->cancellable = g_cancellable_new();
+	helper->ts_start = g_get_monotonic_time();
+	helper->budget = self->poll_budget > 0 ? self->poll_budget : self->poll_interval * 1000;
+	helper->deadline_source = g_timeout_source_new(helper->budget);
+	g_source_set_callback(helper->deadline_source, sbu_manager_poll_deadline_cb, helper, NULL);
+	g_source_attach(helper->deadline_source, NULL);
+	self->poll_running = TRUE;
+
+	/* rescan stuff that can change at runtime */
+	helper->pending = 1;
+	for (guint i = 0; i < self->devices->len; i++) {
+		SbuDevice *device = g_ptr_array_index(self->devices, i);
+		helper->pending++;
+		sbu_device_refresh_async(device,
+					 helper->cancellable,
+					 sbu_manager_poll_device_cb,
+					 helper);
+	}
+	if (--helper->pending == 0)
+		sbu_manager_poll_done(helper);
 	return TRUE;
 }
 
@@ -98,6 +391,25 @@ sbu_manager_poll_stop(SbuManager *self)
 	self->poll_id = 0;
 }
 
+/* all the items are saved in one transaction, and use the same timestamp for
+ * the database and the cache */
+static void
+sbu_manager_save_items(SbuManager *self, SbuDevice *device, GPtrArray *items)
+{
+	g_autoptr(GError) error = NULL;
+
+	if (items->len == 0)
+		return;
+	self->history_generation++;
+	if (!sbu_database_save_values(self->database, sbu_device_get_id(device), items, &error))
+		g_warning("%s", error->message);
+	for (guint i = 0; i < items->len; i++) {
+		sbu_history_cache_add_item(self->history_cache,
+					   sbu_device_get_id(device),
+					   g_ptr_array_index(items, i));
+	}
+}
+
 static void
 sbu_manager_plugins_update_metadata_cb(SbuPlugin *plugin,
 				       SbuDevice *device,
@@ -105,57 +417,217 @@ sbu_manager_plugins_update_metadata_cb(SbuPlugin *plugin,
 				       gint value,
 				       SbuManager *self)
 {
-	g_autoptr(GError) error = NULL;
-	if (!sbu_database_save_value(self->database, sbu_device_get_id(device), key, value, &error))
-		g_warning("%s", error->message);
+	SbuDatabaseItem *item = g_new0(SbuDatabaseItem, 1);
+	g_autoptr(GPtrArray) items =
+	    g_ptr_array_new_with_free_func((GDestroyNotify)sbu_database_item_free);
+
+	item->key = g_strdup(key);
+	item->ts = g_get_real_time() / G_USEC_PER_SEC;
+	item->val = value;
+	g_ptr_array_add(items, item);
+	sbu_manager_save_items(self, device, items);
+}
+
+static void
+sbu_manager_plugins_update_metadata_values_cb(SbuPlugin *plugin,
+					      SbuDevice *device,
+					      GVariant *values,
+					      SbuManager *self)
+{
+	GVariantIter iter;
+	const gchar *key;
+	gint value;
+	gint64 ts = g_get_real_time() / G_USEC_PER_SEC;
+	g_autoptr(GPtrArray) items =
+	    g_ptr_array_new_with_free_func((GDestroyNotify)sbu_database_item_free);
+
+	g_variant_iter_init(&iter, values);
+	while (g_variant_iter_next(&iter, "{&si}", &key, &value)) {
+		SbuDatabaseItem *item = g_new0(SbuDatabaseItem, 1);
+		item->key = g_strdup(key);
+		item->ts = ts;
+		item->val = value;
+		g_ptr_array_add(items, item);
+	}
+	sbu_manager_save_items(self, device, items);
 }
 
 static void
 sbu_manager_plugins_remove_device_cb(SbuPlugin *plugin, SbuDevice *device, SbuManager *self)
 {
+	g_autoptr(SbuDevice) device_tmp = g_object_ref(device);
+
 	g_debug("removing device %s", sbu_device_get_id(device));
-	g_ptr_array_remove(self->devices, device);
+	g_signal_handlers_disconnect_by_data(device, self);
+	g_ptr_array_remove(self->devices_disabled, device);
+	if (g_ptr_array_remove(self->devices, device)) {
+		self->generation += sbu_device_get_generation(device) + 1;
+		g_signal_emit(self, signals[SIGNAL_DEVICE_REMOVED], 0, device);
+		sbu_manager_emit_changed(self);
+	}
 	if (self->devices->len == 0)
 		sbu_manager_poll_stop(self);
 }
 
+/* gets the value as stored in the database, or %FALSE if it is not saved */
+static gboolean
+sbu_manager_history_value(const gchar *propname, GVariant *value, gint *val)
+{
+	if (g_strcmp0(propname, "active") == 0 &&
+	    g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)) {
+		*val = g_variant_get_boolean(value);
+		return TRUE;
+	}
+	if ((g_strcmp0(propname, "power") == 0 || g_strcmp0(propname, "current") == 0 ||
+	     g_strcmp0(propname, "voltage") == 0 || g_strcmp0(propname, "frequency") == 0) &&
+	    g_variant_is_of_type(value, G_VARIANT_TYPE_DOUBLE)) {
+		*val = g_variant_get_double(value) * 1000.f;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+typedef struct {
+	SbuDatabase *database;
+	gchar *device_id;
+	gchar *key;
+	guint64 ts_start;
+	guint64 ts_end;
+	guint64 ts_now;
+	guint limit;
+	SbuHistoryMode mode;
+	guint64 history_generation;
+	SbuHistoryBuckets *buckets; /* nullable, live windows only */
+} SbuManagerHistoryHelper;
+
 static void
-sbu_manager_save_history(SbuManager *self,
-			 SbuDevice *device,
-			 const gchar *id,
-			 const gchar *propname,
-			 GObject *obj)
-{
-	gint value = -1;
-
-	/* boolean */
-	if (g_strcmp0(propname, "active") == 0) {
-		gboolean tmp;
-		g_object_get(obj, propname, &tmp, NULL);
-		value = (guint)tmp;
-
-		/* double */
-	} else if (g_strcmp0(propname, "power") == 0 || g_strcmp0(propname, "current") == 0 ||
-		   g_strcmp0(propname, "voltage") == 0 || g_strcmp0(propname, "frequency") == 0) {
-		gdouble tmp;
-		g_object_get(obj, propname, &tmp, NULL);
-		value = tmp * 1000.f;
-	}
-
-	/* save to database */
-	if (value != -1) {
-		g_autofree gchar *key = NULL;
-		g_autoptr(GError) error = NULL;
-		key = g_strdup_printf("%s:%s", id, propname);
-		if (!sbu_database_save_value(self->database,
-					     sbu_device_get_id(device),
-					     key,
-					     value,
-					     &error))
-			g_warning("%s", error->message);
+sbu_manager_history_helper_free(SbuManagerHistoryHelper *helper)
+{
+	if (helper->buckets != NULL)
+		sbu_history_buckets_free(helper->buckets);
+	g_object_unref(helper->database);
+	g_free(helper->device_id);
+	g_free(helper->key);
+	g_free(helper);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuManagerHistoryHelper, sbu_manager_history_helper_free)
+
+static SbuManagerHistoryHelper *
+sbu_manager_history_helper_new(SbuManager *self,
+			       SbuDevice *device,
+			       const gchar *key,
+			       guint64 ts_start,
+			       guint64 ts_end,
+			       guint limit,
+			       SbuHistoryMode mode)
+{
+	SbuManagerHistoryHelper *helper = g_new0(SbuManagerHistoryHelper, 1);
+	helper->database = g_object_ref(self->database);
+	helper->device_id = g_strdup(sbu_device_get_id(device));
+	helper->key = g_strdup(key);
+	helper->ts_start = ts_start;
+	helper->ts_end = ts_end;
+	helper->ts_now = g_get_real_time() / G_USEC_PER_SEC;
+	helper->limit = limit;
+	helper->mode = mode;
+	helper->history_generation = self->history_generation;
+
+	/* the raw data is never cached, everything else uses aligned buckets */
+	if (limit > 0)
+		sbu_history_cache_align(&helper->ts_start, &helper->ts_end, limit);
+	return helper;
+}
+
+static GVariant *
+sbu_manager_history_lookup(SbuManager *self, SbuManagerHistoryHelper *helper)
+{
+	GVariant *value;
+
+	if (helper->limit == 0)
+		return NULL;
+	value = sbu_history_cache_lookup(self->history_cache,
+					 helper->device_id,
+					 helper->key,
+					 helper->ts_start,
+					 helper->ts_end,
+					 helper->limit,
+					 helper->mode);
+	if (value != NULL)
+		g_debug("using cached GetHistory %s", helper->key);
+	return value;
+}
+
+/* only uses the database, so this is safe to call from a worker thread */
+static GVariant *
+sbu_manager_history_query(SbuManagerHistoryHelper *helper, GError **error)
+{
+	g_autoptr(GArray) items = NULL;
+	g_autoptr(GPtrArray) results = NULL;
+
+	/* get all results between the two times */
+	g_debug("handling GetHistory %s for %" G_GUINT64_FORMAT "->%" G_GUINT64_FORMAT " using %s",
+		helper->key,
+		helper->ts_start,
+		helper->ts_end,
+		sbu_history_mode_to_string(helper->mode));
+	results = sbu_database_query(helper->database,
+				     helper->device_id,
+				     helper->key,
+				     helper->ts_start,
+				     MIN(helper->ts_end, helper->ts_now),
+				     error);
+	if (results == NULL)
+		return NULL;
+
+	/* keep the bucket state for a live window so new values can be added */
+	if (helper->ts_end > helper->ts_now &&
+	    sbu_history_can_append(helper->limit, helper->mode)) {
+		helper->buckets = sbu_history_buckets_new(helper->ts_start,
+							  helper->ts_end,
+							  helper->limit,
+							  helper->mode);
+		for (guint i = 0; i < results->len; i++) {
+			SbuDatabaseItem *item = g_ptr_array_index(results, i);
+			sbu_history_buckets_add(helper->buckets, item->ts, item->val);
+		}
+		items = sbu_history_buckets_to_array(helper->buckets);
+	} else {
+		items = sbu_history_downsample(results,
+					       helper->ts_start,
+					       helper->ts_end,
+					       helper->limit,
+					       helper->mode);
 	}
+	return g_variant_ref_sink(sbu_history_to_variant(items));
 }
 
+static void
+sbu_manager_history_insert(SbuManager *self, SbuManagerHistoryHelper *helper, GVariant *value)
+{
+	if (helper->limit == 0)
+		return;
+
+	/* a value was saved while querying, so the result may already be stale */
+	if (helper->history_generation != self->history_generation)
+		return;
+
+	sbu_history_cache_insert(self->history_cache,
+				 helper->device_id,
+				 helper->key,
+				 helper->ts_start,
+				 helper->ts_end,
+				 helper->limit,
+				 helper->mode,
+				 value,
+				 g_steal_pointer(&helper->buckets));
+}
+
+/**
+ * sbu_manager_get_history:
+ *
+ * Returns: (transfer full): a #GVariant of type `(a(td))`
+ **/
 GVariant *
 sbu_manager_get_history(SbuManager *self,
 			SbuDevice *device,
@@ -163,189 +635,379 @@ sbu_manager_get_history(SbuManager *self,
 			guint64 arg_start,
 			guint64 arg_end,
 			guint limit,
+			SbuHistoryMode mode,
 			GError **error)
 {
-	GVariantBuilder builder;
-	g_autoptr(GPtrArray) results = NULL;
-	g_autoptr(GPtrArray) results2 = NULL;
+	GVariant *value;
+	g_autoptr(SbuManagerHistoryHelper) helper = NULL;
 
-	/* get all results between the two times */
-	g_debug("handling GetHistory %s for %" G_GUINT64_FORMAT "->%" G_GUINT64_FORMAT,
-		arg_key,
-		arg_start,
-		arg_end);
-	results = sbu_database_query(self->database,
-				     sbu_device_get_id(device),
-				     arg_key,
-				     arg_start,
-				     arg_end,
-				     error);
-	if (results == NULL)
+	helper = sbu_manager_history_helper_new(self,
+						device,
+						arg_key,
+						arg_start,
+						arg_end,
+						limit,
+						mode);
+	value = sbu_manager_history_lookup(self, helper);
+	if (value != NULL)
+		return value;
+	value = sbu_manager_history_query(helper, error);
+	if (value == NULL)
 		return NULL;
+	sbu_manager_history_insert(self, helper, value);
+	return value;
+}
 
-	/* no filter */
-	if (limit == 0) {
-		results2 = g_ptr_array_ref(results);
-
-		/* just one value */
-	} else if (limit == 1) {
-		SbuDatabaseItem *item;
-		gdouble ave_acc = 0;
-		gint ts = 0;
-		results2 = g_ptr_array_new_with_free_func(g_free);
-		for (guint i = 0; i < results->len; i++) {
-			item = g_ptr_array_index(results, i);
-			ave_acc += item->val;
-			ts = item->ts;
-		}
-		item = g_new0(SbuDatabaseItem, 1);
-		item->ts = ts;
-		item->val = ave_acc / results->len;
-		g_ptr_array_add(results2, item);
+static void
+sbu_manager_get_history_thread_cb(GTask *task,
+				  gpointer source_object,
+				  gpointer task_data,
+				  GCancellable *cancellable)
+{
+	SbuManagerHistoryHelper *helper = (SbuManagerHistoryHelper *)task_data;
+	GVariant *value;
+	GError *error = NULL;
 
-		/* bin into averaged groups */
-	} else {
-		gint ts_last_added = 0;
-		guint ave_cnt = 0;
-		gdouble ave_acc = 0;
-		gint64 interval = (arg_end - arg_start) / (limit - 1);
+	value = sbu_manager_history_query(helper, &error);
+	if (value == NULL) {
+		g_task_return_error(task, error);
+		return;
+	}
+	g_task_return_pointer(task, value, (GDestroyNotify)g_variant_unref);
+}
 
-		results2 = g_ptr_array_new_with_free_func(g_free);
-		for (guint i = 0; i < results->len; i++) {
-			SbuDatabaseItem *item = g_ptr_array_index(results, i);
+/* back in the main context, so the cache can be used */
+static void
+sbu_manager_get_history_ready_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuManager *self = SBU_MANAGER(source);
+	g_autoptr(GTask) task = G_TASK(user_data);
+	GVariant *value;
+	GError *error = NULL;
 
-			if (ts_last_added == 0)
-				ts_last_added = item->ts;
-
-			/* first and last points */
-			if (i == 0 || i == results->len - 1) {
-				SbuDatabaseItem *item2 = g_new0(SbuDatabaseItem, 1);
-				item2->ts = item->ts;
-				item2->val = item->val;
-				g_ptr_array_add(results2, item2);
-				continue;
-			}
-
-			/* add to moving average */
-			ave_acc += item->val;
-			ave_cnt += 1;
-
-			/* more than the interval */
-			if (item->ts - ts_last_added > interval) {
-				SbuDatabaseItem *item2 = g_new0(SbuDatabaseItem, 1);
-				item2->ts = item->ts;
-				item2->val = ave_acc / (gdouble)ave_cnt;
-				g_ptr_array_add(results2, item2);
-				ts_last_added = item->ts;
-
-				/* reset moving average */
-				ave_cnt = 0;
-				ave_acc = 0.f;
-			}
-		}
+	value = g_task_propagate_pointer(G_TASK(res), &error);
+	if (value == NULL) {
+		g_task_return_error(task, error);
+		return;
 	}
+	sbu_manager_history_insert(self, g_task_get_task_data(G_TASK(res)), value);
+	g_task_return_pointer(task, value, (GDestroyNotify)g_variant_unref);
+}
+
+/**
+ * sbu_manager_get_history_async:
+ * @self: a #SbuManager
+ * @device: a #SbuDevice
+ * @arg_key: a history key, e.g. `node_battery:voltage`
+ * @arg_start: start of the range
+ * @arg_end: end of the range
+ * @limit: number of buckets, or 0 for the raw values
+ * @mode: a #SbuHistoryMode
+ * @cancellable: a #GCancellable, or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Gets the history without blocking the main loop. Cached results complete
+ * in the next main loop iteration, otherwise the database is queried in a
+ * worker thread.
+ **/
+void
+sbu_manager_get_history_async(SbuManager *self,
+			      SbuDevice *device,
+			      const gchar *arg_key,
+			      guint64 arg_start,
+			      guint64 arg_end,
+			      guint limit,
+			      SbuHistoryMode mode,
+			      GCancellable *cancellable,
+			      GAsyncReadyCallback callback,
+			      gpointer user_data)
+{
+	GVariant *value;
+	SbuManagerHistoryHelper *helper;
+	g_autoptr(GTask) task = NULL;
+	g_autoptr(GTask) task_thread = NULL;
+
+	g_return_if_fail(SBU_IS_MANAGER(self));
+	g_return_if_fail(SBU_IS_DEVICE(device));
+	g_return_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable));
 
-	/* return as a GVariant */
-	g_variant_builder_init(&builder, G_VARIANT_TYPE("(a(td))"));
-	g_variant_builder_open(&builder, G_VARIANT_TYPE("a(td)"));
-	for (guint i = 0; i < results2->len; i++) {
-		SbuDatabaseItem *item = g_ptr_array_index(results2, i);
-		gdouble val = item->val;
-		if (fabs(val) > 1.1f)
-			val /= 1000.f;
-		g_variant_builder_add(&builder, "(td)", item->ts, val);
+	task = g_task_new(self, cancellable, callback, user_data);
+	g_task_set_source_tag(task, sbu_manager_get_history_async);
+	helper = sbu_manager_history_helper_new(self,
+						device,
+						arg_key,
+						arg_start,
+						arg_end,
+						limit,
+						mode);
+	value = sbu_manager_history_lookup(self, helper);
+	if (value != NULL) {
+		sbu_manager_history_helper_free(helper);
+		g_task_return_pointer(task, value, (GDestroyNotify)g_variant_unref);
+		return;
 	}
-	g_variant_builder_close(&builder);
-	return g_variant_builder_end(&builder);
+	task_thread = g_task_new(self,
+				 cancellable,
+				 sbu_manager_get_history_ready_cb,
+				 g_steal_pointer(&task));
+	g_task_set_task_data(task_thread,
+			     helper,
+			     (GDestroyNotify)sbu_manager_history_helper_free);
+	g_task_run_in_thread(task_thread, sbu_manager_get_history_thread_cb);
 }
 
-static void
-sbu_manager_node_notify_cb(SbuNode *n, GParamSpec *pspec, gpointer user_data)
+/**
+ * sbu_manager_get_history_finish:
+ * @self: a #SbuManager
+ * @res: a #GAsyncResult
+ * @error: a #GError, or %NULL
+ *
+ * Gets the result of sbu_manager_get_history_async().
+ *
+ * Returns: (transfer full): a #GVariant of type `(a(td))`, or %NULL on error
+ **/
+GVariant *
+sbu_manager_get_history_finish(SbuManager *self, GAsyncResult *res, GError **error)
 {
-	SbuManager *self = SBU_MANAGER(user_data);
-	g_debug("changed %s:%s", sbu_node_get_id(n), g_param_spec_get_name(pspec));
-	sbu_manager_save_history(self,
-				 g_ptr_array_index(self->devices, 0),
-				 sbu_node_get_id(n),
-				 g_param_spec_get_name(pspec),
-				 G_OBJECT(n));
-	g_signal_emit(self, signals[SIGNAL_CHANGED], 0);
+	g_return_val_if_fail(g_task_is_valid(res, self), NULL);
+	return g_task_propagate_pointer(G_TASK(res), error);
 }
 
+GVariant *
+sbu_manager_get_statistics(SbuManager *self)
+{
+	GVariantBuilder builder;
+	GVariantIter iter;
+	const gchar *key;
+	GVariant *value;
+	g_autoptr(GVariant) stats = g_variant_ref_sink(sbu_stats_to_variant());
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&builder,
+			      "{sv}",
+			      "history-cache",
+			      sbu_history_cache_to_variant(self->history_cache));
+	g_variant_iter_init(&iter, stats);
+	while (g_variant_iter_next(&iter, "{&sv}", &key, &value)) {
+		g_variant_builder_add(&builder, "{sv}", key, value);
+		g_variant_unref(value);
+	}
+	return g_variant_builder_end(&builder);
+}
+
+/* each device update is saved to the database in one batch */
 static void
-sbu_manager_link_notify_cb(SbuLink *l, GParamSpec *pspec, gpointer user_data)
+sbu_manager_device_values_changed_cb(SbuDevice *device, GVariant *changes, SbuManager *self)
 {
-	SbuManager *self = SBU_MANAGER(user_data);
-	g_debug("changed %s:%s", sbu_link_get_id(l), g_param_spec_get_name(pspec));
-	sbu_manager_save_history(self,
-				 g_ptr_array_index(self->devices, 0),
-				 sbu_link_get_id(l),
-				 g_param_spec_get_name(pspec),
-				 G_OBJECT(l));
-	g_signal_emit(self, signals[SIGNAL_CHANGED], 0);
+	GVariantIter iter;
+	GVariant *value;
+	const gchar *id;
+	const gchar *propname;
+	gint64 ts = g_get_real_time() / G_USEC_PER_SEC;
+	g_autoptr(GPtrArray) items =
+	    g_ptr_array_new_with_free_func((GDestroyNotify)sbu_database_item_free);
+
+	g_variant_iter_init(&iter, changes);
+	while (g_variant_iter_next(&iter, "(&s&sv)", &id, &propname, &value)) {
+		gint val = 0;
+		g_debug("changed %s:%s", id, propname);
+		sbu_manager_poll_check_activity(self, id, propname, value);
+		sbu_manager_queue_value(self, device, id, propname, value);
+		if (sbu_manager_history_value(propname, value, &val)) {
+			SbuDatabaseItem *item = g_new0(SbuDatabaseItem, 1);
+			item->key = g_strdup_printf("%s:%s", id, propname);
+			item->ts = ts;
+			item->val = val;
+			g_ptr_array_add(items, item);
+		}
+		g_variant_unref(value);
+	}
+	sbu_manager_save_items(self, device, items);
 }
 
 static void
 sbu_manager_plugins_add_device_cb(SbuPlugin *plugin, SbuDevice *device, SbuManager *self)
 {
-	GPtrArray *array;
-
 	/* just use the array position as the ID */
 	if (sbu_device_get_id(device) == NULL) {
 		g_autofree gchar *id = g_strdup_printf("%u", self->devices->len);
 		sbu_device_set_id(device, id);
 	}
 	g_debug("adding device %s", sbu_device_get_id(device));
+	g_object_set_data(G_OBJECT(device), "sbu-plugin", plugin);
 	g_ptr_array_add(self->devices, g_object_ref(device));
 
 	/* watch all links and nodes */
-	array = sbu_device_get_links(device);
-	for (guint i = 0; i < array->len; i++) {
-		SbuLink *link = g_ptr_array_index(array, i);
-		g_signal_connect(link, "notify", G_CALLBACK(sbu_manager_link_notify_cb), self);
-	}
-	array = sbu_device_get_nodes(device);
-	for (guint i = 0; i < array->len; i++) {
-		SbuNode *node = g_ptr_array_index(array, i);
-		g_signal_connect(node, "notify", G_CALLBACK(sbu_manager_node_notify_cb), self);
-	}
+	g_signal_connect(device,
+			 "values-changed",
+			 G_CALLBACK(sbu_manager_device_values_changed_cb),
+			 self);
+	g_signal_emit(self, signals[SIGNAL_DEVICE_ADDED], 0, device);
+	sbu_manager_emit_changed(self);
 
 	/* set up initial poll */
 	sbu_manager_poll_start(self);
 }
 
-gboolean
-sbu_manager_setup(SbuManager *self, GError **error)
+static SbuPlugin *
+sbu_manager_get_plugin_by_name(SbuManager *self, const gchar *name)
 {
-	g_autofree gchar *location = NULL;
-	g_autoptr(SbuConfig) config = sbu_config_new();
+	for (guint i = 0; i < self->plugins->len; i++) {
+		SbuPlugin *plugin = g_ptr_array_index(self->plugins, i);
+		if (g_strcmp0(sbu_plugin_get_name(plugin), name) == 0)
+			return plugin;
+	}
+	return NULL;
+}
 
-	/* use the system-wide database */
-	location = sbu_config_get_string(config, "DatabaseLocation", error);
-	if (location == NULL)
-		return FALSE;
-	sbu_database_set_location(self->database, location);
-	if (!sbu_database_open(self->database, error)) {
-		g_prefix_error(error, "failed to open database %s: ", location);
-		return FALSE;
+/* devices are hidden rather than closed, so re-enabling is instant */
+static void
+sbu_manager_set_plugin_enabled(SbuManager *self, SbuPlugin *plugin, gboolean enabled)
+{
+	GPtrArray *src = enabled ? self->devices_disabled : self->devices;
+	g_autoptr(GPtrArray) devices = g_ptr_array_new_with_free_func(g_object_unref);
+
+	g_debug("%s plugin %s", enabled ? "enabling" : "disabling", sbu_plugin_get_name(plugin));
+	sbu_plugin_set_enabled(plugin, enabled);
+	for (guint i = 0; i < src->len; i++) {
+		SbuDevice *device = g_ptr_array_index(src, i);
+		if (g_object_get_data(G_OBJECT(device), "sbu-plugin") == plugin)
+			g_ptr_array_add(devices, g_object_ref(device));
+	}
+	for (guint i = 0; i < devices->len; i++) {
+		SbuDevice *device = g_ptr_array_index(devices, i);
+		if (enabled) {
+			g_ptr_array_remove(self->devices_disabled, device);
+			sbu_manager_plugins_add_device_cb(plugin, device, self);
+		} else {
+			sbu_manager_plugins_remove_device_cb(plugin, device, self);
+			g_ptr_array_add(self->devices_disabled, g_object_ref(device));
+		}
 	}
+}
 
-	/* set the poll interval */
-	self->poll_interval = sbu_config_get_integer(config, "DevicePollInterval", error);
-	if (self->poll_interval == 0)
+typedef struct {
+	SbuManager *self;
+	GTimer *timer;
+} SbuManagerSetupHelper;
+
+static void
+sbu_manager_setup_helper_free(SbuManagerSetupHelper *helper)
+{
+	g_object_unref(helper->self);
+	g_timer_destroy(helper->timer);
+	g_free(helper);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(SbuManagerSetupHelper, sbu_manager_setup_helper_free)
+
+/* any devices the plugin found have been added by now */
+static void
+sbu_manager_setup_plugin_ready_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuPlugin *plugin = SBU_PLUGIN(source);
+	g_autoptr(SbuManagerSetupHelper) helper = (SbuManagerSetupHelper *)user_data;
+	SbuManager *self = helper->self;
+	g_autoptr(GError) error = NULL;
+
+	g_hash_table_remove(self->plugins_setup, plugin);
+	if (!sbu_plugin_setup_finish(plugin, res, &error)) {
+		g_warning("disabling %s as failed to set up: %s",
+			  sbu_plugin_get_name(plugin),
+			  error->message);
+		sbu_manager_set_plugin_enabled(self, plugin, FALSE);
+		return;
+	}
+	g_debug("set up %s in %.0fms",
+		sbu_plugin_get_name(plugin),
+		g_timer_elapsed(helper->timer, NULL) * 1000.f);
+}
+
+/* probing hardware can be slow, so do all the plugins at the same time
+ * without blocking the main loop -- each is refreshed once it has finished */
+static void
+sbu_manager_setup_plugins(SbuManager *self, GPtrArray *plugins)
+{
+	for (guint i = 0; i < plugins->len; i++) {
+		SbuPlugin *plugin = g_ptr_array_index(plugins, i);
+		SbuManagerSetupHelper *helper = g_new0(SbuManagerSetupHelper, 1);
+
+		helper->self = g_object_ref(self);
+		helper->timer = g_timer_new();
+		g_hash_table_add(self->plugins_setup, plugin);
+		sbu_plugin_setup_async(plugin, NULL, sbu_manager_setup_plugin_ready_cb, helper);
+	}
+}
+
+/* loads and sets up any newly enabled plugins, and enables or disables the
+ * ones that are already loaded -- plugins are never unloaded */
+static gboolean
+sbu_manager_load_plugins(SbuManager *self, GError **error)
+{
+	const gchar *fn;
+	const gchar *plugin_dir = g_getenv("SBU_PLUGINDIR");
+	gboolean enable_dummy;
+	g_autoptr(GDir) dir = NULL;
+	g_autoptr(GPtrArray) plugins_new = g_ptr_array_new();
+	g_auto(GStrv) disabled = NULL;
+
+	/* allow running the daemon uninstalled */
+	if (plugin_dir == NULL)
+		plugin_dir = PLUGINDIR;
+	dir = g_dir_open(plugin_dir, 0, error);
+	if (dir == NULL) {
+		g_prefix_error(error, "failed to open plugin directory: ");
 		return FALSE;
+	}
 
-	/* enable test device */
-	if (sbu_config_get_boolean(config, "EnableDummyDevice", NULL))
-		g_setenv("SBU_DUMMY_ENABLE", "", TRUE);
-	for (guint i = 0; i < self->plugins->len; i++) {
-		SbuPlugin *plugin = g_ptr_array_index(self->plugins, i);
-		if (!sbu_plugin_get_enabled(plugin))
+	/* decide what to load before any plugin code is mapped */
+	disabled = sbu_config_get_string_list(self->config, "DisabledPlugins", NULL);
+	enable_dummy = sbu_config_get_boolean(self->config, "EnableDummyDevice", NULL);
+	while ((fn = g_dir_read_name(dir)) != NULL) {
+		gboolean enabled = TRUE;
+		g_autofree gchar *filename = NULL;
+		g_autofree gchar *name = NULL;
+		g_autoptr(GError) error_local = NULL;
+		SbuPlugin *plugin;
+
+		name = sbu_plugin_name_from_filename(fn);
+		if (name == NULL)
 			continue;
+		if (disabled != NULL && g_strv_contains((const gchar *const *)disabled, name)) {
+			g_debug("not using %s as disabled in config", name);
+			enabled = FALSE;
+		}
+		if (g_strcmp0(name, "dummy") == 0 && !enable_dummy) {
+			g_debug("not using %s as not testing", name);
+			enabled = FALSE;
+		}
+
+		/* already loaded */
+		plugin = sbu_manager_get_plugin_by_name(self, name);
+		if (plugin != NULL) {
+			if (sbu_plugin_get_enabled(plugin) != enabled)
+				sbu_manager_set_plugin_enabled(self, plugin, enabled);
+			continue;
+		}
+		if (!enabled)
+			continue;
+
+		filename = g_build_filename(plugin_dir, fn, NULL);
+		plugin = sbu_plugin_create(filename, &error_local);
+		if (plugin == NULL) {
+			g_warning("%s", error_local->message);
+			continue;
+		}
+		g_debug("loaded plugin %s", sbu_plugin_get_name(plugin));
 		g_signal_connect(plugin,
 				 "update-metadata",
 				 G_CALLBACK(sbu_manager_plugins_update_metadata_cb),
 				 self);
+		g_signal_connect(plugin,
+				 "update-metadata-values",
+				 G_CALLBACK(sbu_manager_plugins_update_metadata_values_cb),
+				 self);
 		g_signal_connect(plugin,
 				 "add-device",
 				 G_CALLBACK(sbu_manager_plugins_add_device_cb),
@@ -354,22 +1016,238 @@ sbu_manager_setup(SbuManager *self, GError **error)
 				 "remove-device",
 				 G_CALLBACK(sbu_manager_plugins_remove_device_cb),
 				 self);
-		if (!sbu_plugin_setup(plugin, NULL, error))
+		g_ptr_array_add(self->plugins, plugin);
+		g_ptr_array_add(plugins_new, plugin);
+	}
+	sbu_manager_setup_plugins(self, plugins_new);
+	return TRUE;
+}
+
+static gboolean
+sbu_manager_load_database(SbuManager *self, GError **error)
+{
+	g_autofree gchar *location = NULL;
+	g_autoptr(SbuDatabase) database = NULL;
+
+	/* use the system-wide database */
+	location = sbu_config_get_string(self->config, "DatabaseLocation", error);
+	if (location == NULL)
+		return FALSE;
+	if (self->database != NULL &&
+	    g_strcmp0(sbu_database_get_location(self->database), location) == 0)
+		return TRUE;
+
+	/* only switch once the new database is usable */
+	database = sbu_database_new();
+	sbu_database_set_location(database, location);
+	if (!sbu_database_open(database, error)) {
+		g_prefix_error(error, "failed to open database %s: ", location);
+		return FALSE;
+	}
+	g_set_object(&self->database, database);
+	sbu_history_cache_clear(self->history_cache);
+	self->history_generation++;
+	return TRUE;
+}
+
+/* a missing key and a value that is not larger than zero are both errors */
+static gboolean
+sbu_manager_get_poll_setting(SbuManager *self, const gchar *key, guint *value, GError **error)
+{
+	gint tmp;
+	g_autoptr(GError) error_local = NULL;
+
+	tmp = sbu_config_get_integer(self->config, key, &error_local);
+	if (error_local != NULL) {
+		g_propagate_error(error, g_steal_pointer(&error_local));
+		return FALSE;
+	}
+	if (tmp <= 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "%s has to be larger than zero, got %i",
+			    key,
+			    tmp);
+		return FALSE;
+	}
+	*value = (guint)tmp;
+	return TRUE;
+}
+
+/* nothing is changed unless all of the settings are valid */
+static gboolean
+sbu_manager_load_poll_settings(SbuManager *self, GError **error)
+{
+	gboolean poll_adaptive;
+	gint poll_budget;
+	guint poll_interval = 0;
+	guint poll_interval_max = self->poll_interval_max;
+	guint poll_interval_min = self->poll_interval_min;
+	guint threshold = 0;
+
+	/* set the poll interval */
+	if (!sbu_manager_get_poll_setting(self, "DevicePollInterval", &poll_interval, error))
+		return FALSE;
+
+	/* optional, defaults to the poll interval */
+	poll_budget = sbu_config_get_integer(self->config, "DevicePollBudget", NULL);
+	if (poll_budget < 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "DevicePollBudget cannot be negative, got %i",
+			    poll_budget);
+		return FALSE;
+	}
+
+	/* optionally vary the poll interval depending on activity */
+	poll_adaptive = sbu_config_get_boolean(self->config, "AdaptivePolling", NULL);
+	if (poll_adaptive) {
+		if (!sbu_manager_get_poll_setting(self,
+						  "DevicePollIntervalMin",
+						  &poll_interval_min,
+						  error))
+			return FALSE;
+		if (!sbu_manager_get_poll_setting(self,
+						  "DevicePollIntervalMax",
+						  &poll_interval_max,
+						  error))
+			return FALSE;
+		if (poll_interval_min > poll_interval_max) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_DATA,
+				    "DevicePollIntervalMin %u is larger than DevicePollIntervalMax %u",
+				    poll_interval_min,
+				    poll_interval_max);
 			return FALSE;
+		}
+		if (!sbu_manager_get_poll_setting(self,
+						  "AdaptivePollingThreshold",
+						  &threshold,
+						  error))
+			return FALSE;
+		poll_interval = CLAMP(poll_interval, poll_interval_min, poll_interval_max);
+	}
+
+	/* everything is valid, so apply */
+	self->poll_budget = (guint)poll_budget;
+	self->poll_adaptive = poll_adaptive;
+	self->poll_interval_min = poll_interval_min;
+	self->poll_interval_max = poll_interval_max;
+	if (poll_adaptive)
+		self->poll_threshold = (gdouble)threshold / 100.f;
+
+	/* reschedule if already polling */
+	if (poll_interval != self->poll_interval) {
+		g_debug("poll interval now %us", poll_interval);
+		self->poll_interval = poll_interval;
+		if (self->poll_id != 0)
+			sbu_manager_poll_start(self);
 	}
+	return TRUE;
+}
+
+static void
+sbu_manager_load_history_cache_settings(SbuManager *self)
+{
+	gint history_cache_entries;
+	gint history_cache_size;
+	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GError) error_size = NULL;
+
+	/* optional, zero disables the cache */
+	history_cache_entries =
+	    sbu_config_get_integer(self->config, "HistoryCacheEntries", &error_local);
+	if (error_local == NULL && history_cache_entries >= 0)
+		sbu_history_cache_set_max_entries(self->history_cache, history_cache_entries);
+
+	/* optional, in KiB */
+	history_cache_size = sbu_config_get_integer(self->config, "HistoryCacheSize", &error_size);
+	if (error_size == NULL && history_cache_size >= 0) {
+		sbu_history_cache_set_max_bytes(self->history_cache,
+						(gsize)history_cache_size * 1024);
+	}
+}
+
+gboolean
+sbu_manager_setup(SbuManager *self, GError **error)
+{
+	if (!sbu_manager_load_database(self, error))
+		return FALSE;
+	if (!sbu_manager_load_poll_settings(self, error))
+		return FALSE;
+	sbu_manager_load_history_cache_settings(self);
+
+	/* only load the plugins we need */
+	if (!sbu_manager_load_plugins(self, error))
+		return FALSE;
 
 	/* success */
 	return TRUE;
 }
 
+/**
+ * sbu_manager_get_poll_interval:
+ * @self: a #SbuManager
+ *
+ * Gets the current poll interval, which may have been changed by adaptive
+ * polling.
+ *
+ * Returns: interval in seconds
+ **/
+guint
+sbu_manager_get_poll_interval(SbuManager *self)
+{
+	g_return_val_if_fail(SBU_IS_MANAGER(self), 0);
+	return self->poll_interval;
+}
+
+/**
+ * sbu_manager_reload:
+ * @self: a #SbuManager
+ * @error: a #GError or %NULL
+ *
+ * Re-reads the config file and applies any changes to the poll scheduler,
+ * the database and the plugins. Devices that stay enabled are not reopened.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_manager_reload(SbuManager *self, GError **error)
+{
+	g_return_val_if_fail(SBU_IS_MANAGER(self), FALSE);
+
+	if (!sbu_config_reload(self->config, error))
+		return FALSE;
+	if (!sbu_manager_load_database(self, error))
+		return FALSE;
+	if (!sbu_manager_load_poll_settings(self, error))
+		return FALSE;
+	sbu_manager_load_history_cache_settings(self);
+	return sbu_manager_load_plugins(self, error);
+}
+
 static void
 sbu_manager_finalize(GObject *object)
 {
 	SbuManager *self = SBU_MANAGER(object);
 
 	sbu_manager_poll_stop(self);
+	if (self->pending_id != 0)
+		g_source_remove(self->pending_id);
 
-	g_object_unref(self->database);
+	if (self->database != NULL)
+		g_object_unref(self->database);
+	g_object_unref(self->config);
+	g_object_unref(self->history_cache);
+	if (self->devices_cache != NULL)
+		g_variant_unref(self->devices_cache);
+	g_ptr_array_unref(self->devices_disabled);
+	g_hash_table_unref(self->last_values);
+	g_hash_table_unref(self->pending_values);
+	g_hash_table_unref(self->plugins_setup);
 	g_ptr_array_unref(self->plugins);
 	g_ptr_array_unref(self->devices);
 	G_OBJECT_CLASS(sbu_manager_parent_class)->finalize(object);
@@ -378,12 +1256,21 @@ sbu_manager_finalize(GObject *object)
 static void
 sbu_manager_init(SbuManager *self)
 {
-	self->database = sbu_database_new();
+	self->config = sbu_config_new();
+	self->stats_changed = sbu_stats_histogram_get("signal:changed");
+	self->stats_values_changed = sbu_stats_histogram_get("signal:values-changed");
+	self->stats_poll = sbu_stats_histogram_get("poll:cycle");
+	self->stats_poll_overruns = sbu_stats_counter_get("poll:overruns");
+	self->devices_disabled = g_ptr_array_new_with_free_func((GDestroyNotify)g_object_unref);
+	self->history_cache = sbu_history_cache_new();
+	self->last_values = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	self->pending_values = g_hash_table_new_full(g_str_hash,
+						     g_str_equal,
+						     g_free,
+						     (GDestroyNotify)g_variant_unref);
 	self->devices = g_ptr_array_new_with_free_func((GDestroyNotify)g_object_unref);
 	self->plugins = g_ptr_array_new_with_free_func((GDestroyNotify)g_object_unref);
-
-	g_ptr_array_add(self->plugins, g_object_new(SBU_TYPE_DUMMY_PLUGIN, NULL));
-	g_ptr_array_add(self->plugins, g_object_new(SBU_TYPE_MSX_PLUGIN, NULL));
+	self->plugins_setup = g_hash_table_new(g_direct_hash, g_direct_equal);
 }
 
 static void
@@ -401,6 +1288,37 @@ sbu_manager_class_init(SbuManagerClass *klass_manager)
 					       g_cclosure_marshal_VOID__VOID,
 					       G_TYPE_NONE,
 					       0);
+	signals[SIGNAL_VALUES_CHANGED] = g_signal_new("values-changed",
+						      G_TYPE_FROM_CLASS(object_class),
+						      G_SIGNAL_RUN_LAST,
+						      0,
+						      NULL,
+						      NULL,
+						      NULL,
+						      G_TYPE_NONE,
+						      2,
+						      G_TYPE_UINT64,
+						      G_TYPE_VARIANT);
+	signals[SIGNAL_DEVICE_ADDED] = g_signal_new("device-added",
+						    G_TYPE_FROM_CLASS(object_class),
+						    G_SIGNAL_RUN_LAST,
+						    0,
+						    NULL,
+						    NULL,
+						    g_cclosure_marshal_VOID__OBJECT,
+						    G_TYPE_NONE,
+						    1,
+						    SBU_TYPE_DEVICE);
+	signals[SIGNAL_DEVICE_REMOVED] = g_signal_new("device-removed",
+						      G_TYPE_FROM_CLASS(object_class),
+						      G_SIGNAL_RUN_LAST,
+						      0,
+						      NULL,
+						      NULL,
+						      g_cclosure_marshal_VOID__OBJECT,
+						      G_TYPE_NONE,
+						      1,
+						      SBU_TYPE_DEVICE);
 }
 
 SbuManager *
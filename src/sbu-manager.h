@@ -9,6 +9,8 @@
 
 #include <glib-object.h>
 
+#include "sbu-device.h"
+
 #define SBU_TYPE_MANAGER sbu_manager_get_type()
 G_DECLARE_FINAL_TYPE(SbuManager, sbu_manager, SBU, MANAGER, GObject)
 
@@ -16,6 +18,14 @@ SbuManager *
 sbu_manager_new(void);
 gboolean
 sbu_manager_setup(SbuManager *self, GError **error);
+gboolean
+sbu_manager_reload(SbuManager *self, GError **error);
+guint64
+sbu_manager_get_generation(SbuManager *self);
+guint
+sbu_manager_get_poll_interval(SbuManager *self);
+GVariant *
+sbu_manager_get_devices_variant(SbuManager *self, guint64 *generation);
 GPtrArray *
 sbu_manager_get_devices(SbuManager *self);
 SbuDevice *
@@ -27,4 +37,20 @@ sbu_manager_get_history(SbuManager *self,
 			guint64 arg_start,
 			guint64 arg_end,
 			guint limit,
+			SbuHistoryMode mode,
 			GError **error);
+void
+sbu_manager_get_history_async(SbuManager *self,
+			      SbuDevice *device,
+			      const gchar *arg_key,
+			      guint64 arg_start,
+			      guint64 arg_end,
+			      guint limit,
+			      SbuHistoryMode mode,
+			      GCancellable *cancellable,
+			      GAsyncReadyCallback callback,
+			      gpointer user_data);
+GVariant *
+sbu_manager_get_history_finish(SbuManager *self, GAsyncResult *res, GError **error);
+GVariant *
+sbu_manager_get_statistics(SbuManager *self);
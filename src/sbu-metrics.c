@@ -0,0 +1,476 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "sbu-device.h"
+#include "sbu-metrics.h"
+#include "sbu-stats.h"
+
+/* scrapers send a tiny request, so anything bigger is not one */
+#define SBU_METRICS_REQUEST_MAX 4096
+#define SBU_METRICS_TIMEOUT	5 /* s */
+
+struct _SbuMetrics {
+	GObject parent_instance;
+	GSocketService *service;
+	guint16 port;
+	GPtrArray *devices;	  /* of SbuDevice, nullable */
+	GString *devices_str;	  /* pre-rendered */
+	GPtrArray *devices_done;  /* of SbuDevice, as rendered in devices_str */
+	GArray *generations_done; /* of guint64 */
+};
+
+G_DEFINE_TYPE(SbuMetrics, sbu_metrics, G_TYPE_OBJECT)
+
+typedef struct {
+	SbuMetrics *self;
+	GSocketConnection *connection;
+	guint8 buf[SBU_METRICS_REQUEST_MAX];
+	gsize buf_len;
+	GBytes *response;
+} SbuMetricsRequest;
+
+static const struct {
+	SbuDeviceProperty key;
+	const gchar *name;
+	const gchar *unit;
+	const gchar *help;
+} sbu_metrics_node_families[] = {
+    {SBU_DEVICE_PROPERTY_POWER, "sbu_node_power_watts", "watts", "Power"},
+    {SBU_DEVICE_PROPERTY_POWER_MAX, "sbu_node_power_max_watts", "watts", "Maximum power"},
+    {SBU_DEVICE_PROPERTY_VOLTAGE, "sbu_node_voltage_volts", "volts", "Voltage"},
+    {SBU_DEVICE_PROPERTY_VOLTAGE_MAX, "sbu_node_voltage_max_volts", "volts", "Maximum voltage"},
+    {SBU_DEVICE_PROPERTY_CURRENT, "sbu_node_current_amperes", "amperes", "Current"},
+    {SBU_DEVICE_PROPERTY_CURRENT_MAX,
+     "sbu_node_current_max_amperes",
+     "amperes",
+     "Maximum current"},
+    {SBU_DEVICE_PROPERTY_FREQUENCY, "sbu_node_frequency_hertz", "hertz", "Frequency"},
+};
+
+static void
+sbu_metrics_request_free(SbuMetricsRequest *req)
+{
+	g_io_stream_close(G_IO_STREAM(req->connection), NULL, NULL);
+	g_object_unref(req->connection);
+	g_object_unref(req->self);
+	if (req->response != NULL)
+		g_bytes_unref(req->response);
+	g_free(req);
+}
+
+/* only re-render when a device was added, removed or has changed */
+static gboolean
+sbu_metrics_devices_changed(SbuMetrics *self)
+{
+	if (self->devices == NULL)
+		return self->devices_done->len > 0;
+	if (self->devices->len != self->devices_done->len)
+		return TRUE;
+	for (guint i = 0; i < self->devices->len; i++) {
+		SbuDevice *device = g_ptr_array_index(self->devices, i);
+		if (device != g_ptr_array_index(self->devices_done, i))
+			return TRUE;
+		if (sbu_device_get_generation(device) !=
+		    g_array_index(self->generations_done, guint64, i))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void
+sbu_metrics_append_device_label(GString *str, SbuDevice *device)
+{
+	g_string_append_c(str, '{');
+	sbu_openmetrics_append_label(str, "device", sbu_device_get_id(device));
+}
+
+static void
+sbu_metrics_append_value(GString *str, gdouble value)
+{
+	gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+	g_ascii_dtostr(buf, sizeof(buf), value);
+	g_string_append_printf(str, "} %s\n", buf);
+}
+
+static void
+sbu_metrics_render_devices(SbuMetrics *self)
+{
+	GString *str = self->devices_str;
+
+	g_string_truncate(str, 0);
+	g_ptr_array_set_size(self->devices_done, 0);
+	g_array_set_size(self->generations_done, 0);
+	if (self->devices == NULL)
+		return;
+
+	/* each family has to be contiguous */
+	g_string_append(str,
+			"# TYPE sbu_device info\n"
+			"# HELP sbu_device Firmware version and serial number\n");
+	for (guint i = 0; i < self->devices->len; i++) {
+		SbuDevice *device = g_ptr_array_index(self->devices, i);
+		g_string_append(str, "sbu_device_info");
+		sbu_metrics_append_device_label(str, device);
+		g_string_append_c(str, ',');
+		sbu_openmetrics_append_label(str,
+					     "firmware_version",
+					     sbu_device_get_firmware_version(device));
+		g_string_append_c(str, ',');
+		sbu_openmetrics_append_label(str,
+					     "serial_number",
+					     sbu_device_get_serial_number(device));
+		g_string_append(str, "} 1\n");
+	}
+	for (guint j = 0; j < G_N_ELEMENTS(sbu_metrics_node_families); j++) {
+		const gchar *name = sbu_metrics_node_families[j].name;
+		SbuDeviceProperty key = sbu_metrics_node_families[j].key;
+		g_string_append_printf(str,
+				       "# TYPE %s gauge\n# UNIT %s %s\n# HELP %s %s\n",
+				       name,
+				       name,
+				       sbu_metrics_node_families[j].unit,
+				       name,
+				       sbu_metrics_node_families[j].help);
+		for (guint i = 0; i < self->devices->len; i++) {
+			SbuDevice *device = g_ptr_array_index(self->devices, i);
+			GPtrArray *nodes = sbu_device_get_nodes(device);
+			for (guint k = 0; k < nodes->len; k++) {
+				SbuNode *node = g_ptr_array_index(nodes, k);
+				gdouble value = 0.f;
+				if (!sbu_node_get_value(node, key, &value))
+					continue;
+				g_string_append(str, name);
+				sbu_metrics_append_device_label(str, device);
+				g_string_append_c(str, ',');
+				sbu_openmetrics_append_label(
+				    str,
+				    "node",
+				    sbu_node_kind_to_string(sbu_node_get_kind(node)));
+				sbu_metrics_append_value(str, value);
+			}
+		}
+	}
+	g_string_append(str,
+			"# TYPE sbu_link_active gauge\n"
+			"# HELP sbu_link_active If power is flowing between two nodes\n");
+	for (guint i = 0; i < self->devices->len; i++) {
+		SbuDevice *device = g_ptr_array_index(self->devices, i);
+		GPtrArray *links = sbu_device_get_links(device);
+		for (guint k = 0; k < links->len; k++) {
+			SbuLink *link = g_ptr_array_index(links, k);
+			SbuNodeKind src = sbu_link_get_src(link);
+			SbuNodeKind dst = sbu_link_get_dst(link);
+			g_string_append(str, "sbu_link_active");
+			sbu_metrics_append_device_label(str, device);
+			g_string_append_c(str, ',');
+			sbu_openmetrics_append_label(str, "src", sbu_node_kind_to_string(src));
+			g_string_append_c(str, ',');
+			sbu_openmetrics_append_label(str, "dst", sbu_node_kind_to_string(dst));
+			sbu_metrics_append_value(str, sbu_link_get_active(link) ? 1 : 0);
+		}
+	}
+	g_string_append(str,
+			"# TYPE sbu_device_metadata gauge\n"
+			"# HELP sbu_device_metadata Raw values read from the device\n");
+	for (guint i = 0; i < self->devices->len; i++) {
+		SbuDevice *device = g_ptr_array_index(self->devices, i);
+		GHashTable *metadata = sbu_device_get_metadata(device);
+		g_autoptr(GList) keys = NULL;
+
+		keys = g_list_sort(g_hash_table_get_keys(metadata), (GCompareFunc)g_strcmp0);
+		for (GList *l = keys; l != NULL; l = l->next) {
+			const gchar *key = l->data;
+			g_string_append(str, "sbu_device_metadata");
+			sbu_metrics_append_device_label(str, device);
+			g_string_append_c(str, ',');
+			sbu_openmetrics_append_label(str, "key", key);
+			sbu_metrics_append_value(
+			    str,
+			    GPOINTER_TO_INT(g_hash_table_lookup(metadata, key)));
+		}
+	}
+
+	/* save what was rendered */
+	for (guint i = 0; i < self->devices->len; i++) {
+		SbuDevice *device = g_ptr_array_index(self->devices, i);
+		guint64 generation = sbu_device_get_generation(device);
+		g_ptr_array_add(self->devices_done, g_object_ref(device));
+		g_array_append_val(self->generations_done, generation);
+	}
+}
+
+/**
+ * sbu_metrics_render:
+ * @self: a #SbuMetrics
+ *
+ * Renders the device values and the daemon statistics in OpenMetrics text
+ * format. The device values are only formatted again if they have changed.
+ *
+ * Returns: (transfer full): a #GBytes
+ **/
+GBytes *
+sbu_metrics_render(SbuMetrics *self)
+{
+	GString *str;
+
+	g_return_val_if_fail(SBU_IS_METRICS(self), NULL);
+
+	if (sbu_metrics_devices_changed(self))
+		sbu_metrics_render_devices(self);
+	str = g_string_sized_new(self->devices_str->len + 4096);
+	g_string_append_len(str, self->devices_str->str, self->devices_str->len);
+	sbu_stats_to_openmetrics(str);
+	g_string_append(str, "# EOF\n");
+	return g_string_free_to_bytes(str);
+}
+
+static GBytes *
+sbu_metrics_build_response(SbuMetrics *self, const gchar *request)
+{
+	GString *str = g_string_new(NULL);
+	g_auto(GStrv) split = g_strsplit(request, " ", 3);
+	g_autoptr(GBytes) body = NULL;
+	const gchar *content_type = "text/plain; charset=utf-8";
+	const gchar *status = "200 OK";
+
+	if (g_strv_length(split) != 3 || !g_str_has_prefix(split[2], "HTTP/1.")) {
+		status = "400 Bad Request";
+		body = g_bytes_new_static("bad request\n", 12);
+	} else if (g_strcmp0(split[0], "GET") != 0) {
+		status = "405 Method Not Allowed";
+		body = g_bytes_new_static("only GET is supported\n", 22);
+	} else if (g_strcmp0(split[1], "/metrics") != 0) {
+		status = "404 Not Found";
+		body = g_bytes_new_static("not found, try /metrics\n", 24);
+	} else {
+		content_type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+		body = sbu_metrics_render(self);
+	}
+	g_string_append_printf(str,
+			       "HTTP/1.1 %s\r\n"
+			       "Content-Type: %s\r\n"
+			       "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+			       "Connection: close\r\n"
+			       "\r\n",
+			       status,
+			       content_type,
+			       g_bytes_get_size(body));
+	g_string_append_len(str, g_bytes_get_data(body, NULL), g_bytes_get_size(body));
+	return g_string_free_to_bytes(str);
+}
+
+static void
+sbu_metrics_write_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuMetricsRequest *req = (SbuMetricsRequest *)user_data;
+	g_autoptr(GError) error = NULL;
+
+	if (!g_output_stream_write_all_finish(G_OUTPUT_STREAM(source), res, NULL, &error))
+		g_debug("failed to send metrics: %s", error->message);
+	sbu_metrics_request_free(req);
+}
+
+static void
+sbu_metrics_read_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuMetricsRequest *req = (SbuMetricsRequest *)user_data;
+	GOutputStream *ostream;
+	gssize len;
+	gchar *eol;
+	g_autoptr(GError) error = NULL;
+
+	len = g_input_stream_read_finish(G_INPUT_STREAM(source), res, &error);
+	if (len <= 0) {
+		if (len < 0)
+			g_debug("failed to read metrics request: %s", error->message);
+		sbu_metrics_request_free(req);
+		return;
+	}
+	req->buf_len += len;
+
+	/* wait for the end of the headers, which are ignored */
+	if (g_strstr_len((const gchar *)req->buf, req->buf_len, "\r\n\r\n") == NULL) {
+		if (req->buf_len >= sizeof(req->buf) - 1) {
+			sbu_metrics_request_free(req);
+			return;
+		}
+		g_input_stream_read_async(G_INPUT_STREAM(source),
+					  req->buf + req->buf_len,
+					  sizeof(req->buf) - 1 - req->buf_len,
+					  G_PRIORITY_DEFAULT,
+					  NULL,
+					  sbu_metrics_read_cb,
+					  req);
+		return;
+	}
+	req->buf[req->buf_len] = '\0';
+	eol = strstr((gchar *)req->buf, "\r\n");
+	*eol = '\0';
+	req->response = sbu_metrics_build_response(req->self, (const gchar *)req->buf);
+	ostream = g_io_stream_get_output_stream(G_IO_STREAM(req->connection));
+	g_output_stream_write_all_async(ostream,
+					g_bytes_get_data(req->response, NULL),
+					g_bytes_get_size(req->response),
+					G_PRIORITY_DEFAULT,
+					NULL,
+					sbu_metrics_write_cb,
+					req);
+}
+
+static gboolean
+sbu_metrics_incoming_cb(GSocketService *service,
+			GSocketConnection *connection,
+			GObject *source_object,
+			gpointer user_data)
+{
+	SbuMetrics *self = SBU_METRICS(user_data);
+	SbuMetricsRequest *req = g_new0(SbuMetricsRequest, 1);
+	GInputStream *istream = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+
+	/* do not let a stuck client hold the connection open forever */
+	g_socket_set_timeout(g_socket_connection_get_socket(connection), SBU_METRICS_TIMEOUT);
+	req->self = g_object_ref(self);
+	req->connection = g_object_ref(connection);
+	g_input_stream_read_async(istream,
+				  req->buf,
+				  sizeof(req->buf) - 1,
+				  G_PRIORITY_DEFAULT,
+				  NULL,
+				  sbu_metrics_read_cb,
+				  req);
+	return TRUE;
+}
+
+/**
+ * sbu_metrics_set_devices:
+ * @self: a #SbuMetrics
+ * @devices: (nullable): the array of #SbuDevice owned by the manager
+ *
+ * Sets the devices to export. The array is watched for changes, so this only
+ * needs calling once.
+ **/
+void
+sbu_metrics_set_devices(SbuMetrics *self, GPtrArray *devices)
+{
+	g_return_if_fail(SBU_IS_METRICS(self));
+	if (self->devices != NULL)
+		g_ptr_array_unref(self->devices);
+	self->devices = devices != NULL ? g_ptr_array_ref(devices) : NULL;
+}
+
+/**
+ * sbu_metrics_start:
+ * @self: a #SbuMetrics
+ * @address: an address with port, e.g. `127.0.0.1:9099` or `[::1]:9099`
+ * @error: a #GError or %NULL
+ *
+ * Starts serving `/metrics` over HTTP.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_metrics_start(SbuMetrics *self, const gchar *address, GError **error)
+{
+	const gchar *hostname;
+	guint16 port;
+	g_autoptr(GSocketAddress) effective_address = NULL;
+	g_autoptr(GSocketAddress) socket_address = NULL;
+	g_autoptr(GSocketConnectable) connectable = NULL;
+
+	g_return_val_if_fail(SBU_IS_METRICS(self), FALSE);
+	g_return_val_if_fail(address != NULL, FALSE);
+
+	connectable = g_network_address_parse(address, 0, error);
+	if (connectable == NULL) {
+		g_prefix_error(error, "invalid metrics address %s: ", address);
+		return FALSE;
+	}
+	hostname = g_network_address_get_hostname(G_NETWORK_ADDRESS(connectable));
+	port = g_network_address_get_port(G_NETWORK_ADDRESS(connectable));
+	socket_address = g_inet_socket_address_new_from_string(hostname, port);
+	if (socket_address == NULL) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_ARGUMENT,
+			    "metrics address %s is not an IP address",
+			    address);
+		return FALSE;
+	}
+	if (!g_socket_listener_add_address(G_SOCKET_LISTENER(self->service),
+					   socket_address,
+					   G_SOCKET_TYPE_STREAM,
+					   G_SOCKET_PROTOCOL_TCP,
+					   NULL,
+					   &effective_address,
+					   error)) {
+		g_prefix_error(error, "failed to listen on %s: ", address);
+		return FALSE;
+	}
+	self->port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(effective_address));
+	g_socket_service_start(self->service);
+	return TRUE;
+}
+
+/* useful when listening on port 0 */
+guint16
+sbu_metrics_get_port(SbuMetrics *self)
+{
+	g_return_val_if_fail(SBU_IS_METRICS(self), 0);
+	return self->port;
+}
+
+static void
+sbu_metrics_finalize(GObject *object)
+{
+	SbuMetrics *self = SBU_METRICS(object);
+
+	g_socket_service_stop(self->service);
+	g_socket_listener_close(G_SOCKET_LISTENER(self->service));
+	g_object_unref(self->service);
+	if (self->devices != NULL)
+		g_ptr_array_unref(self->devices);
+	g_ptr_array_unref(self->devices_done);
+	g_array_unref(self->generations_done);
+	g_string_free(self->devices_str, TRUE);
+
+	G_OBJECT_CLASS(sbu_metrics_parent_class)->finalize(object);
+}
+
+static void
+sbu_metrics_init(SbuMetrics *self)
+{
+	self->devices_str = g_string_new(NULL);
+	self->devices_done = g_ptr_array_new_with_free_func((GDestroyNotify)g_object_unref);
+	self->generations_done = g_array_new(FALSE, FALSE, sizeof(guint64));
+	self->service = g_socket_service_new();
+	g_signal_connect(self->service, "incoming", G_CALLBACK(sbu_metrics_incoming_cb), self);
+}
+
+static void
+sbu_metrics_class_init(SbuMetricsClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = sbu_metrics_finalize;
+}
+
+/**
+ * sbu_metrics_new:
+ *
+ * Creates an exporter for Prometheus and other OpenMetrics scrapers.
+ *
+ * Returns: (transfer full): a #SbuMetrics
+ **/
+SbuMetrics *
+sbu_metrics_new(void)
+{
+	SbuMetrics *self;
+	self = g_object_new(SBU_TYPE_METRICS, NULL);
+	return SBU_METRICS(self);
+}
@@ -0,0 +1,23 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+#define SBU_TYPE_METRICS (sbu_metrics_get_type())
+G_DECLARE_FINAL_TYPE(SbuMetrics, sbu_metrics, SBU, METRICS, GObject)
+
+SbuMetrics *
+sbu_metrics_new(void);
+void
+sbu_metrics_set_devices(SbuMetrics *self, GPtrArray *devices);
+GBytes *
+sbu_metrics_render(SbuMetrics *self);
+gboolean
+sbu_metrics_start(SbuMetrics *self, const gchar *address, GError **error);
+guint16
+sbu_metrics_get_port(SbuMetrics *self);
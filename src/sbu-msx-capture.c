@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sbu-msx-capture.h"
+#include "sbu-msx-pi30.h"
+
+/*
+ * The file is the magic, then each frame as a little endian header of the
+ * wall clock time in us, the kind and the data length, then the data:
+ *
+ *   | SBUCAP01 | ts:8 | kind:1 | len:2 | data | ts:8 | ...
+ */
+#define SBU_MSX_CAPTURE_MAGIC	    "SBUCAP01"
+#define SBU_MSX_CAPTURE_MAGIC_SIZE  8
+#define SBU_MSX_CAPTURE_HEADER_SIZE 11
+
+struct _SbuMsxCapture {
+	GObject parent_instance;
+	gchar *path;
+	gint fd; /* for writing */
+	GMappedFile *mapped; /* for reading */
+	GArray *frames;	     /* of SbuMsxCaptureFrame */
+};
+
+G_DEFINE_TYPE(SbuMsxCapture, sbu_msx_capture, G_TYPE_OBJECT)
+
+static gboolean
+sbu_msx_capture_write_raw(SbuMsxCapture *self, const guint8 *buf, gsize len, GError **error)
+{
+	if (write(self->fd, buf, len) != (gssize)len) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    g_io_error_from_errno(errno),
+			    "failed to write %s: %s",
+			    self->path,
+			    g_strerror(errno));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * sbu_msx_capture_open:
+ * @self: a #SbuMsxCapture
+ * @path: a filename, which is created if it does not exist
+ * @error: a #GError or %NULL
+ *
+ * Opens a capture file so that frames can be added to the end.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_msx_capture_open(SbuMsxCapture *self, const gchar *path, GError **error)
+{
+	gchar magic[SBU_MSX_CAPTURE_MAGIC_SIZE] = {0};
+	gssize len;
+
+	g_return_val_if_fail(SBU_IS_MSX_CAPTURE(self), FALSE);
+	g_return_val_if_fail(path != NULL, FALSE);
+	g_return_val_if_fail(self->fd < 0, FALSE);
+
+	self->fd = g_open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+	if (self->fd < 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    g_io_error_from_errno(errno),
+			    "failed to open %s: %s",
+			    path,
+			    g_strerror(errno));
+		return FALSE;
+	}
+	g_free(self->path);
+	self->path = g_strdup(path);
+
+	/* a new file gets the magic, an old one has to be a capture */
+	len = pread(self->fd, magic, sizeof(magic), 0);
+	if (len == 0) {
+		return sbu_msx_capture_write_raw(self,
+						 (const guint8 *)SBU_MSX_CAPTURE_MAGIC,
+						 SBU_MSX_CAPTURE_MAGIC_SIZE,
+						 error);
+	}
+	if (len != SBU_MSX_CAPTURE_MAGIC_SIZE ||
+	    memcmp(magic, SBU_MSX_CAPTURE_MAGIC, SBU_MSX_CAPTURE_MAGIC_SIZE) != 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "%s is not a capture file",
+			    path);
+		close(self->fd);
+		self->fd = -1;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * sbu_msx_capture_write:
+ * @self: a #SbuMsxCapture
+ * @kind: a #SbuMsxCaptureKind
+ * @buf: the raw frame
+ * @len: size of @buf
+ * @error: a #GError or %NULL
+ *
+ * Adds a frame to the end of the capture file, timestamped with the current
+ * time. Each frame is written with a single call so that a crash does not
+ * leave a partial frame in the middle of the file.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_msx_capture_write(SbuMsxCapture *self,
+		      SbuMsxCaptureKind kind,
+		      const guint8 *buf,
+		      gsize len,
+		      GError **error)
+{
+	guint8 tmp[SBU_MSX_CAPTURE_HEADER_SIZE + SBU_MSX_PI30_FRAME_MAX];
+	guint64 ts = GUINT64_TO_LE(g_get_real_time());
+	guint16 len_le;
+
+	g_return_val_if_fail(SBU_IS_MSX_CAPTURE(self), FALSE);
+	g_return_val_if_fail(kind < SBU_MSX_CAPTURE_KIND_LAST, FALSE);
+	g_return_val_if_fail(self->fd >= 0, FALSE);
+
+	len = MIN(len, SBU_MSX_PI30_FRAME_MAX);
+	len_le = GUINT16_TO_LE(len);
+	memcpy(tmp, &ts, sizeof(ts));
+	tmp[8] = kind;
+	memcpy(tmp + 9, &len_le, sizeof(len_le));
+	memcpy(tmp + SBU_MSX_CAPTURE_HEADER_SIZE, buf, len);
+	return sbu_msx_capture_write_raw(self, tmp, SBU_MSX_CAPTURE_HEADER_SIZE + len, error);
+}
+
+/**
+ * sbu_msx_capture_load:
+ * @self: a #SbuMsxCapture
+ * @path: a capture filename
+ * @error: a #GError or %NULL
+ *
+ * Loads all the frames from a capture file. A partial frame at the end of
+ * the file is ignored.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_msx_capture_load(SbuMsxCapture *self, const gchar *path, GError **error)
+{
+	const guint8 *data;
+	gsize len;
+	gsize off = SBU_MSX_CAPTURE_MAGIC_SIZE;
+
+	g_return_val_if_fail(SBU_IS_MSX_CAPTURE(self), FALSE);
+	g_return_val_if_fail(path != NULL, FALSE);
+
+	g_clear_pointer(&self->mapped, g_mapped_file_unref);
+	g_array_set_size(self->frames, 0);
+	self->mapped = g_mapped_file_new(path, FALSE, error);
+	if (self->mapped == NULL)
+		return FALSE;
+	data = (const guint8 *)g_mapped_file_get_contents(self->mapped);
+	len = g_mapped_file_get_length(self->mapped);
+	if (len < SBU_MSX_CAPTURE_MAGIC_SIZE ||
+	    memcmp(data, SBU_MSX_CAPTURE_MAGIC, SBU_MSX_CAPTURE_MAGIC_SIZE) != 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "%s is not a capture file",
+			    path);
+		return FALSE;
+	}
+	while (off + SBU_MSX_CAPTURE_HEADER_SIZE <= len) {
+		SbuMsxCaptureFrame frame = {0};
+		guint64 ts;
+		guint16 len_le;
+
+		memcpy(&ts, data + off, sizeof(ts));
+		memcpy(&len_le, data + off + 9, sizeof(len_le));
+		frame.ts = GUINT64_FROM_LE(ts);
+		frame.kind = data[off + 8];
+		frame.len = GUINT16_FROM_LE(len_le);
+		frame.data = data + off + SBU_MSX_CAPTURE_HEADER_SIZE;
+		if (frame.kind >= SBU_MSX_CAPTURE_KIND_LAST) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_DATA,
+				    "invalid frame kind 0x%02x at offset %" G_GSIZE_FORMAT,
+				    frame.kind,
+				    off);
+			return FALSE;
+		}
+		if (off + SBU_MSX_CAPTURE_HEADER_SIZE + frame.len > len)
+			break;
+		g_array_append_val(self->frames, frame);
+		off += SBU_MSX_CAPTURE_HEADER_SIZE + frame.len;
+	}
+	return TRUE;
+}
+
+/**
+ * sbu_msx_capture_get_size:
+ * @self: a #SbuMsxCapture
+ *
+ * Gets the number of loaded frames.
+ *
+ * Returns: integer
+ **/
+guint
+sbu_msx_capture_get_size(SbuMsxCapture *self)
+{
+	g_return_val_if_fail(SBU_IS_MSX_CAPTURE(self), 0);
+	return self->frames->len;
+}
+
+/**
+ * sbu_msx_capture_get_frame:
+ * @self: a #SbuMsxCapture
+ * @idx: an index less than sbu_msx_capture_get_size()
+ *
+ * Gets a loaded frame, which is valid for the lifetime of the capture.
+ *
+ * Returns: a #SbuMsxCaptureFrame
+ **/
+const SbuMsxCaptureFrame *
+sbu_msx_capture_get_frame(SbuMsxCapture *self, guint idx)
+{
+	g_return_val_if_fail(SBU_IS_MSX_CAPTURE(self), NULL);
+	g_return_val_if_fail(idx < self->frames->len, NULL);
+	return &g_array_index(self->frames, SbuMsxCaptureFrame, idx);
+}
+
+static void
+sbu_msx_capture_finalize(GObject *object)
+{
+	SbuMsxCapture *self = SBU_MSX_CAPTURE(object);
+
+	if (self->fd >= 0)
+		close(self->fd);
+	if (self->mapped != NULL)
+		g_mapped_file_unref(self->mapped);
+	g_array_unref(self->frames);
+	g_free(self->path);
+
+	G_OBJECT_CLASS(sbu_msx_capture_parent_class)->finalize(object);
+}
+
+static void
+sbu_msx_capture_init(SbuMsxCapture *self)
+{
+	self->fd = -1;
+	self->frames = g_array_new(FALSE, FALSE, sizeof(SbuMsxCaptureFrame));
+}
+
+static void
+sbu_msx_capture_class_init(SbuMsxCaptureClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = sbu_msx_capture_finalize;
+}
+
+/**
+ * sbu_msx_capture_new:
+ *
+ * Creates a capture of the raw PI30 requests and responses, which can be
+ * written while the daemon is running or loaded for a replay.
+ *
+ * Returns: (transfer full): a #SbuMsxCapture
+ **/
+SbuMsxCapture *
+sbu_msx_capture_new(void)
+{
+	return g_object_new(SBU_TYPE_MSX_CAPTURE, NULL);
+}
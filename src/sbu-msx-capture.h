@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+#define SBU_TYPE_MSX_CAPTURE (sbu_msx_capture_get_type())
+G_DECLARE_FINAL_TYPE(SbuMsxCapture, sbu_msx_capture, SBU, MSX_CAPTURE, GObject)
+
+typedef enum {
+	SBU_MSX_CAPTURE_KIND_REQUEST,
+	SBU_MSX_CAPTURE_KIND_RESPONSE,
+	SBU_MSX_CAPTURE_KIND_LAST
+} SbuMsxCaptureKind;
+
+typedef struct {
+	gint64 ts; /* us, wall clock */
+	SbuMsxCaptureKind kind;
+	const guint8 *data; /* owned by the capture */
+	gsize len;
+} SbuMsxCaptureFrame;
+
+SbuMsxCapture *
+sbu_msx_capture_new(void);
+gboolean
+sbu_msx_capture_open(SbuMsxCapture *self, const gchar *path, GError **error);
+gboolean
+sbu_msx_capture_write(SbuMsxCapture *self,
+		      SbuMsxCaptureKind kind,
+		      const guint8 *buf,
+		      gsize len,
+		      GError **error);
+gboolean
+sbu_msx_capture_load(SbuMsxCapture *self, const gchar *path, GError **error);
+guint
+sbu_msx_capture_get_size(SbuMsxCapture *self);
+const SbuMsxCaptureFrame *
+sbu_msx_capture_get_frame(SbuMsxCapture *self, guint idx);
@@ -10,209 +10,266 @@
 
 #include "sbu-msx-common.h"
 #include "sbu-msx-device.h"
+#include "sbu-msx-pi30.h"
+#include "sbu-stats.h"
 
 #define SBU_MSX_DEVICE_TIMEOUT 5000
 
+/* how often the slower commands are resent, in seconds */
+#define SBU_MSX_DEVICE_WARNING_STATUS_INTERVAL 60
+#define SBU_MSX_DEVICE_SETTINGS_INTERVAL       3600
+
+/* in the order they are sent */
+typedef enum {
+	SBU_MSX_DEVICE_CMD_QPIRI,
+	SBU_MSX_DEVICE_CMD_QPIGS,
+	SBU_MSX_DEVICE_CMD_QFLAG,
+	SBU_MSX_DEVICE_CMD_QPIWS,
+	SBU_MSX_DEVICE_CMD_QPGS,
+	SBU_MSX_DEVICE_CMD_LAST
+} SbuMsxDeviceCmd;
+
+/* looked up once, so recording a transfer does not allocate or lock */
+typedef struct {
+	SbuStatsHistogram *latency;
+	SbuStatsCounter *errors;
+} SbuMsxDeviceStats;
+
 struct _SbuMsxDevice {
 	SbuDevice parent_instance;
-	GUsbDevice *usb_device;
-	GHashTable *hash; /* SbuMsxDeviceKey : int */
+	SbuMsxTransport *transport;
+	SbuMsxPi30Values values; /* last value of each key, and which keys have been seen */
+	gint64 cmd_due[SBU_MSX_DEVICE_CMD_LAST]; /* monotonic, or 0 for the next cycle */
+	gint unit; /* in a parallel group, or -1 for the unit the link is connected to */
+	gchar cmd_qpgs[8]; /* e.g. "QPGS1" */
+	SbuMsxDeviceStats cmd_stats[SBU_MSX_DEVICE_CMD_LAST]; /* set when first sent */
+	SbuStatsHistogram *stats_parse;
+	SbuStatsHistogram *stats_changed;
 };
 
-enum { SIGNAL_CHANGED, SIGNAL_LAST };
+enum { SIGNAL_FRAME_CHANGED, SIGNAL_LAST };
 
 static guint signals[SIGNAL_LAST] = {0};
 
 G_DEFINE_TYPE(SbuMsxDevice, sbu_msx_device, SBU_TYPE_DEVICE)
 
-static guint16
-sbu_msx_crc_half(const guint8 *pin, guint8 len)
-{
-	const guint8 *ptr;
-	guint16 crc;
-	guint8 da;
-	guint8 crc_hi;
-	guint8 crc_lo;
-	guint16 crc_ta[16] = {0x0000,
-			      0x1021,
-			      0x2042,
-			      0x3063,
-			      0x4084,
-			      0x50a5,
-			      0x60c6,
-			      0x70e7,
-			      0x8108,
-			      0x9129,
-			      0xa14a,
-			      0xb16b,
-			      0xc18c,
-			      0xd1ad,
-			      0xe1ce,
-			      0xf1ef};
-	ptr = pin;
-	crc = 0;
-
-	while (len-- != 0) {
-		da = ((guint8)(crc >> 8)) >> 4;
-		crc <<= 4;
-		crc ^= crc_ta[da ^ (*ptr >> 4)];
-		da = ((guint8)(crc >> 8)) >> 4;
-		crc <<= 4;
-		crc ^= crc_ta[da ^ (*ptr & 0x0f)];
-		ptr++;
-	}
-	crc_lo = crc;
-	crc_hi = (guint8)(crc >> 8);
-
-	if (crc_lo == 0x28 || crc_lo == 0x0d || crc_lo == 0x0a)
-		crc_lo++;
-	if (crc_hi == 0x28 || crc_hi == 0x0d || crc_hi == 0x0a)
-		crc_hi++;
-	crc = ((guint16)crc_hi) << 8;
-	crc += crc_lo;
-	return crc;
-}
+typedef struct {
+	gchar *cmd;
+	guint8 buf[16]; /* encoded command */
+	gsize len;
+	gint64 ts_start; /* when sent, rather than queued */
+	SbuMsxDeviceStats stats;
+	gboolean timed_out;
+	GMainContext *context; /* of the task */
+	GSource *timeout_source;
+	GCancellable *cancellable; /* child of the caller cancellable */
+	GCancellable *cancellable_parent;
+	gulong cancellable_id;
+} SbuMsxDeviceRequest;
 
 static void
-sbu_msx_dump_raw(const gchar *title, const guint8 *data, gsize len)
+sbu_msx_device_request_free(SbuMsxDeviceRequest *req)
 {
-	g_autoptr(GString) str = g_string_new(NULL);
-	if (len == 0)
-		return;
-	g_string_append_printf(str, "%s:", title);
-	for (gsize i = strlen(title); i < 16; i++)
-		g_string_append(str, " ");
-	for (gsize i = 0; i < len; i++) {
-		g_string_append_printf(str, "%02x ", data[i]);
-		if (i > 0 && i % 32 == 0)
-			g_string_append(str, "\n");
+	if (req->timeout_source != NULL) {
+		g_source_destroy(req->timeout_source);
+		g_source_unref(req->timeout_source);
 	}
-	g_debug("%s", str->str);
+	if (req->cancellable_parent != NULL) {
+		g_cancellable_disconnect(req->cancellable_parent, req->cancellable_id);
+		g_object_unref(req->cancellable_parent);
+	}
+	g_object_unref(req->cancellable);
+	g_free(req->cmd);
+	g_free(req);
 }
 
-static guint
-sbu_msx_device_packet_count_data(const guint8 *buf, gsize len)
+static gboolean
+sbu_msx_device_request_timeout_cb(gpointer user_data)
 {
-	for (guint j = 0; j < len; j++) {
-		if (buf[j] == '\r')
-			return j;
-	}
-	return 8;
+	SbuMsxDeviceRequest *req = (SbuMsxDeviceRequest *)user_data;
+	req->timed_out = TRUE;
+	g_cancellable_cancel(req->cancellable);
+	return G_SOURCE_REMOVE;
 }
 
-static GBytes *
-sbu_msx_device_send_command(SbuMsxDevice *self, const gchar *cmd, GError **error)
+static void
+sbu_msx_device_request_cancelled_cb(GCancellable *cancellable, gpointer user_data)
 {
-	gsize actual_len = 0;
-	gsize idx = 0;
-	gsize len;
-	guint16 crc;
-	guint8 buf2[256];
-	guint8 buf[8];
-
-	/* copy in the command */
-	memset(buf, 0x00, sizeof(buf));
-	len = strlen(cmd);
-	memcpy(buf, cmd, len);
-
-	/* copy in the footer: CRC then newline */
-	crc = GUINT16_TO_BE(sbu_msx_crc_half(buf, len));
-	memcpy(buf + len, &crc, 2);
-	buf[len + 2] = '\r';
-
-	/* send */
-	sbu_msx_dump_raw("host->self", buf, 8);
-	if (!g_usb_device_control_transfer(self->usb_device,
-					   G_USB_DEVICE_DIRECTION_HOST_TO_DEVICE,
-					   G_USB_DEVICE_REQUEST_TYPE_CLASS,
-					   G_USB_DEVICE_RECIPIENT_INTERFACE,
-					   0x9,
-					   0x200,
-					   0,
-					   buf,
-					   8,
-					   &actual_len,
-					   SBU_MSX_DEVICE_TIMEOUT,
-					   NULL,
-					   error)) {
-		g_prefix_error(error, "failed to send data: ");
-		return FALSE;
+	g_cancellable_cancel(G_CANCELLABLE(user_data));
+}
+
+/* failed transfers are counted, but do not skew the round trip times */
+static void
+sbu_msx_device_request_failed(GTask *task, GError *error)
+{
+	SbuMsxDeviceRequest *req = g_task_get_task_data(task);
+
+	/* the transport reports its own cancelled error, so use the reason we know */
+	if (req->timed_out) {
+		g_clear_error(&error);
+		error = g_error_new(G_IO_ERROR,
+				    G_IO_ERROR_TIMED_OUT,
+				    "no response within %ums",
+				    (guint)SBU_MSX_DEVICE_TIMEOUT);
+	} else if (g_cancellable_is_cancelled(req->cancellable)) {
+		g_clear_error(&error);
+		error = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_CANCELLED, "cancelled");
+	}
+	sbu_stats_counter_inc(req->stats.errors);
+	g_task_return_error(task, error);
+}
+
+static void
+sbu_msx_device_request_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	g_autoptr(GTask) task = G_TASK(user_data);
+	SbuMsxDeviceRequest *req = g_task_get_task_data(task);
+	const gchar *payload = NULL;
+	gsize len = 0;
+	gsize payload_len = 0;
+	const guint8 *data;
+	g_autoptr(GBytes) response = NULL;
+	g_autoptr(GError) error = NULL;
+
+	response = sbu_msx_transport_request_finish(SBU_MSX_TRANSPORT(source), res, &error);
+	if (response == NULL) {
+		sbu_msx_device_request_failed(task, g_steal_pointer(&error));
+		return;
 	}
-	if (actual_len != 8) {
-		g_set_error(error,
-			    G_IO_ERROR,
-			    G_IO_ERROR_FAILED,
-			    "only sent %" G_GSIZE_FORMAT " bytes",
-			    actual_len);
-		return FALSE;
+	data = g_bytes_get_data(response, &len);
+	if (!sbu_msx_pi30_decode(data, len, &payload, &payload_len, &error)) {
+		sbu_msx_device_request_failed(task, g_steal_pointer(&error));
+		return;
 	}
+	sbu_stats_histogram_record(req->stats.latency, req->ts_start);
+	g_task_return_pointer(task,
+			      g_bytes_new(payload, payload_len),
+			      (GDestroyNotify)g_bytes_unref);
+}
 
-	/* recieve */
-	for (guint i = 0; i < 20; i++) {
-		gsize data_valid;
-
-		memset(buf, 0x00, sizeof(buf));
-		if (!g_usb_device_interrupt_transfer(self->usb_device,
-						     0x81,
-						     buf,
-						     sizeof(buf),
-						     &actual_len,
-						     SBU_MSX_DEVICE_TIMEOUT,
-						     NULL,
-						     error)) {
-			g_prefix_error(error, "failed to get data: ");
-			return FALSE;
-		}
+/* the link may be busy with requests from other units in a parallel group,
+ * so the time spent waiting in the queue does not count */
+static void
+sbu_msx_device_request_sent_cb(gpointer user_data)
+{
+	SbuMsxDeviceRequest *req = (SbuMsxDeviceRequest *)user_data;
+	req->ts_start = g_get_monotonic_time();
+	req->timeout_source = g_timeout_source_new(SBU_MSX_DEVICE_TIMEOUT);
+	g_source_set_callback(req->timeout_source, sbu_msx_device_request_timeout_cb, req, NULL);
+	g_source_attach(req->timeout_source, req->context);
+}
 
-		/* check message was long enough to parse */
-		if (actual_len != 8) {
-			g_set_error(error,
-				    G_IO_ERROR,
-				    G_IO_ERROR_FAILED,
-				    "only recieved %" G_GSIZE_FORMAT " bytes",
-				    actual_len);
-			return FALSE;
-		}
+static void
+sbu_msx_device_stats_init(SbuMsxDeviceStats *stats, const gchar *cmd)
+{
+	g_autofree gchar *name = g_strdup_printf("usb:%s", cmd);
+	g_autofree gchar *name_errors = g_strdup_printf("usb:%s:errors", cmd);
+	stats->latency = sbu_stats_histogram_get(name);
+	stats->errors = sbu_stats_counter_get(name_errors);
+}
 
-		sbu_msx_dump_raw("self->host", buf, actual_len);
-		data_valid = sbu_msx_device_packet_count_data(buf, actual_len);
-		memcpy(buf2 + idx, buf, data_valid);
-		idx += data_valid;
-		if (data_valid <= 7)
-			break;
+/* each request is driven by the transport completions on the calling
+ * thread-default main context, so no thread is blocked per device */
+static void
+sbu_msx_device_send_command_async(SbuMsxDevice *self,
+				  const gchar *cmd,
+				  const SbuMsxDeviceStats *stats,
+				  GCancellable *cancellable,
+				  GAsyncReadyCallback callback,
+				  gpointer user_data)
+{
+	SbuMsxDeviceRequest *req = g_new0(SbuMsxDeviceRequest, 1);
+	g_autoptr(GTask) task = g_task_new(self, cancellable, callback, user_data);
+
+	req->cmd = g_strdup(cmd);
+	req->context = g_task_get_context(task);
+
+	/* commands that are only sent when opening are looked up each time */
+	if (stats != NULL)
+		req->stats = *stats;
+	else
+		sbu_msx_device_stats_init(&req->stats, cmd);
+	req->cancellable = g_cancellable_new();
+	g_task_set_task_data(task, req, (GDestroyNotify)sbu_msx_device_request_free);
+
+	/* the command, then the CRC and newline */
+	req->len = sbu_msx_pi30_encode(cmd, req->buf, sizeof(req->buf));
+	if (req->len == 0) {
+		g_task_return_new_error(task,
+					G_IO_ERROR,
+					G_IO_ERROR_INVALID_ARGUMENT,
+					"command %s is too long",
+					cmd);
+		return;
 	}
 
-	/* check checksum of recieved message */
-	crc = GUINT16_TO_BE(sbu_msx_crc_half(buf2, idx - 2));
-	if (memcmp(&crc, buf2 + idx - 2, 2) != 0) {
-		g_set_error(error,
-			    G_IO_ERROR,
-			    G_IO_ERROR_FAILED,
-			    "failed checksum, expected %04x",
-			    crc);
-		return FALSE;
-	}
+	/* the whole exchange has to finish before the deadline, and the
+	 * response has to arrive within the timeout once sent */
+	if (cancellable != NULL) {
+		req->cancellable_parent = g_object_ref(cancellable);
+		req->cancellable_id =
+		    g_cancellable_connect(cancellable,
+					  G_CALLBACK(sbu_msx_device_request_cancelled_cb),
+					  req->cancellable,
+					  NULL);
+	}
+	sbu_msx_transport_request_async(self->transport,
+					req->buf,
+					req->len,
+					sbu_msx_device_request_sent_cb,
+					req,
+					req->cancellable,
+					sbu_msx_device_request_cb,
+					g_steal_pointer(&task));
+}
 
-	/* check first char */
-	if (buf2[0] != '(') {
-		g_set_error_literal(error,
-				    G_IO_ERROR,
-				    G_IO_ERROR_FAILED,
-				    "invalid response start, expected '('");
-		return FALSE;
-	}
+static GBytes *
+sbu_msx_device_send_command_finish(SbuMsxDevice *self, GAsyncResult *res, GError **error)
+{
+	g_return_val_if_fail(g_task_is_valid(res, self), NULL);
+	return g_task_propagate_pointer(G_TASK(res), error);
+}
+
+static void
+sbu_msx_device_send_command_sync_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	GAsyncResult **res_out = (GAsyncResult **)user_data;
+	*res_out = g_object_ref(res);
+}
 
-	return g_bytes_new(buf2 + 1, idx - 3);
+/* only used when opening the device, so iterate a private context rather
+ * than dispatching unrelated sources from the default one */
+static GBytes *
+sbu_msx_device_send_command(SbuMsxDevice *self,
+			    const gchar *cmd,
+			    const SbuMsxDeviceStats *stats,
+			    GCancellable *cancellable,
+			    GError **error)
+{
+	g_autoptr(GMainContext) context = g_main_context_new();
+	g_autoptr(GAsyncResult) res = NULL;
+
+	g_main_context_push_thread_default(context);
+	sbu_msx_device_send_command_async(self,
+					  cmd,
+					  stats,
+					  cancellable,
+					  sbu_msx_device_send_command_sync_cb,
+					  &res);
+	while (res == NULL)
+		g_main_context_iteration(context, TRUE);
+	g_main_context_pop_thread_default(context);
+	return sbu_msx_device_send_command_finish(self, res, error);
 }
 
 static gboolean
-sbu_msx_device_ensure_protocol(SbuMsxDevice *self, GError **error)
+sbu_msx_device_ensure_protocol(SbuMsxDevice *self, GCancellable *cancellable, GError **error)
 {
 	gconstpointer data;
 	gsize len = 0;
 	g_autoptr(GBytes) response = NULL;
 
-	response = sbu_msx_device_send_command(self, "QPI", error);
+	response = sbu_msx_device_send_command(self, "QPI", NULL, cancellable, error);
 	if (response == NULL) {
 		g_prefix_error(error, "failed to get protocol version: ");
 		return FALSE;
@@ -238,14 +295,14 @@ sbu_msx_device_ensure_protocol(SbuMsxDevice *self, GError **error)
 }
 
 static gboolean
-sbu_msx_device_ensure_serial_number(SbuMsxDevice *self, GError **error)
+sbu_msx_device_ensure_serial_number(SbuMsxDevice *self, GCancellable *cancellable, GError **error)
 {
 	gconstpointer data;
 	gsize len = 0;
 	g_autoptr(GBytes) response = NULL;
 	g_autofree gchar *tmp = NULL;
 
-	response = sbu_msx_device_send_command(self, "QID", error);
+	response = sbu_msx_device_send_command(self, "QID", NULL, cancellable, error);
 	if (response == NULL) {
 		g_prefix_error(error, "failed to get serial number: ");
 		return FALSE;
@@ -264,162 +321,74 @@ sbu_msx_device_ensure_serial_number(SbuMsxDevice *self, GError **error)
 	return TRUE;
 }
 
-typedef struct {
-	gsize off;
-	SbuMsxDeviceKey key;
-} MsxDeviceBufferOffsets;
-
-static void
-sbu_msx_device_emit_changed(SbuMsxDevice *self, SbuMsxDeviceKey key, gint val)
-{
-	gpointer hash_key = GUINT_TO_POINTER(key);
-	gint *val_ptr = g_hash_table_lookup(self->hash, hash_key);
-	if (val_ptr == NULL) {
-		val_ptr = g_new0(gint, 1);
-		g_hash_table_insert(self->hash, hash_key, val_ptr);
-		g_debug("cache add new %s=%i", sbu_device_key_to_string(key), val);
-	}
-
-	/* emit and THEN save new value so we can get the old value */
-	g_signal_emit(self, signals[SIGNAL_CHANGED], 0, key, val);
-	*val_ptr = val;
-}
-
 gint
 sbu_msx_device_get_value(SbuMsxDevice *self, SbuMsxDeviceKey key)
 {
-	gpointer hash_key = GUINT_TO_POINTER(key);
-	gint *val_ptr = g_hash_table_lookup(self->hash, hash_key);
-	if (val_ptr == NULL)
-		return 0;
-	return *val_ptr;
+	g_return_val_if_fail(SBU_IS_MSX_DEVICE(self), 0);
+	g_return_val_if_fail(key < SBU_MSX_DEVICE_KEY_LAST, 0);
+	return self->values.vals[key];
 }
 
-static gboolean
-sbu_msx_device_buffer_parse(SbuMsxDevice *self,
-			    GBytes *response,
-			    MsxDeviceBufferOffsets *offsets,
-			    GError **error)
+SbuMsxTransport *
+sbu_msx_device_get_transport(SbuMsxDevice *self)
 {
-	const gchar *data;
-	gsize len = 0;
-	guint i;
-
-	/* check the size */
-	for (i = 0; offsets[i].key != SBU_MSX_DEVICE_KEY_UNKNOWN; i++)
-		;
-	data = g_bytes_get_data(response, &len);
-	if (len < offsets[i].off) {
-		g_set_error(error,
-			    G_IO_ERROR,
-			    G_IO_ERROR_FAILED,
-			    "got %" G_GSIZE_FORMAT " bytes, expected %" G_GSIZE_FORMAT,
-			    len,
-			    offsets[i].off);
-		return FALSE;
-	}
-
-	/* parse each value */
-	for (i = 0; offsets[i].key != SBU_MSX_DEVICE_KEY_UNKNOWN; i++) {
-		gint val = sbu_msx_common_parse_int(data, offsets[i].off, len, error);
-		if (val == G_MAXINT) {
-			g_prefix_error(error,
-				       "failed to parse %s @%02x: ",
-				       sbu_device_key_to_string(offsets[i].key),
-				       (guint)offsets[i].off);
-			return FALSE;
-		}
-		sbu_msx_device_emit_changed(self, offsets[i].key, val);
-	}
-	return TRUE;
+	g_return_val_if_fail(SBU_IS_MSX_DEVICE(self), NULL);
+	return self->transport;
 }
 
-static gboolean
-sbu_msx_device_buffer_parse_bits(SbuMsxDevice *self,
-				 GBytes *response,
-				 MsxDeviceBufferOffsets *offsets,
-				 GError **error)
-{
-	/* parse each value */
-	const gchar *data = g_bytes_get_data(response, NULL);
-	for (guint i = 0; offsets[i].key != SBU_MSX_DEVICE_KEY_UNKNOWN; i++) {
-		if (data[offsets[i].off] == '0') {
-			sbu_msx_device_emit_changed(self, offsets[i].key, 0);
-		} else if (data[offsets[i].off] == '1') {
-			sbu_msx_device_emit_changed(self, offsets[i].key, 1);
-		} else {
-			g_set_error(error,
-				    G_IO_ERROR,
-				    G_IO_ERROR_FAILED,
-				    "failed to parse %s @%02x: %c",
-				    sbu_device_key_to_string(offsets[i].key),
-				    (guint)offsets[i].off,
-				    data[offsets[i].off]);
-			return FALSE;
-		}
-	}
-	return TRUE;
+/* the new values are all saved first, and then ::frame-changed is emitted
+ * once with just the keys that are new or have a different value, so the
+ * handlers see a consistent frame and the parse time does not include them */
+static void
+sbu_msx_device_update_values(SbuMsxDevice *self, const SbuMsxPi30Values *values)
+{
+	gint64 ts_start = g_get_monotonic_time();
+	gboolean any_changed = FALSE;
+	SbuMsxPi30Values changed;
+
+	sbu_msx_pi30_values_init(&changed);
+	for (guint i = SBU_MSX_DEVICE_KEY_UNKNOWN + 1; i < SBU_MSX_DEVICE_KEY_LAST; i++) {
+		if (!sbu_msx_pi30_values_has(values, i))
+			continue;
+		if (values->vals[i] == self->values.vals[i] &&
+		    sbu_msx_pi30_values_has(&self->values, i))
+			continue;
+		sbu_msx_pi30_values_set(&self->values, i, values->vals[i]);
+		sbu_msx_pi30_values_set(&changed, i, values->vals[i]);
+		sbu_device_set_metadata(SBU_DEVICE(self),
+					sbu_device_key_to_string(i),
+					values->vals[i]);
+		any_changed = TRUE;
+	}
+	if (any_changed)
+		g_signal_emit(self, signals[SIGNAL_FRAME_CHANGED], 0, &changed);
+	sbu_stats_histogram_record(self->stats_changed, ts_start);
 }
 
 static gboolean
-sbu_msx_device_ensure_device_rating(SbuMsxDevice *self, GError **error)
+sbu_msx_device_parse_device_rating(SbuMsxDevice *self, GBytes *response, GError **error)
 {
-	g_autoptr(GBytes) response = NULL;
-	MsxDeviceBufferOffsets buffer_offsets[] = {
-	    {0x00, SBU_MSX_DEVICE_KEY_GRID_RATING_VOLTAGE},
-	    {0x06, SBU_MSX_DEVICE_KEY_GRID_RATING_CURRENT},
-	    {0x0b, SBU_MSX_DEVICE_KEY_AC_OUTPUT_RATING_VOLTAGE},
-	    {0x11, SBU_MSX_DEVICE_KEY_AC_OUTPUT_RATING_FREQUENCY},
-	    {0x16, SBU_MSX_DEVICE_KEY_AC_OUTPUT_RATING_CURRENT},
-	    {0x1b, SBU_MSX_DEVICE_KEY_AC_OUTPUT_RATING_APPARENT_POWER},
-	    {0x20, SBU_MSX_DEVICE_KEY_AC_OUTPUT_RATING_ACTIVE_POWER},
-	    {0x25, SBU_MSX_DEVICE_KEY_BATTERY_RATING_VOLTAGE},
-	    {0x2a, SBU_MSX_DEVICE_KEY_BATTERY_RECHARGE_VOLTAGE},
-	    {0x2f, SBU_MSX_DEVICE_KEY_BATTERY_UNDER_VOLTAGE},
-	    {0x34, SBU_MSX_DEVICE_KEY_BATTERY_BULK_VOLTAGE},
-	    {0x39, SBU_MSX_DEVICE_KEY_BATTERY_FLOAT_VOLTAGE},
-	    {0x3e, SBU_MSX_DEVICE_KEY_BATTERY_TYPE},
-	    {0x40, SBU_MSX_DEVICE_KEY_PRESENT_MAX_AC_CHARGING_CURRENT},
-	    {0x43, SBU_MSX_DEVICE_KEY_PRESENT_MAX_CHARGING_CURRENT},
-	    {0x46, SBU_MSX_DEVICE_KEY_INPUT_VOLTAGE_RANGE},
-	    {0x48, SBU_MSX_DEVICE_KEY_OUTPUT_SOURCE_PRIORITY},
-	    {0x4a, SBU_MSX_DEVICE_KEY_CHARGER_SOURCE_PRIORITY},
-	    {0x4c, SBU_MSX_DEVICE_KEY_PARALLEL_MAX_NUM},
-	    {0x4e, SBU_MSX_DEVICE_KEY_MACHINE_TYPE},
-	    {0x51, SBU_MSX_DEVICE_KEY_TOPOLOGY},
-	    {0x53, SBU_MSX_DEVICE_KEY_OUTPUT_MODE},
-	    {0x55, SBU_MSX_DEVICE_KEY_BATTERY_REDISCHARGE_VOLTAGE},
-	    {0x5a, SBU_MSX_DEVICE_KEY_PV_OK_CONDITION_FOR_PARALLEL},
-	    {0x5c, SBU_MSX_DEVICE_KEY_PV_POWER_BALANCE},
-	    {0x5d, SBU_MSX_DEVICE_KEY_UNKNOWN}};
-
-	/* parse the data buffer */
-	response = sbu_msx_device_send_command(self, "QPIRI", error);
-	if (response == NULL) {
-		g_prefix_error(error, "failed to get device rating: ");
-		return FALSE;
-	}
-	if (!sbu_msx_device_buffer_parse(self, response, buffer_offsets, error)) {
+	gint64 ts_start = g_get_monotonic_time();
+	gsize len = 0;
+	const gchar *data = g_bytes_get_data(response, &len);
+	SbuMsxPi30Values values;
+
+	if (!sbu_msx_pi30_parse_qpiri(data, len, &values, error)) {
 		g_prefix_error(error, "QPIRI data invalid: ");
 		return FALSE;
 	}
+	sbu_stats_histogram_record(self->stats_parse, ts_start);
+	sbu_msx_device_update_values(self, &values);
 	return TRUE;
 }
 
 static gboolean
-sbu_msx_device_ensure_device_flags(SbuMsxDevice *self, GError **error)
+sbu_msx_device_parse_device_flags(SbuMsxDevice *self, GBytes *response, GError **error)
 {
 	const gchar *data;
 	gint val = 1;
 	gsize len = 0;
-	g_autoptr(GBytes) response = NULL;
-
-	/* send request */
-	response = sbu_msx_device_send_command(self, "QFLAG", error);
-	if (response == NULL) {
-		g_prefix_error(error, "failed to get device rating: ");
-		return FALSE;
-	}
+	SbuMsxPi30Values values;
 
 	/* check the size */
 	data = g_bytes_get_data(response, &len);
@@ -433,6 +402,7 @@ sbu_msx_device_ensure_device_flags(SbuMsxDevice *self, GError **error)
 	}
 
 	/* parse */
+	sbu_msx_pi30_values_init(&values);
 	for (gsize i = 0; i < len; i++) {
 		switch (data[i]) {
 		case 'D':
@@ -442,57 +412,54 @@ sbu_msx_device_ensure_device_flags(SbuMsxDevice *self, GError **error)
 			val = 1;
 			break;
 		case 'a':
-			sbu_msx_device_emit_changed(self, SBU_MSX_DEVICE_KEY_ENABLE_BUZZER, val);
+			sbu_msx_pi30_values_set(&values, SBU_MSX_DEVICE_KEY_ENABLE_BUZZER, val);
 			break;
 		case 'b':
-			sbu_msx_device_emit_changed(self,
-						    SBU_MSX_DEVICE_KEY_OVERLOAD_BYPASS_FUNCTION,
-						    val);
+			sbu_msx_pi30_values_set(&values,
+						SBU_MSX_DEVICE_KEY_OVERLOAD_BYPASS_FUNCTION,
+						val);
 			break;
 		case 'j':
-			sbu_msx_device_emit_changed(self, SBU_MSX_DEVICE_KEY_POWER_SAVE, val);
+			sbu_msx_pi30_values_set(&values, SBU_MSX_DEVICE_KEY_POWER_SAVE, val);
 			break;
 		case 'k':
-			sbu_msx_device_emit_changed(self,
-						    SBU_MSX_DEVICE_KEY_LCD_DISPLAY_ESCAPE,
-						    val);
+			sbu_msx_pi30_values_set(&values,
+						SBU_MSX_DEVICE_KEY_LCD_DISPLAY_ESCAPE,
+						val);
 			break;
 		case 'u':
-			sbu_msx_device_emit_changed(self, SBU_MSX_DEVICE_KEY_OVERLOAD_RESTART, val);
+			sbu_msx_pi30_values_set(&values, SBU_MSX_DEVICE_KEY_OVERLOAD_RESTART, val);
 			break;
 		case 'v':
-			sbu_msx_device_emit_changed(self,
-						    SBU_MSX_DEVICE_KEY_OVER_TEMPERATURE_RESTART,
-						    val);
+			sbu_msx_pi30_values_set(&values,
+						SBU_MSX_DEVICE_KEY_OVER_TEMPERATURE_RESTART,
+						val);
 			break;
 		case 'x':
-			sbu_msx_device_emit_changed(self, SBU_MSX_DEVICE_KEY_LCD_BACKLIGHT, val);
+			sbu_msx_pi30_values_set(&values, SBU_MSX_DEVICE_KEY_LCD_BACKLIGHT, val);
 			break;
 		case 'y':
-			sbu_msx_device_emit_changed(
-			    self,
-			    SBU_MSX_DEVICE_KEY_ALARM_PRIMARY_SOURCE_INTERRUPT,
-			    val);
+			sbu_msx_pi30_values_set(&values,
+						SBU_MSX_DEVICE_KEY_ALARM_PRIMARY_SOURCE_INTERRUPT,
+						val);
 			break;
 		case 'z':
-			sbu_msx_device_emit_changed(self,
-						    SBU_MSX_DEVICE_KEY_FAULT_CODE_RECORD,
-						    val);
+			sbu_msx_pi30_values_set(&values, SBU_MSX_DEVICE_KEY_FAULT_CODE_RECORD, val);
 			break;
 		default:
 			g_warning("failed to parse flag '%c'", data[i]);
 			break;
 		}
 	}
+	sbu_msx_device_update_values(self, &values);
 	return TRUE;
 }
 
 static gboolean
-sbu_msx_device_ensure_device_warning_status(SbuMsxDevice *self, GError **error)
+sbu_msx_device_parse_device_warning_status(SbuMsxDevice *self, GBytes *response, GError **error)
 {
 	const gchar *data;
 	gsize len = 0;
-	g_autoptr(GBytes) response = NULL;
 	struct {
 		gboolean is_fault;
 		const gchar *msg;
@@ -530,13 +497,6 @@ sbu_msx_device_ensure_device_warning_status(SbuMsxDevice *self, GError **error)
 			   {TRUE, "Reserved"},
 			   {FALSE, NULL}};
 
-	/* send request */
-	response = sbu_msx_device_send_command(self, "QPIWS", error);
-	if (response == NULL) {
-		g_prefix_error(error, "failed to get device rating: ");
-		return FALSE;
-	}
-
 	/* check the size */
 	data = g_bytes_get_data(response, &len);
 	if (len != 32) {
@@ -566,60 +526,68 @@ sbu_msx_device_ensure_device_warning_status(SbuMsxDevice *self, GError **error)
 }
 
 static gboolean
-sbu_msx_device_ensure_device_general_status(SbuMsxDevice *self, GError **error)
+sbu_msx_device_parse_device_general_status(SbuMsxDevice *self, GBytes *response, GError **error)
 {
-	g_autoptr(GBytes) response = NULL;
-	MsxDeviceBufferOffsets buffer_offsets[] = {
-	    {0x00, SBU_MSX_DEVICE_KEY_GRID_VOLTAGE},
-	    {0x06, SBU_MSX_DEVICE_KEY_GRID_FREQUENCY},
-	    {0x0b, SBU_MSX_DEVICE_KEY_AC_OUTPUT_VOLTAGE},
-	    {0x11, SBU_MSX_DEVICE_KEY_AC_OUTPUT_FREQUENCY},
-	    {0x16, SBU_MSX_DEVICE_KEY_AC_OUTPUT_POWER},
-	    {0x1b, SBU_MSX_DEVICE_KEY_AC_OUTPUT_ACTIVE_POWER},
-	    {0x20, SBU_MSX_DEVICE_KEY_MAXIMUM_POWER_PERCENTAGE},
-	    {0x24, SBU_MSX_DEVICE_KEY_BUS_VOLTAGE},
-	    {0x28, SBU_MSX_DEVICE_KEY_BATTERY_VOLTAGE},
-	    {0x2e, SBU_MSX_DEVICE_KEY_BATTERY_CURRENT},
-	    {0x32, SBU_MSX_DEVICE_KEY_BATTERY_CAPACITY},
-	    {0x36, SBU_MSX_DEVICE_KEY_INVERTER_HEATSINK_TEMPERATURE},
-	    {0x3b, SBU_MSX_DEVICE_KEY_PV_INPUT_CURRENT_FOR_BATTERY},
-	    {0x40, SBU_MSX_DEVICE_KEY_PV_INPUT_VOLTAGE},
-	    {0x46, SBU_MSX_DEVICE_KEY_BATTERY_VOLTAGE_FROM_SCC},
-	    {0x4c, SBU_MSX_DEVICE_KEY_BATTERY_DISCHARGE_CURRENT},
-	    {0x5b, SBU_MSX_DEVICE_KEY_BATTERY_VOLTAGE_OFFSET_FOR_FANS},
-	    {0x5e, SBU_MSX_DEVICE_KEY_EEPROM_VERSION},
-	    {0x61, SBU_MSX_DEVICE_KEY_PV_CHARGING_POWER},
-	    {0x6a, SBU_MSX_DEVICE_KEY_UNKNOWN}};
-	MsxDeviceBufferOffsets buffer_bits[] = {
-	    {0x52, SBU_MSX_DEVICE_KEY_ADD_SBU_PRIORITY_VERSION},
-	    {0x53, SBU_MSX_DEVICE_KEY_CONFIGURATION_STATUS_CHANGE},
-	    {0x54, SBU_MSX_DEVICE_KEY_SCC_FIRMWARE_VERSION_UPDATED},
-	    {0x55, SBU_MSX_DEVICE_KEY_LOAD_STATUS_ON},
-	    {0x56, SBU_MSX_DEVICE_KEY_BATTERY_VOLTAGE_TO_STEADY_WHILE_CHARGING},
-	    {0x57, SBU_MSX_DEVICE_KEY_CHARGING_ON},
-	    {0x58, SBU_MSX_DEVICE_KEY_CHARGING_ON_SOLAR},
-	    {0x59, SBU_MSX_DEVICE_KEY_CHARGING_ON_AC},
-	    {0x6a, SBU_MSX_DEVICE_KEY_UNKNOWN}};
-#if 0
-	MsxDeviceBufferOffsets device_bits[] = {{0x67, SBU_MSX_DEVICE_KEY_CHARGING_TO_FLOATING_MODE},
-						{0x68, SBU_MSX_DEVICE_KEY_SWITCH_ON},
-						{0x6a, SBU_MSX_DEVICE_KEY_UNKNOWN}};
-#endif
-
-	/* parse the data buffer */
-	response = sbu_msx_device_send_command(self, "QPIGS", error);
-	if (response == NULL) {
-		g_prefix_error(error, "failed to get device rating: ");
+	gint64 ts_start = g_get_monotonic_time();
+	gsize len = 0;
+	const gchar *data = g_bytes_get_data(response, &len);
+	SbuMsxDeviceKey config_status_key = SBU_MSX_DEVICE_KEY_CONFIGURATION_STATUS_CHANGE;
+	gboolean has_config_status = sbu_msx_pi30_values_has(&self->values, config_status_key);
+	gint config_status = sbu_msx_device_get_value(self, config_status_key);
+	SbuMsxPi30Values values;
+
+	if (!sbu_msx_pi30_parse_qpigs(data, len, &values, error)) {
+		g_prefix_error(error, "QPIGS data invalid: ");
 		return FALSE;
 	}
-	if (!sbu_msx_device_buffer_parse(self, response, buffer_offsets, error)) {
-		g_prefix_error(error, "QPIGS data invalid: ");
+	sbu_stats_histogram_record(self->stats_parse, ts_start);
+	sbu_msx_device_update_values(self, &values);
+
+	/* the settings were changed on the front panel, so read them again */
+	if (has_config_status &&
+	    config_status != sbu_msx_device_get_value(self, config_status_key)) {
+		g_debug("configuration status changed, rescheduling QPIRI and QFLAG");
+		self->cmd_due[SBU_MSX_DEVICE_CMD_QPIRI] = 0;
+		self->cmd_due[SBU_MSX_DEVICE_CMD_QFLAG] = 0;
+	}
+	return TRUE;
+}
+
+static gboolean
+sbu_msx_device_parse_parallel_status(SbuMsxDevice *self, GBytes *response, GError **error)
+{
+	gint64 ts_start = g_get_monotonic_time();
+	gsize len = 0;
+	gsize serial_len;
+	const gchar *data = g_bytes_get_data(response, &len);
+	const gchar *serial = sbu_device_get_serial_number(SBU_DEVICE(self));
+	const gchar *serial_end;
+	SbuMsxPi30Values values;
+
+	/* the group has fewer units than the maximum */
+	if (len < 2 || data[0] != '1') {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_NOT_FOUND,
+			    "no unit %i in the parallel group",
+			    self->unit);
 		return FALSE;
 	}
-	if (!sbu_msx_device_buffer_parse_bits(self, response, buffer_bits, error)) {
-		g_prefix_error(error, "QPIGS data invalid: ");
+	if (!sbu_msx_pi30_parse_qpgs(data, len, &values, error)) {
+		g_prefix_error(error, "%s data invalid: ", self->cmd_qpgs);
 		return FALSE;
 	}
+	sbu_stats_histogram_record(self->stats_parse, ts_start);
+
+	/* a unit can be replaced without the link changing */
+	serial_end = memchr(data + 2, ' ', len - 2);
+	serial_len = serial_end != NULL ? (gsize)(serial_end - (data + 2)) : 0;
+	if (serial == NULL || strlen(serial) != serial_len ||
+	    memcmp(serial, data + 2, serial_len) != 0) {
+		g_autofree gchar *tmp = g_strndup(data + 2, serial_len);
+		sbu_device_set_serial_number(SBU_DEVICE(self), tmp);
+	}
+	sbu_msx_device_update_values(self, &values);
 	return TRUE;
 }
 
@@ -634,7 +602,7 @@ sbu_msx_device_remove_leading_zeros(const gchar *val)
 }
 
 static gboolean
-sbu_msx_device_ensure_firmware_versions(SbuMsxDevice *self, GError **error)
+sbu_msx_device_ensure_firmware_versions(SbuMsxDevice *self, GCancellable *cancellable, GError **error)
 {
 	gconstpointer data;
 	gsize len = 0;
@@ -645,7 +613,7 @@ sbu_msx_device_ensure_firmware_versions(SbuMsxDevice *self, GError **error)
 	g_autoptr(GBytes) response2 = NULL;
 
 	/* main CPU firmware version inquiry */
-	response1 = sbu_msx_device_send_command(self, "QVFW", error);
+	response1 = sbu_msx_device_send_command(self, "QVFW", NULL, cancellable, error);
 	if (response1 == NULL) {
 		g_prefix_error(error, "failed to get CPU version: ");
 		return FALSE;
@@ -662,7 +630,7 @@ sbu_msx_device_ensure_firmware_versions(SbuMsxDevice *self, GError **error)
 	fwver1 = g_strndup((const gchar *)data + 6, 8);
 
 	/* secondary CPU firmware version inquiry */
-	response2 = sbu_msx_device_send_command(self, "QVFW2", error);
+	response2 = sbu_msx_device_send_command(self, "QVFW2", NULL, cancellable, error);
 	if (response2 == NULL) {
 		g_prefix_error(error, "failed to get CPU version: ");
 		return FALSE;
@@ -686,69 +654,200 @@ sbu_msx_device_ensure_firmware_versions(SbuMsxDevice *self, GError **error)
 	return TRUE;
 }
 
+typedef gboolean (*SbuMsxDeviceParseFunc)(SbuMsxDevice *self, GBytes *response, GError **error);
+
+/* QPIGS has the live values and is sent every cycle, everything else is
+ * sent at startup and then on a slower schedule -- the other units in a
+ * parallel group only have QPGSn sent, every cycle */
+static const struct {
+	const gchar *cmd;
+	SbuMsxDeviceParseFunc func;
+	guint interval; /* s, or 0 for every cycle */
+} sbu_msx_device_refresh_cmds[] = {
+    [SBU_MSX_DEVICE_CMD_QPIRI] = {"QPIRI",
+				  sbu_msx_device_parse_device_rating,
+				  SBU_MSX_DEVICE_SETTINGS_INTERVAL},
+    [SBU_MSX_DEVICE_CMD_QPIGS] = {"QPIGS", sbu_msx_device_parse_device_general_status, 0},
+    [SBU_MSX_DEVICE_CMD_QFLAG] = {"QFLAG",
+				  sbu_msx_device_parse_device_flags,
+				  SBU_MSX_DEVICE_SETTINGS_INTERVAL},
+    [SBU_MSX_DEVICE_CMD_QPIWS] = {"QPIWS",
+				  sbu_msx_device_parse_device_warning_status,
+				  SBU_MSX_DEVICE_WARNING_STATUS_INTERVAL},
+    [SBU_MSX_DEVICE_CMD_QPGS] = {NULL, sbu_msx_device_parse_parallel_status, 0},
+};
+
+static const gchar *
+sbu_msx_device_refresh_cmd(SbuMsxDevice *self, SbuMsxDeviceCmd idx)
+{
+	if (idx == SBU_MSX_DEVICE_CMD_QPGS)
+		return self->cmd_qpgs;
+	return sbu_msx_device_refresh_cmds[idx].cmd;
+}
+
+static const SbuMsxDeviceStats *
+sbu_msx_device_refresh_stats(SbuMsxDevice *self, SbuMsxDeviceCmd idx)
+{
+	SbuMsxDeviceStats *stats = &self->cmd_stats[idx];
+	if (stats->latency == NULL)
+		sbu_msx_device_stats_init(stats, sbu_msx_device_refresh_cmd(self, idx));
+	return stats;
+}
+
+/* returns the next command that is due, or SBU_MSX_DEVICE_CMD_LAST */
+static SbuMsxDeviceCmd
+sbu_msx_device_refresh_next_due(SbuMsxDevice *self, SbuMsxDeviceCmd idx)
+{
+	gint64 now = g_get_monotonic_time();
+	for (; idx < SBU_MSX_DEVICE_CMD_LAST; idx++) {
+		if ((idx == SBU_MSX_DEVICE_CMD_QPGS) != (self->unit >= 0))
+			continue;
+		if (self->cmd_due[idx] <= now)
+			break;
+	}
+	return idx;
+}
+
+/* failed commands are left due so they are retried next cycle */
 static gboolean
-sbu_msx_device_refresh(SbuDevice *device, GError **error)
+sbu_msx_device_refresh_parse(SbuMsxDevice *self,
+			     SbuMsxDeviceCmd idx,
+			     GBytes *response,
+			     GError **error)
 {
-	SbuMsxDevice *self = SBU_MSX_DEVICE(device);
-	if (!sbu_msx_device_ensure_device_rating(self, error))
-		return FALSE;
-	if (!sbu_msx_device_ensure_device_general_status(self, error))
-		return FALSE;
-	if (!sbu_msx_device_ensure_device_flags(self, error))
-		return FALSE;
-	if (!sbu_msx_device_ensure_device_warning_status(self, error))
+	guint interval = sbu_msx_device_refresh_cmds[idx].interval;
+	if (!sbu_msx_device_refresh_cmds[idx].func(self, response, error))
 		return FALSE;
+	if (interval > 0)
+		self->cmd_due[idx] = g_get_monotonic_time() + (gint64)interval * G_USEC_PER_SEC;
 	return TRUE;
 }
 
+/* values are emitted as each command completes, so anything parsed before a
+ * failure or cancellation is kept */
+static gboolean
+sbu_msx_device_refresh(SbuDevice *device, GCancellable *cancellable, GError **error)
+{
+	SbuMsxDevice *self = SBU_MSX_DEVICE(device);
+	for (SbuMsxDeviceCmd idx = sbu_msx_device_refresh_next_due(self, 0);
+	     idx < SBU_MSX_DEVICE_CMD_LAST;
+	     idx = sbu_msx_device_refresh_next_due(self, idx + 1)) {
+		const gchar *cmd = sbu_msx_device_refresh_cmd(self, idx);
+		g_autoptr(GBytes) response = NULL;
+		response = sbu_msx_device_send_command(self,
+						       cmd,
+						       sbu_msx_device_refresh_stats(self, idx),
+						       cancellable,
+						       error);
+		if (response == NULL) {
+			g_prefix_error(error, "failed to send %s: ", cmd);
+			return FALSE;
+		}
+		if (!sbu_msx_device_refresh_parse(self, idx, response, error))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+sbu_msx_device_refresh_next(GTask *task);
+
+static void
+sbu_msx_device_refresh_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuMsxDevice *self = SBU_MSX_DEVICE(source);
+	g_autoptr(GTask) task = G_TASK(user_data);
+	SbuMsxDeviceCmd idx = GPOINTER_TO_UINT(g_task_get_task_data(task));
+	g_autoptr(GBytes) response = NULL;
+	g_autoptr(GError) error = NULL;
+
+	response = sbu_msx_device_send_command_finish(self, res, &error);
+	if (response == NULL) {
+		g_prefix_error(&error,
+			       "failed to send %s: ",
+			       sbu_msx_device_refresh_cmd(self, idx));
+		g_task_return_error(task, g_steal_pointer(&error));
+		return;
+	}
+	if (!sbu_msx_device_refresh_parse(self, idx, response, &error)) {
+		g_task_return_error(task, g_steal_pointer(&error));
+		return;
+	}
+	idx = sbu_msx_device_refresh_next_due(self, idx + 1);
+	g_task_set_task_data(task, GUINT_TO_POINTER(idx), NULL);
+	sbu_msx_device_refresh_next(task);
+}
+
+static void
+sbu_msx_device_refresh_next(GTask *task)
+{
+	SbuMsxDevice *self = g_task_get_source_object(task);
+	SbuMsxDeviceCmd idx = GPOINTER_TO_UINT(g_task_get_task_data(task));
+
+	if (idx == SBU_MSX_DEVICE_CMD_LAST) {
+		g_task_return_boolean(task, TRUE);
+		return;
+	}
+	sbu_msx_device_send_command_async(self,
+					  sbu_msx_device_refresh_cmd(self, idx),
+					  sbu_msx_device_refresh_stats(self, idx),
+					  g_task_get_cancellable(task),
+					  sbu_msx_device_refresh_cb,
+					  g_object_ref(task));
+}
+
+static void
+sbu_msx_device_refresh_async(SbuDevice *device,
+			     GCancellable *cancellable,
+			     GAsyncReadyCallback callback,
+			     gpointer user_data)
+{
+	SbuMsxDevice *self = SBU_MSX_DEVICE(device);
+	g_autoptr(GTask) task = g_task_new(device, cancellable, callback, user_data);
+	g_task_set_source_tag(task, sbu_msx_device_refresh_async);
+	g_task_set_task_data(task,
+			     GUINT_TO_POINTER(sbu_msx_device_refresh_next_due(self, 0)),
+			     NULL);
+	sbu_msx_device_refresh_next(task);
+}
+
+static gboolean
+sbu_msx_device_refresh_finish(SbuDevice *device, GAsyncResult *res, GError **error)
+{
+	g_return_val_if_fail(g_task_is_valid(res, device), FALSE);
+	return g_task_propagate_boolean(G_TASK(res), error);
+}
+
 gboolean
 sbu_msx_device_open(SbuMsxDevice *self, GError **error)
 {
-	g_debug("opening device");
-	if (!g_usb_device_open(self->usb_device, error)) {
-		g_prefix_error(error, "failed to open self: ");
-		return FALSE;
-	}
+	GCancellable *cancellable = NULL;
+
+	/* the link is opened by the unit it is connected to */
+	if (self->unit >= 0)
+		return sbu_msx_device_refresh(SBU_DEVICE(self), cancellable, error);
 
-	g_debug("claiming interface");
-	if (!g_usb_device_claim_interface(self->usb_device,
-					  0x00,
-					  G_USB_DEVICE_CLAIM_INTERFACE_BIND_KERNEL_DRIVER,
-					  error)) {
-		g_prefix_error(error, "failed to claim interface: ");
+	if (!sbu_msx_transport_open(self->transport, error))
 		return FALSE;
-	}
 
 	/* rescan static things */
-	if (!sbu_msx_device_ensure_protocol(self, error))
+	if (!sbu_msx_device_ensure_protocol(self, cancellable, error))
 		return FALSE;
-	if (!sbu_msx_device_ensure_serial_number(self, error))
+	if (!sbu_msx_device_ensure_serial_number(self, cancellable, error))
 		return FALSE;
-	if (!sbu_msx_device_ensure_firmware_versions(self, error))
+	if (!sbu_msx_device_ensure_firmware_versions(self, cancellable, error))
 		return FALSE;
 
 	/* initial try */
-	return sbu_msx_device_refresh(SBU_DEVICE(self), error);
+	return sbu_msx_device_refresh(SBU_DEVICE(self), cancellable, error);
 }
 
 gboolean
 sbu_msx_device_close(SbuMsxDevice *self, GError **error)
 {
-	g_debug("releasing interface");
-	if (!g_usb_device_release_interface(self->usb_device,
-					    0x00,
-					    G_USB_DEVICE_CLAIM_INTERFACE_BIND_KERNEL_DRIVER,
-					    error)) {
-		g_prefix_error(error, "failed to claim interface: ");
-		return FALSE;
-	}
-
-	g_debug("closing device");
-	if (!g_usb_device_close(self->usb_device, error)) {
-		g_prefix_error(error, "failed to close self: ");
-		return FALSE;
-	}
-	return TRUE;
+	if (self->unit >= 0)
+		return TRUE;
+	return sbu_msx_transport_close(self->transport, error);
 }
 
 static void
@@ -756,8 +855,7 @@ sbu_msx_device_finalize(GObject *object)
 {
 	SbuMsxDevice *self = SBU_MSX_DEVICE(object);
 
-	g_object_unref(self->usb_device);
-	g_hash_table_unref(self->hash);
+	g_object_unref(self->transport);
 
 	G_OBJECT_CLASS(sbu_msx_device_parent_class)->finalize(object);
 }
@@ -765,7 +863,10 @@ sbu_msx_device_finalize(GObject *object)
 static void
 sbu_msx_device_init(SbuMsxDevice *self)
 {
-	self->hash = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+	sbu_msx_pi30_values_init(&self->values);
+	self->unit = -1;
+	self->stats_parse = sbu_stats_histogram_get("parse");
+	self->stats_changed = sbu_stats_histogram_get("signal:msx-changed");
 }
 
 static void
@@ -776,25 +877,47 @@ sbu_msx_device_class_init(SbuMsxDeviceClass *class)
 
 	object_class->finalize = sbu_msx_device_finalize;
 	device_class->refresh = sbu_msx_device_refresh;
+	device_class->refresh_async = sbu_msx_device_refresh_async;
+	device_class->refresh_finish = sbu_msx_device_refresh_finish;
 
-	signals[SIGNAL_CHANGED] = g_signal_new("changed",
-					       G_TYPE_FROM_CLASS(object_class),
-					       G_SIGNAL_RUN_LAST,
-					       0,
-					       NULL,
-					       NULL,
-					       g_cclosure_marshal_generic,
-					       G_TYPE_NONE,
-					       2,
-					       G_TYPE_UINT,
-					       G_TYPE_INT);
+	signals[SIGNAL_FRAME_CHANGED] = g_signal_new("frame-changed",
+						     G_TYPE_FROM_CLASS(object_class),
+						     G_SIGNAL_RUN_LAST,
+						     0,
+						     NULL,
+						     NULL,
+						     g_cclosure_marshal_VOID__POINTER,
+						     G_TYPE_NONE,
+						     1,
+						     G_TYPE_POINTER);
 }
 
 SbuMsxDevice *
-sbu_msx_device_new(GUsbDevice *usb_device)
+sbu_msx_device_new(SbuMsxTransport *transport)
 {
 	SbuMsxDevice *self;
 	self = g_object_new(SBU_TYPE_MSX_DEVICE, NULL);
-	self->usb_device = g_object_ref(usb_device);
+	self->transport = g_object_ref(transport);
 	return SBU_MSX_DEVICE(self);
 }
+
+/**
+ * sbu_msx_device_new_for_unit:
+ * @transport: the link to a unit in the same parallel group
+ * @unit: the unit number, from 0 to 8
+ *
+ * Creates a device for a unit in a parallel group, which shares the link of
+ * the unit it is connected to and is read using QPGSn.
+ *
+ * Returns: (transfer full): a #SbuMsxDevice
+ **/
+SbuMsxDevice *
+sbu_msx_device_new_for_unit(SbuMsxTransport *transport, guint unit)
+{
+	SbuMsxDevice *self;
+	g_return_val_if_fail(unit < 9, NULL);
+	self = sbu_msx_device_new(transport);
+	self->unit = unit;
+	g_snprintf(self->cmd_qpgs, sizeof(self->cmd_qpgs), "QPGS%u", unit);
+	return self;
+}
@@ -6,16 +6,19 @@
 
 #pragma once
 
-#include <gusb.h>
-
 #include "sbu-device.h"
 #include "sbu-msx-common.h"
+#include "sbu-msx-transport.h"
 
 #define SBU_TYPE_MSX_DEVICE sbu_msx_device_get_type()
 G_DECLARE_FINAL_TYPE(SbuMsxDevice, sbu_msx_device, SBU, MSX_DEVICE, SbuDevice)
 
 SbuMsxDevice *
-sbu_msx_device_new(GUsbDevice *usb_device);
+sbu_msx_device_new(SbuMsxTransport *transport);
+SbuMsxDevice *
+sbu_msx_device_new_for_unit(SbuMsxTransport *transport, guint unit);
+SbuMsxTransport *
+sbu_msx_device_get_transport(SbuMsxDevice *self);
 
 gboolean
 sbu_msx_device_close(SbuMsxDevice *self, GError **error);
@@ -0,0 +1,475 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+#include "sbu-msx-pi30.h"
+
+typedef struct {
+	SbuMsxDeviceKey key; /* or UNKNOWN to skip the field */
+	guint8 n_bits;	     /* 0 for a number, otherwise consecutive keys from @key */
+	const SbuMsxDeviceKey *bit_keys; /* nullable, used instead of consecutive keys */
+} SbuMsxPi30Field;
+
+#define SBU_MSX_PI30_QPIGS_FIELDS 21
+#define SBU_MSX_PI30_QPIRI_FIELDS 25
+#define SBU_MSX_PI30_QPGS_FIELDS  27
+
+/* fields are separated by a single space, in this order */
+static const SbuMsxPi30Field sbu_msx_pi30_qpigs_fields[] = {
+    {SBU_MSX_DEVICE_KEY_GRID_VOLTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_GRID_FREQUENCY, 0},
+    {SBU_MSX_DEVICE_KEY_AC_OUTPUT_VOLTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_AC_OUTPUT_FREQUENCY, 0},
+    {SBU_MSX_DEVICE_KEY_AC_OUTPUT_POWER, 0},
+    {SBU_MSX_DEVICE_KEY_AC_OUTPUT_ACTIVE_POWER, 0},
+    {SBU_MSX_DEVICE_KEY_MAXIMUM_POWER_PERCENTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_BUS_VOLTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_BATTERY_VOLTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_BATTERY_CURRENT, 0},
+    {SBU_MSX_DEVICE_KEY_BATTERY_CAPACITY, 0},
+    {SBU_MSX_DEVICE_KEY_INVERTER_HEATSINK_TEMPERATURE, 0},
+    {SBU_MSX_DEVICE_KEY_PV_INPUT_CURRENT_FOR_BATTERY, 0},
+    {SBU_MSX_DEVICE_KEY_PV_INPUT_VOLTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_BATTERY_VOLTAGE_FROM_SCC, 0},
+    {SBU_MSX_DEVICE_KEY_BATTERY_DISCHARGE_CURRENT, 0},
+    {SBU_MSX_DEVICE_KEY_ADD_SBU_PRIORITY_VERSION, 8}, /* b7..b0 */
+    {SBU_MSX_DEVICE_KEY_BATTERY_VOLTAGE_OFFSET_FOR_FANS, 0},
+    {SBU_MSX_DEVICE_KEY_EEPROM_VERSION, 0},
+    {SBU_MSX_DEVICE_KEY_PV_CHARGING_POWER, 0},
+    {SBU_MSX_DEVICE_KEY_UNKNOWN, 3}, /* b10..b8 */
+};
+G_STATIC_ASSERT(G_N_ELEMENTS(sbu_msx_pi30_qpigs_fields) == SBU_MSX_PI30_QPIGS_FIELDS);
+G_STATIC_ASSERT(SBU_MSX_DEVICE_KEY_CHARGING_ON_AC - SBU_MSX_DEVICE_KEY_ADD_SBU_PRIORITY_VERSION ==
+		8 - 1);
+
+static const SbuMsxPi30Field sbu_msx_pi30_qpiri_fields[] = {
+    {SBU_MSX_DEVICE_KEY_GRID_RATING_VOLTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_GRID_RATING_CURRENT, 0},
+    {SBU_MSX_DEVICE_KEY_AC_OUTPUT_RATING_VOLTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_AC_OUTPUT_RATING_FREQUENCY, 0},
+    {SBU_MSX_DEVICE_KEY_AC_OUTPUT_RATING_CURRENT, 0},
+    {SBU_MSX_DEVICE_KEY_AC_OUTPUT_RATING_APPARENT_POWER, 0},
+    {SBU_MSX_DEVICE_KEY_AC_OUTPUT_RATING_ACTIVE_POWER, 0},
+    {SBU_MSX_DEVICE_KEY_BATTERY_RATING_VOLTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_BATTERY_RECHARGE_VOLTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_BATTERY_UNDER_VOLTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_BATTERY_BULK_VOLTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_BATTERY_FLOAT_VOLTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_BATTERY_TYPE, 0},
+    {SBU_MSX_DEVICE_KEY_PRESENT_MAX_AC_CHARGING_CURRENT, 0},
+    {SBU_MSX_DEVICE_KEY_PRESENT_MAX_CHARGING_CURRENT, 0},
+    {SBU_MSX_DEVICE_KEY_INPUT_VOLTAGE_RANGE, 0},
+    {SBU_MSX_DEVICE_KEY_OUTPUT_SOURCE_PRIORITY, 0},
+    {SBU_MSX_DEVICE_KEY_CHARGER_SOURCE_PRIORITY, 0},
+    {SBU_MSX_DEVICE_KEY_PARALLEL_MAX_NUM, 0},
+    {SBU_MSX_DEVICE_KEY_MACHINE_TYPE, 0},
+    {SBU_MSX_DEVICE_KEY_TOPOLOGY, 0},
+    {SBU_MSX_DEVICE_KEY_OUTPUT_MODE, 0},
+    {SBU_MSX_DEVICE_KEY_BATTERY_REDISCHARGE_VOLTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_PV_OK_CONDITION_FOR_PARALLEL, 0},
+    {SBU_MSX_DEVICE_KEY_PV_POWER_BALANCE, 0},
+};
+G_STATIC_ASSERT(G_N_ELEMENTS(sbu_msx_pi30_qpiri_fields) == SBU_MSX_PI30_QPIRI_FIELDS);
+
+/* the inverter status of a unit in a parallel group, b7..b0 */
+static const SbuMsxDeviceKey sbu_msx_pi30_qpgs_status_keys[] = {
+    SBU_MSX_DEVICE_KEY_UNKNOWN, /* SCC ok */
+    SBU_MSX_DEVICE_KEY_CHARGING_ON_AC,
+    SBU_MSX_DEVICE_KEY_CHARGING_ON_SOLAR,
+    SBU_MSX_DEVICE_KEY_UNKNOWN, /* battery status */
+    SBU_MSX_DEVICE_KEY_UNKNOWN,
+    SBU_MSX_DEVICE_KEY_UNKNOWN, /* line loss */
+    SBU_MSX_DEVICE_KEY_LOAD_STATUS_ON,
+    SBU_MSX_DEVICE_KEY_CONFIGURATION_STATUS_CHANGE,
+};
+
+/* the totals for the whole group are not saved as they are the sum of the units */
+static const SbuMsxPi30Field sbu_msx_pi30_qpgs_fields[] = {
+    {SBU_MSX_DEVICE_KEY_UNKNOWN, 0}, /* unit exists */
+    {SBU_MSX_DEVICE_KEY_UNKNOWN, 0}, /* serial number */
+    {SBU_MSX_DEVICE_KEY_UNKNOWN, 0}, /* work mode */
+    {SBU_MSX_DEVICE_KEY_UNKNOWN, 0}, /* fault code */
+    {SBU_MSX_DEVICE_KEY_GRID_VOLTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_GRID_FREQUENCY, 0},
+    {SBU_MSX_DEVICE_KEY_AC_OUTPUT_VOLTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_AC_OUTPUT_FREQUENCY, 0},
+    {SBU_MSX_DEVICE_KEY_AC_OUTPUT_POWER, 0},
+    {SBU_MSX_DEVICE_KEY_AC_OUTPUT_ACTIVE_POWER, 0},
+    {SBU_MSX_DEVICE_KEY_MAXIMUM_POWER_PERCENTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_BATTERY_VOLTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_BATTERY_CURRENT, 0},
+    {SBU_MSX_DEVICE_KEY_BATTERY_CAPACITY, 0},
+    {SBU_MSX_DEVICE_KEY_PV_INPUT_VOLTAGE, 0},
+    {SBU_MSX_DEVICE_KEY_UNKNOWN, 0}, /* total charging current */
+    {SBU_MSX_DEVICE_KEY_UNKNOWN, 0}, /* total AC output apparent power */
+    {SBU_MSX_DEVICE_KEY_UNKNOWN, 0}, /* total AC output active power */
+    {SBU_MSX_DEVICE_KEY_UNKNOWN, 0}, /* total AC output percentage */
+    {SBU_MSX_DEVICE_KEY_UNKNOWN, 8, sbu_msx_pi30_qpgs_status_keys},
+    {SBU_MSX_DEVICE_KEY_OUTPUT_MODE, 0},
+    {SBU_MSX_DEVICE_KEY_CHARGER_SOURCE_PRIORITY, 0},
+    {SBU_MSX_DEVICE_KEY_PRESENT_MAX_CHARGING_CURRENT, 0},
+    {SBU_MSX_DEVICE_KEY_UNKNOWN, 0}, /* max charger range */
+    {SBU_MSX_DEVICE_KEY_PRESENT_MAX_AC_CHARGING_CURRENT, 0},
+    {SBU_MSX_DEVICE_KEY_PV_INPUT_CURRENT_FOR_BATTERY, 0},
+    {SBU_MSX_DEVICE_KEY_BATTERY_DISCHARGE_CURRENT, 0},
+};
+G_STATIC_ASSERT(G_N_ELEMENTS(sbu_msx_pi30_qpgs_fields) == SBU_MSX_PI30_QPGS_FIELDS);
+
+/**
+ * sbu_msx_pi30_crc:
+ * @buf: data, including the leading '(' for responses
+ * @len: size of @buf
+ *
+ * Calculates the CRC used by the PI30 protocol, where bytes that would be
+ * confused with the framing characters are incremented.
+ *
+ * Returns: the CRC, in host order
+ **/
+guint16
+sbu_msx_pi30_crc(const guint8 *buf, gsize len)
+{
+	guint16 crc = 0;
+	guint8 da;
+	guint8 crc_hi;
+	guint8 crc_lo;
+	static const guint16 crc_ta[16] = {0x0000,
+					   0x1021,
+					   0x2042,
+					   0x3063,
+					   0x4084,
+					   0x50a5,
+					   0x60c6,
+					   0x70e7,
+					   0x8108,
+					   0x9129,
+					   0xa14a,
+					   0xb16b,
+					   0xc18c,
+					   0xd1ad,
+					   0xe1ce,
+					   0xf1ef};
+
+	for (gsize i = 0; i < len; i++) {
+		da = ((guint8)(crc >> 8)) >> 4;
+		crc <<= 4;
+		crc ^= crc_ta[da ^ (buf[i] >> 4)];
+		da = ((guint8)(crc >> 8)) >> 4;
+		crc <<= 4;
+		crc ^= crc_ta[da ^ (buf[i] & 0x0f)];
+	}
+	crc_lo = crc;
+	crc_hi = (guint8)(crc >> 8);
+
+	if (crc_lo == 0x28 || crc_lo == 0x0d || crc_lo == 0x0a)
+		crc_lo++;
+	if (crc_hi == 0x28 || crc_hi == 0x0d || crc_hi == 0x0a)
+		crc_hi++;
+	return ((guint16)crc_hi) << 8 | crc_lo;
+}
+
+/**
+ * sbu_msx_pi30_encode:
+ * @cmd: a command, e.g. "QPIGS"
+ * @buf: a caller-provided buffer
+ * @bufsz: size of @buf
+ *
+ * Writes the command, the big endian CRC and the carriage return into @buf.
+ * The remainder of @buf is left untouched.
+ *
+ * Returns: the number of bytes written, or 0 if @buf is too small
+ **/
+gsize
+sbu_msx_pi30_encode(const gchar *cmd, guint8 *buf, gsize bufsz)
+{
+	gsize len = strlen(cmd);
+	guint16 crc;
+
+	if (len + 3 > bufsz)
+		return 0;
+	memcpy(buf, cmd, len);
+	crc = sbu_msx_pi30_crc(buf, len);
+	buf[len] = crc >> 8;
+	buf[len + 1] = crc & 0xff;
+	buf[len + 2] = '\r';
+	return len + 3;
+}
+
+/**
+ * sbu_msx_pi30_decode:
+ * @buf: a response frame, with or without the trailing carriage return
+ * @len: size of @buf
+ * @payload: (out): the data between the '(' and the CRC
+ * @payload_len: (out): size of @payload
+ * @error: a #GError, or %NULL
+ *
+ * Checks the framing and the CRC of a response. @payload points into @buf and
+ * is not NUL terminated.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_msx_pi30_decode(const guint8 *buf,
+		    gsize len,
+		    const gchar **payload,
+		    gsize *payload_len,
+		    GError **error)
+{
+	guint16 crc;
+
+	if (len > 0 && buf[len - 1] == '\r')
+		len--;
+	if (len < 3) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "response too short, got %" G_GSIZE_FORMAT " bytes",
+			    len);
+		return FALSE;
+	}
+
+	/* check checksum of recieved message */
+	crc = sbu_msx_pi30_crc(buf, len - 2);
+	if (buf[len - 2] != crc >> 8 || buf[len - 1] != (crc & 0xff)) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "failed checksum, expected %04x",
+			    crc);
+		return FALSE;
+	}
+
+	/* check first char */
+	if (buf[0] != '(') {
+		g_set_error_literal(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_DATA,
+				    "invalid response start, expected '('");
+		return FALSE;
+	}
+	*payload = (const gchar *)buf + 1;
+	*payload_len = len - 3;
+	return TRUE;
+}
+
+/**
+ * sbu_msx_pi30_values_init:
+ * @values: a #SbuMsxPi30Values
+ *
+ * Marks every value as unset, and sets it to zero.
+ **/
+void
+sbu_msx_pi30_values_init(SbuMsxPi30Values *values)
+{
+	memset(values, 0x00, sizeof(*values));
+}
+
+/**
+ * sbu_msx_pi30_values_has:
+ * @values: a #SbuMsxPi30Values
+ * @key: a #SbuMsxDeviceKey
+ *
+ * Finds out if the value for @key was set by the last parse.
+ *
+ * Returns: %TRUE if set
+ **/
+gboolean
+sbu_msx_pi30_values_has(const SbuMsxPi30Values *values, SbuMsxDeviceKey key)
+{
+	return (values->valid[key / 32] & (1u << (key % 32))) > 0;
+}
+
+/**
+ * sbu_msx_pi30_values_set:
+ * @values: a #SbuMsxPi30Values
+ * @key: a #SbuMsxDeviceKey
+ * @val: the new value
+ *
+ * Sets the value for @key and marks it as set.
+ **/
+void
+sbu_msx_pi30_values_set(SbuMsxPi30Values *values, SbuMsxDeviceKey key, gint val)
+{
+	values->vals[key] = val;
+	values->valid[key / 32] |= 1u << (key % 32);
+}
+
+static gboolean
+sbu_msx_pi30_parse_field(const SbuMsxPi30Field *field,
+			 const gchar *data,
+			 gsize off,
+			 gsize end,
+			 SbuMsxPi30Values *values,
+			 GError **error)
+{
+	gint val;
+
+	/* number, with the decimal point removed */
+	if (field->n_bits == 0) {
+		if (field->key == SBU_MSX_DEVICE_KEY_UNKNOWN)
+			return TRUE;
+		val = end > off ? sbu_msx_common_parse_int(data, off, end, NULL) : G_MAXINT;
+		if (val == G_MAXINT) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_DATA,
+				    "failed to parse %s @%02x",
+				    sbu_device_key_to_string(field->key),
+				    (guint)off);
+			return FALSE;
+		}
+		sbu_msx_pi30_values_set(values, field->key, val);
+		return TRUE;
+	}
+
+	/* a string of '0' and '1', most significant bit first */
+	if (end - off != field->n_bits) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "expected %u bits @%02x, got %u",
+			    (guint)field->n_bits,
+			    (guint)off,
+			    (guint)(end - off));
+		return FALSE;
+	}
+	for (guint i = 0; i < field->n_bits; i++) {
+		SbuMsxDeviceKey key = field->key;
+		gchar bit = data[off + i];
+		if (bit != '0' && bit != '1') {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_DATA,
+				    "failed to parse bit @%02x: %c",
+				    (guint)(off + i),
+				    bit);
+			return FALSE;
+		}
+		if (field->bit_keys != NULL)
+			key = field->bit_keys[i];
+		else if (key != SBU_MSX_DEVICE_KEY_UNKNOWN)
+			key += i;
+		if (key != SBU_MSX_DEVICE_KEY_UNKNOWN)
+			sbu_msx_pi30_values_set(values, key, bit == '1');
+	}
+	return TRUE;
+}
+
+/* one pass over the payload, splitting on the spaces -- any fields after the
+ * ones we know about are from newer firmware and are ignored */
+static gboolean
+sbu_msx_pi30_parse_fields(const SbuMsxPi30Field *fields,
+			  guint n_fields,
+			  const gchar *data,
+			  gsize len,
+			  SbuMsxPi30Values *values,
+			  GError **error)
+{
+	gsize off = 0;
+	guint idx = 0;
+
+	sbu_msx_pi30_values_init(values);
+	for (gsize i = 0; i <= len && idx < n_fields; i++) {
+		if (i < len && data[i] != ' ')
+			continue;
+		if (!sbu_msx_pi30_parse_field(&fields[idx], data, off, i, values, error))
+			return FALSE;
+		off = i + 1;
+		idx++;
+	}
+	if (idx < n_fields) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "got %u fields, expected %u",
+			    idx,
+			    n_fields);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * sbu_msx_pi30_parse_qpigs:
+ * @data: the payload of a QPIGS response
+ * @len: size of @data
+ * @values: a caller-provided #SbuMsxPi30Values
+ * @error: a #GError, or %NULL
+ *
+ * Parses the general status response without allocating.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_msx_pi30_parse_qpigs(const gchar *data, gsize len, SbuMsxPi30Values *values, GError **error)
+{
+	return sbu_msx_pi30_parse_fields(sbu_msx_pi30_qpigs_fields,
+					 G_N_ELEMENTS(sbu_msx_pi30_qpigs_fields),
+					 data,
+					 len,
+					 values,
+					 error);
+}
+
+/**
+ * sbu_msx_pi30_parse_qpiri:
+ * @data: the payload of a QPIRI response
+ * @len: size of @data
+ * @values: a caller-provided #SbuMsxPi30Values
+ * @error: a #GError, or %NULL
+ *
+ * Parses the device rating response without allocating.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_msx_pi30_parse_qpiri(const gchar *data, gsize len, SbuMsxPi30Values *values, GError **error)
+{
+	return sbu_msx_pi30_parse_fields(sbu_msx_pi30_qpiri_fields,
+					 G_N_ELEMENTS(sbu_msx_pi30_qpiri_fields),
+					 data,
+					 len,
+					 values,
+					 error);
+}
+
+/**
+ * sbu_msx_pi30_parse_qpgs:
+ * @data: the payload of a QPGSn response
+ * @len: size of @data
+ * @values: a caller-provided #SbuMsxPi30Values
+ * @error: a #GError, or %NULL
+ *
+ * Parses the status of one unit in a parallel group without allocating. The
+ * caller has to check the unit exists first.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_msx_pi30_parse_qpgs(const gchar *data, gsize len, SbuMsxPi30Values *values, GError **error)
+{
+	gint v;
+	gint a;
+
+	if (!sbu_msx_pi30_parse_fields(sbu_msx_pi30_qpgs_fields,
+				       G_N_ELEMENTS(sbu_msx_pi30_qpgs_fields),
+				       data,
+				       len,
+				       values,
+				       error))
+		return FALSE;
+
+	/* there is no PV power, so use the same units as QPIGS */
+	v = values->vals[SBU_MSX_DEVICE_KEY_PV_INPUT_VOLTAGE];
+	a = values->vals[SBU_MSX_DEVICE_KEY_PV_INPUT_CURRENT_FOR_BATTERY];
+	sbu_msx_pi30_values_set(values,
+				SBU_MSX_DEVICE_KEY_PV_CHARGING_POWER,
+				(gint)(((gint64)v * a) / 1000));
+	return TRUE;
+}
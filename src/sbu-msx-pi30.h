@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#pragma once
+
+#include "sbu-msx-common.h"
+
+/* largest frame that is reassembled, including the header and CRC */
+#define SBU_MSX_PI30_FRAME_MAX 256
+
+typedef struct {
+	gint vals[SBU_MSX_DEVICE_KEY_LAST];
+	guint32 valid[(SBU_MSX_DEVICE_KEY_LAST + 31) / 32];
+} SbuMsxPi30Values;
+
+guint16
+sbu_msx_pi30_crc(const guint8 *buf, gsize len);
+gsize
+sbu_msx_pi30_encode(const gchar *cmd, guint8 *buf, gsize bufsz);
+gboolean
+sbu_msx_pi30_decode(const guint8 *buf,
+		    gsize len,
+		    const gchar **payload,
+		    gsize *payload_len,
+		    GError **error);
+
+void
+sbu_msx_pi30_values_init(SbuMsxPi30Values *values);
+gboolean
+sbu_msx_pi30_values_has(const SbuMsxPi30Values *values, SbuMsxDeviceKey key);
+void
+sbu_msx_pi30_values_set(SbuMsxPi30Values *values, SbuMsxDeviceKey key, gint val);
+gboolean
+sbu_msx_pi30_parse_qpigs(const gchar *data, gsize len, SbuMsxPi30Values *values, GError **error);
+gboolean
+sbu_msx_pi30_parse_qpgs(const gchar *data, gsize len, SbuMsxPi30Values *values, GError **error);
+gboolean
+sbu_msx_pi30_parse_qpiri(const gchar *data, gsize len, SbuMsxPi30Values *values, GError **error);
@@ -8,16 +8,33 @@
 
 #include <config.h>
 
+#include <errno.h>
+#include <glib/gstdio.h>
+
+#include "sbu-config.h"
 #include "sbu-msx-device.h"
+#include "sbu-msx-pi30.h"
+#include "sbu-msx-transport-fd.h"
+#include "sbu-msx-transport-replay.h"
+#include "sbu-msx-transport-usb.h"
 
 struct _SbuMsxPlugin {
 	SbuPlugin parent_instance;
 	GUsbContext *usb_context;
 	GHashTable *devices;
+	gchar *capture_dir; /* nullable */
 };
 
 G_DEFINE_TYPE(SbuMsxPlugin, sbu_msx_plugin, SBU_TYPE_PLUGIN)
 
+typedef enum {
+	SBU_MSX_PLUGIN_UPDATE_NONE = 0,
+	SBU_MSX_PLUGIN_UPDATE_SOLAR_VOLTAGE = 1 << 0,
+	SBU_MSX_PLUGIN_UPDATE_BATTERY_POWER = 1 << 1,
+	SBU_MSX_PLUGIN_UPDATE_LINK_SOLAR_LOAD = 1 << 2,
+	SBU_MSX_PLUGIN_UPDATE_LINK_UTILITY_LOAD = 1 << 3,
+} SbuMsxPluginUpdate;
+
 static gdouble
 sbu_msx_val_to_double(gint value)
 {
@@ -88,8 +105,11 @@ sbu_msx_device_update_node_solar_voltage(SbuMsxDevice *device)
 	/* if the PWM voltage is nonzero, get the voltage as
 	 * applied to the battery */
 	gint v = sbu_msx_device_get_value(device, SBU_MSX_DEVICE_KEY_PV_INPUT_VOLTAGE);
-	if (v > 0)
-		v = sbu_msx_device_get_value(device, SBU_MSX_DEVICE_KEY_BATTERY_VOLTAGE_FROM_SCC);
+	gint v_scc = sbu_msx_device_get_value(device, SBU_MSX_DEVICE_KEY_BATTERY_VOLTAGE_FROM_SCC);
+
+	/* the other units in a parallel group do not report the SCC voltage */
+	if (v > 0 && v_scc > 0)
+		v = v_scc;
 	sbu_device_set_node_value(SBU_DEVICE(device),
 				  SBU_NODE_KIND_SOLAR,
 				  SBU_DEVICE_PROPERTY_VOLTAGE,
@@ -147,9 +167,13 @@ sbu_msx_device_update_link_utility_load(SbuMsxDevice *device)
 	sbu_msx_device_update_node_utility_power(device);
 }
 
-static void
-sbu_msx_device_changed_cb(SbuMsxDevice *device, SbuMsxDeviceKey key, gint value, SbuMsxPlugin *self)
+/* sets the nodes that map directly to one key, and returns the derived values
+ * that depend on it so they can be recalculated once the frame is applied */
+static SbuMsxPluginUpdate
+sbu_msx_plugin_apply_value(SbuMsxDevice *device, SbuMsxDeviceKey key, gint value)
 {
+	SbuMsxPluginUpdate updates = SBU_MSX_PLUGIN_UPDATE_NONE;
+
 	switch (key) {
 	case SBU_MSX_DEVICE_KEY_GRID_RATING_VOLTAGE:
 		sbu_device_set_node_value(SBU_DEVICE(device),
@@ -204,7 +228,7 @@ sbu_msx_device_changed_cb(SbuMsxDevice *device, SbuMsxDeviceKey key, gint value,
 					  SBU_NODE_KIND_UTILITY,
 					  SBU_DEVICE_PROPERTY_VOLTAGE,
 					  sbu_msx_val_to_double(value));
-		sbu_msx_device_update_link_utility_load(device);
+		updates |= SBU_MSX_PLUGIN_UPDATE_LINK_UTILITY_LOAD;
 		break;
 	case SBU_MSX_DEVICE_KEY_GRID_FREQUENCY:
 		sbu_device_set_node_value(SBU_DEVICE(device),
@@ -230,22 +254,22 @@ sbu_msx_device_changed_cb(SbuMsxDevice *device, SbuMsxDeviceKey key, gint value,
 					  SBU_NODE_KIND_LOAD,
 					  SBU_DEVICE_PROPERTY_POWER,
 					  MAX(sbu_msx_val_to_double(value), 20.f));
-		sbu_msx_device_update_link_solar_load(device);
-		sbu_msx_device_update_link_utility_load(device);
+		updates |= SBU_MSX_PLUGIN_UPDATE_LINK_SOLAR_LOAD;
+		updates |= SBU_MSX_PLUGIN_UPDATE_LINK_UTILITY_LOAD;
 		break;
 	case SBU_MSX_DEVICE_KEY_BATTERY_VOLTAGE:
 		sbu_device_set_node_value(SBU_DEVICE(device),
 					  SBU_NODE_KIND_BATTERY,
 					  SBU_DEVICE_PROPERTY_VOLTAGE,
 					  sbu_msx_val_to_double(value));
-		sbu_msx_device_update_node_battery_power(device);
+		updates |= SBU_MSX_PLUGIN_UPDATE_BATTERY_POWER;
 		break;
 	case SBU_MSX_DEVICE_KEY_BATTERY_CURRENT:
 		sbu_device_set_node_value(SBU_DEVICE(device),
 					  SBU_NODE_KIND_BATTERY,
 					  SBU_DEVICE_PROPERTY_CURRENT,
 					  -sbu_msx_val_to_double(value));
-		sbu_msx_device_update_node_battery_power(device);
+		updates |= SBU_MSX_PLUGIN_UPDATE_BATTERY_POWER;
 		break;
 	case SBU_MSX_DEVICE_KEY_PV_INPUT_CURRENT_FOR_BATTERY:
 		sbu_device_set_node_value(SBU_DEVICE(device),
@@ -253,9 +277,10 @@ sbu_msx_device_changed_cb(SbuMsxDevice *device, SbuMsxDeviceKey key, gint value,
 					  SBU_DEVICE_PROPERTY_CURRENT,
 					  sbu_msx_val_to_double(value));
 		break;
+	case SBU_MSX_DEVICE_KEY_PV_INPUT_VOLTAGE:
 	case SBU_MSX_DEVICE_KEY_BATTERY_VOLTAGE_FROM_SCC:
-		sbu_msx_device_update_node_solar_voltage(device);
-		sbu_msx_device_update_link_solar_load(device);
+		updates |= SBU_MSX_PLUGIN_UPDATE_SOLAR_VOLTAGE;
+		updates |= SBU_MSX_PLUGIN_UPDATE_LINK_SOLAR_LOAD;
 		break;
 	case SBU_MSX_DEVICE_KEY_PV_CHARGING_POWER:
 		sbu_device_set_node_value(SBU_DEVICE(device),
@@ -272,11 +297,11 @@ sbu_msx_device_changed_cb(SbuMsxDevice *device, SbuMsxDeviceKey key, gint value,
 					   SBU_NODE_KIND_BATTERY,
 					   SBU_NODE_KIND_LOAD,
 					   value >= 1);
-		sbu_msx_device_update_node_battery_power(device);
-		sbu_msx_device_update_link_utility_load(device);
+		updates |= SBU_MSX_PLUGIN_UPDATE_BATTERY_POWER;
+		updates |= SBU_MSX_PLUGIN_UPDATE_LINK_UTILITY_LOAD;
 		break;
 	case SBU_MSX_DEVICE_KEY_CHARGING_ON:
-		sbu_msx_device_update_link_solar_load(device);
+		updates |= SBU_MSX_PLUGIN_UPDATE_LINK_SOLAR_LOAD;
 		break;
 	case SBU_MSX_DEVICE_KEY_CHARGING_ON_SOLAR:
 		sbu_device_set_link_active(SBU_DEVICE(device),
@@ -312,7 +337,6 @@ sbu_msx_device_changed_cb(SbuMsxDevice *device, SbuMsxDeviceKey key, gint value,
 	case SBU_MSX_DEVICE_KEY_BUS_VOLTAGE:
 	case SBU_MSX_DEVICE_KEY_BATTERY_CAPACITY:
 	case SBU_MSX_DEVICE_KEY_INVERTER_HEATSINK_TEMPERATURE:
-	case SBU_MSX_DEVICE_KEY_PV_INPUT_VOLTAGE:
 	case SBU_MSX_DEVICE_KEY_ADD_SBU_PRIORITY_VERSION:
 	case SBU_MSX_DEVICE_KEY_CONFIGURATION_STATUS_CHANGE:
 	case SBU_MSX_DEVICE_KEY_SCC_FIRMWARE_VERSION_UPDATED:
@@ -337,7 +361,12 @@ sbu_msx_device_changed_cb(SbuMsxDevice *device, SbuMsxDeviceKey key, gint value,
 		g_warning("key %s=%i not handled", sbu_device_key_to_string(key), value);
 		break;
 	}
+	return updates;
+}
 
+static gboolean
+sbu_msx_plugin_key_is_metadata(SbuMsxDeviceKey key)
+{
 	/* save nearly every changed key until we have a stable API */
 	switch (key) {
 	case SBU_MSX_DEVICE_KEY_AC_OUTPUT_FREQUENCY:
@@ -349,23 +378,55 @@ sbu_msx_device_changed_cb(SbuMsxDevice *device, SbuMsxDeviceKey key, gint value,
 	case SBU_MSX_DEVICE_KEY_GRID_FREQUENCY:
 	case SBU_MSX_DEVICE_KEY_GRID_RATING_VOLTAGE:
 	case SBU_MSX_DEVICE_KEY_PV_INPUT_CURRENT_FOR_BATTERY:
-		break;
+		return FALSE;
 	default:
-		if (sbu_msx_device_get_value(device, key) != value) {
-			sbu_plugin_update_metadata(SBU_PLUGIN(self),
-						   SBU_DEVICE(device),
-						   sbu_device_key_to_string(key),
-						   value);
+		return TRUE;
+	}
+}
+
+static void
+sbu_msx_device_frame_changed_cb(SbuMsxDevice *device,
+				const SbuMsxPi30Values *changed,
+				SbuMsxPlugin *self)
+{
+	GVariantBuilder metadata;
+	SbuMsxPluginUpdate updates = SBU_MSX_PLUGIN_UPDATE_NONE;
+
+	/* each node and link only notifies once, after the whole frame, and the
+	 * metadata is saved to the database in one transaction */
+	sbu_device_begin_update(SBU_DEVICE(device));
+	g_variant_builder_init(&metadata, G_VARIANT_TYPE("a{si}"));
+	for (guint i = SBU_MSX_DEVICE_KEY_UNKNOWN + 1; i < SBU_MSX_DEVICE_KEY_LAST; i++) {
+		if (!sbu_msx_pi30_values_has(changed, i))
+			continue;
+		updates |= sbu_msx_plugin_apply_value(device, i, changed->vals[i]);
+		if (sbu_msx_plugin_key_is_metadata(i)) {
+			g_variant_builder_add(&metadata,
+					      "{si}",
+					      sbu_device_key_to_string(i),
+					      changed->vals[i]);
 		}
-		break;
 	}
+	sbu_plugin_update_metadata_values(SBU_PLUGIN(self),
+					  SBU_DEVICE(device),
+					  g_variant_builder_end(&metadata));
+
+	/* solar load reads the solar voltage, and utility load reads solar load */
+	if (updates & SBU_MSX_PLUGIN_UPDATE_SOLAR_VOLTAGE)
+		sbu_msx_device_update_node_solar_voltage(device);
+	if (updates & SBU_MSX_PLUGIN_UPDATE_BATTERY_POWER)
+		sbu_msx_device_update_node_battery_power(device);
+	if (updates & SBU_MSX_PLUGIN_UPDATE_LINK_SOLAR_LOAD)
+		sbu_msx_device_update_link_solar_load(device);
+	if (updates & SBU_MSX_PLUGIN_UPDATE_LINK_UTILITY_LOAD)
+		sbu_msx_device_update_link_utility_load(device);
+	sbu_device_commit_update(SBU_DEVICE(device));
 }
 
+/* values are emitted when opening, so this has to be done first */
 static void
-sbu_msx_plugin_device_added_cb(GUsbContext *context, GUsbDevice *usb_device, SbuMsxPlugin *self)
+sbu_msx_plugin_setup_device(SbuMsxPlugin *self, SbuMsxDevice *device)
 {
-	SbuMsxDevice *device;
-	g_autoptr(GError) error = NULL;
 	SbuNodeKind kinds[] = {SBU_NODE_KIND_SOLAR,
 			       SBU_NODE_KIND_BATTERY,
 			       SBU_NODE_KIND_UTILITY,
@@ -384,14 +445,6 @@ sbu_msx_plugin_device_added_cb(GUsbContext *context, GUsbDevice *usb_device, Sbu
 			       SBU_NODE_KIND_UNKNOWN,
 			       SBU_NODE_KIND_UNKNOWN};
 
-	if (g_usb_device_get_vid(usb_device) != 0x0665)
-		return;
-	if (g_usb_device_get_pid(usb_device) != 0x5161)
-		return;
-
-	/* create device */
-	device = sbu_msx_device_new(usb_device);
-	sbu_device_set_id(SBU_DEVICE(device), "msx");
 	for (guint i = 0; kinds[i] != SBU_NODE_KIND_UNKNOWN; i++) {
 		g_autoptr(SbuNode) n = sbu_node_new(kinds[i]);
 		sbu_device_add_node(SBU_DEVICE(device), n);
@@ -400,32 +453,181 @@ sbu_msx_plugin_device_added_cb(GUsbContext *context, GUsbDevice *usb_device, Sbu
 		g_autoptr(SbuLink) l = sbu_link_new(links[i], links[i + 1]);
 		sbu_device_add_link(SBU_DEVICE(device), l);
 	}
+	g_signal_connect(device,
+			 "frame-changed",
+			 G_CALLBACK(sbu_msx_device_frame_changed_cb),
+			 self);
+}
+
+static void
+sbu_msx_plugin_add_device(SbuMsxPlugin *self, SbuMsxDevice *device, const gchar *key)
+{
+	g_hash_table_insert(self->devices, g_strdup(key), g_object_ref(device));
+	sbu_plugin_add_device(SBU_PLUGIN(self), SBU_DEVICE(device));
+}
+
+/* the unit on the link answers QPGSn for every unit in the parallel group,
+ * including itself, and all of them are read over the same link -- units are
+ * only probed when the link is added, so one that is switched on later is
+ * not found until the link is added again */
+static void
+sbu_msx_plugin_add_parallel_units(SbuMsxPlugin *self, SbuMsxDevice *host)
+{
+	SbuMsxTransport *transport = sbu_msx_device_get_transport(host);
+	gint max = sbu_msx_device_get_value(host, SBU_MSX_DEVICE_KEY_PARALLEL_MAX_NUM) / 1000;
+
+	for (gint i = 0; i < MIN(max, 9); i++) {
+		g_autofree gchar *id = NULL;
+		g_autofree gchar *key = NULL;
+		g_autoptr(GError) error = NULL;
+		g_autoptr(SbuMsxDevice) device = sbu_msx_device_new_for_unit(transport, i);
+
+		sbu_msx_plugin_setup_device(self, device);
+		if (!sbu_msx_device_open(device, &error)) {
+			if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+				continue;
+			g_debug("no parallel group on %s: %s",
+				sbu_msx_transport_get_id(transport),
+				error->message);
+			return;
+		}
+		if (g_strcmp0(sbu_device_get_serial_number(SBU_DEVICE(device)),
+			      sbu_device_get_serial_number(SBU_DEVICE(host))) == 0)
+			continue;
+		id = g_strdup_printf("%s-%i", sbu_device_get_id(SBU_DEVICE(host)), i);
+		sbu_device_set_id(SBU_DEVICE(device), id);
+		key = g_strdup_printf("%s:%i", sbu_msx_transport_get_id(transport), i);
+		g_debug("adding unit %i of parallel group on %s as %s",
+			i,
+			sbu_msx_transport_get_id(transport),
+			id);
+		sbu_msx_plugin_add_device(self, device, key);
+	}
+}
+
+static void
+sbu_msx_plugin_add_transport(SbuMsxPlugin *self, SbuMsxTransport *transport)
+{
+	g_autoptr(SbuMsxDevice) device = NULL;
+	g_autoptr(GError) error = NULL;
+
+	/* create device, keeping the old ID for the first so the history is kept */
+	device = sbu_msx_device_new(transport);
+	if (g_hash_table_size(self->devices) == 0) {
+		sbu_device_set_id(SBU_DEVICE(device), "msx");
+	} else {
+		g_autofree gchar *id = g_strdup_printf("msx%u", g_hash_table_size(self->devices));
+		sbu_device_set_id(SBU_DEVICE(device), id);
+	}
+	sbu_msx_plugin_setup_device(self, device);
+
+	/* record everything sent and received, named so it survives a restart */
+	if (self->capture_dir != NULL) {
+		g_autofree gchar *basename =
+		    g_strdup_printf("%s.sbucap", sbu_device_get_id(SBU_DEVICE(device)));
+		g_autofree gchar *filename = g_build_filename(self->capture_dir, basename, NULL);
+		g_autoptr(GError) error_capture = NULL;
+		g_autoptr(SbuMsxCapture) capture = sbu_msx_capture_new();
+		if (sbu_msx_capture_open(capture, filename, &error_capture)) {
+			g_debug("capturing %s to %s",
+				sbu_msx_transport_get_id(transport),
+				filename);
+			sbu_msx_transport_set_capture(transport, capture);
+		} else {
+			g_warning("failed to capture: %s", error_capture->message);
+		}
+	}
 
 	/* open */
-	g_signal_connect(device, "changed", G_CALLBACK(sbu_msx_device_changed_cb), self);
 	if (!sbu_msx_device_open(device, &error)) {
-		g_warning("failed to open: %s", error->message);
+		g_warning("failed to open %s: %s",
+			  sbu_msx_transport_get_id(transport),
+			  error->message);
 		return;
 	}
+	sbu_msx_plugin_add_device(self, device, sbu_msx_transport_get_id(transport));
+	sbu_msx_plugin_add_parallel_units(self, device);
+}
 
-	g_hash_table_insert(self->devices,
-			    g_strdup(g_usb_device_get_platform_id(usb_device)),
-			    g_object_ref(device));
-	sbu_plugin_add_device(SBU_PLUGIN(self), SBU_DEVICE(device));
+static void
+sbu_msx_plugin_device_added_cb(GUsbContext *context, GUsbDevice *usb_device, SbuMsxPlugin *self)
+{
+	g_autoptr(SbuMsxTransport) transport = NULL;
+
+	if (g_usb_device_get_vid(usb_device) != 0x0665)
+		return;
+	if (g_usb_device_get_pid(usb_device) != 0x5161)
+		return;
+	transport = sbu_msx_transport_usb_new(usb_device);
+	sbu_msx_plugin_add_transport(self, transport);
+}
+
+/* empty entries are ignored so that "Key=" disables the backend */
+static void
+sbu_msx_plugin_add_fd_transports(SbuMsxPlugin *self,
+				 SbuConfig *config,
+				 const gchar *key,
+				 SbuMsxTransportFdKind kind)
+{
+	g_auto(GStrv) paths = sbu_config_get_string_list(config, key, NULL);
+	if (paths == NULL)
+		return;
+	for (guint i = 0; paths[i] != NULL; i++) {
+		g_autoptr(SbuMsxTransport) transport = NULL;
+		if (paths[i][0] == '\0')
+			continue;
+		transport = sbu_msx_transport_fd_new(paths[i], kind);
+		sbu_msx_plugin_add_transport(self, transport);
+	}
+}
+
+/* each capture is replayed as a separate inverter */
+static void
+sbu_msx_plugin_add_replay_transports(SbuMsxPlugin *self, SbuConfig *config)
+{
+	g_auto(GStrv) paths = sbu_config_get_string_list(config, "MsxReplayCaptures", NULL);
+	if (paths == NULL)
+		return;
+	for (guint i = 0; paths[i] != NULL; i++) {
+		g_autoptr(GError) error = NULL;
+		g_autoptr(SbuMsxCapture) capture = sbu_msx_capture_new();
+		g_autoptr(SbuMsxTransport) transport = NULL;
+		if (paths[i][0] == '\0')
+			continue;
+		if (!sbu_msx_capture_load(capture, paths[i], &error)) {
+			g_warning("failed to load capture: %s", error->message);
+			continue;
+		}
+		transport = sbu_msx_transport_replay_new(capture);
+		sbu_msx_transport_set_id(transport, paths[i]);
+		sbu_msx_plugin_add_transport(self, transport);
+	}
 }
 
 static void
 sbu_msx_plugin_device_removed_cb(GUsbContext *context, GUsbDevice *usb_device, SbuMsxPlugin *self)
 {
-	SbuDevice *device;
+	const gchar *platform_id = g_usb_device_get_platform_id(usb_device);
+	GHashTableIter iter;
+	SbuMsxDevice *device;
+	SbuMsxTransport *transport;
+	g_autoptr(GPtrArray) devices = g_ptr_array_new_with_free_func(g_object_unref);
 
-	/* remove device */
-	device = g_hash_table_lookup(self->devices, g_usb_device_get_platform_id(usb_device));
+	/* remove device, and any other units in the same parallel group */
+	device = g_hash_table_lookup(self->devices, platform_id);
 	if (device == NULL)
 		return;
-	g_debug("device removed: %s", sbu_device_get_serial_number(device));
-	g_hash_table_remove(self->devices, device);
-	sbu_plugin_remove_device(SBU_PLUGIN(self), device);
+	transport = sbu_msx_device_get_transport(device);
+	g_hash_table_iter_init(&iter, self->devices);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&device)) {
+		if (sbu_msx_device_get_transport(device) != transport)
+			continue;
+		g_debug("device removed: %s", sbu_device_get_serial_number(SBU_DEVICE(device)));
+		g_ptr_array_add(devices, g_object_ref(device));
+		g_hash_table_iter_remove(&iter);
+	}
+	for (guint i = 0; i < devices->len; i++)
+		sbu_plugin_remove_device(SBU_PLUGIN(self), g_ptr_array_index(devices, i));
 }
 
 static gboolean
@@ -433,6 +635,45 @@ sbu_msx_plugin_setup(SbuPlugin *plugin, GCancellable *cancellable, GError **erro
 {
 	SbuMsxPlugin *self = SBU_MSX_PLUGIN(plugin);
 	g_autoptr(GPtrArray) devices = NULL;
+	g_autoptr(SbuConfig) config = sbu_config_new();
+	g_autofree gchar *capture_dir = NULL;
+	g_auto(GStrv) hidraw = NULL;
+	g_auto(GStrv) replay = NULL;
+
+	/* optional, and off by default */
+	capture_dir = sbu_config_get_string(config, "MsxCaptureDirectory", NULL);
+	if (capture_dir != NULL && capture_dir[0] != '\0') {
+		if (g_mkdir_with_parents(capture_dir, 0750) < 0) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    g_io_error_from_errno(errno),
+				    "failed to create %s: %s",
+				    capture_dir,
+				    g_strerror(errno));
+			return FALSE;
+		}
+		self->capture_dir = g_steal_pointer(&capture_dir);
+	}
+
+	/* inverters that are not talked to using libusb */
+	sbu_msx_plugin_add_fd_transports(self,
+					 config,
+					 "MsxSerialPorts",
+					 SBU_MSX_TRANSPORT_FD_KIND_SERIAL);
+	sbu_msx_plugin_add_fd_transports(self,
+					 config,
+					 "MsxHidrawDevices",
+					 SBU_MSX_TRANSPORT_FD_KIND_HIDRAW);
+	sbu_msx_plugin_add_replay_transports(self, config);
+
+	/* the hidraw device is the same inverter, so do not detach its driver,
+	 * and a replay should not be mixed with live data */
+	hidraw = sbu_config_get_string_list(config, "MsxHidrawDevices", NULL);
+	if (hidraw != NULL && hidraw[0] != NULL && hidraw[0][0] != '\0')
+		return TRUE;
+	replay = sbu_config_get_string_list(config, "MsxReplayCaptures", NULL);
+	if (replay != NULL && replay[0] != NULL && replay[0][0] != '\0')
+		return TRUE;
 
 	/* get all the SBU devices */
 	self->usb_context = g_usb_context_new(error);
@@ -454,7 +695,7 @@ sbu_msx_plugin_setup(SbuPlugin *plugin, GCancellable *cancellable, GError **erro
 			 G_CALLBACK(sbu_msx_plugin_device_added_cb),
 			 self);
 	g_signal_connect(self->usb_context,
-			 "device-added",
+			 "device-removed",
 			 G_CALLBACK(sbu_msx_plugin_device_removed_cb),
 			 self);
 
@@ -469,6 +710,7 @@ sbu_msx_plugin_finalize(GObject *object)
 	if (self->usb_context != NULL)
 		g_object_unref(self->usb_context);
 	g_hash_table_unref(self->devices);
+	g_free(self->capture_dir);
 
 	G_OBJECT_CLASS(sbu_msx_plugin_parent_class)->finalize(object);
 }
@@ -488,3 +730,9 @@ sbu_msx_plugin_class_init(SbuMsxPluginClass *class)
 	object_class->finalize = sbu_msx_plugin_finalize;
 	plugin_class->setup = sbu_msx_plugin_setup;
 }
+
+GType
+sbu_plugin_query_type(void)
+{
+	return SBU_TYPE_MSX_PLUGIN;
+}
@@ -0,0 +1,400 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib-unix.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "sbu-msx-pi30.h"
+#include "sbu-msx-simulator.h"
+
+/* a PI30 inverter on the other end of a pseudo-terminal, answering from
+ * its own thread so that blocking callers in the daemon still get replies */
+struct _SbuMsxSimulator {
+	GObject parent_instance;
+	guint idx;
+	gint fd_master;
+	gint fd_slave; /* kept open so the master never sees a hangup */
+	gchar *path;
+	GThread *thread;
+	GMainContext *context;
+	GMainLoop *loop;
+	GRand *rand;
+	guint8 buf[SBU_MSX_PI30_FRAME_MAX]; /* request */
+	gsize idx_buf;
+	guint cycle;
+	guint n_units; /* in the parallel group, including this one */
+	gint latency;  /* ms, atomic */
+	gint faults;   /* SbuMsxSimulatorFault, atomic */
+	gint rate;     /* percentage of responses that have a fault, atomic */
+	gint requests; /* atomic */
+};
+
+G_DEFINE_TYPE(SbuMsxSimulator, sbu_msx_simulator, G_TYPE_OBJECT)
+
+typedef struct {
+	SbuMsxSimulator *self;
+	guint8 buf[SBU_MSX_PI30_FRAME_MAX];
+	gsize len;
+} SbuMsxSimulatorReply;
+
+/**
+ * sbu_msx_simulator_set_latency:
+ * @self: a #SbuMsxSimulator
+ * @latency: time in ms to wait before each response
+ *
+ * Sets the response latency, which can be changed while running.
+ **/
+void
+sbu_msx_simulator_set_latency(SbuMsxSimulator *self, guint latency)
+{
+	g_return_if_fail(SBU_IS_MSX_SIMULATOR(self));
+	g_atomic_int_set(&self->latency, latency);
+}
+
+/**
+ * sbu_msx_simulator_set_faults:
+ * @self: a #SbuMsxSimulator
+ * @faults: the #SbuMsxSimulatorFault kinds to choose from
+ * @rate: percentage of responses that are faulty, where 100 is every response
+ *
+ * Sets the faults to inject, which can be changed while running.
+ **/
+void
+sbu_msx_simulator_set_faults(SbuMsxSimulator *self, SbuMsxSimulatorFault faults, guint rate)
+{
+	g_return_if_fail(SBU_IS_MSX_SIMULATOR(self));
+	g_atomic_int_set(&self->faults, faults);
+	g_atomic_int_set(&self->rate, MIN(rate, 100));
+}
+
+/**
+ * sbu_msx_simulator_set_units:
+ * @self: a #SbuMsxSimulator
+ * @n_units: number of units in the parallel group, where 1 is a single inverter
+ *
+ * Sets how many units answer QPGSn. The simulator is unit 0.
+ **/
+void
+sbu_msx_simulator_set_units(SbuMsxSimulator *self, guint n_units)
+{
+	g_return_if_fail(SBU_IS_MSX_SIMULATOR(self));
+	g_return_if_fail(self->thread == NULL);
+	self->n_units = n_units;
+}
+
+/**
+ * sbu_msx_simulator_get_path:
+ * @self: a #SbuMsxSimulator
+ *
+ * Gets the serial port to use with the serial MSX transport.
+ *
+ * Returns: a path like `/dev/pts/3`, or %NULL if not started
+ **/
+const gchar *
+sbu_msx_simulator_get_path(SbuMsxSimulator *self)
+{
+	g_return_val_if_fail(SBU_IS_MSX_SIMULATOR(self), NULL);
+	return self->path;
+}
+
+/**
+ * sbu_msx_simulator_get_requests:
+ * @self: a #SbuMsxSimulator
+ *
+ * Gets the number of requests received, including any that were not answered.
+ *
+ * Returns: integer
+ **/
+guint
+sbu_msx_simulator_get_requests(SbuMsxSimulator *self)
+{
+	g_return_val_if_fail(SBU_IS_MSX_SIMULATOR(self), 0);
+	return g_atomic_int_get(&self->requests);
+}
+
+/* the live values change a little each time so that every poll has work to do */
+static gchar *
+sbu_msx_simulator_payload(SbuMsxSimulator *self, const gchar *cmd)
+{
+	if (g_strcmp0(cmd, "QPI") == 0)
+		return g_strdup("PI30");
+	if (g_strcmp0(cmd, "QID") == 0)
+		return g_strdup_printf("%014u", 92931709 + self->idx);
+	if (g_str_has_prefix(cmd, "QPGS") && strlen(cmd) == 5 && g_ascii_isdigit(cmd[4])) {
+		guint unit = cmd[4] - '0';
+		if (unit >= self->n_units) {
+			return g_strdup("0 00000000000000 - 00 000.0 00.00 000.0 00.00 0000 "
+					"0000 000 00.0 000 000 000.0 000 00000 00000 000 "
+					"00000000 0 0 000 000 000 00 000");
+		}
+		return g_strdup_printf("1 %014u B 00 230.0 49.98 230.0 49.98 %04u 0269 006 51.2 "
+				       "000 055 045.9 000 00644 00538 005 10100010 0 1 060 120 "
+				       "030 01 000",
+				       92931709 + self->idx + 1000 * unit,
+				       300 + unit);
+	}
+	if (g_strcmp0(cmd, "QVFW") == 0)
+		return g_strdup("VERFW:00072.70");
+	if (g_strcmp0(cmd, "QVFW2") == 0)
+		return g_strdup("VERFW2:00000.31");
+	if (g_strcmp0(cmd, "QPIRI") == 0) {
+		return g_strdup("230.0 21.7 230.0 50.0 21.7 5000 4000 48.0 46.0 42.0 56.4 54.0 "
+				"2 10 030 1 2 0 9 01 0 0 54.0 0 1");
+	}
+	if (g_strcmp0(cmd, "QPIGS") == 0) {
+		guint cycle = self->cycle++;
+		return g_strdup_printf("000.0 00.0 230.0 49.9 %04u %04u 003 460 57.50 012 100 "
+				       "0069 0014 103.8 57.45 00000 00110110 00 00 %05u 010",
+				       150 + cycle % 20,
+				       110 + cycle % 20,
+				       850 + cycle % 10);
+	}
+	if (g_strcmp0(cmd, "QFLAG") == 0)
+		return g_strdup("EakxyDbjuvz");
+	if (g_strcmp0(cmd, "QPIWS") == 0)
+		return g_strdup("00000000000000000000000000000000");
+	return g_strdup("NAK");
+}
+
+static gboolean
+sbu_msx_simulator_reply_cb(gpointer user_data)
+{
+	SbuMsxSimulatorReply *reply = (SbuMsxSimulatorReply *)user_data;
+	if (write(reply->self->fd_master, reply->buf, reply->len) != (gssize)reply->len)
+		g_debug("failed to write %s: %s", reply->self->path, g_strerror(errno));
+	return G_SOURCE_REMOVE;
+}
+
+static void
+sbu_msx_simulator_handle(SbuMsxSimulator *self, const guint8 *buf, gsize len)
+{
+	SbuMsxSimulatorFault faults = g_atomic_int_get(&self->faults);
+	SbuMsxSimulatorFault fault = SBU_MSX_SIMULATOR_FAULT_NONE;
+	g_autofree gchar *cmd = NULL;
+	g_autofree gchar *payload = NULL;
+	g_autofree gchar *frame = NULL;
+	g_autoptr(GSource) source = NULL;
+	SbuMsxSimulatorReply *reply = g_new0(SbuMsxSimulatorReply, 1);
+
+	g_atomic_int_inc(&self->requests);
+
+	/* hidraw style report IDs are skipped, and a bad CRC is refused */
+	while (len > 0 && buf[0] == 0x00) {
+		buf++;
+		len--;
+	}
+	if (len >= 3 &&
+	    sbu_msx_pi30_crc(buf, len - 3) == ((guint16)buf[len - 3] << 8 | buf[len - 2]))
+		cmd = g_strndup((const gchar *)buf, len - 3);
+	payload = cmd != NULL ? sbu_msx_simulator_payload(self, cmd) : g_strdup("NAK");
+
+	/* choose one of the faults */
+	if (faults != SBU_MSX_SIMULATOR_FAULT_NONE &&
+	    (guint)g_rand_int_range(self->rand, 0, 100) < (guint)g_atomic_int_get(&self->rate)) {
+		do {
+			fault = 1 << g_rand_int_range(self->rand, 0, 4);
+		} while ((faults & fault) == 0);
+	}
+	if (fault == SBU_MSX_SIMULATOR_FAULT_DROP) {
+		g_free(reply);
+		return;
+	}
+	if (fault == SBU_MSX_SIMULATOR_FAULT_NAK) {
+		g_free(payload);
+		payload = g_strdup("NAK");
+	}
+	frame = g_strdup_printf("(%s", payload);
+	reply->self = self;
+	reply->len = sbu_msx_pi30_encode(frame, reply->buf, sizeof(reply->buf));
+	if (fault == SBU_MSX_SIMULATOR_FAULT_CORRUPT)
+		reply->buf[g_rand_int_range(self->rand, 1, reply->len - 3)] ^= 0x01;
+	if (fault == SBU_MSX_SIMULATOR_FAULT_TRUNCATE) {
+		reply->len = g_rand_int_range(self->rand, 1, reply->len - 1);
+		reply->buf[reply->len++] = '\r';
+	}
+
+	/* send after the latency */
+	source = g_timeout_source_new(g_atomic_int_get(&self->latency));
+	g_source_set_callback(source, sbu_msx_simulator_reply_cb, reply, g_free);
+	g_source_attach(source, self->context);
+}
+
+static gboolean
+sbu_msx_simulator_readable_cb(gint fd, GIOCondition condition, gpointer user_data)
+{
+	SbuMsxSimulator *self = SBU_MSX_SIMULATOR(user_data);
+	guint8 tmp[SBU_MSX_PI30_FRAME_MAX];
+	gssize len = read(fd, tmp, sizeof(tmp));
+
+	if (len <= 0)
+		return G_SOURCE_CONTINUE;
+	for (gssize i = 0; i < len; i++) {
+		if (tmp[i] == '\r') {
+			sbu_msx_simulator_handle(self, self->buf, self->idx_buf);
+			self->idx_buf = 0;
+			continue;
+		}
+		if (self->idx_buf < sizeof(self->buf))
+			self->buf[self->idx_buf++] = tmp[i];
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+static gpointer
+sbu_msx_simulator_thread_cb(gpointer user_data)
+{
+	SbuMsxSimulator *self = SBU_MSX_SIMULATOR(user_data);
+	g_main_context_push_thread_default(self->context);
+	g_main_loop_run(self->loop);
+	g_main_context_pop_thread_default(self->context);
+	return NULL;
+}
+
+/**
+ * sbu_msx_simulator_start:
+ * @self: a #SbuMsxSimulator
+ * @error: a #GError or %NULL
+ *
+ * Creates the pseudo-terminal and starts answering requests.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_msx_simulator_start(SbuMsxSimulator *self, GError **error)
+{
+	struct termios tio;
+	g_autoptr(GSource) source = NULL;
+
+	g_return_val_if_fail(SBU_IS_MSX_SIMULATOR(self), FALSE);
+	g_return_val_if_fail(self->thread == NULL, FALSE);
+
+	self->fd_master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (self->fd_master < 0 || grantpt(self->fd_master) < 0 ||
+	    unlockpt(self->fd_master) < 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    g_io_error_from_errno(errno),
+			    "failed to create pseudo-terminal: %s",
+			    g_strerror(errno));
+		return FALSE;
+	}
+	self->path = g_strdup(ptsname(self->fd_master));
+	self->fd_slave = open(self->path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (self->fd_slave < 0 || tcgetattr(self->fd_slave, &tio) < 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    g_io_error_from_errno(errno),
+			    "failed to open %s: %s",
+			    self->path,
+			    g_strerror(errno));
+		return FALSE;
+	}
+	cfmakeraw(&tio);
+	if (tcsetattr(self->fd_slave, TCSANOW, &tio) < 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    g_io_error_from_errno(errno),
+			    "failed to set attributes of %s: %s",
+			    self->path,
+			    g_strerror(errno));
+		return FALSE;
+	}
+
+	/* answer from a private context */
+	source = g_unix_fd_source_new(self->fd_master, G_IO_IN);
+	g_source_set_callback(source, G_SOURCE_FUNC(sbu_msx_simulator_readable_cb), self, NULL);
+	g_source_attach(source, self->context);
+	self->thread = g_thread_new("sbu-msx-simulator", sbu_msx_simulator_thread_cb, self);
+	return TRUE;
+}
+
+static gboolean
+sbu_msx_simulator_quit_cb(gpointer user_data)
+{
+	SbuMsxSimulator *self = SBU_MSX_SIMULATOR(user_data);
+	g_main_loop_quit(self->loop);
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * sbu_msx_simulator_stop:
+ * @self: a #SbuMsxSimulator
+ *
+ * Stops answering requests, and waits for the thread to finish.
+ **/
+void
+sbu_msx_simulator_stop(SbuMsxSimulator *self)
+{
+	g_return_if_fail(SBU_IS_MSX_SIMULATOR(self));
+	if (self->thread == NULL)
+		return;
+
+	/* quitting before the thread has started running the loop would be lost,
+	 * so ask the loop to quit itself */
+	g_main_context_invoke(self->context, sbu_msx_simulator_quit_cb, self);
+	g_thread_join(g_steal_pointer(&self->thread));
+}
+
+static void
+sbu_msx_simulator_finalize(GObject *object)
+{
+	SbuMsxSimulator *self = SBU_MSX_SIMULATOR(object);
+
+	sbu_msx_simulator_stop(self);
+	if (self->fd_slave >= 0)
+		close(self->fd_slave);
+	if (self->fd_master >= 0)
+		close(self->fd_master);
+	g_main_loop_unref(self->loop);
+	g_main_context_unref(self->context);
+	g_rand_free(self->rand);
+	g_free(self->path);
+
+	G_OBJECT_CLASS(sbu_msx_simulator_parent_class)->finalize(object);
+}
+
+static void
+sbu_msx_simulator_init(SbuMsxSimulator *self)
+{
+	self->fd_master = -1;
+	self->fd_slave = -1;
+	self->context = g_main_context_new();
+	self->loop = g_main_loop_new(self->context, FALSE);
+}
+
+static void
+sbu_msx_simulator_class_init(SbuMsxSimulatorClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = sbu_msx_simulator_finalize;
+}
+
+/**
+ * sbu_msx_simulator_new:
+ * @idx: a number used for the serial number and the fault sequence
+ *
+ * Creates a simulated PI30 inverter.
+ *
+ * Returns: (transfer full): a #SbuMsxSimulator
+ **/
+SbuMsxSimulator *
+sbu_msx_simulator_new(guint idx)
+{
+	SbuMsxSimulator *self = g_object_new(SBU_TYPE_MSX_SIMULATOR, NULL);
+	self->idx = idx;
+	self->n_units = 1;
+	self->rand = g_rand_new_with_seed(idx);
+	return self;
+}
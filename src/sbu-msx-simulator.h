@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+#define SBU_TYPE_MSX_SIMULATOR (sbu_msx_simulator_get_type())
+G_DECLARE_FINAL_TYPE(SbuMsxSimulator, sbu_msx_simulator, SBU, MSX_SIMULATOR, GObject)
+
+typedef enum {
+	SBU_MSX_SIMULATOR_FAULT_NONE = 0,
+	SBU_MSX_SIMULATOR_FAULT_DROP = 1 << 0,	  /* no response at all */
+	SBU_MSX_SIMULATOR_FAULT_CORRUPT = 1 << 1, /* one payload byte changed */
+	SBU_MSX_SIMULATOR_FAULT_TRUNCATE = 1 << 2,
+	SBU_MSX_SIMULATOR_FAULT_NAK = 1 << 3,
+} SbuMsxSimulatorFault;
+
+SbuMsxSimulator *
+sbu_msx_simulator_new(guint idx);
+void
+sbu_msx_simulator_set_latency(SbuMsxSimulator *self, guint latency);
+void
+sbu_msx_simulator_set_faults(SbuMsxSimulator *self, SbuMsxSimulatorFault faults, guint rate);
+void
+sbu_msx_simulator_set_units(SbuMsxSimulator *self, guint n_units);
+gboolean
+sbu_msx_simulator_start(SbuMsxSimulator *self, GError **error);
+void
+sbu_msx_simulator_stop(SbuMsxSimulator *self);
+const gchar *
+sbu_msx_simulator_get_path(SbuMsxSimulator *self);
+guint
+sbu_msx_simulator_get_requests(SbuMsxSimulator *self);
@@ -0,0 +1,352 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib-unix.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "sbu-msx-pi30.h"
+#include "sbu-msx-transport-fd.h"
+
+/* hidraw reports are the same size as the USB interrupt transfers */
+#define SBU_MSX_TRANSPORT_FD_REPORT_SIZE 8
+
+struct _SbuMsxTransportFd {
+	SbuMsxTransport parent_instance;
+	gchar *path;
+	SbuMsxTransportFdKind kind;
+	gint fd;
+};
+
+G_DEFINE_TYPE(SbuMsxTransportFd, sbu_msx_transport_fd, SBU_TYPE_MSX_TRANSPORT)
+
+typedef struct {
+	guint8 buf[SBU_MSX_PI30_FRAME_MAX];
+	gsize idx; /* into buf */
+	GSource *source;
+} SbuMsxTransportFdRequest;
+
+static void
+sbu_msx_transport_fd_request_free(SbuMsxTransportFdRequest *req)
+{
+	if (req->source != NULL) {
+		g_source_destroy(req->source);
+		g_source_unref(req->source);
+	}
+	g_free(req);
+}
+
+/* destroying the source drops its reference on the task */
+static void
+sbu_msx_transport_fd_request_return(GTask *task, GBytes *response, GError *error)
+{
+	SbuMsxTransportFdRequest *req = g_task_get_task_data(task);
+	g_autoptr(GTask) task_tmp = g_object_ref(task);
+	if (response != NULL)
+		g_task_return_pointer(task, response, (GDestroyNotify)g_bytes_unref);
+	else
+		g_task_return_error(task, error);
+	g_source_destroy(req->source);
+}
+
+static gboolean
+sbu_msx_transport_fd_readable_cb(gint fd, GIOCondition condition, gpointer user_data)
+{
+	GTask *task = G_TASK(user_data);
+	SbuMsxTransportFd *self = g_task_get_source_object(task);
+	SbuMsxTransportFdRequest *req = g_task_get_task_data(task);
+	gsize bufsz = sizeof(req->buf) - req->idx;
+	gssize len;
+	g_autoptr(GError) error = NULL;
+
+	/* hidraw returns one report per read, serial returns everything that
+	 * has arrived so far, which is normally the whole response */
+	if (self->kind == SBU_MSX_TRANSPORT_FD_KIND_HIDRAW)
+		bufsz = MIN(bufsz, SBU_MSX_TRANSPORT_FD_REPORT_SIZE);
+	len = read(fd, req->buf + req->idx, bufsz);
+	if (len < 0 && (errno == EAGAIN || errno == EINTR) && (condition & G_IO_IN) > 0)
+		return G_SOURCE_CONTINUE;
+	if (len < 0) {
+		g_set_error(&error,
+			    G_IO_ERROR,
+			    g_io_error_from_errno(errno),
+			    "failed to read %s: %s",
+			    self->path,
+			    g_strerror(errno));
+		sbu_msx_transport_fd_request_return(task, NULL, g_steal_pointer(&error));
+		return G_SOURCE_REMOVE;
+	}
+	if (len == 0) {
+		g_set_error(&error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_BROKEN_PIPE,
+			    "%s was closed",
+			    self->path);
+		sbu_msx_transport_fd_request_return(task, NULL, g_steal_pointer(&error));
+		return G_SOURCE_REMOVE;
+	}
+	sbu_msx_transport_dump_raw("self->host", req->buf + req->idx, len);
+
+	/* anything after the carriage return is report padding */
+	for (gsize i = req->idx; i < req->idx + (gsize)len; i++) {
+		if (req->buf[i] == '\r') {
+			sbu_msx_transport_fd_request_return(task, g_bytes_new(req->buf, i), NULL);
+			return G_SOURCE_REMOVE;
+		}
+	}
+	req->idx += len;
+	if (req->idx == sizeof(req->buf)) {
+		g_set_error(&error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "no carriage return in %" G_GSIZE_FORMAT " bytes",
+			    req->idx);
+		sbu_msx_transport_fd_request_return(task, NULL, g_steal_pointer(&error));
+		return G_SOURCE_REMOVE;
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+sbu_msx_transport_fd_cancelled_cb(GCancellable *cancellable, gpointer user_data)
+{
+	GTask *task = G_TASK(user_data);
+	sbu_msx_transport_fd_request_return(task,
+					    NULL,
+					    g_error_new_literal(G_IO_ERROR,
+								G_IO_ERROR_CANCELLED,
+								"cancelled"));
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean
+sbu_msx_transport_fd_write(SbuMsxTransportFd *self, const guint8 *buf, gsize len, GError **error)
+{
+	guint8 report[SBU_MSX_TRANSPORT_FD_REPORT_SIZE + 1] = {0x0};
+	gssize wrote;
+
+	/* hidraw needs the report ID, and the command padded to the report size */
+	if (self->kind == SBU_MSX_TRANSPORT_FD_KIND_HIDRAW) {
+		if (len > SBU_MSX_TRANSPORT_FD_REPORT_SIZE) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_INVALID_ARGUMENT,
+				    "command of %" G_GSIZE_FORMAT " bytes is too long",
+				    len);
+			return FALSE;
+		}
+		memcpy(report + 1, buf, len);
+		buf = report;
+		len = sizeof(report);
+	}
+	sbu_msx_transport_dump_raw("host->self", buf, len);
+	wrote = write(self->fd, buf, len);
+	if (wrote < 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    g_io_error_from_errno(errno),
+			    "failed to write %s: %s",
+			    self->path,
+			    g_strerror(errno));
+		return FALSE;
+	}
+	if ((gsize)wrote != len) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_FAILED,
+			    "only sent %" G_GSSIZE_FORMAT " bytes",
+			    wrote);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+sbu_msx_transport_fd_request_async(SbuMsxTransport *transport,
+				   const guint8 *buf,
+				   gsize len,
+				   GCancellable *cancellable,
+				   GAsyncReadyCallback callback,
+				   gpointer user_data)
+{
+	SbuMsxTransportFd *self = SBU_MSX_TRANSPORT_FD(transport);
+	SbuMsxTransportFdRequest *req = g_new0(SbuMsxTransportFdRequest, 1);
+	g_autoptr(GTask) task = g_task_new(self, cancellable, callback, user_data);
+	g_autoptr(GError) error = NULL;
+
+	g_task_set_task_data(task, req, (GDestroyNotify)sbu_msx_transport_fd_request_free);
+	if (self->fd < 0) {
+		g_task_return_new_error(task,
+					G_IO_ERROR,
+					G_IO_ERROR_NOT_CONNECTED,
+					"%s is not open",
+					self->path);
+		return;
+	}
+
+	/* throw away the end of any response that timed out */
+	if (self->kind == SBU_MSX_TRANSPORT_FD_KIND_SERIAL)
+		tcflush(self->fd, TCIFLUSH);
+	if (!sbu_msx_transport_fd_write(self, buf, len, &error)) {
+		g_task_return_error(task, g_steal_pointer(&error));
+		return;
+	}
+
+	/* wait for the response, or for the caller to give up */
+	req->source = g_unix_fd_source_new(self->fd, G_IO_IN | G_IO_ERR | G_IO_HUP);
+	g_source_set_callback(req->source,
+			      G_SOURCE_FUNC(sbu_msx_transport_fd_readable_cb),
+			      g_object_ref(task),
+			      g_object_unref);
+	if (cancellable != NULL) {
+		g_autoptr(GSource) cancellable_source = g_cancellable_source_new(cancellable);
+		g_source_set_callback(cancellable_source,
+				      G_SOURCE_FUNC(sbu_msx_transport_fd_cancelled_cb),
+				      task,
+				      NULL);
+		g_source_add_child_source(req->source, cancellable_source);
+	}
+	g_source_attach(req->source, g_task_get_context(task));
+}
+
+static GBytes *
+sbu_msx_transport_fd_request_finish(SbuMsxTransport *transport, GAsyncResult *res, GError **error)
+{
+	g_return_val_if_fail(g_task_is_valid(res, transport), NULL);
+	return g_task_propagate_pointer(G_TASK(res), error);
+}
+
+/* PI30 inverters use 2400 baud, 8 data bits, no parity and one stop bit */
+static gboolean
+sbu_msx_transport_fd_setup_serial(SbuMsxTransportFd *self, GError **error)
+{
+	struct termios tio;
+
+	if (tcgetattr(self->fd, &tio) < 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    g_io_error_from_errno(errno),
+			    "failed to get attributes of %s: %s",
+			    self->path,
+			    g_strerror(errno));
+		return FALSE;
+	}
+	cfmakeraw(&tio);
+	cfsetispeed(&tio, B2400);
+	cfsetospeed(&tio, B2400);
+	tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	if (tcsetattr(self->fd, TCSANOW, &tio) < 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    g_io_error_from_errno(errno),
+			    "failed to set attributes of %s: %s",
+			    self->path,
+			    g_strerror(errno));
+		return FALSE;
+	}
+	tcflush(self->fd, TCIOFLUSH);
+	return TRUE;
+}
+
+static gboolean
+sbu_msx_transport_fd_open(SbuMsxTransport *transport, GError **error)
+{
+	SbuMsxTransportFd *self = SBU_MSX_TRANSPORT_FD(transport);
+
+	if (self->fd >= 0)
+		return TRUE;
+	g_debug("opening %s", self->path);
+	self->fd = open(self->path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (self->fd < 0) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    g_io_error_from_errno(errno),
+			    "failed to open %s: %s",
+			    self->path,
+			    g_strerror(errno));
+		return FALSE;
+	}
+	if (self->kind == SBU_MSX_TRANSPORT_FD_KIND_SERIAL &&
+	    !sbu_msx_transport_fd_setup_serial(self, error)) {
+		close(self->fd);
+		self->fd = -1;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean
+sbu_msx_transport_fd_close(SbuMsxTransport *transport, GError **error)
+{
+	SbuMsxTransportFd *self = SBU_MSX_TRANSPORT_FD(transport);
+	if (self->fd < 0)
+		return TRUE;
+	g_debug("closing %s", self->path);
+	if (!g_close(self->fd, error)) {
+		self->fd = -1;
+		g_prefix_error(error, "failed to close %s: ", self->path);
+		return FALSE;
+	}
+	self->fd = -1;
+	return TRUE;
+}
+
+static void
+sbu_msx_transport_fd_finalize(GObject *object)
+{
+	SbuMsxTransportFd *self = SBU_MSX_TRANSPORT_FD(object);
+	if (self->fd >= 0)
+		close(self->fd);
+	g_free(self->path);
+	G_OBJECT_CLASS(sbu_msx_transport_fd_parent_class)->finalize(object);
+}
+
+static void
+sbu_msx_transport_fd_init(SbuMsxTransportFd *self)
+{
+	self->fd = -1;
+}
+
+static void
+sbu_msx_transport_fd_class_init(SbuMsxTransportFdClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	SbuMsxTransportClass *transport_class = SBU_MSX_TRANSPORT_CLASS(klass);
+	object_class->finalize = sbu_msx_transport_fd_finalize;
+	transport_class->open = sbu_msx_transport_fd_open;
+	transport_class->close = sbu_msx_transport_fd_close;
+	transport_class->request_async = sbu_msx_transport_fd_request_async;
+	transport_class->request_finish = sbu_msx_transport_fd_request_finish;
+}
+
+/**
+ * sbu_msx_transport_fd_new:
+ * @path: a device path, e.g. `/dev/hidraw0` or `/dev/ttyUSB0`
+ * @kind: a #SbuMsxTransportFdKind
+ *
+ * Creates a transport that talks to the inverter using the kernel hidraw
+ * driver, which does not need the kernel driver detaching, or using a
+ * RS232 or USB-serial port.
+ *
+ * Returns: (transfer full): a #SbuMsxTransport
+ **/
+SbuMsxTransport *
+sbu_msx_transport_fd_new(const gchar *path, SbuMsxTransportFdKind kind)
+{
+	SbuMsxTransportFd *self = g_object_new(SBU_TYPE_MSX_TRANSPORT_FD, NULL);
+	self->path = g_strdup(path);
+	self->kind = kind;
+	sbu_msx_transport_set_id(SBU_MSX_TRANSPORT(self), path);
+	return SBU_MSX_TRANSPORT(self);
+}
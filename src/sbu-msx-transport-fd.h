@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#pragma once
+
+#include "sbu-msx-transport.h"
+
+#define SBU_TYPE_MSX_TRANSPORT_FD sbu_msx_transport_fd_get_type()
+G_DECLARE_FINAL_TYPE(SbuMsxTransportFd,
+		     sbu_msx_transport_fd,
+		     SBU,
+		     MSX_TRANSPORT_FD,
+		     SbuMsxTransport)
+
+typedef enum {
+	SBU_MSX_TRANSPORT_FD_KIND_HIDRAW,
+	SBU_MSX_TRANSPORT_FD_KIND_SERIAL,
+	SBU_MSX_TRANSPORT_FD_KIND_LAST
+} SbuMsxTransportFdKind;
+
+SbuMsxTransport *
+sbu_msx_transport_fd_new(const gchar *path, SbuMsxTransportFdKind kind);
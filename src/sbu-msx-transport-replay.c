@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "sbu-msx-transport-replay.h"
+
+/* answers each request with the response that followed the same request in
+ * a capture, without any delay, so that a trace from a real inverter can be
+ * fed through the whole daemon as fast as it can process it */
+struct _SbuMsxTransportReplay {
+	SbuMsxTransport parent_instance;
+	SbuMsxCapture *capture;
+	guint idx; /* next frame to search from */
+};
+
+G_DEFINE_TYPE(SbuMsxTransportReplay, sbu_msx_transport_replay, SBU_TYPE_MSX_TRANSPORT)
+
+/* the capture wraps around so that it can be replayed for as long as needed */
+static gboolean
+sbu_msx_transport_replay_find(SbuMsxTransportReplay *self, const guint8 *buf, gsize len)
+{
+	guint size = sbu_msx_capture_get_size(self->capture);
+	for (guint i = 0; i < size; i++) {
+		guint idx = (self->idx + i) % size;
+		const SbuMsxCaptureFrame *frame = sbu_msx_capture_get_frame(self->capture, idx);
+		if (frame->kind != SBU_MSX_CAPTURE_KIND_REQUEST)
+			continue;
+		if (frame->len != len || memcmp(frame->data, buf, len) != 0)
+			continue;
+		self->idx = (idx + 1) % size;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+static void
+sbu_msx_transport_replay_request_async(SbuMsxTransport *transport,
+				       const guint8 *buf,
+				       gsize len,
+				       GCancellable *cancellable,
+				       GAsyncReadyCallback callback,
+				       gpointer user_data)
+{
+	SbuMsxTransportReplay *self = SBU_MSX_TRANSPORT_REPLAY(transport);
+	const SbuMsxCaptureFrame *frame;
+	g_autoptr(GTask) task = g_task_new(self, cancellable, callback, user_data);
+
+	g_task_set_source_tag(task, sbu_msx_transport_replay_request_async);
+	if (g_task_return_error_if_cancelled(task))
+		return;
+	sbu_msx_transport_dump_raw("host->self", buf, len);
+	if (!sbu_msx_transport_replay_find(self, buf, len)) {
+		g_task_return_new_error(task,
+					G_IO_ERROR,
+					G_IO_ERROR_NOT_FOUND,
+					"request was not captured");
+		return;
+	}
+
+	/* the inverter did not answer when captured */
+	frame = sbu_msx_capture_get_frame(self->capture, self->idx);
+	if (frame->kind != SBU_MSX_CAPTURE_KIND_RESPONSE) {
+		g_task_return_new_error(task,
+					G_IO_ERROR,
+					G_IO_ERROR_TIMED_OUT,
+					"no response was captured");
+		return;
+	}
+	sbu_msx_transport_dump_raw("self->host", frame->data, frame->len);
+	g_task_return_pointer(task,
+			      g_bytes_new(frame->data, frame->len),
+			      (GDestroyNotify)g_bytes_unref);
+}
+
+static GBytes *
+sbu_msx_transport_replay_request_finish(SbuMsxTransport *transport,
+					GAsyncResult *res,
+					GError **error)
+{
+	g_return_val_if_fail(g_task_is_valid(res, transport), NULL);
+	return g_task_propagate_pointer(G_TASK(res), error);
+}
+
+static void
+sbu_msx_transport_replay_finalize(GObject *object)
+{
+	SbuMsxTransportReplay *self = SBU_MSX_TRANSPORT_REPLAY(object);
+	g_object_unref(self->capture);
+	G_OBJECT_CLASS(sbu_msx_transport_replay_parent_class)->finalize(object);
+}
+
+static void
+sbu_msx_transport_replay_init(SbuMsxTransportReplay *self)
+{
+}
+
+static void
+sbu_msx_transport_replay_class_init(SbuMsxTransportReplayClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	SbuMsxTransportClass *transport_class = SBU_MSX_TRANSPORT_CLASS(klass);
+	object_class->finalize = sbu_msx_transport_replay_finalize;
+	transport_class->request_async = sbu_msx_transport_replay_request_async;
+	transport_class->request_finish = sbu_msx_transport_replay_request_finish;
+}
+
+/**
+ * sbu_msx_transport_replay_new:
+ * @capture: a #SbuMsxCapture with the frames loaded
+ *
+ * Creates a transport that replays a capture rather than talking to an
+ * inverter.
+ *
+ * Returns: (transfer full): a #SbuMsxTransport
+ **/
+SbuMsxTransport *
+sbu_msx_transport_replay_new(SbuMsxCapture *capture)
+{
+	SbuMsxTransportReplay *self;
+	g_return_val_if_fail(SBU_IS_MSX_CAPTURE(capture), NULL);
+	self = g_object_new(SBU_TYPE_MSX_TRANSPORT_REPLAY, NULL);
+	self->capture = g_object_ref(capture);
+	return SBU_MSX_TRANSPORT(self);
+}
@@ -0,0 +1,20 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#pragma once
+
+#include "sbu-msx-capture.h"
+#include "sbu-msx-transport.h"
+
+#define SBU_TYPE_MSX_TRANSPORT_REPLAY sbu_msx_transport_replay_get_type()
+G_DECLARE_FINAL_TYPE(SbuMsxTransportReplay,
+		     sbu_msx_transport_replay,
+		     SBU,
+		     MSX_TRANSPORT_REPLAY,
+		     SbuMsxTransport)
+
+SbuMsxTransport *
+sbu_msx_transport_replay_new(SbuMsxCapture *capture);
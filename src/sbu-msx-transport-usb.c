@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "sbu-msx-pi30.h"
+#include "sbu-msx-transport-usb.h"
+
+#define SBU_MSX_TRANSPORT_USB_TIMEOUT	 5000 /* ms, for each transfer */
+#define SBU_MSX_TRANSPORT_USB_CHUNK_SIZE 8
+#define SBU_MSX_TRANSPORT_USB_CHUNKS_MAX 20
+
+struct _SbuMsxTransportUsb {
+	SbuMsxTransport parent_instance;
+	GUsbDevice *usb_device;
+};
+
+G_DEFINE_TYPE(SbuMsxTransportUsb, sbu_msx_transport_usb, SBU_TYPE_MSX_TRANSPORT)
+
+typedef struct {
+	guint8 buf[SBU_MSX_TRANSPORT_USB_CHUNK_SIZE];  /* current chunk */
+	guint8 buf2[SBU_MSX_PI30_FRAME_MAX];	       /* reassembled response */
+	gsize idx;				       /* into buf2 */
+	guint chunks;
+} SbuMsxTransportUsbRequest;
+
+static guint
+sbu_msx_transport_usb_count_data(const guint8 *buf, gsize len)
+{
+	for (guint j = 0; j < len; j++) {
+		if (buf[j] == '\r')
+			return j;
+	}
+	return SBU_MSX_TRANSPORT_USB_CHUNK_SIZE;
+}
+
+static void
+sbu_msx_transport_usb_recv(GTask *task);
+
+static void
+sbu_msx_transport_usb_recv_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	g_autoptr(GTask) task = G_TASK(user_data);
+	SbuMsxTransportUsbRequest *req = g_task_get_task_data(task);
+	gsize data_valid;
+	gssize actual_len;
+	g_autoptr(GError) error = NULL;
+
+	actual_len = g_usb_device_interrupt_transfer_finish(G_USB_DEVICE(source), res, &error);
+	if (actual_len < 0) {
+		g_prefix_error(&error, "failed to get data: ");
+		g_task_return_error(task, g_steal_pointer(&error));
+		return;
+	}
+
+	/* check message was long enough to parse */
+	if (actual_len != SBU_MSX_TRANSPORT_USB_CHUNK_SIZE) {
+		g_task_return_new_error(task,
+					G_IO_ERROR,
+					G_IO_ERROR_FAILED,
+					"only recieved %" G_GSSIZE_FORMAT " bytes",
+					actual_len);
+		return;
+	}
+
+	sbu_msx_transport_dump_raw("self->host", req->buf, actual_len);
+	data_valid = sbu_msx_transport_usb_count_data(req->buf, actual_len);
+	memcpy(req->buf2 + req->idx, req->buf, data_valid);
+	req->idx += data_valid;
+	if (data_valid == SBU_MSX_TRANSPORT_USB_CHUNK_SIZE &&
+	    ++req->chunks < SBU_MSX_TRANSPORT_USB_CHUNKS_MAX) {
+		sbu_msx_transport_usb_recv(task);
+		return;
+	}
+	g_task_return_pointer(task,
+			      g_bytes_new(req->buf2, req->idx),
+			      (GDestroyNotify)g_bytes_unref);
+}
+
+static void
+sbu_msx_transport_usb_recv(GTask *task)
+{
+	SbuMsxTransportUsb *self = g_task_get_source_object(task);
+	SbuMsxTransportUsbRequest *req = g_task_get_task_data(task);
+
+	memset(req->buf, 0x00, sizeof(req->buf));
+	g_usb_device_interrupt_transfer_async(self->usb_device,
+					      0x81,
+					      req->buf,
+					      sizeof(req->buf),
+					      SBU_MSX_TRANSPORT_USB_TIMEOUT,
+					      g_task_get_cancellable(task),
+					      sbu_msx_transport_usb_recv_cb,
+					      g_object_ref(task));
+}
+
+static void
+sbu_msx_transport_usb_send_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	g_autoptr(GTask) task = G_TASK(user_data);
+	gssize actual_len;
+	g_autoptr(GError) error = NULL;
+
+	actual_len = g_usb_device_control_transfer_finish(G_USB_DEVICE(source), res, &error);
+	if (actual_len < 0) {
+		g_prefix_error(&error, "failed to send data: ");
+		g_task_return_error(task, g_steal_pointer(&error));
+		return;
+	}
+	if (actual_len != SBU_MSX_TRANSPORT_USB_CHUNK_SIZE) {
+		g_task_return_new_error(task,
+					G_IO_ERROR,
+					G_IO_ERROR_FAILED,
+					"only sent %" G_GSSIZE_FORMAT " bytes",
+					actual_len);
+		return;
+	}
+	sbu_msx_transport_usb_recv(task);
+}
+
+/* the command is sent as one HID SET_REPORT, and the response is read back
+ * in 8 byte interrupt transfers until the carriage return */
+static void
+sbu_msx_transport_usb_request_async(SbuMsxTransport *transport,
+				    const guint8 *buf,
+				    gsize len,
+				    GCancellable *cancellable,
+				    GAsyncReadyCallback callback,
+				    gpointer user_data)
+{
+	SbuMsxTransportUsb *self = SBU_MSX_TRANSPORT_USB(transport);
+	SbuMsxTransportUsbRequest *req = g_new0(SbuMsxTransportUsbRequest, 1);
+	g_autoptr(GTask) task = g_task_new(self, cancellable, callback, user_data);
+
+	g_task_set_task_data(task, req, g_free);
+	if (len > sizeof(req->buf)) {
+		g_task_return_new_error(task,
+					G_IO_ERROR,
+					G_IO_ERROR_INVALID_ARGUMENT,
+					"command of %" G_GSIZE_FORMAT " bytes is too long",
+					len);
+		return;
+	}
+
+	/* padded to the chunk size */
+	memcpy(req->buf, buf, len);
+	sbu_msx_transport_dump_raw("host->self", req->buf, sizeof(req->buf));
+	g_usb_device_control_transfer_async(self->usb_device,
+					    G_USB_DEVICE_DIRECTION_HOST_TO_DEVICE,
+					    G_USB_DEVICE_REQUEST_TYPE_CLASS,
+					    G_USB_DEVICE_RECIPIENT_INTERFACE,
+					    0x9,
+					    0x200,
+					    0,
+					    req->buf,
+					    sizeof(req->buf),
+					    SBU_MSX_TRANSPORT_USB_TIMEOUT,
+					    cancellable,
+					    sbu_msx_transport_usb_send_cb,
+					    g_steal_pointer(&task));
+}
+
+static GBytes *
+sbu_msx_transport_usb_request_finish(SbuMsxTransport *transport, GAsyncResult *res, GError **error)
+{
+	g_return_val_if_fail(g_task_is_valid(res, transport), NULL);
+	return g_task_propagate_pointer(G_TASK(res), error);
+}
+
+static gboolean
+sbu_msx_transport_usb_open(SbuMsxTransport *transport, GError **error)
+{
+	SbuMsxTransportUsb *self = SBU_MSX_TRANSPORT_USB(transport);
+
+	g_debug("opening device");
+	if (!g_usb_device_open(self->usb_device, error)) {
+		g_prefix_error(error, "failed to open self: ");
+		return FALSE;
+	}
+
+	g_debug("claiming interface");
+	if (!g_usb_device_claim_interface(self->usb_device,
+					  0x00,
+					  G_USB_DEVICE_CLAIM_INTERFACE_BIND_KERNEL_DRIVER,
+					  error)) {
+		g_prefix_error(error, "failed to claim interface: ");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static gboolean
+sbu_msx_transport_usb_close(SbuMsxTransport *transport, GError **error)
+{
+	SbuMsxTransportUsb *self = SBU_MSX_TRANSPORT_USB(transport);
+
+	g_debug("releasing interface");
+	if (!g_usb_device_release_interface(self->usb_device,
+					    0x00,
+					    G_USB_DEVICE_CLAIM_INTERFACE_BIND_KERNEL_DRIVER,
+					    error)) {
+		g_prefix_error(error, "failed to claim interface: ");
+		return FALSE;
+	}
+
+	g_debug("closing device");
+	if (!g_usb_device_close(self->usb_device, error)) {
+		g_prefix_error(error, "failed to close self: ");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+sbu_msx_transport_usb_finalize(GObject *object)
+{
+	SbuMsxTransportUsb *self = SBU_MSX_TRANSPORT_USB(object);
+	g_object_unref(self->usb_device);
+	G_OBJECT_CLASS(sbu_msx_transport_usb_parent_class)->finalize(object);
+}
+
+static void
+sbu_msx_transport_usb_init(SbuMsxTransportUsb *self)
+{
+}
+
+static void
+sbu_msx_transport_usb_class_init(SbuMsxTransportUsbClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	SbuMsxTransportClass *transport_class = SBU_MSX_TRANSPORT_CLASS(klass);
+	object_class->finalize = sbu_msx_transport_usb_finalize;
+	transport_class->open = sbu_msx_transport_usb_open;
+	transport_class->close = sbu_msx_transport_usb_close;
+	transport_class->request_async = sbu_msx_transport_usb_request_async;
+	transport_class->request_finish = sbu_msx_transport_usb_request_finish;
+}
+
+SbuMsxTransport *
+sbu_msx_transport_usb_new(GUsbDevice *usb_device)
+{
+	SbuMsxTransportUsb *self = g_object_new(SBU_TYPE_MSX_TRANSPORT_USB, NULL);
+	self->usb_device = g_object_ref(usb_device);
+	sbu_msx_transport_set_id(SBU_MSX_TRANSPORT(self), g_usb_device_get_platform_id(usb_device));
+	return SBU_MSX_TRANSPORT(self);
+}
@@ -0,0 +1,21 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#pragma once
+
+#include <gusb.h>
+
+#include "sbu-msx-transport.h"
+
+#define SBU_TYPE_MSX_TRANSPORT_USB sbu_msx_transport_usb_get_type()
+G_DECLARE_FINAL_TYPE(SbuMsxTransportUsb,
+		     sbu_msx_transport_usb,
+		     SBU,
+		     MSX_TRANSPORT_USB,
+		     SbuMsxTransport)
+
+SbuMsxTransport *
+sbu_msx_transport_usb_new(GUsbDevice *usb_device);
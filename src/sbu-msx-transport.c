@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#include "config.h"
+
+#include "sbu-msx-pi30.h"
+#include "sbu-msx-transport.h"
+#include "sbu-stats.h"
+
+typedef struct {
+	gchar *id;
+	GQueue *requests; /* of GTask, waiting for the link */
+	gboolean busy;
+	SbuMsxCapture *capture; /* nullable */
+	SbuStatsCounter *stats_capture_errors;
+} SbuMsxTransportPrivate;
+
+typedef struct {
+	GBytes *buf;
+	SbuMsxTransportSentFunc sent_func; /* nullable */
+	gpointer sent_data;
+} SbuMsxTransportRequest;
+
+G_DEFINE_TYPE_WITH_PRIVATE(SbuMsxTransport, sbu_msx_transport, G_TYPE_OBJECT)
+#define GET_PRIVATE(o) (sbu_msx_transport_get_instance_private(o))
+
+void
+sbu_msx_transport_dump_raw(const gchar *title, const guint8 *data, gsize len)
+{
+	gchar str[3 * SBU_MSX_PI30_FRAME_MAX + 1];
+	if (len == 0 || g_getenv("G_MESSAGES_DEBUG") == NULL)
+		return;
+	len = MIN(len, SBU_MSX_PI30_FRAME_MAX);
+	for (gsize i = 0; i < len; i++) {
+		str[i * 3] = "0123456789abcdef"[data[i] >> 4];
+		str[i * 3 + 1] = "0123456789abcdef"[data[i] & 0x0f];
+		str[i * 3 + 2] = ' ';
+	}
+	str[len * 3] = '\0';
+	g_debug("%-16s%s", title, str);
+}
+
+/**
+ * sbu_msx_transport_get_id:
+ * @self: a #SbuMsxTransport
+ *
+ * Gets a string that identifies the inverter connection, e.g. the USB
+ * platform ID or the device path.
+ *
+ * Returns: string, or %NULL if unset
+ **/
+const gchar *
+sbu_msx_transport_get_id(SbuMsxTransport *self)
+{
+	SbuMsxTransportPrivate *priv = GET_PRIVATE(self);
+	g_return_val_if_fail(SBU_IS_MSX_TRANSPORT(self), NULL);
+	return priv->id;
+}
+
+void
+sbu_msx_transport_set_id(SbuMsxTransport *self, const gchar *id)
+{
+	SbuMsxTransportPrivate *priv = GET_PRIVATE(self);
+	g_return_if_fail(SBU_IS_MSX_TRANSPORT(self));
+	g_free(priv->id);
+	priv->id = g_strdup(id);
+}
+
+/**
+ * sbu_msx_transport_set_capture:
+ * @self: a #SbuMsxTransport
+ * @capture: (nullable): a #SbuMsxCapture opened for writing
+ *
+ * Sets the capture that every raw request and response is added to. Requests
+ * are added when they are actually sent, so the frames from devices sharing
+ * the link are always in request and response pairs.
+ **/
+void
+sbu_msx_transport_set_capture(SbuMsxTransport *self, SbuMsxCapture *capture)
+{
+	SbuMsxTransportPrivate *priv = GET_PRIVATE(self);
+	g_return_if_fail(SBU_IS_MSX_TRANSPORT(self));
+	g_set_object(&priv->capture, capture);
+}
+
+/* a capture that cannot be written does not stop the link being used */
+static void
+sbu_msx_transport_capture(SbuMsxTransport *self,
+			  SbuMsxCaptureKind kind,
+			  const guint8 *buf,
+			  gsize len)
+{
+	SbuMsxTransportPrivate *priv = GET_PRIVATE(self);
+	g_autoptr(GError) error = NULL;
+	if (priv->capture == NULL)
+		return;
+	if (!sbu_msx_capture_write(priv->capture, kind, buf, len, &error)) {
+		g_debug("failed to capture: %s", error->message);
+		sbu_stats_counter_inc(priv->stats_capture_errors);
+	}
+}
+
+static void
+sbu_msx_transport_request_free(SbuMsxTransportRequest *req)
+{
+	g_bytes_unref(req->buf);
+	g_free(req);
+}
+
+gboolean
+sbu_msx_transport_open(SbuMsxTransport *self, GError **error)
+{
+	SbuMsxTransportClass *klass = SBU_MSX_TRANSPORT_GET_CLASS(self);
+	g_return_val_if_fail(SBU_IS_MSX_TRANSPORT(self), FALSE);
+	if (klass->open == NULL)
+		return TRUE;
+	return klass->open(self, error);
+}
+
+gboolean
+sbu_msx_transport_close(SbuMsxTransport *self, GError **error)
+{
+	SbuMsxTransportClass *klass = SBU_MSX_TRANSPORT_GET_CLASS(self);
+	g_return_val_if_fail(SBU_IS_MSX_TRANSPORT(self), FALSE);
+	if (klass->close == NULL)
+		return TRUE;
+	return klass->close(self, error);
+}
+
+static void
+sbu_msx_transport_request_next(SbuMsxTransport *self);
+
+static void
+sbu_msx_transport_request_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuMsxTransport *self = SBU_MSX_TRANSPORT(source);
+	SbuMsxTransportClass *klass = SBU_MSX_TRANSPORT_GET_CLASS(self);
+	SbuMsxTransportPrivate *priv = GET_PRIVATE(self);
+	g_autoptr(GTask) task = G_TASK(user_data);
+	g_autoptr(GError) error = NULL;
+	GBytes *response;
+
+	/* anything sent from the callback goes to the back of the queue */
+	priv->busy = FALSE;
+	response = klass->request_finish(self, res, &error);
+	if (response == NULL) {
+		g_task_return_error(task, g_steal_pointer(&error));
+	} else {
+		sbu_msx_transport_capture(self,
+					  SBU_MSX_CAPTURE_KIND_RESPONSE,
+					  g_bytes_get_data(response, NULL),
+					  g_bytes_get_size(response));
+		g_task_return_pointer(task, response, (GDestroyNotify)g_bytes_unref);
+	}
+	sbu_msx_transport_request_next(self);
+}
+
+/* requests that were cancelled while waiting are only noticed here, which is
+ * at most one response timeout later */
+static void
+sbu_msx_transport_request_next(SbuMsxTransport *self)
+{
+	SbuMsxTransportClass *klass = SBU_MSX_TRANSPORT_GET_CLASS(self);
+	SbuMsxTransportPrivate *priv = GET_PRIVATE(self);
+
+	while (!priv->busy) {
+		SbuMsxTransportRequest *req;
+		GTask *task = g_queue_pop_head(priv->requests);
+		if (task == NULL)
+			return;
+		if (g_task_return_error_if_cancelled(task)) {
+			g_object_unref(task);
+			continue;
+		}
+		req = g_task_get_task_data(task);
+		priv->busy = TRUE;
+		sbu_msx_transport_capture(self,
+					  SBU_MSX_CAPTURE_KIND_REQUEST,
+					  g_bytes_get_data(req->buf, NULL),
+					  g_bytes_get_size(req->buf));
+		if (req->sent_func != NULL)
+			req->sent_func(req->sent_data);
+		klass->request_async(self,
+				     g_bytes_get_data(req->buf, NULL),
+				     g_bytes_get_size(req->buf),
+				     g_task_get_cancellable(task),
+				     sbu_msx_transport_request_cb,
+				     task);
+	}
+}
+
+/**
+ * sbu_msx_transport_request_async:
+ * @self: a #SbuMsxTransport
+ * @buf: an encoded PI30 command, including the CRC and carriage return
+ * @len: size of @buf
+ * @sent_func: (nullable): the function to run when the request is sent
+ * @sent_data: the data to pass to @sent_func
+ * @cancellable: a #GCancellable, or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Sends a command and reads the response from the thread-default main
+ * context. The link can only carry one request at a time, so devices that
+ * share it, e.g. the units in a parallel group, have their requests queued
+ * and each is sent as soon as the previous response arrives. Any timeout or
+ * latency measurement should be started from @sent_func rather than when
+ * queueing, as the request may wait for several others first.
+ **/
+void
+sbu_msx_transport_request_async(SbuMsxTransport *self,
+				const guint8 *buf,
+				gsize len,
+				SbuMsxTransportSentFunc sent_func,
+				gpointer sent_data,
+				GCancellable *cancellable,
+				GAsyncReadyCallback callback,
+				gpointer user_data)
+{
+	SbuMsxTransportPrivate *priv = GET_PRIVATE(self);
+	SbuMsxTransportRequest *req;
+	GTask *task;
+
+	g_return_if_fail(SBU_IS_MSX_TRANSPORT(self));
+	g_return_if_fail(buf != NULL);
+	g_return_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable));
+
+	task = g_task_new(self, cancellable, callback, user_data);
+	g_task_set_source_tag(task, sbu_msx_transport_request_async);
+	req = g_new0(SbuMsxTransportRequest, 1);
+	req->buf = g_bytes_new(buf, len);
+	req->sent_func = sent_func;
+	req->sent_data = sent_data;
+	g_task_set_task_data(task, req, (GDestroyNotify)sbu_msx_transport_request_free);
+	g_queue_push_tail(priv->requests, task);
+	sbu_msx_transport_request_next(self);
+}
+
+/**
+ * sbu_msx_transport_request_finish:
+ * @self: a #SbuMsxTransport
+ * @res: a #GAsyncResult
+ * @error: a #GError, or %NULL
+ *
+ * Gets the result of sbu_msx_transport_request_async().
+ *
+ * Returns: (transfer full): the raw response without the trailing carriage
+ * return, or %NULL for error
+ **/
+GBytes *
+sbu_msx_transport_request_finish(SbuMsxTransport *self, GAsyncResult *res, GError **error)
+{
+	g_return_val_if_fail(SBU_IS_MSX_TRANSPORT(self), NULL);
+	g_return_val_if_fail(g_task_is_valid(res, self), NULL);
+	return g_task_propagate_pointer(G_TASK(res), error);
+}
+
+static void
+sbu_msx_transport_finalize(GObject *object)
+{
+	SbuMsxTransport *self = SBU_MSX_TRANSPORT(object);
+	SbuMsxTransportPrivate *priv = GET_PRIVATE(self);
+	g_queue_free_full(priv->requests, g_object_unref);
+	if (priv->capture != NULL)
+		g_object_unref(priv->capture);
+	g_free(priv->id);
+	G_OBJECT_CLASS(sbu_msx_transport_parent_class)->finalize(object);
+}
+
+static void
+sbu_msx_transport_init(SbuMsxTransport *self)
+{
+	SbuMsxTransportPrivate *priv = GET_PRIVATE(self);
+	priv->requests = g_queue_new();
+	priv->stats_capture_errors = sbu_stats_counter_get("msx:capture-errors");
+}
+
+static void
+sbu_msx_transport_class_init(SbuMsxTransportClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = sbu_msx_transport_finalize;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+#include "sbu-msx-capture.h"
+
+#define SBU_TYPE_MSX_TRANSPORT sbu_msx_transport_get_type()
+G_DECLARE_DERIVABLE_TYPE(SbuMsxTransport, sbu_msx_transport, SBU, MSX_TRANSPORT, GObject)
+
+struct _SbuMsxTransportClass {
+	GObjectClass parent_class;
+	gboolean (*open)(SbuMsxTransport *self, GError **error);
+	gboolean (*close)(SbuMsxTransport *self, GError **error);
+	void (*request_async)(SbuMsxTransport *self,
+			      const guint8 *buf,
+			      gsize len,
+			      GCancellable *cancellable,
+			      GAsyncReadyCallback callback,
+			      gpointer user_data);
+	GBytes *(*request_finish)(SbuMsxTransport *self, GAsyncResult *res, GError **error);
+};
+
+typedef void (*SbuMsxTransportSentFunc)(gpointer user_data);
+
+const gchar *
+sbu_msx_transport_get_id(SbuMsxTransport *self);
+void
+sbu_msx_transport_set_id(SbuMsxTransport *self, const gchar *id);
+void
+sbu_msx_transport_set_capture(SbuMsxTransport *self, SbuMsxCapture *capture);
+gboolean
+sbu_msx_transport_open(SbuMsxTransport *self, GError **error);
+gboolean
+sbu_msx_transport_close(SbuMsxTransport *self, GError **error);
+void
+sbu_msx_transport_request_async(SbuMsxTransport *self,
+				const guint8 *buf,
+				gsize len,
+				SbuMsxTransportSentFunc sent_func,
+				gpointer sent_data,
+				GCancellable *cancellable,
+				GAsyncReadyCallback callback,
+				gpointer user_data);
+GBytes *
+sbu_msx_transport_request_finish(SbuMsxTransport *self, GAsyncResult *res, GError **error);
+
+void
+sbu_msx_transport_dump_raw(const gchar *title, const guint8 *data, gsize len);
@@ -197,12 +197,21 @@ sbu_node_set_property(GObject *object, guint prop_id, const GValue *value, GPara
 	case PROP_POWER:
 		self->values[SBU_DEVICE_PROPERTY_POWER] = g_value_get_double(value);
 		break;
+	case PROP_POWER_MAX:
+		self->values[SBU_DEVICE_PROPERTY_POWER_MAX] = g_value_get_double(value);
+		break;
 	case PROP_VOLTAGE:
 		self->values[SBU_DEVICE_PROPERTY_VOLTAGE] = g_value_get_double(value);
 		break;
+	case PROP_VOLTAGE_MAX:
+		self->values[SBU_DEVICE_PROPERTY_VOLTAGE_MAX] = g_value_get_double(value);
+		break;
 	case PROP_CURRENT:
 		self->values[SBU_DEVICE_PROPERTY_CURRENT] = g_value_get_double(value);
 		break;
+	case PROP_CURRENT_MAX:
+		self->values[SBU_DEVICE_PROPERTY_CURRENT_MAX] = g_value_get_double(value);
+		break;
 	case PROP_FREQUENCY:
 		self->values[SBU_DEVICE_PROPERTY_FREQUENCY] = g_value_get_double(value);
 		break;
@@ -221,12 +230,21 @@ sbu_node_get_property(GObject *object, guint prop_id, GValue *value, GParamSpec
 	case PROP_POWER:
 		g_value_set_double(value, self->values[SBU_DEVICE_PROPERTY_POWER]);
 		break;
+	case PROP_POWER_MAX:
+		g_value_set_double(value, self->values[SBU_DEVICE_PROPERTY_POWER_MAX]);
+		break;
 	case PROP_VOLTAGE:
 		g_value_set_double(value, self->values[SBU_DEVICE_PROPERTY_VOLTAGE]);
 		break;
+	case PROP_VOLTAGE_MAX:
+		g_value_set_double(value, self->values[SBU_DEVICE_PROPERTY_VOLTAGE_MAX]);
+		break;
 	case PROP_CURRENT:
 		g_value_set_double(value, self->values[SBU_DEVICE_PROPERTY_CURRENT]);
 		break;
+	case PROP_CURRENT_MAX:
+		g_value_set_double(value, self->values[SBU_DEVICE_PROPERTY_CURRENT_MAX]);
+		break;
 	case PROP_FREQUENCY:
 		g_value_set_double(value, self->values[SBU_DEVICE_PROPERTY_FREQUENCY]);
 		break;
@@ -6,10 +6,17 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include "sbu-plugin.h"
 
+#define SBU_PLUGIN_MODULE_PREFIX "libsbu_plugin_"
+
 typedef struct {
 	GModule *module;
+	GThread *thread; /* the thread signals are emitted in */
+	GMutex pending_mutex;
+	GPtrArray *pending; /* of SbuPluginEmitHelper, held while being set up */
 	guint64 flags;
 	gboolean enabled;
 	gchar *name;
@@ -19,20 +26,16 @@ G_DEFINE_TYPE_WITH_PRIVATE(SbuPlugin, sbu_plugin, G_TYPE_OBJECT)
 
 enum { PROP_0, PROP_FLAGS, PROP_LAST };
 
-enum { SIGNAL_UPDATE_METADATA, SIGNAL_ADD_DEVICE, SIGNAL_REMOVE_DEVICE, SIGNAL_LAST };
+enum {
+	SIGNAL_UPDATE_METADATA,
+	SIGNAL_UPDATE_METADATA_VALUES,
+	SIGNAL_ADD_DEVICE,
+	SIGNAL_REMOVE_DEVICE,
+	SIGNAL_LAST
+};
 
 static guint signals[SIGNAL_LAST] = {0};
 
-gboolean
-sbu_plugin_setup(SbuPlugin *self, GCancellable *cancellable, GError **error)
-{
-	SbuPluginClass *plugin_klass = SBU_PLUGIN_GET_CLASS(self);
-	g_return_val_if_fail(SBU_IS_PLUGIN(self), FALSE);
-	if (plugin_klass->setup == NULL)
-		return TRUE;
-	return plugin_klass->setup(self, cancellable, error);
-}
-
 gboolean
 sbu_plugin_refresh(SbuPlugin *self, GCancellable *cancellable, GError **error)
 {
@@ -65,6 +68,13 @@ sbu_plugin_finalize(GObject *object)
 	SbuPlugin *self = SBU_PLUGIN(object);
 	SbuPluginPrivate *priv = sbu_plugin_get_instance_private(self);
 	g_free(priv->name);
+	if (priv->pending != NULL)
+		g_ptr_array_unref(priv->pending);
+	g_mutex_clear(&priv->pending_mutex);
+	if (priv->module != NULL)
+		g_module_close(priv->module);
+
+	G_OBJECT_CLASS(sbu_plugin_parent_class)->finalize(object);
 }
 
 const gchar *
@@ -75,13 +85,241 @@ sbu_plugin_get_name(SbuPlugin *self)
 	return priv->name;
 }
 
+typedef struct {
+	SbuPlugin *plugin;
+	SbuDevice *device;
+	guint signal_id;
+	gchar *key;
+	gint value;
+	GVariant *values; /* nullable */
+} SbuPluginEmitHelper;
+
+static void
+sbu_plugin_emit_helper_free(SbuPluginEmitHelper *helper)
+{
+	g_object_unref(helper->plugin);
+	g_object_unref(helper->device);
+	g_free(helper->key);
+	if (helper->values != NULL)
+		g_variant_unref(helper->values);
+	g_free(helper);
+}
+
+static gboolean
+sbu_plugin_emit_idle_cb(gpointer user_data)
+{
+	SbuPluginEmitHelper *helper = (SbuPluginEmitHelper *)user_data;
+	if (helper->signal_id == signals[SIGNAL_UPDATE_METADATA]) {
+		g_signal_emit(helper->plugin,
+			      helper->signal_id,
+			      0,
+			      helper->device,
+			      helper->key,
+			      helper->value);
+	} else if (helper->signal_id == signals[SIGNAL_UPDATE_METADATA_VALUES]) {
+		g_signal_emit(helper->plugin,
+			      helper->signal_id,
+			      0,
+			      helper->device,
+			      helper->values);
+	} else {
+		g_signal_emit(helper->plugin, helper->signal_id, 0, helper->device);
+	}
+	return FALSE;
+}
+
+/* plugins are set up in a worker thread, but everything connected to the
+ * plugin signals expects to be called in the main thread -- anything emitted
+ * during setup is held back until the plugin has finished probing, so nothing
+ * else can use a device that the worker is still changing */
+static void
+sbu_plugin_emit(SbuPlugin *self,
+		guint signal_id,
+		SbuDevice *device,
+		const gchar *key,
+		gint value,
+		GVariant *values)
+{
+	SbuPluginPrivate *priv = sbu_plugin_get_instance_private(self);
+	SbuPluginEmitHelper *helper;
+
+	if (g_thread_self() == priv->thread) {
+		if (signal_id == signals[SIGNAL_UPDATE_METADATA]) {
+			g_signal_emit(self, signal_id, 0, device, key, value);
+		} else if (signal_id == signals[SIGNAL_UPDATE_METADATA_VALUES]) {
+			g_signal_emit(self, signal_id, 0, device, values);
+		} else {
+			g_signal_emit(self, signal_id, 0, device);
+		}
+		return;
+	}
+	helper = g_new0(SbuPluginEmitHelper, 1);
+	helper->plugin = g_object_ref(self);
+	helper->device = g_object_ref(device);
+	helper->signal_id = signal_id;
+	helper->key = g_strdup(key);
+	helper->value = value;
+	if (values != NULL)
+		helper->values = g_variant_ref(values);
+	g_mutex_lock(&priv->pending_mutex);
+	if (priv->pending != NULL) {
+		g_ptr_array_add(priv->pending, helper);
+		g_mutex_unlock(&priv->pending_mutex);
+		return;
+	}
+	g_mutex_unlock(&priv->pending_mutex);
+	g_idle_add_full(G_PRIORITY_DEFAULT,
+			sbu_plugin_emit_idle_cb,
+			helper,
+			(GDestroyNotify)sbu_plugin_emit_helper_free);
+}
+
+gboolean
+sbu_plugin_setup(SbuPlugin *self, GCancellable *cancellable, GError **error)
+{
+	SbuPluginClass *plugin_klass = SBU_PLUGIN_GET_CLASS(self);
+	g_return_val_if_fail(SBU_IS_PLUGIN(self), FALSE);
+	if (plugin_klass->setup == NULL)
+		return TRUE;
+	return plugin_klass->setup(self, cancellable, error);
+}
+
+static void
+sbu_plugin_setup_thread_cb(GTask *task,
+			   gpointer source_object,
+			   gpointer task_data,
+			   GCancellable *cancellable)
+{
+	SbuPlugin *self = SBU_PLUGIN(source_object);
+	GError *error = NULL;
+
+	if (!sbu_plugin_setup(self, cancellable, &error)) {
+		g_task_return_error(task, error);
+		return;
+	}
+	g_task_return_boolean(task, TRUE);
+}
+
+/* back in the main context, and the worker has finished with the devices */
+static void
+sbu_plugin_setup_ready_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuPlugin *self = SBU_PLUGIN(source);
+	SbuPluginPrivate *priv = sbu_plugin_get_instance_private(self);
+	g_autoptr(GTask) task = G_TASK(user_data);
+	g_autoptr(GPtrArray) pending = NULL;
+	GError *error = NULL;
+
+	g_mutex_lock(&priv->pending_mutex);
+	pending = g_steal_pointer(&priv->pending);
+	g_mutex_unlock(&priv->pending_mutex);
+
+	/* a plugin that failed is disabled, so do not add its devices */
+	if (!g_task_propagate_boolean(G_TASK(res), &error)) {
+		g_task_return_error(task, error);
+		return;
+	}
+	for (guint i = 0; i < pending->len; i++)
+		sbu_plugin_emit_idle_cb(g_ptr_array_index(pending, i));
+	g_task_return_boolean(task, TRUE);
+}
+
+/**
+ * sbu_plugin_setup_async:
+ * @self: a #SbuPlugin
+ * @cancellable: a #GCancellable, or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Sets up the plugin in a worker thread, as probing hardware can be slow.
+ *
+ * Any devices or metadata the plugin adds are only signalled once the setup
+ * has completed, in the thread that called this function.
+ **/
+void
+sbu_plugin_setup_async(SbuPlugin *self,
+		       GCancellable *cancellable,
+		       GAsyncReadyCallback callback,
+		       gpointer user_data)
+{
+	SbuPluginPrivate *priv = sbu_plugin_get_instance_private(self);
+	g_autoptr(GTask) task = NULL;
+	g_autoptr(GTask) task_thread = NULL;
+
+	g_return_if_fail(SBU_IS_PLUGIN(self));
+	g_return_if_fail(cancellable == NULL || G_IS_CANCELLABLE(cancellable));
+
+	task = g_task_new(self, cancellable, callback, user_data);
+	g_task_set_source_tag(task, sbu_plugin_setup_async);
+	g_mutex_lock(&priv->pending_mutex);
+	if (priv->pending != NULL) {
+		g_mutex_unlock(&priv->pending_mutex);
+		g_task_return_new_error(task,
+					G_IO_ERROR,
+					G_IO_ERROR_PENDING,
+					"%s is already being set up",
+					priv->name);
+		return;
+	}
+	priv->pending = g_ptr_array_new_with_free_func((GDestroyNotify)sbu_plugin_emit_helper_free);
+	g_mutex_unlock(&priv->pending_mutex);
+	task_thread = g_task_new(self,
+				 cancellable,
+				 sbu_plugin_setup_ready_cb,
+				 g_steal_pointer(&task));
+	g_task_run_in_thread(task_thread, sbu_plugin_setup_thread_cb);
+}
+
+/**
+ * sbu_plugin_setup_finish:
+ * @self: a #SbuPlugin
+ * @res: a #GAsyncResult
+ * @error: a #GError, or %NULL
+ *
+ * Gets the result of sbu_plugin_setup_async().
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_plugin_setup_finish(SbuPlugin *self, GAsyncResult *res, GError **error)
+{
+	g_return_val_if_fail(g_task_is_valid(res, self), FALSE);
+	return g_task_propagate_boolean(G_TASK(res), error);
+}
+
 void
 sbu_plugin_update_metadata(SbuPlugin *self, SbuDevice *device, const gchar *key, gint value)
 {
 	g_return_if_fail(SBU_IS_PLUGIN(self));
 	g_return_if_fail(SBU_IS_DEVICE(device));
 	g_debug("saving metadata %s=%i", key, value);
-	g_signal_emit(self, signals[SIGNAL_UPDATE_METADATA], 0, device, key, value);
+	sbu_plugin_emit(self, signals[SIGNAL_UPDATE_METADATA], device, key, value, NULL);
+}
+
+/**
+ * sbu_plugin_update_metadata_values:
+ * @self: a #SbuPlugin
+ * @device: a #SbuDevice
+ * @values: a #GVariant of type `a{si}`
+ *
+ * Saves several metadata values at once, which uses a single database
+ * transaction rather than one for each sbu_plugin_update_metadata() call.
+ **/
+void
+sbu_plugin_update_metadata_values(SbuPlugin *self, SbuDevice *device, GVariant *values)
+{
+	g_autoptr(GVariant) values_tmp = NULL;
+
+	g_return_if_fail(SBU_IS_PLUGIN(self));
+	g_return_if_fail(SBU_IS_DEVICE(device));
+	g_return_if_fail(values != NULL);
+
+	values_tmp = g_variant_ref_sink(values);
+	g_return_if_fail(g_variant_is_of_type(values, G_VARIANT_TYPE("a{si}")));
+	if (g_variant_n_children(values) == 0)
+		return;
+	g_debug("saving %" G_GSIZE_FORMAT " metadata values", g_variant_n_children(values));
+	sbu_plugin_emit(self, signals[SIGNAL_UPDATE_METADATA_VALUES], device, NULL, 0, values);
 }
 
 void
@@ -89,7 +327,7 @@ sbu_plugin_add_device(SbuPlugin *self, SbuDevice *device)
 {
 	g_return_if_fail(SBU_IS_PLUGIN(self));
 	g_return_if_fail(SBU_IS_DEVICE(device));
-	g_signal_emit(self, signals[SIGNAL_ADD_DEVICE], 0, device);
+	sbu_plugin_emit(self, signals[SIGNAL_ADD_DEVICE], device, NULL, 0, NULL);
 }
 
 void
@@ -97,7 +335,91 @@ sbu_plugin_remove_device(SbuPlugin *self, SbuDevice *device)
 {
 	g_return_if_fail(SBU_IS_PLUGIN(self));
 	g_return_if_fail(SBU_IS_DEVICE(device));
-	g_signal_emit(self, signals[SIGNAL_REMOVE_DEVICE], 0, device);
+	sbu_plugin_emit(self, signals[SIGNAL_REMOVE_DEVICE], device, NULL, 0, NULL);
+}
+
+/**
+ * sbu_plugin_name_from_filename:
+ * @filename: a filename, e.g. `libsbu_plugin_msx.so`
+ *
+ * Gets the plugin name without loading the module.
+ *
+ * Returns: (transfer full): a plugin name, e.g. `msx`, or %NULL if not a plugin
+ **/
+gchar *
+sbu_plugin_name_from_filename(const gchar *filename)
+{
+	g_autofree gchar *basename = g_path_get_basename(filename);
+	const gchar *tmp;
+
+	if (!g_str_has_prefix(basename, SBU_PLUGIN_MODULE_PREFIX))
+		return NULL;
+	if (!g_str_has_suffix(basename, "." G_MODULE_SUFFIX))
+		return NULL;
+	tmp = basename + strlen(SBU_PLUGIN_MODULE_PREFIX);
+	return g_strndup(tmp, strcspn(tmp, "."));
+}
+
+/**
+ * sbu_plugin_create:
+ * @filename: full path to a plugin module, e.g. `/usr/lib64/sbu-plugins-1/libsbu_plugin_msx.so`
+ * @error: a #GError or %NULL
+ *
+ * Loads a plugin module and creates the plugin object it provides.
+ *
+ * Returns: (transfer full): a #SbuPlugin, or %NULL on error
+ **/
+SbuPlugin *
+sbu_plugin_create(const gchar *filename, GError **error)
+{
+	GModule *module;
+	GType gtype;
+	SbuPlugin *self;
+	SbuPluginPrivate *priv;
+	g_autofree gchar *name = NULL;
+	GType (*query_type_fn)(void) = NULL;
+
+	g_return_val_if_fail(filename != NULL, NULL);
+
+	/* get the plugin name from the filename */
+	name = sbu_plugin_name_from_filename(filename);
+	if (name == NULL) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_FILENAME,
+			    "%s is not a plugin",
+			    filename);
+		return NULL;
+	}
+	module = g_module_open(filename, G_MODULE_BIND_LOCAL);
+	if (module == NULL) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_FAILED,
+			    "failed to open plugin %s: %s",
+			    filename,
+			    g_module_error());
+		return NULL;
+	}
+	if (!g_module_symbol(module, "sbu_plugin_query_type", (gpointer *)&query_type_fn)) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_NOT_SUPPORTED,
+			    "failed to load %s: %s",
+			    filename,
+			    g_module_error());
+		g_module_close(module);
+		return NULL;
+	}
+
+	/* types cannot be unregistered */
+	g_module_make_resident(module);
+	gtype = query_type_fn();
+	self = g_object_new(gtype, NULL);
+	priv = sbu_plugin_get_instance_private(self);
+	priv->module = module;
+	priv->name = g_steal_pointer(&name);
+	return self;
 }
 
 static void
@@ -158,6 +480,18 @@ sbu_plugin_class_init(SbuPluginClass *class)
 			 SBU_TYPE_DEVICE,
 			 G_TYPE_STRING,
 			 G_TYPE_INT);
+	signals[SIGNAL_UPDATE_METADATA_VALUES] =
+	    g_signal_new("update-metadata-values",
+			 G_TYPE_FROM_CLASS(object_class),
+			 G_SIGNAL_RUN_LAST,
+			 G_STRUCT_OFFSET(SbuPluginClass, update_metadata_values),
+			 NULL,
+			 NULL,
+			 g_cclosure_marshal_generic,
+			 G_TYPE_NONE,
+			 2,
+			 SBU_TYPE_DEVICE,
+			 G_TYPE_VARIANT);
 	signals[SIGNAL_ADD_DEVICE] = g_signal_new("add-device",
 						  G_TYPE_FROM_CLASS(object_class),
 						  G_SIGNAL_RUN_LAST,
@@ -171,7 +505,7 @@ sbu_plugin_class_init(SbuPluginClass *class)
 	signals[SIGNAL_REMOVE_DEVICE] = g_signal_new("remove-device",
 						     G_TYPE_FROM_CLASS(object_class),
 						     G_SIGNAL_RUN_LAST,
-						     G_STRUCT_OFFSET(SbuPluginClass, add_device),
+						     G_STRUCT_OFFSET(SbuPluginClass, remove_device),
 						     NULL,
 						     NULL,
 						     g_cclosure_marshal_generic,
@@ -185,4 +519,6 @@ sbu_plugin_init(SbuPlugin *self)
 {
 	SbuPluginPrivate *priv = sbu_plugin_get_instance_private(self);
 	priv->enabled = TRUE;
+	priv->thread = g_thread_self();
+	g_mutex_init(&priv->pending_mutex);
 }
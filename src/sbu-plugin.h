@@ -23,8 +23,17 @@ struct _SbuPluginClass {
 	void (*remove_device)(SbuPlugin *self, SbuDevice *device);
 	gboolean (*setup)(SbuPlugin *self, GCancellable *cancellable, GError **error);
 	gboolean (*refresh)(SbuPlugin *self, GCancellable *cancellable, GError **error);
+	void (*update_metadata_values)(SbuPlugin *self, SbuDevice *device, GVariant *values);
 };
 
+/* implemented by each plugin module */
+G_MODULE_EXPORT GType
+sbu_plugin_query_type(void);
+
+gchar *
+sbu_plugin_name_from_filename(const gchar *filename);
+SbuPlugin *
+sbu_plugin_create(const gchar *filename, GError **error);
 const gchar *
 sbu_plugin_get_name(SbuPlugin *self);
 gboolean
@@ -35,11 +44,20 @@ sbu_plugin_set_enabled(SbuPlugin *self, gboolean enabled);
 void
 sbu_plugin_update_metadata(SbuPlugin *self, SbuDevice *device, const gchar *key, gint value);
 void
+sbu_plugin_update_metadata_values(SbuPlugin *self, SbuDevice *device, GVariant *values);
+void
 sbu_plugin_add_device(SbuPlugin *self, SbuDevice *device);
 void
 sbu_plugin_remove_device(SbuPlugin *self, SbuDevice *device);
 
 gboolean
 sbu_plugin_setup(SbuPlugin *self, GCancellable *cancellable, GError **error);
+void
+sbu_plugin_setup_async(SbuPlugin *self,
+		       GCancellable *cancellable,
+		       GAsyncReadyCallback callback,
+		       gpointer user_data);
+gboolean
+sbu_plugin_setup_finish(SbuPlugin *self, GAsyncResult *res, GError **error);
 gboolean
 sbu_plugin_refresh(SbuPlugin *self, GCancellable *cancellable, GError **error);
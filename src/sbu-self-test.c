@@ -4,16 +4,42 @@
  * SPDX-License-Identifier: GPL-2+
  */
 
+#define _GNU_SOURCE
+
 #include "config.h"
 
+#include <fcntl.h>
 #include <glib-object.h>
+#include <glib-unix.h>
 #include <glib/gstdio.h>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <termios.h>
+#include <unistd.h>
 
 #include "sbu-common.h"
 #include "sbu-database.h"
+#include "sbu-dbus-generated.h"
+#include "sbu-device.h"
+#include "sbu-history-cache.h"
+#include "sbu-history.h"
+#include "sbu-line-exporter.h"
+#include "sbu-manager.h"
+#include "sbu-metrics.h"
+#include "sbu-msx-capture.h"
 #include "sbu-msx-common.h"
 #include "sbu-msx-device.h"
+#include "sbu-msx-pi30.h"
+#include "sbu-msx-simulator.h"
+#include "sbu-msx-transport-fd.h"
+#include "sbu-msx-transport-replay.h"
+#include "sbu-plugin.h"
+#include "sbu-stats.h"
+#include "sbu-stream-client.h"
+#include "sbu-stream-server.h"
+#include "sbu-subscription.h"
 
 static void
 sbu_msx_test_common_func(void)
@@ -58,6 +84,827 @@ sbu_msx_test_common_func(void)
 		g_assert_cmpstr(sbu_device_key_to_string(i), !=, NULL);
 }
 
+/* captured from real inverters, including the CRC and carriage return */
+static const struct {
+	const gchar *cmd;
+	const gchar *frame;
+	gsize len;
+} sbu_msx_test_pi30_corpus[] = {
+#define SBU_TEST_FRAME(cmd, frame) {cmd, frame, sizeof(frame) - 1}
+    SBU_TEST_FRAME("QPIGS",
+		   "(000.0 00.0 230.0 49.9 0161 0119 003 460 57.50 012 100 0069 0014 103.8 "
+		   "57.45 00000 00110110 00 00 00856 010"
+		   "\x24\x8c"
+		   "\r"),
+    SBU_TEST_FRAME("QPIGS",
+		   "(227.2 50.0 230.3 50.0 0829 0751 016 376 52.70 000 064 0037 0005 240.8 "
+		   "52.71 00000 00010110 00 00 00241 010"
+		   "\xa3\x72"
+		   "\r"),
+    SBU_TEST_FRAME("QPIRI",
+		   "(230.0 21.7 230.0 50.0 21.7 5000 4000 48.0 46.0 42.0 56.4 54.0 2 10 030 1 2 "
+		   "0 9 01 0 0 54.0 0 1"
+		   "\xdb\x62"
+		   "\r"),
+    SBU_TEST_FRAME("QPIRI",
+		   "(230.0 13.0 230.0 50.0 13.0 3000 2400 24.0 23.0 21.0 28.2 27.0 0 30 060 0 2 "
+		   "2 - 01 1 0 27.0 0 0 120"
+		   "\x93\x58"
+		   "\r"),
+#undef SBU_TEST_FRAME
+};
+
+static gboolean
+sbu_msx_test_pi30_parse(const gchar *cmd,
+			const gchar *data,
+			gsize len,
+			SbuMsxPi30Values *values,
+			GError **error)
+{
+	if (g_strcmp0(cmd, "QPIGS") == 0)
+		return sbu_msx_pi30_parse_qpigs(data, len, values, error);
+	return sbu_msx_pi30_parse_qpiri(data, len, values, error);
+}
+
+static void
+sbu_msx_test_pi30_func(void)
+{
+	gboolean ret;
+	gsize len;
+	const gchar *payload = NULL;
+	gsize payload_len = 0;
+	guint8 buf[SBU_MSX_PI30_FRAME_MAX];
+	SbuMsxPi30Values values;
+	const gchar *qpgs = "1 92932105105335 B 00 000.0 00.00 230.0 49.98 0322 0269 006 51.2 "
+			    "000 055 045.9 000 00644 00538 005 10100010 0 1 060 120 030 01 000";
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GRand) rand = g_rand_new_with_seed(30);
+
+	/* command */
+	len = sbu_msx_pi30_encode("QPIGS", buf, 8);
+	g_assert_cmpint(len, ==, 8);
+	g_assert_cmpint(memcmp(buf, "QPIGS\xb7\xa9\r", 8), ==, 0);
+	g_assert_cmpint(sbu_msx_pi30_encode("QPIGS", buf, 7), ==, 0);
+
+	/* general status */
+	ret = sbu_msx_pi30_decode((const guint8 *)sbu_msx_test_pi30_corpus[0].frame,
+				  sbu_msx_test_pi30_corpus[0].len,
+				  &payload,
+				  &payload_len,
+				  &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_cmpint(payload_len, ==, 106);
+	ret = sbu_msx_pi30_parse_qpigs(payload, payload_len, &values, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_AC_OUTPUT_VOLTAGE], ==, 230000);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_BATTERY_VOLTAGE], ==, 57500);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_PV_INPUT_VOLTAGE], ==, 103800);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_PV_CHARGING_POWER], ==, 856000);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_LOAD_STATUS_ON], ==, 1);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_CHARGING_ON_SOLAR], ==, 1);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_CHARGING_ON_AC], ==, 0);
+	g_assert_false(sbu_msx_pi30_values_has(&values, SBU_MSX_DEVICE_KEY_GRID_RATING_VOLTAGE));
+	g_assert_false(sbu_msx_pi30_values_has(&values, SBU_MSX_DEVICE_KEY_SWITCH_ON));
+
+	/* device rating, with a placeholder and a field from newer firmware */
+	ret = sbu_msx_pi30_decode((const guint8 *)sbu_msx_test_pi30_corpus[3].frame,
+				  sbu_msx_test_pi30_corpus[3].len,
+				  &payload,
+				  &payload_len,
+				  &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	ret = sbu_msx_pi30_parse_qpiri(payload, payload_len, &values, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_PRESENT_MAX_CHARGING_CURRENT], ==, 60000);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_PARALLEL_MAX_NUM], ==, 0);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_MACHINE_TYPE], ==, 1000);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_PV_POWER_BALANCE], ==, 0);
+
+	/* one unit in a parallel group, with the PV power calculated */
+	ret = sbu_msx_pi30_parse_qpgs(qpgs, strlen(qpgs), &values, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_AC_OUTPUT_VOLTAGE], ==, 230000);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_AC_OUTPUT_POWER], ==, 322000);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_BATTERY_VOLTAGE], ==, 51200);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_PV_CHARGING_POWER], ==, 45900);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_CHARGING_ON_SOLAR], ==, 1);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_CHARGING_ON_AC], ==, 0);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_LOAD_STATUS_ON], ==, 1);
+	g_assert_cmpint(values.vals[SBU_MSX_DEVICE_KEY_CHARGER_SOURCE_PRIORITY], ==, 1000);
+	g_assert_false(sbu_msx_pi30_values_has(&values, SBU_MSX_DEVICE_KEY_BUS_VOLTAGE));
+	ret = sbu_msx_pi30_parse_qpgs(qpgs, 40, &values, &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert_false(ret);
+	g_clear_error(&error);
+
+	/* framing errors */
+	memcpy(buf, sbu_msx_test_pi30_corpus[2].frame, sbu_msx_test_pi30_corpus[2].len);
+	buf[5] = '1';
+	len = sbu_msx_test_pi30_corpus[2].len;
+	ret = sbu_msx_pi30_decode(buf, len, &payload, &payload_len, &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert_false(ret);
+	g_clear_error(&error);
+	ret = sbu_msx_pi30_decode(buf, 2, &payload, &payload_len, &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert_false(ret);
+	g_clear_error(&error);
+
+	/* every frame in the corpus is valid, and damaged payloads fail cleanly */
+	for (guint i = 0; i < G_N_ELEMENTS(sbu_msx_test_pi30_corpus); i++) {
+		const gchar *cmd = sbu_msx_test_pi30_corpus[i].cmd;
+		ret = sbu_msx_pi30_decode((const guint8 *)sbu_msx_test_pi30_corpus[i].frame,
+					  sbu_msx_test_pi30_corpus[i].len,
+					  &payload,
+					  &payload_len,
+					  &error);
+		g_assert_no_error(error);
+		g_assert_true(ret);
+		ret = sbu_msx_test_pi30_parse(cmd, payload, payload_len, &values, &error);
+		g_assert_no_error(error);
+		g_assert_true(ret);
+		for (guint j = 0; j < 1000; j++) {
+			gsize len_tmp = g_rand_int_range(rand, 0, payload_len + 1);
+			gsize off = g_rand_int_range(rand, 0, payload_len);
+			memcpy(buf, payload, payload_len);
+			buf[off] = g_rand_int_range(rand, 0, 256);
+			ret = sbu_msx_test_pi30_parse(cmd,
+						      (const gchar *)buf,
+						      j % 2 == 0 ? payload_len : len_tmp,
+						      &values,
+						      &error);
+			g_assert_true(ret == (error == NULL));
+			g_clear_error(&error);
+		}
+	}
+}
+
+static void
+sbu_msx_test_pi30_benchmark_func(void)
+{
+	const guint8 *frame = (const guint8 *)sbu_msx_test_pi30_corpus[0].frame;
+	gsize len = sbu_msx_test_pi30_corpus[0].len;
+	const guint n = 100000;
+	gdouble elapsed;
+	SbuMsxPi30Values values;
+
+	if (!g_test_perf()) {
+		g_test_skip("only run with -m perf");
+		return;
+	}
+	g_test_timer_start();
+	for (guint i = 0; i < n; i++) {
+		const gchar *payload = NULL;
+		gsize payload_len = 0;
+		if (!sbu_msx_pi30_decode(frame, len, &payload, &payload_len, NULL))
+			g_assert_not_reached();
+		if (!sbu_msx_pi30_parse_qpigs(payload, payload_len, &values, NULL))
+			g_assert_not_reached();
+	}
+	elapsed = g_test_timer_elapsed() * 1e9 / n;
+	g_test_minimized_result(elapsed, "QPIGS decode and parse: %.0fns", elapsed);
+}
+
+static void
+sbu_test_async_result_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	GAsyncResult **res_out = (GAsyncResult **)user_data;
+	*res_out = g_object_ref(res);
+}
+
+typedef struct {
+	guint8 buf[SBU_MSX_PI30_FRAME_MAX]; /* request */
+	gsize idx;
+	const gchar *response;
+	gsize response_len;
+} SbuMsxTestInverter;
+
+/* the other end of the pseudo-terminal, which replies once a whole request arrives */
+static gboolean
+sbu_msx_test_inverter_cb(gint fd, GIOCondition condition, gpointer user_data)
+{
+	SbuMsxTestInverter *inverter = (SbuMsxTestInverter *)user_data;
+	gssize len = read(fd, inverter->buf + inverter->idx, sizeof(inverter->buf) - inverter->idx);
+	if (len <= 0)
+		return G_SOURCE_CONTINUE;
+	inverter->idx += len;
+	if (memchr(inverter->buf, '\r', inverter->idx) == NULL || inverter->response == NULL)
+		return G_SOURCE_CONTINUE;
+	g_assert_cmpint(write(fd, inverter->response, inverter->response_len),
+			==,
+			inverter->response_len);
+	return G_SOURCE_CONTINUE;
+}
+
+static void
+sbu_msx_test_transport_fd(SbuMsxTransportFdKind kind)
+{
+	gboolean ret;
+	gint fd_master;
+	gint fd_slave;
+	gsize len;
+	guint watch_id;
+	guint8 buf[16];
+	struct termios tio;
+	SbuMsxTestInverter inverter = {
+	    .response = sbu_msx_test_pi30_corpus[0].frame,
+	    .response_len = sbu_msx_test_pi30_corpus[0].len,
+	};
+	g_autoptr(GAsyncResult) res = NULL;
+	g_autoptr(GBytes) response = NULL;
+	g_autoptr(GCancellable) cancellable = g_cancellable_new();
+	g_autoptr(GError) error = NULL;
+	g_autoptr(SbuMsxTransport) transport = NULL;
+
+	/* a raw pseudo-terminal stands in for the inverter */
+	fd_master = posix_openpt(O_RDWR | O_NOCTTY);
+	g_assert_cmpint(fd_master, >=, 0);
+	g_assert_cmpint(grantpt(fd_master), ==, 0);
+	g_assert_cmpint(unlockpt(fd_master), ==, 0);
+	fd_slave = open(ptsname(fd_master), O_RDWR | O_NOCTTY);
+	g_assert_cmpint(fd_slave, >=, 0);
+	g_assert_cmpint(tcgetattr(fd_slave, &tio), ==, 0);
+	cfmakeraw(&tio);
+	g_assert_cmpint(tcsetattr(fd_slave, TCSANOW, &tio), ==, 0);
+	watch_id = g_unix_fd_add(fd_master, G_IO_IN, sbu_msx_test_inverter_cb, &inverter);
+
+	transport = sbu_msx_transport_fd_new(ptsname(fd_master), kind);
+	ret = sbu_msx_transport_open(transport, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+
+	/* the response is reassembled without the carriage return */
+	len = sbu_msx_pi30_encode("QPIGS", buf, sizeof(buf));
+	sbu_msx_transport_request_async(transport,
+					buf,
+					len,
+					NULL,
+					NULL,
+					NULL,
+					sbu_test_async_result_cb,
+					&res);
+	while (res == NULL)
+		g_main_context_iteration(NULL, TRUE);
+	response = sbu_msx_transport_request_finish(transport, res, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(response);
+	g_assert_cmpint(g_bytes_get_size(response), ==, inverter.response_len - 1);
+	g_assert_cmpint(memcmp(g_bytes_get_data(response, NULL),
+			       inverter.response,
+			       inverter.response_len - 1),
+			==,
+			0);
+
+	/* hidraw writes a whole report with the report ID first */
+	if (kind == SBU_MSX_TRANSPORT_FD_KIND_HIDRAW) {
+		g_assert_cmpint(inverter.idx, ==, 9);
+		g_assert_cmpint(inverter.buf[0], ==, 0x00);
+		g_assert_cmpint(memcmp(inverter.buf + 1, buf, len), ==, 0);
+	} else {
+		g_assert_cmpint(inverter.idx, ==, len);
+		g_assert_cmpint(memcmp(inverter.buf, buf, len), ==, 0);
+	}
+
+	/* no response */
+	g_clear_object(&res);
+	inverter.idx = 0;
+	inverter.response = NULL;
+	sbu_msx_transport_request_async(transport,
+					buf,
+					len,
+					NULL,
+					NULL,
+					cancellable,
+					sbu_test_async_result_cb,
+					&res);
+	g_cancellable_cancel(cancellable);
+	while (res == NULL)
+		g_main_context_iteration(NULL, TRUE);
+	g_clear_pointer(&response, g_bytes_unref);
+	response = sbu_msx_transport_request_finish(transport, res, &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+	g_assert_null(response);
+
+	ret = sbu_msx_transport_close(transport, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_source_remove(watch_id);
+	close(fd_slave);
+	close(fd_master);
+}
+
+static void
+sbu_msx_test_transport_func(void)
+{
+	sbu_msx_test_transport_fd(SBU_MSX_TRANSPORT_FD_KIND_SERIAL);
+	sbu_msx_test_transport_fd(SBU_MSX_TRANSPORT_FD_KIND_HIDRAW);
+}
+
+static void
+sbu_msx_test_simulator_func(void)
+{
+	gboolean ret;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(SbuMsxDevice) device = NULL;
+	g_autoptr(SbuMsxSimulator) simulator = sbu_msx_simulator_new(0);
+	g_autoptr(SbuMsxTransport) transport = NULL;
+
+	ret = sbu_msx_simulator_start(simulator, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+
+	/* every static and live command is answered */
+	transport = sbu_msx_transport_fd_new(sbu_msx_simulator_get_path(simulator),
+					     SBU_MSX_TRANSPORT_FD_KIND_SERIAL);
+	device = sbu_msx_device_new(transport);
+	ret = sbu_msx_device_open(device, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_cmpint(sbu_msx_simulator_get_requests(simulator), ==, 8);
+	g_assert_cmpstr(sbu_device_get_serial_number(SBU_DEVICE(device)), ==, "00000092931709");
+	g_assert_cmpint(sbu_msx_device_get_value(device, SBU_MSX_DEVICE_KEY_AC_OUTPUT_VOLTAGE),
+			==,
+			230000);
+	g_assert_cmpint(sbu_msx_device_get_value(device, SBU_MSX_DEVICE_KEY_BATTERY_VOLTAGE),
+			==,
+			57500);
+
+	/* every response is damaged */
+	sbu_msx_simulator_set_faults(simulator,
+				     SBU_MSX_SIMULATOR_FAULT_CORRUPT |
+					 SBU_MSX_SIMULATOR_FAULT_TRUNCATE |
+					 SBU_MSX_SIMULATOR_FAULT_NAK,
+				     100);
+	for (guint i = 0; i < 5; i++) {
+		ret = sbu_device_refresh(SBU_DEVICE(device), NULL, &error);
+		g_assert_nonnull(error);
+		g_assert_false(ret);
+		g_clear_error(&error);
+	}
+
+	/* and recovers */
+	sbu_msx_simulator_set_faults(simulator, SBU_MSX_SIMULATOR_FAULT_NONE, 0);
+	ret = sbu_device_refresh(SBU_DEVICE(device), NULL, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_cmpint(sbu_msx_simulator_get_requests(simulator), ==, 14);
+
+	ret = sbu_msx_device_close(device, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	sbu_msx_simulator_stop(simulator);
+}
+
+typedef struct {
+	SbuMsxDevice *device;
+	gint64 ts_start;
+	gint64 latency; /* us, total */
+	guint polls;
+	guint errors;
+	guint *pending;
+} SbuMsxTestPoller;
+
+static void
+sbu_msx_test_poller_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuMsxTestPoller *poller = (SbuMsxTestPoller *)user_data;
+	g_autoptr(GError) error = NULL;
+
+	if (!sbu_device_refresh_finish(SBU_DEVICE(source), res, &error))
+		poller->errors++;
+	poller->latency += g_get_monotonic_time() - poller->ts_start;
+	poller->polls++;
+	(*poller->pending)--;
+}
+
+static void
+sbu_msx_test_simulator_benchmark_func(void)
+{
+	const guint n_devices = 8;
+	const guint n_cycles = 50;
+	gdouble elapsed;
+	gdouble cpu;
+	gint64 latency = 0;
+	guint errors = 0;
+	guint pending = 0;
+	struct rusage ru_start;
+	struct rusage ru_end;
+	SbuMsxTestPoller pollers[8] = {0};
+	g_autoptr(GPtrArray) simulators = g_ptr_array_new_with_free_func(g_object_unref);
+
+	if (!g_test_perf()) {
+		g_test_skip("only run with -m perf");
+		return;
+	}
+
+	/* a realistic serial round trip, with a few damaged responses */
+	for (guint i = 0; i < n_devices; i++) {
+		g_autoptr(GError) error = NULL;
+		g_autoptr(SbuMsxSimulator) simulator = sbu_msx_simulator_new(i);
+		g_autoptr(SbuMsxTransport) transport = NULL;
+
+		if (!sbu_msx_simulator_start(simulator, &error))
+			g_assert_not_reached();
+		transport = sbu_msx_transport_fd_new(sbu_msx_simulator_get_path(simulator),
+						     SBU_MSX_TRANSPORT_FD_KIND_SERIAL);
+		pollers[i].device = sbu_msx_device_new(transport);
+		pollers[i].pending = &pending;
+		if (!sbu_msx_device_open(pollers[i].device, &error))
+			g_assert_not_reached();
+		sbu_msx_simulator_set_latency(simulator, 20);
+		sbu_msx_simulator_set_faults(simulator,
+					     SBU_MSX_SIMULATOR_FAULT_CORRUPT |
+						 SBU_MSX_SIMULATOR_FAULT_TRUNCATE,
+					     2);
+		g_ptr_array_add(simulators, g_steal_pointer(&simulator));
+	}
+
+	/* poll all the devices at once, like the daemon does */
+	g_assert_cmpint(getrusage(RUSAGE_SELF, &ru_start), ==, 0);
+	g_test_timer_start();
+	for (guint j = 0; j < n_cycles; j++) {
+		for (guint i = 0; i < n_devices; i++) {
+			pollers[i].ts_start = g_get_monotonic_time();
+			sbu_device_refresh_async(SBU_DEVICE(pollers[i].device),
+						 NULL,
+						 sbu_msx_test_poller_cb,
+						 &pollers[i]);
+			pending++;
+		}
+		while (pending > 0)
+			g_main_context_iteration(NULL, TRUE);
+	}
+	elapsed = g_test_timer_elapsed();
+	g_assert_cmpint(getrusage(RUSAGE_SELF, &ru_end), ==, 0);
+
+	/* this includes the simulator threads */
+	cpu = (ru_end.ru_utime.tv_sec - ru_start.ru_utime.tv_sec) +
+	      (ru_end.ru_stime.tv_sec - ru_start.ru_stime.tv_sec) +
+	      (ru_end.ru_utime.tv_usec - ru_start.ru_utime.tv_usec) / 1e6 +
+	      (ru_end.ru_stime.tv_usec - ru_start.ru_stime.tv_usec) / 1e6;
+	for (guint i = 0; i < n_devices; i++) {
+		g_assert_cmpint(pollers[i].polls, ==, n_cycles);
+		latency += pollers[i].latency;
+		errors += pollers[i].errors;
+		g_object_unref(pollers[i].device);
+	}
+	g_test_maximized_result(n_devices * n_cycles / elapsed,
+				"%u devices: %.1f polls/s",
+				n_devices,
+				n_devices * n_cycles / elapsed);
+	g_test_minimized_result(cpu * 100 / elapsed, "CPU: %.1f%%", cpu * 100 / elapsed);
+	g_test_minimized_result((gdouble)latency / (n_devices * n_cycles) / 1000,
+				"mean latency: %.1fms, %u failed polls",
+				(gdouble)latency / (n_devices * n_cycles) / 1000,
+				errors);
+}
+
+static void
+sbu_msx_test_parallel_refresh_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	guint *pending = (guint *)user_data;
+	g_autoptr(GError) error = NULL;
+	gboolean ret = sbu_device_refresh_finish(SBU_DEVICE(source), res, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	(*pending)--;
+}
+
+static void
+sbu_msx_test_parallel_func(void)
+{
+	gboolean ret;
+	gint64 ts_start;
+	guint pending = 0;
+	g_autofree gchar *filename = NULL;
+	g_autofree gchar *tmpdir = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) units = g_ptr_array_new_with_free_func(g_object_unref);
+	g_autoptr(SbuMsxCapture) capture = sbu_msx_capture_new();
+	g_autoptr(SbuMsxCapture) capture_replay = sbu_msx_capture_new();
+	g_autoptr(SbuMsxDevice) device = NULL;
+	g_autoptr(SbuMsxDevice) device_replay = NULL;
+	g_autoptr(SbuMsxSimulator) simulator = sbu_msx_simulator_new(0);
+	g_autoptr(SbuMsxTransport) transport = NULL;
+	g_autoptr(SbuMsxTransport) transport_replay = NULL;
+
+	sbu_msx_simulator_set_units(simulator, 3);
+	ret = sbu_msx_simulator_start(simulator, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	transport = sbu_msx_transport_fd_new(sbu_msx_simulator_get_path(simulator),
+					     SBU_MSX_TRANSPORT_FD_KIND_SERIAL);
+	device = sbu_msx_device_new(transport);
+	ret = sbu_msx_device_open(device, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_cmpint(sbu_msx_device_get_value(device, SBU_MSX_DEVICE_KEY_PARALLEL_MAX_NUM),
+			==,
+			9000);
+
+	/* unit 0 is the one on the link, and there are only three */
+	for (guint i = 0; i < 4; i++) {
+		g_autoptr(SbuMsxDevice) unit = sbu_msx_device_new_for_unit(transport, i);
+		ret = sbu_msx_device_open(unit, &error);
+		if (i == 3) {
+			g_assert_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+			g_assert_false(ret);
+			g_clear_error(&error);
+			continue;
+		}
+		g_assert_no_error(error);
+		g_assert_true(ret);
+		g_assert_cmpint(sbu_msx_device_get_value(unit, SBU_MSX_DEVICE_KEY_AC_OUTPUT_POWER),
+				==,
+				(300 + i) * 1000);
+		g_assert_cmpint(sbu_msx_device_get_value(unit, SBU_MSX_DEVICE_KEY_BATTERY_VOLTAGE),
+				==,
+				51200);
+		if (i == 0) {
+			g_assert_cmpstr(sbu_device_get_serial_number(SBU_DEVICE(unit)),
+					==,
+					sbu_device_get_serial_number(SBU_DEVICE(device)));
+			continue;
+		}
+		g_ptr_array_add(units, g_steal_pointer(&unit));
+	}
+	g_assert_cmpstr(sbu_device_get_serial_number(g_ptr_array_index(units, 1)),
+			==,
+			"00000092933709");
+
+	/* every unit is refreshed at once, and the requests are queued on the link */
+	tmpdir = g_dir_make_tmp("sbu-self-test-XXXXXX", &error);
+	g_assert_no_error(error);
+	filename = g_build_filename(tmpdir, "msx.sbucap", NULL);
+	ret = sbu_msx_capture_open(capture, filename, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	sbu_msx_transport_set_capture(transport, capture);
+	sbu_msx_simulator_set_latency(simulator, 20);
+	ts_start = g_get_monotonic_time();
+	sbu_device_refresh_async(SBU_DEVICE(device),
+				 NULL,
+				 sbu_msx_test_parallel_refresh_cb,
+				 &pending);
+	pending++;
+	for (guint i = 0; i < units->len; i++) {
+		sbu_device_refresh_async(g_ptr_array_index(units, i),
+					 NULL,
+					 sbu_msx_test_parallel_refresh_cb,
+					 &pending);
+		pending++;
+	}
+	while (pending > 0)
+		g_main_context_iteration(NULL, TRUE);
+	g_assert_cmpint(g_get_monotonic_time() - ts_start, >=, 3 * 20 * 1000);
+	g_assert_cmpint(sbu_msx_simulator_get_requests(simulator), ==, 8 + 4 + 3);
+	sbu_msx_transport_set_capture(transport, NULL);
+
+	/* the queued requests are captured when sent, so each has its response */
+	ret = sbu_msx_capture_load(capture_replay, filename, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_cmpint(sbu_msx_capture_get_size(capture_replay), ==, 3 * 2);
+	for (guint i = 0; i < sbu_msx_capture_get_size(capture_replay); i++) {
+		const SbuMsxCaptureFrame *frame = sbu_msx_capture_get_frame(capture_replay, i);
+		g_assert_cmpint(frame->kind,
+				==,
+				i % 2 == 0 ? SBU_MSX_CAPTURE_KIND_REQUEST
+					   : SBU_MSX_CAPTURE_KIND_RESPONSE);
+	}
+	transport_replay = sbu_msx_transport_replay_new(capture_replay);
+	device_replay = sbu_msx_device_new_for_unit(transport_replay, 2);
+	ret = sbu_device_refresh(SBU_DEVICE(device_replay), NULL, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_cmpint(sbu_msx_device_get_value(device_replay,
+						 SBU_MSX_DEVICE_KEY_AC_OUTPUT_POWER),
+			==,
+			302 * 1000);
+	g_unlink(filename);
+	g_rmdir(tmpdir);
+
+	/* the link belongs to the unit it is connected to */
+	ret = sbu_msx_device_close(g_ptr_array_index(units, 0), &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	ret = sbu_msx_device_close(device, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	sbu_msx_simulator_stop(simulator);
+}
+
+/* records a simulated inverter being opened and then refreshed */
+static void
+sbu_msx_test_capture_simulator(const gchar *filename, guint n_refresh, gint *values)
+{
+	gboolean ret;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(SbuMsxCapture) capture = sbu_msx_capture_new();
+	g_autoptr(SbuMsxDevice) device = NULL;
+	g_autoptr(SbuMsxSimulator) simulator = sbu_msx_simulator_new(0);
+	g_autoptr(SbuMsxTransport) transport = NULL;
+
+	ret = sbu_msx_simulator_start(simulator, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	ret = sbu_msx_capture_open(capture, filename, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	transport = sbu_msx_transport_fd_new(sbu_msx_simulator_get_path(simulator),
+					     SBU_MSX_TRANSPORT_FD_KIND_SERIAL);
+	sbu_msx_transport_set_capture(transport, capture);
+	device = sbu_msx_device_new(transport);
+	ret = sbu_msx_device_open(device, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	for (guint i = 0; i < n_refresh; i++) {
+		if (values != NULL)
+			values[i] = sbu_msx_device_get_value(device,
+							     SBU_MSX_DEVICE_KEY_PV_CHARGING_POWER);
+		ret = sbu_device_refresh(SBU_DEVICE(device), NULL, &error);
+		g_assert_no_error(error);
+		g_assert_true(ret);
+	}
+	ret = sbu_msx_device_close(device, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	sbu_msx_simulator_stop(simulator);
+}
+
+static void
+sbu_msx_test_capture_func(void)
+{
+	gboolean ret;
+	gint values[3] = {0};
+	const SbuMsxCaptureFrame *frame;
+	g_autofree gchar *filename = NULL;
+	g_autofree gchar *tmpdir = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(SbuMsxCapture) capture = sbu_msx_capture_new();
+	g_autoptr(SbuMsxDevice) device = NULL;
+	g_autoptr(SbuMsxTransport) transport = NULL;
+
+	tmpdir = g_dir_make_tmp("sbu-self-test-XXXXXX", &error);
+	g_assert_no_error(error);
+	filename = g_build_filename(tmpdir, "msx.sbucap", NULL);
+	sbu_msx_test_capture_simulator(filename, G_N_ELEMENTS(values), values);
+	g_assert_cmpint(values[0], !=, values[1]);
+
+	/* each of the eight requests sent when opening, and each refresh, has a response */
+	ret = sbu_msx_capture_load(capture, filename, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_cmpint(sbu_msx_capture_get_size(capture), ==, (8 + G_N_ELEMENTS(values)) * 2);
+	for (guint i = 0; i < sbu_msx_capture_get_size(capture); i++) {
+		frame = sbu_msx_capture_get_frame(capture, i);
+		g_assert_cmpint(frame->kind,
+				==,
+				i % 2 == 0 ? SBU_MSX_CAPTURE_KIND_REQUEST
+					   : SBU_MSX_CAPTURE_KIND_RESPONSE);
+		g_assert_cmpint(frame->ts, >, 0);
+	}
+	frame = sbu_msx_capture_get_frame(capture, 1);
+	g_assert_cmpint(frame->len, ==, 7);
+	g_assert_cmpint(memcmp(frame->data, "(PI30", 5), ==, 0);
+
+	/* the replay sees exactly what the inverter sent */
+	transport = sbu_msx_transport_replay_new(capture);
+	device = sbu_msx_device_new(transport);
+	ret = sbu_msx_device_open(device, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_cmpstr(sbu_device_get_serial_number(SBU_DEVICE(device)), ==, "00000092931709");
+	for (guint i = 0; i < G_N_ELEMENTS(values); i++) {
+		g_assert_cmpint(sbu_msx_device_get_value(device,
+							 SBU_MSX_DEVICE_KEY_PV_CHARGING_POWER),
+				==,
+				values[i]);
+		ret = sbu_device_refresh(SBU_DEVICE(device), NULL, &error);
+		g_assert_no_error(error);
+		g_assert_true(ret);
+	}
+
+	/* not a capture */
+	ret = g_file_set_contents(filename, "SBUCAP00", -1, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_clear_object(&capture);
+	capture = sbu_msx_capture_new();
+	ret = sbu_msx_capture_load(capture, filename, &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert_false(ret);
+
+	g_unlink(filename);
+	g_rmdir(tmpdir);
+}
+
+typedef struct {
+	SbuDatabase *db;
+	guint pending;
+	guint saved;
+} SbuMsxTestReplay;
+
+static void
+sbu_msx_test_replay_frame_changed_cb(SbuMsxDevice *device,
+				     const SbuMsxPi30Values *changed,
+				     gpointer user_data)
+{
+	SbuMsxTestReplay *replay = (SbuMsxTestReplay *)user_data;
+	gint64 ts = g_get_real_time() / G_USEC_PER_SEC;
+	SbuDatabaseItem items[SBU_MSX_DEVICE_KEY_LAST];
+	g_autoptr(GPtrArray) array = g_ptr_array_new();
+
+	for (guint i = 1; i < SBU_MSX_DEVICE_KEY_LAST; i++) {
+		if (!sbu_msx_pi30_values_has(changed, i))
+			continue;
+		items[i].key = (gchar *)sbu_device_key_to_string(i);
+		items[i].ts = ts;
+		items[i].val = changed->vals[i];
+		g_ptr_array_add(array, &items[i]);
+	}
+	if (!sbu_database_save_values(replay->db, "msx", array, NULL))
+		g_assert_not_reached();
+	replay->saved += array->len;
+}
+
+static void
+sbu_msx_test_replay_refresh_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuMsxTestReplay *replay = (SbuMsxTestReplay *)user_data;
+	if (!sbu_device_refresh_finish(SBU_DEVICE(source), res, NULL))
+		g_assert_not_reached();
+	replay->pending--;
+}
+
+static void
+sbu_msx_test_replay_benchmark_func(void)
+{
+	const guint n = 10000;
+	gdouble elapsed;
+	SbuMsxTestReplay replay = {0};
+	g_autofree gchar *filename = NULL;
+	g_autofree gchar *location = NULL;
+	g_autofree gchar *tmpdir = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(SbuDatabase) db = sbu_database_new();
+	g_autoptr(SbuMsxCapture) capture = sbu_msx_capture_new();
+	g_autoptr(SbuMsxDevice) device = NULL;
+	g_autoptr(SbuMsxTransport) transport = NULL;
+
+	if (!g_test_perf()) {
+		g_test_skip("only run with -m perf");
+		return;
+	}
+
+	/* a short trace, which the replay goes round and round */
+	tmpdir = g_dir_make_tmp("sbu-self-test-XXXXXX", &error);
+	g_assert_no_error(error);
+	filename = g_build_filename(tmpdir, "msx.sbucap", NULL);
+	location = g_build_filename(tmpdir, "raw.db", NULL);
+	sbu_msx_test_capture_simulator(filename, 20, NULL);
+	if (!sbu_msx_capture_load(capture, filename, &error))
+		g_assert_not_reached();
+	sbu_database_set_location(db, location);
+	if (!sbu_database_open(db, &error))
+		g_assert_not_reached();
+	replay.db = db;
+
+	/* decode, parse and save every response as fast as possible */
+	transport = sbu_msx_transport_replay_new(capture);
+	device = sbu_msx_device_new(transport);
+	g_signal_connect(device,
+			 "frame-changed",
+			 G_CALLBACK(sbu_msx_test_replay_frame_changed_cb),
+			 &replay);
+	if (!sbu_msx_device_open(device, &error))
+		g_assert_not_reached();
+	g_test_timer_start();
+	for (guint i = 0; i < n; i++) {
+		replay.pending++;
+		sbu_device_refresh_async(SBU_DEVICE(device),
+					 NULL,
+					 sbu_msx_test_replay_refresh_cb,
+					 &replay);
+		while (replay.pending > 0)
+			g_main_context_iteration(NULL, TRUE);
+	}
+	elapsed = g_test_timer_elapsed();
+	g_test_maximized_result(n / elapsed,
+				"replay: %.0f polls/s, %u values saved",
+				n / elapsed,
+				replay.saved);
+
+	g_unlink(location);
+	g_unlink(filename);
+	g_rmdir(tmpdir);
+}
+
 static void
 sbu_test_database_func(void)
 {
@@ -65,14 +912,21 @@ sbu_test_database_func(void)
 	gboolean ret;
 	gint ts;
 	g_autofree gchar *location = NULL;
+	g_autofree gchar *tmpdir = NULL;
 	g_autoptr(GError) error = NULL;
 	g_autoptr(GPtrArray) latest = NULL;
 	g_autoptr(GPtrArray) array1 = NULL;
 	g_autoptr(GPtrArray) array2 = NULL;
+	g_autoptr(GPtrArray) array3 = NULL;
+	g_autoptr(GPtrArray) batch = g_ptr_array_new();
 	g_autoptr(SbuDatabase) db = NULL;
+	SbuDatabaseItem batch_items[] = {{"node_battery:voltage", 0, 27500},
+					 {"node_battery:current", 0, 2000},
+					 {"node_battery:voltage", 0, 27600}};
 
-	location = g_build_filename("/tmp", "sbu-self-test", "raw.db", NULL);
-	g_unlink(location);
+	tmpdir = g_dir_make_tmp("sbu-self-test-XXXXXX", &error);
+	g_assert_no_error(error);
+	location = g_build_filename(tmpdir, "raw.db", NULL);
 
 	db = sbu_database_new();
 	sbu_database_set_location(db, location);
@@ -101,6 +955,20 @@ sbu_test_database_func(void)
 	g_assert(array2 != NULL);
 	g_assert_cmpint(array2->len, ==, 0);
 
+	/* several values saved at once */
+	for (guint i = 0; i < G_N_ELEMENTS(batch_items); i++) {
+		batch_items[i].ts = ts;
+		g_ptr_array_add(batch, &batch_items[i]);
+	}
+	ret = sbu_database_save_values(db, "device-batch", batch, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	array3 = sbu_database_query(db, "device-batch", "node_battery:voltage", 0, ts, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(array3);
+	g_assert_cmpint(array3->len, ==, 2);
+	g_assert_cmpint(((SbuDatabaseItem *)g_ptr_array_index(array3, 1))->val, ==, 27600);
+
 	/* close, and reload */
 	g_debug("loading again...");
 	g_object_unref(db);
@@ -122,7 +990,9 @@ sbu_test_database_func(void)
 	g_assert_cmpint(item->val, ==, 52000);
 
 	/* cleanup */
+	g_clear_object(&db);
 	g_unlink(location);
+	g_rmdir(tmpdir);
 }
 
 static void
@@ -152,6 +1022,1124 @@ sbu_test_common_func(void)
 	}
 }
 
+static gboolean
+sbu_test_history_has_value(GArray *array, gint64 ts, gdouble val)
+{
+	for (guint i = 0; i < array->len; i++) {
+		SbuHistoryItem *item = &g_array_index(array, SbuHistoryItem, i);
+		if (item->ts == ts && item->val == val)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void
+sbu_test_device_values_changed_cb(SbuDevice *device, GVariant *changes, gpointer user_data)
+{
+	GVariant **changes_out = (GVariant **)user_data;
+	if (*changes_out != NULL)
+		g_variant_unref(*changes_out);
+	*changes_out = g_variant_ref(changes);
+}
+
+static void
+sbu_test_device_func(void)
+{
+	gboolean ret;
+	guint64 generation;
+	g_autoptr(GAsyncResult) res = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) changes = NULL;
+	g_autoptr(GVariant) changes_emitted = NULL;
+	g_autoptr(GVariant) value = NULL;
+	g_autoptr(GVariant) variant1 = NULL;
+	g_autoptr(GVariant) variant2 = NULL;
+	g_autoptr(GVariant) variant3 = NULL;
+	g_autoptr(SbuDevice) device = sbu_device_new();
+	g_autoptr(SbuLink) link = sbu_link_new(SBU_NODE_KIND_SOLAR, SBU_NODE_KIND_LOAD);
+	g_autoptr(SbuNode) node = sbu_node_new(SBU_NODE_KIND_BATTERY);
+
+	sbu_device_set_id(device, "0");
+	sbu_device_add_node(device, node);
+	sbu_device_add_link(device, link);
+
+	/* changes for other devices are ignored */
+	changes = g_variant_ref_sink(
+	    g_variant_new_parsed("[('0', 'node_battery', 'voltage', <27.5>),"
+				 " ('0', 'link_solar_load', 'active', <true>),"
+				 " ('1', 'node_battery', 'voltage', <12.0>)]"));
+	ret = sbu_device_apply_changes(device, changes, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_cmpfloat(sbu_device_get_node_value(device,
+						    SBU_NODE_KIND_BATTERY,
+						    SBU_DEVICE_PROPERTY_VOLTAGE),
+			  ==,
+			  27.5);
+	g_assert_true(sbu_device_get_link_active(device, SBU_NODE_KIND_SOLAR, SBU_NODE_KIND_LOAD));
+
+	/* unknown object */
+	value = g_variant_ref_sink(g_variant_new_double(1.0));
+	ret = sbu_device_apply_change(device, "node_solar", "voltage", value, &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+	g_assert_false(ret);
+
+	/* serialized once per generation */
+	generation = sbu_device_get_generation(device);
+	variant1 = sbu_device_to_variant(device);
+	variant2 = sbu_device_to_variant(device);
+	g_assert_true(variant1 == variant2);
+	sbu_node_set_value(node, SBU_DEVICE_PROPERTY_CURRENT, 3.f);
+	g_assert_cmpint(sbu_device_get_generation(device), >, generation);
+	variant3 = sbu_device_to_variant(device);
+	g_assert_true(variant1 != variant3);
+
+	/* changes outside of an update are delivered one at a time */
+	g_signal_connect(device,
+			 "values-changed",
+			 G_CALLBACK(sbu_test_device_values_changed_cb),
+			 &changes_emitted);
+	sbu_device_set_node_value(device, SBU_NODE_KIND_BATTERY, SBU_DEVICE_PROPERTY_POWER, 1.f);
+	g_assert_nonnull(changes_emitted);
+	g_assert_cmpint(g_variant_n_children(changes_emitted), ==, 1);
+	g_clear_pointer(&changes_emitted, g_variant_unref);
+
+	/* an update is delivered once, with only the latest value of each property */
+	sbu_device_begin_update(device);
+	sbu_device_begin_update(device);
+	sbu_device_set_node_value(device, SBU_NODE_KIND_BATTERY, SBU_DEVICE_PROPERTY_POWER, 2.f);
+	sbu_device_set_node_value(device, SBU_NODE_KIND_BATTERY, SBU_DEVICE_PROPERTY_POWER, 3.f);
+	sbu_device_set_link_active(device, SBU_NODE_KIND_SOLAR, SBU_NODE_KIND_LOAD, FALSE);
+	sbu_device_commit_update(device);
+	g_assert_null(changes_emitted);
+	sbu_device_commit_update(device);
+	g_assert_nonnull(changes_emitted);
+	g_assert_cmpint(g_variant_n_children(changes_emitted), ==, 2);
+	for (guint i = 0; i < g_variant_n_children(changes_emitted); i++) {
+		const gchar *id = NULL;
+		const gchar *propname = NULL;
+		g_autoptr(GVariant) val = NULL;
+		g_variant_get_child(changes_emitted, i, "(&s&sv)", &id, &propname, &val);
+		if (g_strcmp0(id, "node_battery") == 0) {
+			g_assert_cmpstr(propname, ==, "power");
+			g_assert_cmpfloat(g_variant_get_double(val), ==, 3.f);
+		} else {
+			g_assert_cmpstr(id, ==, "link_solar_load");
+			g_assert_false(g_variant_get_boolean(val));
+		}
+	}
+	g_clear_pointer(&changes_emitted, g_variant_unref);
+
+	/* devices without an async refresh still complete from the main loop */
+	sbu_device_refresh_async(device, NULL, sbu_test_async_result_cb, &res);
+	g_assert_null(res);
+	while (res == NULL)
+		g_main_context_iteration(NULL, TRUE);
+	ret = sbu_device_refresh_finish(device, res, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+}
+
+static void
+sbu_test_node_dbus_func(void)
+{
+	const gchar *props[] =
+	    {"power", "power-max", "voltage", "voltage-max", "current", "current-max", "frequency"};
+	g_autoptr(GDBusInterface) iface = NULL;
+	g_autoptr(GDBusObjectManagerServer) object_manager = NULL;
+	g_autoptr(SbuDbusNode) skeleton = sbu_dbus_node_skeleton_new();
+	g_autoptr(SbuDbusObjectSkeleton) object = NULL;
+	g_autoptr(SbuNode) node = sbu_node_new(SBU_NODE_KIND_BATTERY);
+
+	sbu_node_set_value(node, SBU_DEVICE_PROPERTY_POWER, 100.f);
+	sbu_node_set_value(node, SBU_DEVICE_PROPERTY_POWER_MAX, 5000.f);
+	sbu_node_set_value(node, SBU_DEVICE_PROPERTY_VOLTAGE_MAX, 60.f);
+	sbu_node_set_value(node, SBU_DEVICE_PROPERTY_CURRENT_MAX, 80.f);
+
+	/* exported the same way as sbud does */
+	object_manager = g_dbus_object_manager_server_new("/com/hughski/PowerSBU/devices");
+	object = sbu_dbus_object_skeleton_new("/com/hughski/PowerSBU/devices/0/node_battery");
+	for (guint i = 0; i < G_N_ELEMENTS(props); i++)
+		g_object_bind_property(node, props[i], skeleton, props[i], G_BINDING_SYNC_CREATE);
+	sbu_dbus_object_skeleton_set_node(object, skeleton);
+	g_dbus_object_manager_server_export(object_manager, G_DBUS_OBJECT_SKELETON(object));
+
+	/* the maximums are readable back from the exported interface */
+	iface = g_dbus_object_manager_get_interface(G_DBUS_OBJECT_MANAGER(object_manager),
+						    "/com/hughski/PowerSBU/devices/0/node_battery",
+						    "com.hughski.PowerSBU.Node");
+	g_assert_nonnull(iface);
+	g_assert_cmpfloat(sbu_dbus_node_get_power(SBU_DBUS_NODE(iface)), ==, 100.f);
+	g_assert_cmpfloat(sbu_dbus_node_get_power_max(SBU_DBUS_NODE(iface)), ==, 5000.f);
+	g_assert_cmpfloat(sbu_dbus_node_get_voltage_max(SBU_DBUS_NODE(iface)), ==, 60.f);
+	g_assert_cmpfloat(sbu_dbus_node_get_current_max(SBU_DBUS_NODE(iface)), ==, 80.f);
+
+	/* and follow changes */
+	sbu_node_set_value(node, SBU_DEVICE_PROPERTY_POWER_MAX, 6000.f);
+	g_assert_cmpfloat(sbu_dbus_node_get_power_max(SBU_DBUS_NODE(iface)), ==, 6000.f);
+}
+
+static void
+sbu_test_history_func(void)
+{
+	g_autoptr(GArray) array_ave = NULL;
+	g_autoptr(GArray) array_buckets = NULL;
+	g_autoptr(GArray) array_gap = NULL;
+	g_autoptr(GArray) array_lttb = NULL;
+	g_autoptr(GArray) array_minmax = NULL;
+	g_autoptr(GArray) array_odd = NULL;
+	g_autoptr(GArray) array_raw = NULL;
+	g_autoptr(GPtrArray) items = g_ptr_array_new_with_free_func(g_free);
+	g_autoptr(SbuHistoryBuckets) buckets = NULL;
+
+	/* flat line with a single spike */
+	for (guint i = 0; i < 1000; i++) {
+		SbuDatabaseItem *item = g_new0(SbuDatabaseItem, 1);
+		item->ts = i;
+		item->val = i == 503 ? 1000 : 10;
+		g_ptr_array_add(items, item);
+	}
+
+	for (guint i = SBU_HISTORY_MODE_AVERAGE; i < SBU_HISTORY_MODE_LAST; i++)
+		g_assert_cmpint(sbu_history_mode_from_string(sbu_history_mode_to_string(i)), ==, i);
+	g_assert_cmpint(sbu_history_mode_from_string("dave"), ==, SBU_HISTORY_MODE_UNKNOWN);
+
+	/* no filter */
+	array_raw = sbu_history_downsample(items, 0, 999, 0, SBU_HISTORY_MODE_LTTB);
+	g_assert_cmpint(array_raw->len, ==, 1000);
+
+	/* time-aligned buckets, spike is averaged away */
+	array_ave = sbu_history_downsample(items, 0, 999, 10, SBU_HISTORY_MODE_AVERAGE);
+	g_assert_cmpint(array_ave->len, ==, 10);
+	g_assert_cmpint(g_array_index(array_ave, SbuHistoryItem, 0).ts, ==, 50);
+	g_assert_cmpfloat(g_array_index(array_ave, SbuHistoryItem, 0).val, ==, 10.0);
+	g_assert_cmpint(g_array_index(array_ave, SbuHistoryItem, 5).ts, ==, 550);
+	g_assert_cmpfloat(g_array_index(array_ave, SbuHistoryItem, 5).val, ==, 19.9);
+
+	/* buckets with no values hold the last value, so the limit is honoured */
+	array_gap = sbu_history_downsample(items, 0, 1999, 10, SBU_HISTORY_MODE_AVERAGE);
+	g_assert_cmpint(array_gap->len, ==, 10);
+	g_assert_cmpint(g_array_index(array_gap, SbuHistoryItem, 9).ts, ==, 1900);
+	g_assert_cmpfloat(g_array_index(array_gap, SbuHistoryItem, 9).val, ==, 10.0);
+
+	/* envelope keeps the spike, and returns exactly the limit */
+	array_minmax = sbu_history_downsample(items, 0, 999, 10, SBU_HISTORY_MODE_MINMAX);
+	g_assert_cmpint(array_minmax->len, ==, 10);
+	g_assert_true(sbu_test_history_has_value(array_minmax, 503, 1000));
+	array_odd = sbu_history_downsample(items, 0, 999, 11, SBU_HISTORY_MODE_MINMAX);
+	g_assert_cmpint(array_odd->len, ==, 11);
+	g_assert_cmpint(g_array_index(array_odd, SbuHistoryItem, 10).ts, ==, 999);
+
+	/* the running state used for live windows gives the same result */
+	buckets = sbu_history_buckets_new(0, 999, 10, SBU_HISTORY_MODE_MINMAX);
+	for (guint i = 0; i < items->len; i++) {
+		SbuDatabaseItem *item = g_ptr_array_index(items, i);
+		g_assert_true(sbu_history_buckets_add(buckets, item->ts, item->val));
+	}
+	g_assert_false(sbu_history_buckets_add(buckets, 0, 10));
+	array_buckets = sbu_history_buckets_to_array(buckets);
+	g_assert_cmpint(array_buckets->len, ==, array_minmax->len);
+	g_assert_cmpmem(array_buckets->data,
+			array_buckets->len * sizeof(SbuHistoryItem),
+			array_minmax->data,
+			array_minmax->len * sizeof(SbuHistoryItem));
+
+	/* exactly the number of points asked for, including the spike */
+	array_lttb = sbu_history_downsample(items, 0, 999, 10, SBU_HISTORY_MODE_LTTB);
+	g_assert_cmpint(array_lttb->len, ==, 10);
+	g_assert_cmpint(g_array_index(array_lttb, SbuHistoryItem, 0).ts, ==, 0);
+	g_assert_cmpint(g_array_index(array_lttb, SbuHistoryItem, 9).ts, ==, 999);
+	g_assert_true(sbu_test_history_has_value(array_lttb, 503, 1000));
+}
+
+static void
+sbu_test_history_fd_func(void)
+{
+	const SbuHistoryItem *items;
+	gint fd;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GMappedFile) mapped = NULL;
+	g_autoptr(GVariant) history = NULL;
+
+#ifndef HAVE_MEMFD_CREATE
+	g_test_skip("no memfd support");
+	return;
+#endif
+	history = g_variant_ref_sink(g_variant_new_parsed("([(@t 10, 1.5), (@t 20, -2.5)],)"));
+	fd = sbu_history_to_fd(history, &error);
+	g_assert_no_error(error);
+	g_assert_cmpint(fd, >=, 0);
+
+	/* sealed, so the client can trust it */
+	g_assert_cmpint(write(fd, "x", 1), ==, -1);
+
+	mapped = sbu_history_map_fd(fd, &error);
+	g_assert_no_error(error);
+	g_assert_nonnull(mapped);
+	g_assert_cmpint(g_mapped_file_get_length(mapped), ==, 2 * sizeof(SbuHistoryItem));
+	items = (const SbuHistoryItem *)g_mapped_file_get_contents(mapped);
+	g_assert_cmpint(items[0].ts, ==, 10);
+	g_assert_cmpfloat(items[0].val, ==, 1.5);
+	g_assert_cmpint(items[1].ts, ==, 20);
+	g_assert_cmpfloat(items[1].val, ==, -2.5);
+	close(fd);
+}
+
+static void
+sbu_test_history_cache_func(void)
+{
+	guint64 ts_start = 1001;
+	guint64 ts_end = 1999;
+	g_autoptr(GVariant) value1 = NULL;
+	g_autoptr(GVariant) value2 = NULL;
+	g_autoptr(GVariant) value3 = NULL;
+	g_autoptr(GVariant) value4 = NULL;
+	g_autofree gchar *str = NULL;
+	g_autoptr(SbuHistoryCache) cache = sbu_history_cache_new();
+	SbuHistoryBuckets *buckets;
+	SbuDatabaseItem item = {.key = "node_solar:power"};
+	SbuDatabaseItem item_load = {.key = "node_load:power", .ts = 50};
+
+	/* aligned to the bucket width */
+	sbu_history_cache_align(&ts_start, &ts_end, 10);
+	g_assert_cmpint(ts_start, ==, 990);
+	g_assert_cmpint(ts_end, ==, 2078);
+
+	/* miss, then hit */
+	value1 = sbu_history_cache_lookup(cache,
+					  "msx",
+					  "node_solar:power",
+					  0,
+					  99,
+					  10,
+					  SBU_HISTORY_MODE_AVERAGE);
+	g_assert_null(value1);
+	sbu_history_cache_insert(cache,
+				 "msx",
+				 "node_solar:power",
+				 0,
+				 99,
+				 10,
+				 SBU_HISTORY_MODE_AVERAGE,
+				 g_variant_new_uint32(123),
+				 NULL);
+	value2 = sbu_history_cache_lookup(cache,
+					  "msx",
+					  "node_solar:power",
+					  0,
+					  99,
+					  10,
+					  SBU_HISTORY_MODE_AVERAGE);
+	g_assert_nonnull(value2);
+	g_assert_cmpint(g_variant_get_uint32(value2), ==, 123);
+	g_assert_cmpint(sbu_history_cache_get_hits(cache), ==, 1);
+	g_assert_cmpint(sbu_history_cache_get_misses(cache), ==, 1);
+	g_assert_cmpint(sbu_history_cache_get_bytes(cache), >, 0);
+
+	/* samples after the range do not invalidate, inside the range do */
+	item.ts = 100;
+	sbu_history_cache_add_item(cache, "msx", &item);
+	g_assert_cmpint(sbu_history_cache_get_size(cache), ==, 1);
+	sbu_history_cache_add_item(cache, "msx", &item_load);
+	g_assert_cmpint(sbu_history_cache_get_size(cache), ==, 1);
+	item.ts = 50;
+	sbu_history_cache_add_item(cache, "msx", &item);
+	g_assert_cmpint(sbu_history_cache_get_size(cache), ==, 0);
+	g_assert_cmpint(sbu_history_cache_get_bytes(cache), ==, 0);
+
+	/* a live window has new samples added rather than being dropped */
+	buckets = sbu_history_buckets_new(0, 99, 2, SBU_HISTORY_MODE_AVERAGE);
+	for (guint i = 0; i < 2; i++)
+		g_assert_true(sbu_history_buckets_add(buckets, i * 10, 2000));
+	sbu_history_cache_insert(cache,
+				 "msx",
+				 "node_solar:power",
+				 0,
+				 99,
+				 2,
+				 SBU_HISTORY_MODE_AVERAGE,
+				 g_variant_new_uint32(0),
+				 buckets);
+	item.ts = 60;
+	item.val = 4000;
+	sbu_history_cache_add_item(cache, "msx", &item);
+	g_assert_cmpint(sbu_history_cache_get_size(cache), ==, 1);
+	value4 = sbu_history_cache_lookup(cache,
+					  "msx",
+					  "node_solar:power",
+					  0,
+					  99,
+					  2,
+					  SBU_HISTORY_MODE_AVERAGE);
+	g_assert_nonnull(value4);
+	str = g_variant_print(value4, FALSE);
+	g_assert_cmpstr(str, ==, "([(25, 2.0), (75, 4.0)],)");
+
+	/* an out-of-order sample cannot be appended */
+	item.ts = 5;
+	sbu_history_cache_add_item(cache, "msx", &item);
+	g_assert_cmpint(sbu_history_cache_get_size(cache), ==, 0);
+	g_assert_cmpint(sbu_history_cache_get_bytes(cache), ==, 0);
+
+	/* least recently used is evicted first */
+	sbu_history_cache_set_max_entries(cache, 2);
+	for (guint i = 0; i < 3; i++) {
+		sbu_history_cache_insert(cache,
+					 "msx",
+					 "node_solar:power",
+					 0,
+					 99,
+					 10 + i,
+					 SBU_HISTORY_MODE_LTTB,
+					 g_variant_new_uint32(i),
+					 NULL);
+	}
+	g_assert_cmpint(sbu_history_cache_get_size(cache), ==, 2);
+	g_assert_cmpint(sbu_history_cache_get_evictions(cache), ==, 1);
+	value3 = sbu_history_cache_lookup(cache,
+					  "msx",
+					  "node_solar:power",
+					  0,
+					  99,
+					  10,
+					  SBU_HISTORY_MODE_LTTB);
+	g_assert_null(value3);
+
+	/* the size is limited as well as the number of entries */
+	sbu_history_cache_set_max_bytes(cache, 1);
+	g_assert_cmpint(sbu_history_cache_get_size(cache), ==, 0);
+	g_assert_cmpint(sbu_history_cache_get_bytes(cache), ==, 0);
+}
+
+static gpointer
+sbu_test_stats_thread_cb(gpointer user_data)
+{
+	SbuStatsHistogram *histogram = (SbuStatsHistogram *)user_data;
+	for (guint i = 1; i <= 1000; i++)
+		sbu_stats_histogram_add(histogram, i);
+	return NULL;
+}
+
+#define SBU_TYPE_TEST_PLUGIN sbu_test_plugin_get_type()
+G_DECLARE_FINAL_TYPE(SbuTestPlugin, sbu_test_plugin, SBU, TEST_PLUGIN, SbuPlugin)
+
+struct _SbuTestPlugin {
+	SbuPlugin parent_instance;
+	gint setup_done; /* atomic */
+};
+
+G_DEFINE_TYPE(SbuTestPlugin, sbu_test_plugin, SBU_TYPE_PLUGIN)
+
+static gboolean
+sbu_test_plugin_setup(SbuPlugin *plugin, GCancellable *cancellable, GError **error)
+{
+	SbuTestPlugin *self = SBU_TEST_PLUGIN(plugin);
+	g_autoptr(SbuDevice) device = sbu_device_new();
+
+	/* give the main loop a chance to see the device early */
+	sbu_device_set_id(device, "test");
+	sbu_plugin_update_metadata(plugin, device, "test", 1);
+	sbu_plugin_add_device(plugin, device);
+	g_usleep(G_USEC_PER_SEC / 10);
+	g_atomic_int_set(&self->setup_done, TRUE);
+	return TRUE;
+}
+
+static void
+sbu_test_plugin_init(SbuTestPlugin *self)
+{
+}
+
+static void
+sbu_test_plugin_class_init(SbuTestPluginClass *klass)
+{
+	SbuPluginClass *plugin_class = SBU_PLUGIN_CLASS(klass);
+	plugin_class->setup = sbu_test_plugin_setup;
+}
+
+typedef struct {
+	GThread *thread;
+	guint cnt;
+	gboolean done;
+} SbuTestPluginHelper;
+
+static void
+sbu_test_plugin_signal_cb(SbuTestPlugin *plugin, SbuDevice *device, SbuTestPluginHelper *helper)
+{
+	g_assert_true(g_thread_self() == helper->thread);
+	g_assert_true(g_atomic_int_get(&plugin->setup_done));
+	helper->cnt++;
+}
+
+static void
+sbu_test_plugin_metadata_cb(SbuTestPlugin *plugin,
+			    SbuDevice *device,
+			    const gchar *key,
+			    gint value,
+			    SbuTestPluginHelper *helper)
+{
+	sbu_test_plugin_signal_cb(plugin, device, helper);
+}
+
+static void
+sbu_test_plugin_setup_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuTestPluginHelper *helper = (SbuTestPluginHelper *)user_data;
+	g_autoptr(GError) error = NULL;
+	gboolean ret;
+
+	ret = sbu_plugin_setup_finish(SBU_PLUGIN(source), res, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	helper->done = TRUE;
+}
+
+static void
+sbu_test_plugin_func(void)
+{
+	SbuTestPluginHelper helper = {0};
+	g_autoptr(SbuPlugin) plugin = g_object_new(SBU_TYPE_TEST_PLUGIN, NULL);
+
+	/* nothing is signalled until the worker has finished with the device */
+	helper.thread = g_thread_self();
+	g_signal_connect(plugin, "add-device", G_CALLBACK(sbu_test_plugin_signal_cb), &helper);
+	g_signal_connect(plugin,
+			 "update-metadata",
+			 G_CALLBACK(sbu_test_plugin_metadata_cb),
+			 &helper);
+	sbu_plugin_setup_async(plugin, NULL, sbu_test_plugin_setup_cb, &helper);
+	while (!helper.done)
+		g_main_context_iteration(NULL, TRUE);
+	g_assert_cmpint(helper.cnt, ==, 2);
+}
+
+static void
+sbu_test_stats_func(void)
+{
+	GThread *threads[4];
+	SbuStatsHistogram *histogram;
+	g_autoptr(GVariant) value = NULL;
+	g_autoptr(GVariant) latency = NULL;
+
+	sbu_stats_reset();
+
+	/* nothing recorded */
+	histogram = sbu_stats_histogram_get("usb:QPIGS");
+	g_assert_cmpint(sbu_stats_histogram_get_count(histogram), ==, 0);
+	g_assert_cmpint(sbu_stats_histogram_get_percentile(histogram, 99), ==, 0);
+
+	/* small values are exact */
+	for (guint i = 0; i < 4; i++)
+		sbu_stats_histogram_add(histogram, 3);
+	g_assert_cmpint(sbu_stats_histogram_get_percentile(histogram, 50), ==, 3);
+	sbu_stats_reset();
+
+	/* concurrent writers do not lose samples */
+	histogram = sbu_stats_histogram_get("db:insert");
+	for (guint i = 0; i < G_N_ELEMENTS(threads); i++)
+		threads[i] = g_thread_new("stats", sbu_test_stats_thread_cb, histogram);
+	for (guint i = 0; i < G_N_ELEMENTS(threads); i++)
+		g_thread_join(threads[i]);
+	g_assert_cmpint(sbu_stats_histogram_get_count(histogram), ==, 4000);
+	g_assert_cmpint(sbu_stats_histogram_get_max(histogram), ==, 1000);
+	g_assert_cmpint(sbu_stats_histogram_get_mean(histogram), ==, 500);
+
+	/* within one sub-bucket of the real value */
+	g_assert_cmpint(sbu_stats_histogram_get_percentile(histogram, 50), >=, 500);
+	g_assert_cmpint(sbu_stats_histogram_get_percentile(histogram, 50), <, 640);
+	g_assert_cmpint(sbu_stats_histogram_get_percentile(histogram, 99), >=, 990);
+	g_assert_cmpint(sbu_stats_histogram_get_percentile(histogram, 99), <=, 1000);
+
+	/* the sum does not wrap, and kept histograms survive a reset */
+	sbu_stats_reset();
+	g_assert_cmpint(sbu_stats_histogram_get_count(histogram), ==, 0);
+	for (guint i = 0; i < 4; i++)
+		sbu_stats_histogram_add(histogram, G_MAXINT);
+	g_assert_cmpint(sbu_stats_histogram_get_mean(histogram), ==, G_MAXINT);
+
+	/* counters */
+	sbu_stats_count("usb:QPIGS:errors");
+	sbu_stats_count("usb:QPIGS:errors");
+	g_assert_cmpint(sbu_stats_counter_get_value(sbu_stats_counter_get("usb:QPIGS:errors")),
+			==,
+			2);
+
+	/* exported */
+	value = g_variant_ref_sink(sbu_stats_to_variant());
+	latency = g_variant_lookup_value(value, "latency", G_VARIANT_TYPE_VARDICT);
+	g_assert_nonnull(latency);
+	g_assert_true(g_variant_lookup(latency, "db:insert", "@a{sv}", NULL));
+	sbu_stats_reset();
+}
+
+static void
+sbu_test_subscription_changes_cb(SbuSubscription *subscription,
+				 GVariant *changes,
+				 gpointer user_data)
+{
+	GMainLoop *loop = (GMainLoop *)user_data;
+	g_object_set_data_full(G_OBJECT(subscription),
+			       "changes",
+			       g_variant_ref(changes),
+			       (GDestroyNotify)g_variant_unref);
+	g_main_loop_quit(loop);
+}
+
+static void
+sbu_test_subscription_func(void)
+{
+	GVariant *changes_sent;
+	const gchar *keys[] = {"*:node_battery:voltage", NULL};
+	g_autoptr(GMainLoop) loop = g_main_loop_new(NULL, FALSE);
+	g_autoptr(GVariant) changes1 = NULL;
+	g_autoptr(GVariant) changes2 = NULL;
+	g_autoptr(SbuSubscription) subscription = NULL;
+
+	subscription = sbu_subscription_new(1, ":1.23", (gchar **)keys, 20.f);
+	g_signal_connect(subscription,
+			 "changes",
+			 G_CALLBACK(sbu_test_subscription_changes_cb),
+			 loop);
+	g_assert_true(sbu_subscription_matches(subscription, "0", "node_battery", "voltage"));
+	g_assert_false(sbu_subscription_matches(subscription, "0", "node_battery", "current"));
+
+	/* first update is sent straight away, filtered */
+	changes1 = g_variant_ref_sink(
+	    g_variant_new_parsed("[('0', 'node_battery', 'voltage', <27.5>),"
+				 " ('0', 'node_solar', 'voltage', <80.0>)]"));
+	sbu_subscription_add_changes(subscription, changes1);
+	changes_sent = g_object_get_data(G_OBJECT(subscription), "changes");
+	g_assert_nonnull(changes_sent);
+	g_assert_cmpint(g_variant_n_children(changes_sent), ==, 1);
+	g_assert_cmpint(sbu_subscription_get_pending(subscription), ==, 0);
+
+	/* the next two are coalesced to the latest value */
+	g_object_set_data(G_OBJECT(subscription), "changes", NULL);
+	changes2 = g_variant_ref_sink(
+	    g_variant_new_parsed("[('0', 'node_battery', 'voltage', <27.6>)]"));
+	sbu_subscription_add_changes(subscription, changes2);
+	sbu_subscription_add_changes(subscription, changes2);
+	g_assert_null(g_object_get_data(G_OBJECT(subscription), "changes"));
+	g_assert_cmpint(sbu_subscription_get_pending(subscription), ==, 1);
+	g_main_loop_run(loop);
+	changes_sent = g_object_get_data(G_OBJECT(subscription), "changes");
+	g_assert_nonnull(changes_sent);
+	g_assert_cmpint(g_variant_n_children(changes_sent), ==, 1);
+}
+
+typedef struct {
+	GString *received;
+	guint8 buf[1024];
+} SbuTestLineHelper;
+
+static void
+sbu_test_line_exporter_read_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuTestLineHelper *helper = (SbuTestLineHelper *)user_data;
+	gssize len = g_input_stream_read_finish(G_INPUT_STREAM(source), res, NULL);
+	if (len <= 0)
+		return;
+	g_string_append_len(helper->received, (const gchar *)helper->buf, len);
+	g_input_stream_read_async(G_INPUT_STREAM(source),
+				  helper->buf,
+				  sizeof(helper->buf),
+				  G_PRIORITY_DEFAULT,
+				  NULL,
+				  sbu_test_line_exporter_read_cb,
+				  helper);
+}
+
+static gboolean
+sbu_test_line_exporter_incoming_cb(GSocketService *service,
+				   GSocketConnection *connection,
+				   GObject *source_object,
+				   gpointer user_data)
+{
+	SbuTestLineHelper *helper = (SbuTestLineHelper *)user_data;
+	GInputStream *istream = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+
+	/* keep the connection open until the service is destroyed */
+	g_object_set_data_full(G_OBJECT(service),
+			       "connection",
+			       g_object_ref(connection),
+			       g_object_unref);
+	g_input_stream_read_async(istream,
+				  helper->buf,
+				  sizeof(helper->buf),
+				  G_PRIORITY_DEFAULT,
+				  NULL,
+				  sbu_test_line_exporter_read_cb,
+				  helper);
+	return TRUE;
+}
+
+static void
+sbu_test_line_exporter_func(void)
+{
+	const gchar *pos1;
+	const gchar *pos2;
+	gboolean ret;
+	guint16 port;
+	SbuTestLineHelper helper = {0};
+	g_autofree gchar *spool = NULL;
+	g_autofree gchar *str = NULL;
+	g_autofree gchar *tmpdir = NULL;
+	g_autofree gchar *uri = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GSocketListener) listener = g_socket_listener_new();
+	g_autoptr(GSocketService) service = NULL;
+	g_autoptr(GString) received = g_string_new(NULL);
+	g_autoptr(GVariant) changes1 = NULL;
+	g_autoptr(GVariant) changes2 = NULL;
+	g_autoptr(GVariant) changes3 = NULL;
+	g_autoptr(GVariant) changes4 = NULL;
+	g_autofree gchar *str2 = NULL;
+	g_autoptr(SbuLineExporter) exporter = sbu_line_exporter_new();
+
+	/* grouped by node, with escaped tags */
+	changes1 = g_variant_ref_sink(
+	    g_variant_new_parsed("[('0', 'node_battery', 'voltage', <27.5>),"
+				 " ('0', 'link_solar_load', 'active', <true>),"
+				 " ('0', 'node_battery', 'current', <3.0>),"
+				 " ('0 1', 'node_battery', 'voltage', <12.0>)]"));
+	str = sbu_line_exporter_format(changes1, 1000);
+	g_assert_cmpstr(str,
+			==,
+			"sbu,device=0,id=node_battery voltage=27.5,current=3 1000\n"
+			"sbu,device=0,id=link_solar_load active=true 1000\n"
+			"sbu,device=0\\ 1,id=node_battery voltage=12 1000\n");
+
+	/* values that line protocol cannot represent are skipped */
+	changes4 = g_variant_ref_sink(
+	    g_variant_new_parsed("[('0', 'node_battery', 'voltage', %v),"
+				 " ('0', 'node_battery', 'current', <1.5>)]",
+				 g_variant_new_double(NAN)));
+	str2 = sbu_line_exporter_format(changes4, 1000);
+	g_assert_cmpstr(str2, ==, "sbu,device=0,id=node_battery current=1.5 1000\n");
+
+	/* find a port with nothing listening */
+	port = g_socket_listener_add_any_inet_port(listener, NULL, &error);
+	g_assert_no_error(error);
+	g_socket_listener_close(listener);
+
+	tmpdir = g_dir_make_tmp("sbu-self-test-XXXXXX", &error);
+	g_assert_no_error(error);
+	spool = g_build_filename(tmpdir, "line-protocol.spool", NULL);
+	uri = g_strdup_printf("tcp://127.0.0.1:%u", port);
+	sbu_line_exporter_set_batch_size(exporter, 1);
+	sbu_line_exporter_set_flush_interval(exporter, 10);
+	sbu_line_exporter_set_spool(exporter, spool, 1024 * 1024);
+	ret = sbu_line_exporter_start(exporter, uri, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+
+	/* endpoint is down, so this gets spooled */
+	changes2 = g_variant_ref_sink(
+	    g_variant_new_parsed("[('0', 'node_battery', 'voltage', <27.6>)]"));
+	sbu_line_exporter_push_changes(exporter, changes2);
+	for (guint i = 0; i < 500 && !g_file_test(spool, G_FILE_TEST_EXISTS); i++)
+		g_usleep(10000);
+	g_assert_true(g_file_test(spool, G_FILE_TEST_EXISTS));
+
+	/* endpoint is back, so the spool is sent first */
+	helper.received = received;
+	service = g_socket_service_new();
+	g_socket_listener_add_inet_port(G_SOCKET_LISTENER(service), port, NULL, &error);
+	g_assert_no_error(error);
+	g_signal_connect(service,
+			 "incoming",
+			 G_CALLBACK(sbu_test_line_exporter_incoming_cb),
+			 &helper);
+	changes3 = g_variant_ref_sink(
+	    g_variant_new_parsed("[('0', 'node_battery', 'voltage', <27.7>)]"));
+	sbu_line_exporter_push_changes(exporter, changes3);
+	while (g_strstr_len(received->str, -1, "voltage=27.7") == NULL)
+		g_main_context_iteration(NULL, TRUE);
+	pos1 = g_strstr_len(received->str, -1, "voltage=27.6");
+	pos2 = g_strstr_len(received->str, -1, "voltage=27.7");
+	g_assert_nonnull(pos1);
+	g_assert_true(pos1 < pos2);
+	g_assert_false(g_file_test(spool, G_FILE_TEST_EXISTS));
+
+	g_clear_object(&exporter);
+	g_socket_service_stop(service);
+	g_rmdir(tmpdir);
+}
+
+typedef struct {
+	guint16 port;
+	gint done;
+} SbuTestMetricsHelper;
+
+static gpointer
+sbu_test_metrics_thread_cb(gpointer user_data)
+{
+	SbuTestMetricsHelper *helper = (SbuTestMetricsHelper *)user_data;
+	GInputStream *istream;
+	GOutputStream *ostream;
+	const gchar *request = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GSocketClient) client = g_socket_client_new();
+	g_autoptr(GSocketConnection) connection = NULL;
+	g_autoptr(GOutputStream) response = g_memory_output_stream_new_resizable();
+
+	connection =
+	    g_socket_client_connect_to_host(client, "127.0.0.1", helper->port, NULL, &error);
+	g_assert_no_error(error);
+	ostream = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+	g_output_stream_write_all(ostream, request, strlen(request), NULL, NULL, &error);
+	g_assert_no_error(error);
+
+	/* the server closes the connection when done */
+	istream = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+	g_output_stream_splice(response, istream, G_OUTPUT_STREAM_SPLICE_NONE, NULL, &error);
+	g_assert_no_error(error);
+	g_output_stream_write_all(response, "", 1, NULL, NULL, &error);
+	g_assert_no_error(error);
+	g_output_stream_close(response, NULL, &error);
+	g_assert_no_error(error);
+
+	/* the main context is blocked waiting for an event */
+	g_atomic_int_set(&helper->done, 1);
+	g_main_context_wakeup(NULL);
+	return g_memory_output_stream_steal_as_bytes(G_MEMORY_OUTPUT_STREAM(response));
+}
+
+static void
+sbu_test_manager_write_config(const gchar *filename, const gchar *location, const gchar *settings)
+{
+	gboolean ret;
+	g_autofree gchar *data = NULL;
+	g_autoptr(GError) error = NULL;
+
+	data = g_strdup_printf("[sbud Settings]\nDatabaseLocation=%s\n%s", location, settings);
+	ret = g_file_set_contents(filename, data, -1, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+}
+
+static void
+sbu_test_manager_reload_func(void)
+{
+	gboolean ret;
+	g_autofree gchar *filename = NULL;
+	g_autofree gchar *location = NULL;
+	g_autofree gchar *tmpdir = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(SbuManager) manager = sbu_manager_new();
+
+	/* no plugins, and a private config file */
+	tmpdir = g_dir_make_tmp("sbu-self-test-XXXXXX", &error);
+	g_assert_no_error(error);
+	filename = g_build_filename(tmpdir, "sbud.conf", NULL);
+	location = g_build_filename(tmpdir, "sbu.db", NULL);
+	g_setenv("SBU_CONFIG", filename, TRUE);
+	g_setenv("SBU_PLUGINDIR", tmpdir, TRUE);
+	sbu_test_manager_write_config(filename, location, "DevicePollInterval=10\n");
+	ret = sbu_manager_setup(manager, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_cmpint(sbu_manager_get_poll_interval(manager), ==, 10);
+
+	/* zero is rejected with an error, and nothing is applied */
+	sbu_test_manager_write_config(filename,
+				      location,
+				      "DevicePollInterval=20\n"
+				      "AdaptivePolling=true\n"
+				      "DevicePollIntervalMin=0\n"
+				      "DevicePollIntervalMax=60\n"
+				      "AdaptivePollingThreshold=5\n");
+	ret = sbu_manager_reload(manager, &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+	g_assert_false(ret);
+	g_assert_cmpint(sbu_manager_get_poll_interval(manager), ==, 10);
+	g_clear_error(&error);
+
+	/* so is a missing value */
+	sbu_test_manager_write_config(filename, location, "AdaptivePolling=false\n");
+	ret = sbu_manager_reload(manager, &error);
+	g_assert_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND);
+	g_assert_false(ret);
+	g_assert_cmpint(sbu_manager_get_poll_interval(manager), ==, 10);
+	g_clear_error(&error);
+
+	/* a valid file is applied */
+	sbu_test_manager_write_config(filename,
+				      location,
+				      "DevicePollInterval=20\n"
+				      "AdaptivePolling=true\n"
+				      "DevicePollIntervalMin=5\n"
+				      "DevicePollIntervalMax=60\n"
+				      "AdaptivePollingThreshold=5\n");
+	ret = sbu_manager_reload(manager, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_cmpint(sbu_manager_get_poll_interval(manager), ==, 20);
+
+	g_unsetenv("SBU_CONFIG");
+	g_unsetenv("SBU_PLUGINDIR");
+	g_clear_object(&manager);
+	g_unlink(filename);
+	g_unlink(location);
+	g_rmdir(tmpdir);
+}
+
+static void
+sbu_test_metrics_func(void)
+{
+	const gchar *data;
+	gboolean ret;
+	guint buckets = 0;
+	GThread *thread;
+	SbuTestMetricsHelper helper = {0};
+	g_autoptr(GBytes) blob1 = NULL;
+	g_autoptr(GBytes) blob2 = NULL;
+	g_autoptr(GBytes) blob3 = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) devices = g_ptr_array_new_with_free_func(g_object_unref);
+	g_autoptr(SbuDevice) device = sbu_device_new();
+	g_autoptr(SbuLink) link = sbu_link_new(SBU_NODE_KIND_SOLAR, SBU_NODE_KIND_LOAD);
+	g_autoptr(SbuMetrics) metrics = sbu_metrics_new();
+	g_autoptr(SbuNode) node = sbu_node_new(SBU_NODE_KIND_BATTERY);
+
+	sbu_stats_reset();
+	sbu_stats_record("usb:QPIGS", g_get_monotonic_time() - 1500);
+	sbu_stats_count("usb:QPIGS:errors");
+	sbu_device_set_id(device, "0");
+	sbu_device_set_serial_number(device, "say \"hi\"");
+	sbu_device_set_metadata(device, "BatteryType", 2);
+	sbu_device_add_node(device, node);
+	sbu_device_add_link(device, link);
+	sbu_node_set_value(node, SBU_DEVICE_PROPERTY_VOLTAGE, 27.5);
+	g_ptr_array_add(devices, g_object_ref(device));
+	sbu_metrics_set_devices(metrics, devices);
+
+	blob1 = sbu_metrics_render(metrics);
+	data = g_bytes_get_data(blob1, NULL);
+	g_assert_nonnull(g_strstr_len(data, -1, "serial_number=\"say \\\"hi\\\"\"} 1\n"));
+	g_assert_nonnull(
+	    g_strstr_len(data, -1, "sbu_node_voltage_volts{device=\"0\",node=\"battery\"} 27.5\n"));
+	g_assert_nonnull(g_strstr_len(
+	    data,
+	    -1,
+	    "sbu_link_active{device=\"0\",src=\"solar\",dst=\"load\"} 0\n"));
+	g_assert_nonnull(
+	    g_strstr_len(data, -1, "sbu_device_metadata{device=\"0\",key=\"BatteryType\"} 2\n"));
+	g_assert_nonnull(
+	    g_strstr_len(data, -1, "sbud_events_total{name=\"usb:QPIGS:errors\"} 1\n"));
+	g_assert_nonnull(
+	    g_strstr_len(data, -1, "sbud_latency_seconds_count{name=\"usb:QPIGS\"} 1\n"));
+	g_assert_nonnull(
+	    g_strstr_len(data,
+			 -1,
+			 "sbud_latency_seconds_bucket{name=\"usb:QPIGS\",le=\"0.001023\"} 0\n"));
+	g_assert_nonnull(g_strstr_len(
+	    data,
+	    -1,
+	    "sbud_latency_seconds_bucket{name=\"usb:QPIGS\",le=\"+Inf\"} 1\n"));
+
+	/* a fixed set of empty buckets is included, so the boundaries never change */
+	for (const gchar *tmp = g_strstr_len(data, -1, "_bucket{name=\"usb:QPIGS\""); tmp != NULL;
+	     tmp = g_strstr_len(tmp + 1, -1, "_bucket{name=\"usb:QPIGS\""))
+		buckets++;
+	g_assert_cmpint(buckets, ==, 18);
+	g_assert_true(g_str_has_suffix(data, "# EOF\n"));
+
+	/* changed values are picked up */
+	sbu_node_set_value(node, SBU_DEVICE_PROPERTY_VOLTAGE, 27.6);
+	blob2 = sbu_metrics_render(metrics);
+	data = g_bytes_get_data(blob2, NULL);
+	g_assert_nonnull(
+	    g_strstr_len(data, -1, "sbu_node_voltage_volts{device=\"0\",node=\"battery\"} 27.6\n"));
+
+	/* over HTTP */
+	ret = sbu_metrics_start(metrics, "127.0.0.1:0", &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	helper.port = sbu_metrics_get_port(metrics);
+	thread = g_thread_new("metrics", sbu_test_metrics_thread_cb, &helper);
+	while (!g_atomic_int_get(&helper.done))
+		g_main_context_iteration(NULL, TRUE);
+	blob3 = g_thread_join(thread);
+	data = g_bytes_get_data(blob3, NULL);
+	g_assert_true(g_str_has_prefix(data, "HTTP/1.1 200 OK\r\n"));
+	g_assert_nonnull(g_strstr_len(data, g_bytes_get_size(blob3), "# EOF\n"));
+	sbu_stats_reset();
+}
+
+typedef struct {
+	const gchar *path;
+	guint id;
+	gint *done;
+} SbuTestStreamHelper;
+
+static GVariant *
+sbu_test_stream_snapshot_cb(gpointer user_data)
+{
+	return g_variant_ref_sink(g_variant_new_parsed("[{'DeviceId': <'0'>}]"));
+}
+
+static void
+sbu_test_stream_history_cb(const gchar *device_id,
+			   const gchar *key,
+			   guint64 start,
+			   guint64 end,
+			   guint limit,
+			   const gchar *mode,
+			   GTask *task,
+			   gpointer user_data)
+{
+	if (g_strcmp0(device_id, "0") != 0) {
+		g_task_return_new_error(task,
+					G_IO_ERROR,
+					G_IO_ERROR_NOT_FOUND,
+					"no device %s",
+					device_id);
+		return;
+	}
+	g_task_return_pointer(task,
+			      g_variant_ref_sink(g_variant_new_parsed("[(%t, 27.5)]", start)),
+			      (GDestroyNotify)g_variant_unref);
+}
+
+static gpointer
+sbu_test_stream_thread_cb(gpointer user_data)
+{
+	SbuTestStreamHelper *helper = (SbuTestStreamHelper *)user_data;
+	SbuStreamFrameKind kind = SBU_STREAM_FRAME_KIND_UNKNOWN;
+	gboolean got_delta = FALSE;
+	gboolean got_reply = FALSE;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) devices = NULL;
+	g_autoptr(GVariant) snapshot = NULL;
+	g_autoptr(SbuStreamClient) client = sbu_stream_client_new();
+
+	g_assert_true(sbu_stream_client_connect(client, helper->path, &error));
+	g_assert_no_error(error);
+
+	/* always sent first */
+	snapshot = sbu_stream_client_read(client, &kind, &error);
+	g_assert_no_error(error);
+	g_assert_cmpint(kind, ==, SBU_STREAM_FRAME_KIND_SNAPSHOT);
+	devices = g_variant_get_child_value(snapshot, 1);
+	g_assert_cmpint(g_variant_n_children(devices), ==, 1);
+	g_assert_true(sbu_stream_client_request_history(client,
+							helper->id,
+							"0",
+							"node_battery:voltage",
+							helper->id,
+							100,
+							0,
+							"average",
+							&error));
+	g_assert_no_error(error);
+
+	/* the reply and the delta can arrive in either order */
+	while (!got_delta || !got_reply) {
+		g_autoptr(GVariant) frame = sbu_stream_client_read(client, &kind, &error);
+		g_assert_no_error(error);
+		g_assert_nonnull(frame);
+		if (kind == SBU_STREAM_FRAME_KIND_DELTA) {
+			guint64 seq = 0;
+			g_variant_get(frame, "(t@a(sssv))", &seq, NULL);
+			g_assert_cmpint(seq, ==, 42);
+			got_delta = TRUE;
+		} else if (kind == SBU_STREAM_FRAME_KIND_HISTORY_REPLY) {
+			guint id = 0;
+			guint64 ts = 0;
+			gdouble val = 0.f;
+			g_autoptr(GVariant) array = NULL;
+			g_variant_get(frame, "(u@a(td))", &id, &array);
+			g_assert_cmpint(id, ==, helper->id);
+			g_assert_cmpint(g_variant_n_children(array), ==, 1);
+			g_variant_get_child(array, 0, "(td)", &ts, &val);
+			g_assert_cmpint(ts, ==, helper->id);
+			g_assert_cmpfloat(val, ==, 27.5);
+			got_reply = TRUE;
+		} else {
+			g_assert_not_reached();
+		}
+	}
+	g_atomic_int_inc(helper->done);
+	return NULL;
+}
+
+static void
+sbu_test_stream_func(void)
+{
+	gboolean ret;
+	gint done = 0;
+	guint32 size = 0;
+	GThread *threads[8];
+	SbuStreamFrameKind kind = SBU_STREAM_FRAME_KIND_UNKNOWN;
+	SbuTestStreamHelper helpers[G_N_ELEMENTS(threads)];
+	g_autofree gchar *tmpdir = NULL;
+	g_autofree gchar *path = NULL;
+	g_autofree gchar *str = NULL;
+	g_autoptr(GBytes) frame = NULL;
+	g_autoptr(GBytes) payload = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) changes = NULL;
+	g_autoptr(GVariant) value = NULL;
+	g_autoptr(SbuStreamServer) server = sbu_stream_server_new();
+	g_autoptr(SbuStreamServer) server2 = sbu_stream_server_new();
+
+	/* frames survive a round trip */
+	frame = sbu_stream_frame_new(SBU_STREAM_FRAME_KIND_ERROR, g_variant_new("(us)", 7, "hi"));
+	ret = sbu_stream_frame_parse_header(g_bytes_get_data(frame, NULL), &kind, &size, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+	g_assert_cmpint(kind, ==, SBU_STREAM_FRAME_KIND_ERROR);
+	g_assert_cmpint(size + SBU_STREAM_FRAME_HEADER_SIZE, ==, g_bytes_get_size(frame));
+	payload = g_bytes_new_from_bytes(frame, SBU_STREAM_FRAME_HEADER_SIZE, size);
+	value = sbu_stream_frame_parse_payload(kind, payload, &error);
+	g_assert_no_error(error);
+	str = g_variant_print(value, FALSE);
+	g_assert_cmpstr(str, ==, "(7, 'hi')");
+
+	tmpdir = g_dir_make_tmp("sbu-self-test-XXXXXX", &error);
+	g_assert_no_error(error);
+	path = g_build_filename(tmpdir, "stream.socket", NULL);
+	sbu_stream_server_set_funcs(server,
+				    sbu_test_stream_snapshot_cb,
+				    sbu_test_stream_history_cb,
+				    NULL);
+	ret = sbu_stream_server_start(server, path, &error);
+	g_assert_no_error(error);
+	g_assert_true(ret);
+
+	/* lots of clients at the same time */
+	for (guint i = 0; i < G_N_ELEMENTS(threads); i++) {
+		helpers[i].path = path;
+		helpers[i].id = i + 1;
+		helpers[i].done = &done;
+		threads[i] = g_thread_new("stream", sbu_test_stream_thread_cb, &helpers[i]);
+	}
+	while (sbu_stream_server_get_n_clients(server) < G_N_ELEMENTS(threads))
+		g_main_context_iteration(NULL, TRUE);
+
+	/* every client gets the delta */
+	changes = g_variant_ref_sink(
+	    g_variant_new_parsed("[('0', 'node_battery', 'voltage', <27.6>)]"));
+	sbu_stream_server_push_changes(server, 42, changes);
+
+	/* clients disconnecting wakes up the main context */
+	while (sbu_stream_server_get_n_clients(server) > 0)
+		g_main_context_iteration(NULL, TRUE);
+	for (guint i = 0; i < G_N_ELEMENTS(threads); i++)
+		g_thread_join(threads[i]);
+	g_assert_cmpint(g_atomic_int_get(&done), ==, G_N_ELEMENTS(threads));
+
+	/* the socket is not stolen from a running server */
+	ret = sbu_stream_server_start(server2, path, &error);
+	g_assert_error(error, G_IO_ERROR, G_IO_ERROR_ADDRESS_IN_USE);
+	g_assert_false(ret);
+
+	g_clear_object(&server);
+	g_assert_false(g_file_test(path, G_FILE_TEST_EXISTS));
+	g_rmdir(tmpdir);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -162,7 +2150,27 @@ main(int argc, char **argv)
 	/* tests go here */
 	g_test_add_func("/database", sbu_test_database_func);
 	g_test_add_func("/common", sbu_test_common_func);
+	g_test_add_func("/device", sbu_test_device_func);
+	g_test_add_func("/history", sbu_test_history_func);
+	g_test_add_func("/history{fd}", sbu_test_history_fd_func);
+	g_test_add_func("/history-cache", sbu_test_history_cache_func);
+	g_test_add_func("/line-exporter", sbu_test_line_exporter_func);
+	g_test_add_func("/manager{reload}", sbu_test_manager_reload_func);
+	g_test_add_func("/metrics", sbu_test_metrics_func);
 	g_test_add_func("/msx", sbu_msx_test_common_func);
+	g_test_add_func("/msx{pi30}", sbu_msx_test_pi30_func);
+	g_test_add_func("/msx{pi30-benchmark}", sbu_msx_test_pi30_benchmark_func);
+	g_test_add_func("/msx{transport}", sbu_msx_test_transport_func);
+	g_test_add_func("/msx{simulator}", sbu_msx_test_simulator_func);
+	g_test_add_func("/msx{simulator-benchmark}", sbu_msx_test_simulator_benchmark_func);
+	g_test_add_func("/msx{parallel}", sbu_msx_test_parallel_func);
+	g_test_add_func("/msx{capture}", sbu_msx_test_capture_func);
+	g_test_add_func("/msx{replay-benchmark}", sbu_msx_test_replay_benchmark_func);
+	g_test_add_func("/node{dbus}", sbu_test_node_dbus_func);
+	g_test_add_func("/plugin", sbu_test_plugin_func);
+	g_test_add_func("/stats", sbu_test_stats_func);
+	g_test_add_func("/stream", sbu_test_stream_func);
+	g_test_add_func("/subscription", sbu_test_subscription_func);
 
 	return g_test_run();
 }
@@ -0,0 +1,446 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#include "config.h"
+
+#include "sbu-common.h"
+#include "sbu-stats.h"
+
+/* each power of two is split into this many linear buckets, so the reported
+ * percentiles are never more than 25% above the real value */
+#define SBU_STATS_SUB_BUCKETS 4
+#define SBU_STATS_BUCKETS     (64 * SBU_STATS_SUB_BUCKETS)
+
+/* the OpenMetrics output only uses one bucket for each power of two, from
+ * about 1ms to about 67s, and anything slower is only counted in +Inf */
+#define SBU_STATS_OPENMETRICS_BITS_MIN 10
+#define SBU_STATS_OPENMETRICS_BITS_MAX 26
+
+struct _SbuStatsHistogram {
+	gchar *name;
+	gint buckets[SBU_STATS_BUCKETS]; /* atomic */
+	gint count;			 /* atomic */
+	gint64 sum;			 /* atomic, as gssize wraps on 32 bit */
+	gint max;			 /* atomic */
+};
+
+struct _SbuStatsCounter {
+	gchar *name;
+	gint value; /* atomic */
+};
+
+/* only used to register and list names, and never taken when recording a
+ * value through a histogram or counter that the caller has kept */
+static GMutex sbu_stats_mutex;
+static GHashTable *sbu_stats_histograms = NULL; /* name : SbuStatsHistogram */
+static GHashTable *sbu_stats_counters = NULL;	/* name : SbuStatsCounter */
+
+static guint
+sbu_stats_bucket_for_value(guint64 value)
+{
+	guint bits;
+	if (value < SBU_STATS_SUB_BUCKETS)
+		return value;
+	bits = g_bit_storage(value);
+	return (bits - 2) * SBU_STATS_SUB_BUCKETS +
+	       ((value >> (bits - 3)) & (SBU_STATS_SUB_BUCKETS - 1));
+}
+
+/* largest value that would end up in @idx */
+static guint64
+sbu_stats_bucket_upper(guint idx)
+{
+	guint bits;
+	guint sub;
+	if (idx < SBU_STATS_SUB_BUCKETS)
+		return idx;
+	bits = idx / SBU_STATS_SUB_BUCKETS + 2;
+	sub = idx % SBU_STATS_SUB_BUCKETS;
+	return (((guint64)SBU_STATS_SUB_BUCKETS + sub + 1) << (bits - 3)) - 1;
+}
+
+static void
+sbu_stats_histogram_free(SbuStatsHistogram *histogram)
+{
+	g_free(histogram->name);
+	g_free(histogram);
+}
+
+static void
+sbu_stats_counter_free(SbuStatsCounter *counter)
+{
+	g_free(counter->name);
+	g_free(counter);
+}
+
+static void
+sbu_stats_ensure(void)
+{
+	if (sbu_stats_histograms != NULL)
+		return;
+	sbu_stats_histograms =
+	    g_hash_table_new_full(g_str_hash,
+				  g_str_equal,
+				  NULL,
+				  (GDestroyNotify)sbu_stats_histogram_free);
+	sbu_stats_counters = g_hash_table_new_full(g_str_hash,
+						   g_str_equal,
+						   NULL,
+						   (GDestroyNotify)sbu_stats_counter_free);
+}
+
+/**
+ * sbu_stats_histogram_get:
+ * @name: a unique name, e.g. `usb:QPIGS`
+ *
+ * Gets the histogram for @name, creating it if required. The returned pointer
+ * is valid for the lifetime of the process and can be cached by the caller.
+ *
+ * Returns: (transfer none): a #SbuStatsHistogram
+ **/
+SbuStatsHistogram *
+sbu_stats_histogram_get(const gchar *name)
+{
+	SbuStatsHistogram *histogram;
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&sbu_stats_mutex);
+
+	sbu_stats_ensure();
+	histogram = g_hash_table_lookup(sbu_stats_histograms, name);
+	if (histogram == NULL) {
+		histogram = g_new0(SbuStatsHistogram, 1);
+		histogram->name = g_strdup(name);
+		g_hash_table_insert(sbu_stats_histograms, histogram->name, histogram);
+	}
+	return histogram;
+}
+
+/**
+ * sbu_stats_histogram_add:
+ * @histogram: a #SbuStatsHistogram
+ * @usec: a duration in microseconds
+ *
+ * Records one duration. This does not take any locks and is safe to call from
+ * any thread.
+ **/
+void
+sbu_stats_histogram_add(SbuStatsHistogram *histogram, gint64 usec)
+{
+	gint max;
+	usec = CLAMP(usec, 0, G_MAXINT);
+	g_atomic_int_inc(&histogram->buckets[sbu_stats_bucket_for_value(usec)]);
+	g_atomic_int_inc(&histogram->count);
+	__atomic_fetch_add(&histogram->sum, usec, __ATOMIC_RELAXED);
+	do {
+		max = g_atomic_int_get(&histogram->max);
+		if (usec <= max)
+			break;
+	} while (!g_atomic_int_compare_and_exchange(&histogram->max, max, (gint)usec));
+}
+
+/**
+ * sbu_stats_histogram_record:
+ * @histogram: a #SbuStatsHistogram
+ * @ts_start: the value of g_get_monotonic_time() when the operation started
+ *
+ * Records the time since @ts_start. Like sbu_stats_histogram_add() this does
+ * not take any locks.
+ **/
+void
+sbu_stats_histogram_record(SbuStatsHistogram *histogram, gint64 ts_start)
+{
+	sbu_stats_histogram_add(histogram, g_get_monotonic_time() - ts_start);
+}
+
+static gint64
+sbu_stats_histogram_get_sum(SbuStatsHistogram *histogram)
+{
+	return __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED);
+}
+
+guint
+sbu_stats_histogram_get_count(SbuStatsHistogram *histogram)
+{
+	return g_atomic_int_get(&histogram->count);
+}
+
+gint64
+sbu_stats_histogram_get_max(SbuStatsHistogram *histogram)
+{
+	return g_atomic_int_get(&histogram->max);
+}
+
+gint64
+sbu_stats_histogram_get_mean(SbuStatsHistogram *histogram)
+{
+	guint count = sbu_stats_histogram_get_count(histogram);
+	if (count == 0)
+		return 0;
+	return sbu_stats_histogram_get_sum(histogram) / count;
+}
+
+/**
+ * sbu_stats_histogram_get_percentile:
+ * @histogram: a #SbuStatsHistogram
+ * @percentile: a percentile, e.g. 99
+ *
+ * Estimates the percentile using the upper bound of the bucket it falls in.
+ *
+ * Returns: a duration in microseconds, or 0 if nothing was recorded
+ **/
+gint64
+sbu_stats_histogram_get_percentile(SbuStatsHistogram *histogram, guint percentile)
+{
+	guint64 acc = 0;
+	guint64 rank;
+	guint count = sbu_stats_histogram_get_count(histogram);
+
+	if (count == 0)
+		return 0;
+	rank = MAX(((guint64)count * MIN(percentile, 100) + 99) / 100, 1);
+	for (guint i = 0; i < SBU_STATS_BUCKETS; i++) {
+		acc += g_atomic_int_get(&histogram->buckets[i]);
+		if (acc >= rank)
+			return MIN(sbu_stats_bucket_upper(i),
+				   (guint64)sbu_stats_histogram_get_max(histogram));
+	}
+	return sbu_stats_histogram_get_max(histogram);
+}
+
+/**
+ * sbu_stats_counter_get:
+ * @name: a unique name, e.g. `usb:errors`
+ *
+ * Returns: (transfer none): a #SbuStatsCounter
+ **/
+SbuStatsCounter *
+sbu_stats_counter_get(const gchar *name)
+{
+	SbuStatsCounter *counter;
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&sbu_stats_mutex);
+
+	sbu_stats_ensure();
+	counter = g_hash_table_lookup(sbu_stats_counters, name);
+	if (counter == NULL) {
+		counter = g_new0(SbuStatsCounter, 1);
+		counter->name = g_strdup(name);
+		g_hash_table_insert(sbu_stats_counters, counter->name, counter);
+	}
+	return counter;
+}
+
+void
+sbu_stats_counter_inc(SbuStatsCounter *counter)
+{
+	g_atomic_int_inc(&counter->value);
+}
+
+guint
+sbu_stats_counter_get_value(SbuStatsCounter *counter)
+{
+	return g_atomic_int_get(&counter->value);
+}
+
+/**
+ * sbu_stats_record:
+ * @name: a histogram name
+ * @ts_start: the value of g_get_monotonic_time() when the operation started
+ *
+ * Records the time since @ts_start into the named histogram. This looks up
+ * the name each time, so code that records often should keep the
+ * #SbuStatsHistogram from sbu_stats_histogram_get() instead.
+ **/
+void
+sbu_stats_record(const gchar *name, gint64 ts_start)
+{
+	sbu_stats_histogram_add(sbu_stats_histogram_get(name),
+				g_get_monotonic_time() - ts_start);
+}
+
+void
+sbu_stats_count(const gchar *name)
+{
+	sbu_stats_counter_inc(sbu_stats_counter_get(name));
+}
+
+/**
+ * sbu_stats_to_variant:
+ *
+ * Returns: (transfer floating): a #GVariant of type `a{sv}` with `latency` and
+ * `counters` dictionaries, with all durations in microseconds
+ **/
+GVariant *
+sbu_stats_to_variant(void)
+{
+	GHashTableIter iter;
+	gpointer value;
+	GVariantBuilder builder;
+	GVariantBuilder builder_counters;
+	GVariantBuilder builder_latency;
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&sbu_stats_mutex);
+
+	sbu_stats_ensure();
+	g_variant_builder_init(&builder_latency, G_VARIANT_TYPE_VARDICT);
+	g_hash_table_iter_init(&iter, sbu_stats_histograms);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		SbuStatsHistogram *histogram = value;
+		GVariantBuilder builder_histogram;
+		g_variant_builder_init(&builder_histogram, G_VARIANT_TYPE_VARDICT);
+		g_variant_builder_add(&builder_histogram,
+				      "{sv}",
+				      "count",
+				      g_variant_new_uint32(sbu_stats_histogram_get_count(histogram)));
+		g_variant_builder_add(&builder_histogram,
+				      "{sv}",
+				      "mean",
+				      g_variant_new_int64(sbu_stats_histogram_get_mean(histogram)));
+		g_variant_builder_add(
+		    &builder_histogram,
+		    "{sv}",
+		    "p50",
+		    g_variant_new_int64(sbu_stats_histogram_get_percentile(histogram, 50)));
+		g_variant_builder_add(
+		    &builder_histogram,
+		    "{sv}",
+		    "p90",
+		    g_variant_new_int64(sbu_stats_histogram_get_percentile(histogram, 90)));
+		g_variant_builder_add(
+		    &builder_histogram,
+		    "{sv}",
+		    "p99",
+		    g_variant_new_int64(sbu_stats_histogram_get_percentile(histogram, 99)));
+		g_variant_builder_add(&builder_histogram,
+				      "{sv}",
+				      "max",
+				      g_variant_new_int64(sbu_stats_histogram_get_max(histogram)));
+		g_variant_builder_add(&builder_latency,
+				      "{sv}",
+				      histogram->name,
+				      g_variant_builder_end(&builder_histogram));
+	}
+	g_variant_builder_init(&builder_counters, G_VARIANT_TYPE_VARDICT);
+	g_hash_table_iter_init(&iter, sbu_stats_counters);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		SbuStatsCounter *counter = value;
+		g_variant_builder_add(&builder_counters,
+				      "{sv}",
+				      counter->name,
+				      g_variant_new_uint32(sbu_stats_counter_get_value(counter)));
+	}
+	g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+	g_variant_builder_add(&builder,
+			      "{sv}",
+			      "latency",
+			      g_variant_builder_end(&builder_latency));
+	g_variant_builder_add(&builder,
+			      "{sv}",
+			      "counters",
+			      g_variant_builder_end(&builder_counters));
+	return g_variant_builder_end(&builder);
+}
+
+/**
+ * sbu_stats_to_openmetrics:
+ * @str: a #GString
+ *
+ * Appends the counters and the latency histograms in OpenMetrics text format.
+ * A fixed set of coarse buckets is included, even if empty, so that the bucket
+ * boundaries do not change between scrapes. Each boundary is also the end of
+ * an internal bucket, so the cumulative counts are exact.
+ **/
+void
+sbu_stats_to_openmetrics(GString *str)
+{
+	gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+	g_autoptr(GList) counters = NULL;
+	g_autoptr(GList) histograms = NULL;
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&sbu_stats_mutex);
+
+	sbu_stats_ensure();
+	counters = g_list_sort(g_hash_table_get_keys(sbu_stats_counters), (GCompareFunc)g_strcmp0);
+	g_string_append(str,
+			"# TYPE sbud_events counter\n"
+			"# HELP sbud_events Events such as failed transfers and poll overruns\n");
+	for (GList *l = counters; l != NULL; l = l->next) {
+		SbuStatsCounter *counter = g_hash_table_lookup(sbu_stats_counters, l->data);
+		g_string_append(str, "sbud_events_total{");
+		sbu_openmetrics_append_label(str, "name", counter->name);
+		g_string_append_printf(str, "} %u\n", sbu_stats_counter_get_value(counter));
+	}
+
+	histograms =
+	    g_list_sort(g_hash_table_get_keys(sbu_stats_histograms), (GCompareFunc)g_strcmp0);
+	g_string_append(str,
+			"# TYPE sbud_latency_seconds histogram\n"
+			"# UNIT sbud_latency_seconds seconds\n"
+			"# HELP sbud_latency_seconds Time taken by transfers, polls and queries\n");
+	for (GList *l = histograms; l != NULL; l = l->next) {
+		SbuStatsHistogram *histogram = g_hash_table_lookup(sbu_stats_histograms, l->data);
+		guint acc = 0;
+		guint idx = 0;
+		g_autoptr(GString) labels = g_string_new(NULL);
+
+		sbu_openmetrics_append_label(labels, "name", histogram->name);
+		for (guint bits = SBU_STATS_OPENMETRICS_BITS_MIN;
+		     bits <= SBU_STATS_OPENMETRICS_BITS_MAX;
+		     bits++) {
+			guint64 upper = ((guint64)1 << bits) - 1;
+			for (; idx <= sbu_stats_bucket_for_value(upper); idx++)
+				acc += g_atomic_int_get(&histogram->buckets[idx]);
+			g_snprintf(buf,
+				   sizeof(buf),
+				   "%" G_GUINT64_FORMAT ".%06" G_GUINT64_FORMAT,
+				   upper / G_USEC_PER_SEC,
+				   upper % G_USEC_PER_SEC);
+			g_string_append_printf(str,
+					       "sbud_latency_seconds_bucket{%s,le=\"%s\"} %u\n",
+					       labels->str,
+					       buf,
+					       acc);
+		}
+		for (; idx < SBU_STATS_BUCKETS; idx++)
+			acc += g_atomic_int_get(&histogram->buckets[idx]);
+
+		/* use the bucket total so the count can never be less than a bucket */
+		g_string_append_printf(str,
+				       "sbud_latency_seconds_bucket{%s,le=\"+Inf\"} %u\n",
+				       labels->str,
+				       acc);
+		g_string_append_printf(str,
+				       "sbud_latency_seconds_count{%s} %u\n",
+				       labels->str,
+				       acc);
+		g_ascii_dtostr(buf,
+			       sizeof(buf),
+			       (gdouble)sbu_stats_histogram_get_sum(histogram) / G_USEC_PER_SEC);
+		g_string_append_printf(str, "sbud_latency_seconds_sum{%s} %s\n", labels->str, buf);
+	}
+}
+
+/* only for the self tests; the names stay registered so that any kept
+ * histograms and counters are still valid */
+void
+sbu_stats_reset(void)
+{
+	GHashTableIter iter;
+	gpointer value;
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new(&sbu_stats_mutex);
+
+	sbu_stats_ensure();
+	g_hash_table_iter_init(&iter, sbu_stats_histograms);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		SbuStatsHistogram *histogram = value;
+		for (guint i = 0; i < SBU_STATS_BUCKETS; i++)
+			g_atomic_int_set(&histogram->buckets[i], 0);
+		g_atomic_int_set(&histogram->count, 0);
+		__atomic_store_n(&histogram->sum, 0, __ATOMIC_RELAXED);
+		g_atomic_int_set(&histogram->max, 0);
+	}
+	g_hash_table_iter_init(&iter, sbu_stats_counters);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		SbuStatsCounter *counter = value;
+		g_atomic_int_set(&counter->value, 0);
+	}
+}
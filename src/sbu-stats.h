@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#pragma once
+
+#include <glib.h>
+
+typedef struct _SbuStatsHistogram SbuStatsHistogram;
+typedef struct _SbuStatsCounter SbuStatsCounter;
+
+SbuStatsHistogram *
+sbu_stats_histogram_get(const gchar *name);
+void
+sbu_stats_histogram_add(SbuStatsHistogram *histogram, gint64 usec);
+void
+sbu_stats_histogram_record(SbuStatsHistogram *histogram, gint64 ts_start);
+guint
+sbu_stats_histogram_get_count(SbuStatsHistogram *histogram);
+gint64
+sbu_stats_histogram_get_max(SbuStatsHistogram *histogram);
+gint64
+sbu_stats_histogram_get_mean(SbuStatsHistogram *histogram);
+gint64
+sbu_stats_histogram_get_percentile(SbuStatsHistogram *histogram, guint percentile);
+
+SbuStatsCounter *
+sbu_stats_counter_get(const gchar *name);
+void
+sbu_stats_counter_inc(SbuStatsCounter *counter);
+guint
+sbu_stats_counter_get_value(SbuStatsCounter *counter);
+
+void
+sbu_stats_record(const gchar *name, gint64 ts_start);
+void
+sbu_stats_count(const gchar *name);
+GVariant *
+sbu_stats_to_variant(void);
+void
+sbu_stats_to_openmetrics(GString *str);
+void
+sbu_stats_reset(void);
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#include "config.h"
+
+#include <gio/gunixsocketaddress.h>
+
+#include "sbu-stream-client.h"
+
+struct _SbuStreamClient {
+	GObject parent_instance;
+	GSocketConnection *connection;
+};
+
+G_DEFINE_TYPE(SbuStreamClient, sbu_stream_client, G_TYPE_OBJECT)
+
+/**
+ * sbu_stream_client_connect:
+ * @self: a #SbuStreamClient
+ * @path: the filename of the Unix socket
+ * @error: a #GError or %NULL
+ *
+ * Connects to sbud. The first frame read will be a snapshot.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_stream_client_connect(SbuStreamClient *self, const gchar *path, GError **error)
+{
+	g_autoptr(GSocketAddress) address = g_unix_socket_address_new(path);
+	g_autoptr(GSocketClient) client = g_socket_client_new();
+
+	g_return_val_if_fail(SBU_IS_STREAM_CLIENT(self), FALSE);
+	g_return_val_if_fail(self->connection == NULL, FALSE);
+
+	self->connection =
+	    g_socket_client_connect(client, G_SOCKET_CONNECTABLE(address), NULL, error);
+	if (self->connection == NULL) {
+		g_prefix_error(error, "failed to connect to %s: ", path);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * sbu_stream_client_read:
+ * @self: a #SbuStreamClient
+ * @kind: (out): the #SbuStreamFrameKind of the frame
+ * @error: a #GError or %NULL
+ *
+ * Blocks until the next frame has been received.
+ *
+ * Returns: (transfer full): the frame payload, or %NULL on error
+ **/
+GVariant *
+sbu_stream_client_read(SbuStreamClient *self, SbuStreamFrameKind *kind, GError **error)
+{
+	GInputStream *istream;
+	gsize bytes_read = 0;
+	guint32 size = 0;
+	guint8 header[SBU_STREAM_FRAME_HEADER_SIZE];
+	g_autofree guint8 *buf = NULL;
+	g_autoptr(GBytes) payload = NULL;
+
+	g_return_val_if_fail(SBU_IS_STREAM_CLIENT(self), NULL);
+	g_return_val_if_fail(kind != NULL, NULL);
+	g_return_val_if_fail(self->connection != NULL, NULL);
+
+	istream = g_io_stream_get_input_stream(G_IO_STREAM(self->connection));
+	if (!g_input_stream_read_all(istream, header, sizeof(header), &bytes_read, NULL, error))
+		return NULL;
+	if (bytes_read != sizeof(header)) {
+		g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_CLOSED, "connection closed");
+		return NULL;
+	}
+	if (!sbu_stream_frame_parse_header(header, kind, &size, error))
+		return NULL;
+	buf = g_malloc(size);
+	if (!g_input_stream_read_all(istream, buf, size, &bytes_read, NULL, error))
+		return NULL;
+	if (bytes_read != size) {
+		g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_CLOSED, "connection closed");
+		return NULL;
+	}
+	payload = g_bytes_new_take(g_steal_pointer(&buf), size);
+	return sbu_stream_frame_parse_payload(*kind, payload, error);
+}
+
+/**
+ * sbu_stream_client_request_history:
+ * @self: a #SbuStreamClient
+ * @id: an ID that is included in the reply
+ * @device_id: a device ID
+ * @key: a history key, e.g. `node_battery:voltage`
+ * @start: the start time in seconds
+ * @end: the end time in seconds
+ * @limit: the number of points, or 0 for all of them
+ * @mode: a history mode, e.g. `average`
+ * @error: a #GError or %NULL
+ *
+ * Asks for a history range. The reply is a history-reply or error frame
+ * with the same @id, and may arrive after other frames.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_stream_client_request_history(SbuStreamClient *self,
+				  guint id,
+				  const gchar *device_id,
+				  const gchar *key,
+				  guint64 start,
+				  guint64 end,
+				  guint limit,
+				  const gchar *mode,
+				  GError **error)
+{
+	GOutputStream *ostream;
+	g_autoptr(GBytes) frame = NULL;
+
+	g_return_val_if_fail(SBU_IS_STREAM_CLIENT(self), FALSE);
+	g_return_val_if_fail(self->connection != NULL, FALSE);
+
+	frame = sbu_stream_frame_new(
+	    SBU_STREAM_FRAME_KIND_HISTORY_REQUEST,
+	    g_variant_new("(ussttus)", id, device_id, key, start, end, limit, mode));
+	ostream = g_io_stream_get_output_stream(G_IO_STREAM(self->connection));
+	return g_output_stream_write_all(ostream,
+					 g_bytes_get_data(frame, NULL),
+					 g_bytes_get_size(frame),
+					 NULL,
+					 NULL,
+					 error);
+}
+
+static void
+sbu_stream_client_finalize(GObject *object)
+{
+	SbuStreamClient *self = SBU_STREAM_CLIENT(object);
+
+	if (self->connection != NULL)
+		g_object_unref(self->connection);
+
+	G_OBJECT_CLASS(sbu_stream_client_parent_class)->finalize(object);
+}
+
+static void
+sbu_stream_client_init(SbuStreamClient *self)
+{
+}
+
+static void
+sbu_stream_client_class_init(SbuStreamClientClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = sbu_stream_client_finalize;
+}
+
+SbuStreamClient *
+sbu_stream_client_new(void)
+{
+	SbuStreamClient *self;
+	self = g_object_new(SBU_TYPE_STREAM_CLIENT, NULL);
+	return SBU_STREAM_CLIENT(self);
+}
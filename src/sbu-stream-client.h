@@ -0,0 +1,31 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+#include "sbu-stream.h"
+
+#define SBU_TYPE_STREAM_CLIENT (sbu_stream_client_get_type())
+G_DECLARE_FINAL_TYPE(SbuStreamClient, sbu_stream_client, SBU, STREAM_CLIENT, GObject)
+
+SbuStreamClient *
+sbu_stream_client_new(void);
+gboolean
+sbu_stream_client_connect(SbuStreamClient *self, const gchar *path, GError **error);
+GVariant *
+sbu_stream_client_read(SbuStreamClient *self, SbuStreamFrameKind *kind, GError **error);
+gboolean
+sbu_stream_client_request_history(SbuStreamClient *self,
+				  guint id,
+				  const gchar *device_id,
+				  const gchar *key,
+				  guint64 start,
+				  guint64 end,
+				  guint limit,
+				  const gchar *mode,
+				  GError **error);
@@ -0,0 +1,564 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#include "config.h"
+
+#include <gio/gunixsocketaddress.h>
+#include <glib/gstdio.h>
+
+#include "sbu-stream-server.h"
+#include "sbu-stream.h"
+
+/* deltas are dropped for clients that cannot keep up with this much */
+#define SBU_STREAM_SERVER_MAX_QUEUED (1024 * 1024)
+
+typedef struct {
+	guint refcount;
+	SbuStreamServer *server; /* no ref, cleared on finalize */
+	GSocketConnection *connection;
+	GCancellable *cancellable;
+	GQueue *outgoing; /* of GBytes */
+	gsize queued;
+	gboolean writing;
+	gboolean overflow;
+	gboolean closed;
+	gboolean close_after_flush;
+	guint8 header[SBU_STREAM_FRAME_HEADER_SIZE];
+	SbuStreamFrameKind kind;
+	guint8 *payload;
+	guint32 payload_size;
+} SbuStreamPeer;
+
+struct _SbuStreamServer {
+	GObject parent_instance;
+	GSocketService *service;
+	gchar *path;
+	GPtrArray *peers; /* of SbuStreamPeer */
+	guint64 seq;
+	gsize max_queued;
+	SbuStreamServerSnapshotFunc snapshot_func;
+	SbuStreamServerHistoryFunc history_func;
+	gpointer user_data;
+};
+
+G_DEFINE_TYPE(SbuStreamServer, sbu_stream_server, G_TYPE_OBJECT)
+
+static void
+sbu_stream_peer_flush(SbuStreamPeer *peer);
+static void
+sbu_stream_peer_read_header(SbuStreamPeer *peer);
+
+static SbuStreamPeer *
+sbu_stream_peer_ref(SbuStreamPeer *peer)
+{
+	peer->refcount++;
+	return peer;
+}
+
+static void
+sbu_stream_peer_unref(SbuStreamPeer *peer)
+{
+	if (--peer->refcount > 0)
+		return;
+	g_queue_free_full(peer->outgoing, (GDestroyNotify)g_bytes_unref);
+	g_object_unref(peer->cancellable);
+	g_object_unref(peer->connection);
+	g_free(peer->payload);
+	g_free(peer);
+}
+
+static void
+sbu_stream_peer_close(SbuStreamPeer *peer)
+{
+	if (peer->closed)
+		return;
+	peer->closed = TRUE;
+	g_cancellable_cancel(peer->cancellable);
+
+	/* the stream cannot be closed while a read is pending */
+	g_socket_close(g_socket_connection_get_socket(peer->connection), NULL);
+	if (peer->server != NULL) {
+		g_debug("stream client disconnected");
+		g_ptr_array_remove(peer->server->peers, peer);
+	}
+}
+
+static void
+sbu_stream_peer_send(SbuStreamPeer *peer, SbuStreamFrameKind kind, GVariant *payload)
+{
+	g_autoptr(GBytes) frame = NULL;
+
+	/* only deltas can be dropped, as a snapshot is sent once the queue drains */
+	if (kind == SBU_STREAM_FRAME_KIND_DELTA) {
+		if (peer->overflow)
+			return;
+		if (peer->queued > peer->server->max_queued) {
+			g_debug("stream client too slow, dropping deltas");
+			peer->overflow = TRUE;
+			return;
+		}
+	}
+	frame = sbu_stream_frame_new(kind, payload);
+	peer->queued += g_bytes_get_size(frame);
+	g_queue_push_tail(peer->outgoing, g_steal_pointer(&frame));
+	sbu_stream_peer_flush(peer);
+}
+
+static void
+sbu_stream_peer_send_snapshot(SbuStreamPeer *peer)
+{
+	SbuStreamServer *self = peer->server;
+	g_autoptr(GVariant) devices = NULL;
+
+	if (self->snapshot_func != NULL)
+		devices = self->snapshot_func(self->user_data);
+	else
+		devices = g_variant_ref_sink(g_variant_new("aa{sv}", NULL));
+	sbu_stream_peer_send(peer,
+			     SBU_STREAM_FRAME_KIND_SNAPSHOT,
+			     g_variant_new("(t@aa{sv})", self->seq, devices));
+}
+
+static void
+sbu_stream_peer_send_error(SbuStreamPeer *peer, guint id, const gchar *message)
+{
+	sbu_stream_peer_send(peer, SBU_STREAM_FRAME_KIND_ERROR, g_variant_new("(us)", id, message));
+}
+
+static void
+sbu_stream_peer_write_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuStreamPeer *peer = (SbuStreamPeer *)user_data;
+	GBytes *frame;
+	g_autoptr(GError) error = NULL;
+
+	if (!g_output_stream_write_all_finish(G_OUTPUT_STREAM(source), res, NULL, &error)) {
+		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_debug("failed to write to stream client: %s", error->message);
+		sbu_stream_peer_close(peer);
+		sbu_stream_peer_unref(peer);
+		return;
+	}
+	frame = g_queue_pop_head(peer->outgoing);
+	peer->queued -= g_bytes_get_size(frame);
+	peer->writing = FALSE;
+	g_bytes_unref(frame);
+
+	/* caught up, so resync with the current state */
+	if (g_queue_is_empty(peer->outgoing)) {
+		if (peer->close_after_flush) {
+			sbu_stream_peer_close(peer);
+			sbu_stream_peer_unref(peer);
+			return;
+		}
+		if (peer->overflow && peer->server != NULL) {
+			peer->overflow = FALSE;
+			sbu_stream_peer_send_snapshot(peer);
+		}
+	}
+	sbu_stream_peer_flush(peer);
+	sbu_stream_peer_unref(peer);
+}
+
+static void
+sbu_stream_peer_flush(SbuStreamPeer *peer)
+{
+	GOutputStream *ostream;
+	GBytes *frame;
+
+	if (peer->writing || peer->closed)
+		return;
+	frame = g_queue_peek_head(peer->outgoing);
+	if (frame == NULL)
+		return;
+	peer->writing = TRUE;
+	ostream = g_io_stream_get_output_stream(G_IO_STREAM(peer->connection));
+	g_output_stream_write_all_async(ostream,
+					g_bytes_get_data(frame, NULL),
+					g_bytes_get_size(frame),
+					G_PRIORITY_DEFAULT,
+					peer->cancellable,
+					sbu_stream_peer_write_cb,
+					sbu_stream_peer_ref(peer));
+}
+
+static void
+sbu_stream_peer_history_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuStreamPeer *peer = (SbuStreamPeer *)user_data;
+	guint id = GPOINTER_TO_UINT(g_task_get_task_data(G_TASK(res)));
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) history = NULL;
+	g_autoptr(GVariant) payload = NULL;
+
+	history = g_task_propagate_pointer(G_TASK(res), &error);
+	if (peer->closed || peer->server == NULL) {
+		sbu_stream_peer_unref(peer);
+		return;
+	}
+	if (history == NULL) {
+		sbu_stream_peer_send_error(peer, id, error->message);
+		sbu_stream_peer_unref(peer);
+		return;
+	}
+
+	/* the client would drop the connection on a frame this large */
+	payload = g_variant_ref_sink(g_variant_new("(u@a(td))", id, history));
+	if (g_variant_get_size(payload) > SBU_STREAM_FRAME_SIZE_MAX) {
+		g_autofree gchar *msg =
+		    g_strdup_printf("history reply of %" G_GSIZE_FORMAT " bytes is too large, "
+				    "use a smaller range or a limit",
+				    g_variant_get_size(payload));
+		sbu_stream_peer_send_error(peer, id, msg);
+		sbu_stream_peer_unref(peer);
+		return;
+	}
+	sbu_stream_peer_send(peer, SBU_STREAM_FRAME_KIND_HISTORY_REPLY, payload);
+	sbu_stream_peer_unref(peer);
+}
+
+/* the reply is sent when the query completes, and other requests can be
+ * handled in the meantime -- the ID is used to match them up */
+static void
+sbu_stream_peer_handle_history(SbuStreamPeer *peer, GVariant *request)
+{
+	SbuStreamServer *self = peer->server;
+	const gchar *device_id = NULL;
+	const gchar *key = NULL;
+	const gchar *mode = NULL;
+	guint id = 0;
+	guint limit = 0;
+	guint64 start = 0;
+	guint64 end = 0;
+	g_autoptr(GTask) task = NULL;
+
+	g_variant_get(request,
+		      "(u&s&sttu&s)",
+		      &id,
+		      &device_id,
+		      &key,
+		      &start,
+		      &end,
+		      &limit,
+		      &mode);
+	if (self->history_func == NULL) {
+		sbu_stream_peer_send_error(peer, id, "history not supported");
+		return;
+	}
+	task = g_task_new(NULL,
+			  peer->cancellable,
+			  sbu_stream_peer_history_cb,
+			  sbu_stream_peer_ref(peer));
+	g_task_set_task_data(task, GUINT_TO_POINTER(id), NULL);
+	self->history_func(device_id, key, start, end, limit, mode, task, self->user_data);
+}
+
+static void
+sbu_stream_peer_read_payload_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuStreamPeer *peer = (SbuStreamPeer *)user_data;
+	gsize bytes_read = 0;
+	g_autoptr(GBytes) payload = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) request = NULL;
+
+	if (!g_input_stream_read_all_finish(G_INPUT_STREAM(source), res, &bytes_read, &error) ||
+	    bytes_read != peer->payload_size || peer->server == NULL) {
+		sbu_stream_peer_close(peer);
+		sbu_stream_peer_unref(peer);
+		return;
+	}
+	payload = g_bytes_new_take(g_steal_pointer(&peer->payload), peer->payload_size);
+
+	/* clients can only ask for history */
+	if (peer->kind != SBU_STREAM_FRAME_KIND_HISTORY_REQUEST) {
+		g_autofree gchar *msg =
+		    g_strdup_printf("unexpected %s frame",
+				    sbu_stream_frame_kind_to_string(peer->kind));
+		sbu_stream_peer_send_error(peer, 0, msg);
+		sbu_stream_peer_read_header(peer);
+		sbu_stream_peer_unref(peer);
+		return;
+	}
+	request = sbu_stream_frame_parse_payload(peer->kind, payload, &error);
+	if (request == NULL) {
+		sbu_stream_peer_send_error(peer, 0, error->message);
+		peer->close_after_flush = TRUE;
+		sbu_stream_peer_unref(peer);
+		return;
+	}
+	sbu_stream_peer_handle_history(peer, request);
+	sbu_stream_peer_read_header(peer);
+	sbu_stream_peer_unref(peer);
+}
+
+static void
+sbu_stream_peer_read_header_cb(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	SbuStreamPeer *peer = (SbuStreamPeer *)user_data;
+	GInputStream *istream = G_INPUT_STREAM(source);
+	gsize bytes_read = 0;
+	g_autoptr(GError) error = NULL;
+
+	/* EOF is the normal way for a client to go away */
+	if (!g_input_stream_read_all_finish(istream, res, &bytes_read, &error) ||
+	    bytes_read != sizeof(peer->header) || peer->server == NULL) {
+		sbu_stream_peer_close(peer);
+		sbu_stream_peer_unref(peer);
+		return;
+	}
+	if (!sbu_stream_frame_parse_header(peer->header,
+					   &peer->kind,
+					   &peer->payload_size,
+					   &error)) {
+		sbu_stream_peer_send_error(peer, 0, error->message);
+		peer->close_after_flush = TRUE;
+		sbu_stream_peer_unref(peer);
+		return;
+	}
+	peer->payload = g_malloc(peer->payload_size);
+	g_input_stream_read_all_async(istream,
+				      peer->payload,
+				      peer->payload_size,
+				      G_PRIORITY_DEFAULT,
+				      peer->cancellable,
+				      sbu_stream_peer_read_payload_cb,
+				      peer);
+}
+
+static void
+sbu_stream_peer_read_header(SbuStreamPeer *peer)
+{
+	GInputStream *istream = g_io_stream_get_input_stream(G_IO_STREAM(peer->connection));
+	g_input_stream_read_all_async(istream,
+				      peer->header,
+				      sizeof(peer->header),
+				      G_PRIORITY_DEFAULT,
+				      peer->cancellable,
+				      sbu_stream_peer_read_header_cb,
+				      sbu_stream_peer_ref(peer));
+}
+
+static gboolean
+sbu_stream_server_incoming_cb(GSocketService *service,
+			      GSocketConnection *connection,
+			      GObject *source_object,
+			      gpointer user_data)
+{
+	SbuStreamServer *self = SBU_STREAM_SERVER(user_data);
+	SbuStreamPeer *peer = g_new0(SbuStreamPeer, 1);
+
+	g_debug("stream client connected");
+	peer->refcount = 1;
+	peer->server = self;
+	peer->connection = g_object_ref(connection);
+	peer->cancellable = g_cancellable_new();
+	peer->outgoing = g_queue_new();
+	g_ptr_array_add(self->peers, peer);
+	sbu_stream_peer_send_snapshot(peer);
+	sbu_stream_peer_read_header(peer);
+	return TRUE;
+}
+
+/**
+ * sbu_stream_server_set_funcs:
+ * @self: a #SbuStreamServer
+ * @snapshot_func: returns the devices as `aa{sv}`
+ * @history_func: completes the task with a history range as `a(td)`
+ * @user_data: data for the functions
+ *
+ * Sets the functions used to answer clients, which keeps the server
+ * independent of the manager.
+ **/
+void
+sbu_stream_server_set_funcs(SbuStreamServer *self,
+			    SbuStreamServerSnapshotFunc snapshot_func,
+			    SbuStreamServerHistoryFunc history_func,
+			    gpointer user_data)
+{
+	g_return_if_fail(SBU_IS_STREAM_SERVER(self));
+	self->snapshot_func = snapshot_func;
+	self->history_func = history_func;
+	self->user_data = user_data;
+}
+
+void
+sbu_stream_server_set_max_queued(SbuStreamServer *self, gsize max_queued)
+{
+	g_return_if_fail(SBU_IS_STREAM_SERVER(self));
+	self->max_queued = max_queued;
+}
+
+guint
+sbu_stream_server_get_n_clients(SbuStreamServer *self)
+{
+	g_return_val_if_fail(SBU_IS_STREAM_SERVER(self), 0);
+	return self->peers->len;
+}
+
+/**
+ * sbu_stream_server_push_changes:
+ * @self: a #SbuStreamServer
+ * @seq: the sequence number of the changes
+ * @changes: a #GVariant of type `a(sssv)`
+ *
+ * Sends a delta frame to every connected client.
+ **/
+void
+sbu_stream_server_push_changes(SbuStreamServer *self, guint64 seq, GVariant *changes)
+{
+	g_autoptr(GVariant) payload = NULL;
+
+	g_return_if_fail(SBU_IS_STREAM_SERVER(self));
+
+	self->seq = seq;
+	if (self->peers->len == 0)
+		return;
+	payload = g_variant_ref_sink(g_variant_new("(t@a(sssv))", seq, changes));
+	for (guint i = 0; i < self->peers->len; i++) {
+		SbuStreamPeer *peer = g_ptr_array_index(self->peers, i);
+		sbu_stream_peer_send(peer, SBU_STREAM_FRAME_KIND_DELTA, payload);
+	}
+}
+
+/**
+ * sbu_stream_server_push_snapshot:
+ * @self: a #SbuStreamServer
+ *
+ * Sends the current state to every connected client, e.g. when a device
+ * is added or removed.
+ **/
+void
+sbu_stream_server_push_snapshot(SbuStreamServer *self)
+{
+	g_return_if_fail(SBU_IS_STREAM_SERVER(self));
+	for (guint i = 0; i < self->peers->len; i++) {
+		SbuStreamPeer *peer = g_ptr_array_index(self->peers, i);
+
+		/* will get one when the queue drains */
+		if (peer->overflow)
+			continue;
+		sbu_stream_peer_send_snapshot(peer);
+	}
+}
+
+/**
+ * sbu_stream_server_start:
+ * @self: a #SbuStreamServer
+ * @path: a filename for the Unix socket
+ * @error: a #GError or %NULL
+ *
+ * Starts listening for clients. A stale socket at @path is removed, but it is
+ * an error if another process is still listening on it.
+ *
+ * Returns: %TRUE for success
+ **/
+gboolean
+sbu_stream_server_start(SbuStreamServer *self, const gchar *path, GError **error)
+{
+	g_autoptr(GSocketAddress) address = NULL;
+
+	g_return_val_if_fail(SBU_IS_STREAM_SERVER(self), FALSE);
+	g_return_val_if_fail(path != NULL, FALSE);
+
+	address = g_unix_socket_address_new(path);
+	if (g_file_test(path, G_FILE_TEST_EXISTS)) {
+		g_autoptr(GSocketClient) client = g_socket_client_new();
+		g_autoptr(GSocketConnection) connection = NULL;
+
+		/* another daemon is still running */
+		connection =
+		    g_socket_client_connect(client, G_SOCKET_CONNECTABLE(address), NULL, NULL);
+		if (connection != NULL) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_ADDRESS_IN_USE,
+				    "%s is already in use",
+				    path);
+			return FALSE;
+		}
+
+		/* left over from a crash */
+		if (g_unlink(path) != 0) {
+			g_set_error(error,
+				    G_IO_ERROR,
+				    G_IO_ERROR_FAILED,
+				    "failed to remove stale socket %s",
+				    path);
+			return FALSE;
+		}
+	}
+	if (!g_socket_listener_add_address(G_SOCKET_LISTENER(self->service),
+					   address,
+					   G_SOCKET_TYPE_STREAM,
+					   G_SOCKET_PROTOCOL_DEFAULT,
+					   NULL,
+					   NULL,
+					   error)) {
+		g_prefix_error(error, "failed to listen on %s: ", path);
+		return FALSE;
+	}
+	self->path = g_strdup(path);
+	g_socket_service_start(self->service);
+	return TRUE;
+}
+
+static void
+sbu_stream_server_finalize(GObject *object)
+{
+	SbuStreamServer *self = SBU_STREAM_SERVER(object);
+
+	g_socket_service_stop(self->service);
+	g_socket_listener_close(G_SOCKET_LISTENER(self->service));
+	for (guint i = 0; i < self->peers->len; i++) {
+		SbuStreamPeer *peer = g_ptr_array_index(self->peers, i);
+		peer->server = NULL;
+		sbu_stream_peer_close(peer);
+	}
+	g_ptr_array_unref(self->peers);
+	g_object_unref(self->service);
+	if (self->path != NULL)
+		g_unlink(self->path);
+	g_free(self->path);
+
+	G_OBJECT_CLASS(sbu_stream_server_parent_class)->finalize(object);
+}
+
+static void
+sbu_stream_server_init(SbuStreamServer *self)
+{
+	self->max_queued = SBU_STREAM_SERVER_MAX_QUEUED;
+	self->peers = g_ptr_array_new_with_free_func((GDestroyNotify)sbu_stream_peer_unref);
+	self->service = g_socket_service_new();
+	g_signal_connect(self->service,
+			 "incoming",
+			 G_CALLBACK(sbu_stream_server_incoming_cb),
+			 self);
+}
+
+static void
+sbu_stream_server_class_init(SbuStreamServerClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = sbu_stream_server_finalize;
+}
+
+/**
+ * sbu_stream_server_new:
+ *
+ * Creates a server for the binary stream protocol described in sbu-stream.h.
+ * Clients get a snapshot when they connect, then a delta frame for every
+ * batch of changed values, and can ask for history ranges at any time.
+ *
+ * Returns: (transfer full): a #SbuStreamServer
+ **/
+SbuStreamServer *
+sbu_stream_server_new(void)
+{
+	SbuStreamServer *self;
+	self = g_object_new(SBU_TYPE_STREAM_SERVER, NULL);
+	return SBU_STREAM_SERVER(self);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+#define SBU_TYPE_STREAM_SERVER (sbu_stream_server_get_type())
+G_DECLARE_FINAL_TYPE(SbuStreamServer, sbu_stream_server, SBU, STREAM_SERVER, GObject)
+
+/* returns aa{sv} */
+typedef GVariant *(*SbuStreamServerSnapshotFunc)(gpointer user_data);
+/* returns a(td) using g_task_return_pointer(), and may complete @task later */
+typedef void (*SbuStreamServerHistoryFunc)(const gchar *device_id,
+					   const gchar *key,
+					   guint64 start,
+					   guint64 end,
+					   guint limit,
+					   const gchar *mode,
+					   GTask *task,
+					   gpointer user_data);
+
+SbuStreamServer *
+sbu_stream_server_new(void);
+void
+sbu_stream_server_set_funcs(SbuStreamServer *self,
+			    SbuStreamServerSnapshotFunc snapshot_func,
+			    SbuStreamServerHistoryFunc history_func,
+			    gpointer user_data);
+void
+sbu_stream_server_set_max_queued(SbuStreamServer *self, gsize max_queued);
+gboolean
+sbu_stream_server_start(SbuStreamServer *self, const gchar *path, GError **error);
+void
+sbu_stream_server_push_changes(SbuStreamServer *self, guint64 seq, GVariant *changes);
+void
+sbu_stream_server_push_snapshot(SbuStreamServer *self);
+guint
+sbu_stream_server_get_n_clients(SbuStreamServer *self);
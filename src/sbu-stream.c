@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+#include "sbu-stream.h"
+
+const gchar *
+sbu_stream_frame_kind_to_string(SbuStreamFrameKind kind)
+{
+	if (kind == SBU_STREAM_FRAME_KIND_SNAPSHOT)
+		return "snapshot";
+	if (kind == SBU_STREAM_FRAME_KIND_DELTA)
+		return "delta";
+	if (kind == SBU_STREAM_FRAME_KIND_HISTORY_REQUEST)
+		return "history-request";
+	if (kind == SBU_STREAM_FRAME_KIND_HISTORY_REPLY)
+		return "history-reply";
+	if (kind == SBU_STREAM_FRAME_KIND_ERROR)
+		return "error";
+	return NULL;
+}
+
+const GVariantType *
+sbu_stream_frame_kind_to_type(SbuStreamFrameKind kind)
+{
+	if (kind == SBU_STREAM_FRAME_KIND_SNAPSHOT)
+		return G_VARIANT_TYPE("(taa{sv})");
+	if (kind == SBU_STREAM_FRAME_KIND_DELTA)
+		return G_VARIANT_TYPE("(ta(sssv))");
+	if (kind == SBU_STREAM_FRAME_KIND_HISTORY_REQUEST)
+		return G_VARIANT_TYPE("(ussttus)");
+	if (kind == SBU_STREAM_FRAME_KIND_HISTORY_REPLY)
+		return G_VARIANT_TYPE("(ua(td))");
+	if (kind == SBU_STREAM_FRAME_KIND_ERROR)
+		return G_VARIANT_TYPE("(us)");
+	return NULL;
+}
+
+/**
+ * sbu_stream_frame_new:
+ * @kind: a #SbuStreamFrameKind
+ * @payload: a #GVariant of the type for @kind
+ *
+ * Builds a frame with the payload in little-endian GVariant serialization.
+ *
+ * Returns: (transfer full): a #GBytes
+ **/
+GBytes *
+sbu_stream_frame_new(SbuStreamFrameKind kind, GVariant *payload)
+{
+	gsize size;
+	guint16 kind_le = GUINT16_TO_LE(kind);
+	guint32 size_le;
+	guint8 *buf;
+	g_autoptr(GVariant) payload_le = NULL;
+	g_autoptr(GVariant) payload_tmp = g_variant_ref_sink(payload);
+
+	g_return_val_if_fail(g_variant_is_of_type(payload, sbu_stream_frame_kind_to_type(kind)),
+			     NULL);
+
+	if (G_BYTE_ORDER == G_BIG_ENDIAN)
+		payload_le = g_variant_byteswap(payload_tmp);
+	else
+		payload_le = g_variant_ref(payload_tmp);
+	size = g_variant_get_size(payload_le);
+	size_le = GUINT32_TO_LE(size);
+	buf = g_malloc0(SBU_STREAM_FRAME_HEADER_SIZE + size);
+	memcpy(buf + 0, &kind_le, sizeof(kind_le));
+	memcpy(buf + 4, &size_le, sizeof(size_le));
+	g_variant_store(payload_le, buf + SBU_STREAM_FRAME_HEADER_SIZE);
+	return g_bytes_new_take(buf, SBU_STREAM_FRAME_HEADER_SIZE + size);
+}
+
+gboolean
+sbu_stream_frame_parse_header(const guint8 *buf,
+			      SbuStreamFrameKind *kind,
+			      guint32 *size,
+			      GError **error)
+{
+	guint16 kind_le;
+	guint32 size_le;
+
+	memcpy(&kind_le, buf + 0, sizeof(kind_le));
+	memcpy(&size_le, buf + 4, sizeof(size_le));
+	if (GUINT16_FROM_LE(kind_le) == SBU_STREAM_FRAME_KIND_UNKNOWN ||
+	    GUINT16_FROM_LE(kind_le) >= SBU_STREAM_FRAME_KIND_LAST) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "unknown frame kind %u",
+			    GUINT16_FROM_LE(kind_le));
+		return FALSE;
+	}
+	if (GUINT32_FROM_LE(size_le) > SBU_STREAM_FRAME_SIZE_MAX) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "frame size %u too large",
+			    GUINT32_FROM_LE(size_le));
+		return FALSE;
+	}
+	*kind = GUINT16_FROM_LE(kind_le);
+	*size = GUINT32_FROM_LE(size_le);
+	return TRUE;
+}
+
+/**
+ * sbu_stream_frame_parse_payload:
+ * @kind: a #SbuStreamFrameKind
+ * @payload: the bytes following the header
+ * @error: a #GError or %NULL
+ *
+ * Returns: (transfer full): a #GVariant in normal form, or %NULL on error
+ **/
+GVariant *
+sbu_stream_frame_parse_payload(SbuStreamFrameKind kind, GBytes *payload, GError **error)
+{
+	g_autoptr(GVariant) value = NULL;
+
+	value = g_variant_ref_sink(
+	    g_variant_new_from_bytes(sbu_stream_frame_kind_to_type(kind), payload, FALSE));
+
+	/* do not trust the other end */
+	if (!g_variant_is_normal_form(value)) {
+		g_set_error(error,
+			    G_IO_ERROR,
+			    G_IO_ERROR_INVALID_DATA,
+			    "%s frame is not in normal form",
+			    sbu_stream_frame_kind_to_string(kind));
+		return NULL;
+	}
+	if (G_BYTE_ORDER == G_BIG_ENDIAN)
+		return g_variant_byteswap(value);
+	return g_steal_pointer(&value);
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#pragma once
+
+#include <glib.h>
+
+/* 2 bytes kind, 2 bytes reserved, 4 bytes payload size, all little endian */
+#define SBU_STREAM_FRAME_HEADER_SIZE 8
+#define SBU_STREAM_FRAME_SIZE_MAX    (16 * 1024 * 1024)
+
+typedef enum {
+	SBU_STREAM_FRAME_KIND_UNKNOWN,
+	SBU_STREAM_FRAME_KIND_SNAPSHOT,	       /* (taa{sv}) */
+	SBU_STREAM_FRAME_KIND_DELTA,	       /* (ta(sssv)) */
+	SBU_STREAM_FRAME_KIND_HISTORY_REQUEST, /* (ussttus) */
+	SBU_STREAM_FRAME_KIND_HISTORY_REPLY,   /* (ua(td)) */
+	SBU_STREAM_FRAME_KIND_ERROR,	       /* (us) */
+	SBU_STREAM_FRAME_KIND_LAST
+} SbuStreamFrameKind;
+
+const gchar *
+sbu_stream_frame_kind_to_string(SbuStreamFrameKind kind);
+const GVariantType *
+sbu_stream_frame_kind_to_type(SbuStreamFrameKind kind);
+GBytes *
+sbu_stream_frame_new(SbuStreamFrameKind kind, GVariant *payload);
+gboolean
+sbu_stream_frame_parse_header(const guint8 *buf,
+			      SbuStreamFrameKind *kind,
+			      guint32 *size,
+			      GError **error);
+GVariant *
+sbu_stream_frame_parse_payload(SbuStreamFrameKind kind, GBytes *payload, GError **error);
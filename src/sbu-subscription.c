@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#include "config.h"
+
+#include "sbu-subscription.h"
+
+struct _SbuSubscription {
+	GObject parent_instance;
+	guint id;
+	gchar *sender;
+	GPtrArray *patterns; /* of GPatternSpec, empty for everything */
+	gint64 interval;     /* µs, or 0 for no limit */
+	gint64 last_sent;    /* monotonic */
+	GHashTable *pending; /* device:id:key : GVariant (sssv) */
+	guint pending_id;
+};
+
+G_DEFINE_TYPE(SbuSubscription, sbu_subscription, G_TYPE_OBJECT)
+
+enum { SIGNAL_CHANGES, SIGNAL_LAST };
+
+static guint signals[SIGNAL_LAST] = {0};
+
+guint
+sbu_subscription_get_id(SbuSubscription *self)
+{
+	g_return_val_if_fail(SBU_IS_SUBSCRIPTION(self), 0);
+	return self->id;
+}
+
+const gchar *
+sbu_subscription_get_sender(SbuSubscription *self)
+{
+	g_return_val_if_fail(SBU_IS_SUBSCRIPTION(self), NULL);
+	return self->sender;
+}
+
+/**
+ * sbu_subscription_get_pending:
+ * @self: a #SbuSubscription
+ *
+ * Returns: the number of values waiting to be sent
+ **/
+guint
+sbu_subscription_get_pending(SbuSubscription *self)
+{
+	g_return_val_if_fail(SBU_IS_SUBSCRIPTION(self), 0);
+	return g_hash_table_size(self->pending);
+}
+
+/**
+ * sbu_subscription_matches:
+ * @self: a #SbuSubscription
+ * @device_id: a device ID
+ * @id: a node or link ID
+ * @key: a property name
+ *
+ * Checks the value against the glob patterns the client subscribed with,
+ * e.g. `*:node_battery:voltage`.
+ *
+ * Returns: %TRUE if the client wants this value
+ **/
+gboolean
+sbu_subscription_matches(SbuSubscription *self,
+			 const gchar *device_id,
+			 const gchar *id,
+			 const gchar *key)
+{
+	g_autofree gchar *str = NULL;
+
+	g_return_val_if_fail(SBU_IS_SUBSCRIPTION(self), FALSE);
+
+	if (self->patterns->len == 0)
+		return TRUE;
+	str = g_strdup_printf("%s:%s:%s", device_id, id, key);
+	for (guint i = 0; i < self->patterns->len; i++) {
+		GPatternSpec *pspec = g_ptr_array_index(self->patterns, i);
+		if (g_pattern_match_string(pspec, str))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static gboolean
+sbu_subscription_flush_cb(gpointer user_data)
+{
+	SbuSubscription *self = SBU_SUBSCRIPTION(user_data);
+	GHashTableIter iter;
+	GVariant *value;
+	GVariantBuilder builder;
+	g_autoptr(GVariant) changes = NULL;
+
+	g_variant_builder_init(&builder, G_VARIANT_TYPE("a(sssv)"));
+	g_hash_table_iter_init(&iter, self->pending);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&value))
+		g_variant_builder_add_value(&builder, value);
+	g_hash_table_remove_all(self->pending);
+	changes = g_variant_ref_sink(g_variant_builder_end(&builder));
+	self->last_sent = g_get_monotonic_time();
+	self->pending_id = 0;
+	g_signal_emit(self, signals[SIGNAL_CHANGES], 0, changes);
+	return FALSE;
+}
+
+/**
+ * sbu_subscription_add_changes:
+ * @self: a #SbuSubscription
+ * @changes: a #GVariant of type `a(sssv)`
+ *
+ * Queues the values the client is interested in. Values are sent straight
+ * away if the client has not had an update for longer than its rate limit,
+ * otherwise only the latest value of each is sent when the limit expires.
+ **/
+void
+sbu_subscription_add_changes(SbuSubscription *self, GVariant *changes)
+{
+	GVariantIter iter;
+	GVariant *change;
+	gint64 delay;
+
+	g_return_if_fail(SBU_IS_SUBSCRIPTION(self));
+
+	g_variant_iter_init(&iter, changes);
+	while ((change = g_variant_iter_next_value(&iter)) != NULL) {
+		const gchar *device_id;
+		const gchar *id;
+		const gchar *key;
+		g_variant_get(change, "(&s&s&sv)", &device_id, &id, &key, NULL);
+		if (sbu_subscription_matches(self, device_id, id, key)) {
+			g_hash_table_replace(self->pending,
+					     g_strdup_printf("%s:%s:%s", device_id, id, key),
+					     g_variant_ref(change));
+		}
+		g_variant_unref(change);
+	}
+	if (g_hash_table_size(self->pending) == 0 || self->pending_id != 0)
+		return;
+
+	/* coalesce until the rate limit allows another update */
+	delay = self->last_sent + self->interval - g_get_monotonic_time();
+	if (delay <= 0) {
+		sbu_subscription_flush_cb(self);
+		return;
+	}
+	self->pending_id = g_timeout_add(MAX(delay / 1000, 1), sbu_subscription_flush_cb, self);
+}
+
+static void
+sbu_subscription_finalize(GObject *object)
+{
+	SbuSubscription *self = SBU_SUBSCRIPTION(object);
+
+	if (self->pending_id != 0)
+		g_source_remove(self->pending_id);
+	g_free(self->sender);
+	g_ptr_array_unref(self->patterns);
+	g_hash_table_unref(self->pending);
+
+	G_OBJECT_CLASS(sbu_subscription_parent_class)->finalize(object);
+}
+
+static void
+sbu_subscription_init(SbuSubscription *self)
+{
+	self->patterns = g_ptr_array_new_with_free_func((GDestroyNotify)g_pattern_spec_free);
+	self->pending = g_hash_table_new_full(g_str_hash,
+					      g_str_equal,
+					      g_free,
+					      (GDestroyNotify)g_variant_unref);
+}
+
+static void
+sbu_subscription_class_init(SbuSubscriptionClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS(klass);
+	object_class->finalize = sbu_subscription_finalize;
+
+	signals[SIGNAL_CHANGES] = g_signal_new("changes",
+					       G_TYPE_FROM_CLASS(object_class),
+					       G_SIGNAL_RUN_LAST,
+					       0,
+					       NULL,
+					       NULL,
+					       NULL,
+					       G_TYPE_NONE,
+					       1,
+					       G_TYPE_VARIANT);
+}
+
+/**
+ * sbu_subscription_new:
+ * @id: a unique ID
+ * @sender: the unique bus name of the client
+ * @keys: (nullable): glob patterns of `device:id:key`, or %NULL for everything
+ * @max_rate_hz: the maximum number of updates per second, or 0 for no limit
+ *
+ * Returns: (transfer full): a #SbuSubscription
+ **/
+SbuSubscription *
+sbu_subscription_new(guint id, const gchar *sender, gchar **keys, gdouble max_rate_hz)
+{
+	SbuSubscription *self;
+	self = g_object_new(SBU_TYPE_SUBSCRIPTION, NULL);
+	self->id = id;
+	self->sender = g_strdup(sender);
+	for (guint i = 0; keys != NULL && keys[i] != NULL; i++)
+		g_ptr_array_add(self->patterns, g_pattern_spec_new(keys[i]));
+	if (max_rate_hz > 0)
+		self->interval = G_USEC_PER_SEC / max_rate_hz;
+	return SBU_SUBSCRIPTION(self);
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * SPDX-License-Identifier: GPL-2+
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+#define SBU_TYPE_SUBSCRIPTION (sbu_subscription_get_type())
+G_DECLARE_FINAL_TYPE(SbuSubscription, sbu_subscription, SBU, SUBSCRIPTION, GObject)
+
+SbuSubscription *
+sbu_subscription_new(guint id, const gchar *sender, gchar **keys, gdouble max_rate_hz);
+guint
+sbu_subscription_get_id(SbuSubscription *self);
+const gchar *
+sbu_subscription_get_sender(SbuSubscription *self);
+gboolean
+sbu_subscription_matches(SbuSubscription *self,
+			 const gchar *device_id,
+			 const gchar *id,
+			 const gchar *key);
+void
+sbu_subscription_add_changes(SbuSubscription *self, GVariant *changes);
+guint
+sbu_subscription_get_pending(SbuSubscription *self);
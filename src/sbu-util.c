@@ -176,6 +176,122 @@ sbu_util_query(SbuUtil *self, gchar **values, GError **error)
 	return TRUE;
 }
 
+static gint
+sbu_util_sort_strings_cb(gconstpointer a, gconstpointer b)
+{
+	return g_strcmp0(*(const gchar **)a, *(const gchar **)b);
+}
+
+/* returns the keys of an a{sv} in a stable order */
+static GPtrArray *
+sbu_util_get_sorted_keys(GVariant *dict)
+{
+	GVariantIter iter;
+	const gchar *key;
+	GPtrArray *keys = g_ptr_array_new();
+
+	g_variant_iter_init(&iter, dict);
+	while (g_variant_iter_next(&iter, "{&s@v}", &key, NULL))
+		g_ptr_array_add(keys, (gpointer)key);
+	g_ptr_array_sort(keys, sbu_util_sort_strings_cb);
+	return keys;
+}
+
+static void
+sbu_util_print_latency(GVariant *latency)
+{
+	g_autoptr(GPtrArray) keys = sbu_util_get_sorted_keys(latency);
+
+	/* TRANSLATORS: header for a table of timings in microseconds */
+	g_print("%s\n", _("Latency (µs):"));
+	g_print("  %-28s %8s %8s %8s %8s %8s %8s\n",
+		"",
+		"count",
+		"mean",
+		"p50",
+		"p90",
+		"p99",
+		"max");
+	for (guint i = 0; i < keys->len; i++) {
+		const gchar *key = g_ptr_array_index(keys, i);
+		guint32 count = 0;
+		gint64 mean = 0, p50 = 0, p90 = 0, p99 = 0, max = 0;
+		g_autoptr(GVariant) histogram = g_variant_lookup_value(latency, key, NULL);
+		g_variant_lookup(histogram, "count", "u", &count);
+		g_variant_lookup(histogram, "mean", "x", &mean);
+		g_variant_lookup(histogram, "p50", "x", &p50);
+		g_variant_lookup(histogram, "p90", "x", &p90);
+		g_variant_lookup(histogram, "p99", "x", &p99);
+		g_variant_lookup(histogram, "max", "x", &max);
+		g_print("  %-28s %8u %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT
+			" %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT "\n",
+			key,
+			count,
+			mean,
+			p50,
+			p90,
+			p99,
+			max);
+	}
+}
+
+static void
+sbu_util_print_dict(const gchar *title, GVariant *dict)
+{
+	g_autoptr(GPtrArray) keys = sbu_util_get_sorted_keys(dict);
+
+	g_print("%s:\n", title);
+	for (guint i = 0; i < keys->len; i++) {
+		const gchar *key = g_ptr_array_index(keys, i);
+		g_autoptr(GVariant) value = g_variant_lookup_value(dict, key, NULL);
+		g_autofree gchar *str = g_variant_print(value, FALSE);
+		g_print("  %-28s %s\n", key, str);
+	}
+}
+
+static gboolean
+sbu_util_stats(SbuUtil *self, gchar **values, GError **error)
+{
+	g_autoptr(GDBusConnection) connection = NULL;
+	g_autoptr(GVariant) reply = NULL;
+	g_autoptr(GVariant) stats = NULL;
+	g_autoptr(GPtrArray) keys = NULL;
+
+	connection = g_bus_get_sync(G_BUS_TYPE_SYSTEM, self->cancellable, error);
+	if (connection == NULL)
+		return FALSE;
+	reply = g_dbus_connection_call_sync(connection,
+					    SBU_DBUS_NAME,
+					    SBU_DBUS_PATH,
+					    SBU_DBUS_INTERFACE,
+					    "GetStatistics",
+					    NULL,
+					    G_VARIANT_TYPE("(a{sv})"),
+					    G_DBUS_CALL_FLAGS_NONE,
+					    -1,
+					    self->cancellable,
+					    error);
+	if (reply == NULL) {
+		g_prefix_error(error, "failed to get statistics: ");
+		return FALSE;
+	}
+	stats = g_variant_get_child_value(reply, 0);
+	keys = sbu_util_get_sorted_keys(stats);
+	for (guint i = 0; i < keys->len; i++) {
+		const gchar *key = g_ptr_array_index(keys, i);
+		g_autoptr(GVariant) value = g_variant_lookup_value(stats, key, NULL);
+		if (g_strcmp0(key, "latency") == 0) {
+			sbu_util_print_latency(value);
+			continue;
+		}
+		if (g_variant_is_of_type(value, G_VARIANT_TYPE_VARDICT)) {
+			sbu_util_print_dict(key, value);
+			continue;
+		}
+	}
+	return TRUE;
+}
+
 static void
 sbu_util_ignore_cb(const gchar *log_domain,
 		   GLogLevelFlags log_level,
@@ -256,6 +372,12 @@ main(int argc, char *argv[])
 		     /* TRANSLATORS: command description */
 		     _("Repair the database"),
 		     sbu_util_repair);
+	sbu_util_add(self->cmd_array,
+		     "stats",
+		     NULL,
+		     /* TRANSLATORS: command description */
+		     _("Show daemon performance statistics"),
+		     sbu_util_stats);
 
 	/* do stuff on ctrl+c */
 	g_unix_signal_add_full(G_PRIORITY_DEFAULT, SIGINT, sbu_util_sigint_cb, self, NULL);